@@ -29,9 +29,50 @@ void Analyzer::analyze(LexicalScopeNode* root, const std::map<std::string, Class
     std::cout << "DEBUG Analyzer: Phase 2 - Single-pass AST analysis..." << std::endl;
     analyzeNodeSinglePass(root, nullptr, 0);
     
+    std::cout << "DEBUG Analyzer: Phase 3 - Escape analysis..." << std::endl;
+    analyzeEscapes();
+    
     std::cout << "DEBUG Analyzer: Analysis completed" << std::endl;
 }
 
+// Decide which scopes may outlive the code that allocates them (see
+// LexicalScopeNode::escapes). Runs after the single pass, once every
+// function's allNeeded list is final.
+void Analyzer::analyzeEscapes() {
+    for (LexicalScopeNode* scope : scopeNodes) {
+        scope->escapes = false;
+    }
+    
+    // A closure value holds pointers to every scope in its function's
+    // allNeeded list, and the closure can be stored anywhere - so each of
+    // those enclosing scopes may be reachable after it exits
+    for (LexicalScopeNode* scope : scopeNodes) {
+        if (scope->type != AstNodeType::FUNCTION_DECL) {
+            continue;
+        }
+        for (LexicalScopeNode* p = scope->parentFunctionScope; p; p = p->parentFunctionScope) {
+            if (std::find(scope->allNeeded.begin(), scope->allNeeded.end(), p->depth) != scope->allNeeded.end()) {
+                p->escapes = true;
+            }
+        }
+    }
+    
+    // Goroutine and timer targets run after (or alongside) the statement
+    // that starts them, on another thread's scope stack
+    for (FunctionDeclNode* target : asyncTargets) {
+        target->escapes = true;
+    }
+    
+    int stackScopes = 0;
+    for (LexicalScopeNode* scope : scopeNodes) {
+        if (!scope->escapes) {
+            stackScopes++;
+        }
+    }
+    std::cout << "DEBUG: Escape analysis - " << stackScopes << " of " << scopeNodes.size()
+              << " scopes never escape" << std::endl;
+}
+
 // Single-pass analysis that does everything in the correct order
 void Analyzer::analyzeNodeSinglePass(ASTNode* node, LexicalScopeNode* parentScope, int depth) {
     // Prevent infinite recursion
@@ -48,6 +89,7 @@ void Analyzer::analyzeNodeSinglePass(ASTNode* node, LexicalScopeNode* parentScop
         scope->parentFunctionScope = parentScope;
         scope->depth = depth;
         currentScope = scope;
+        scopeNodes.push_back(scope);
         std::string typeStr = (node->type == AstNodeType::FUNCTION_DECL) ? "FUNCTION" : 
                              (node->type == AstNodeType::FOR_STMT) ? "FOR" : "BLOCK";
         std::cout << "DEBUG: Setup scope at depth " << depth << " (type: " << typeStr << ")" << std::endl;
@@ -95,6 +137,9 @@ void Analyzer::analyzeNodeSinglePass(ASTNode* node, LexicalScopeNode* parentScop
         // Analyze the function name identifier
         if (setTimeoutStmt->functionName) {
             analyzeNodeSinglePass(setTimeoutStmt->functionName.get(), currentScope, depth + 1);
+            if (setTimeoutStmt->functionName->varRef && setTimeoutStmt->functionName->varRef->funcNode) {
+                asyncTargets.push_back(setTimeoutStmt->functionName->varRef->funcNode);
+            }
         }
         
         // Analyze the delay literal
@@ -108,6 +153,9 @@ void Analyzer::analyzeNodeSinglePass(ASTNode* node, LexicalScopeNode* parentScop
         // Analyze the function call (this will resolve varRef)
         if (goStmt->functionCall) {
             analyzeNodeSinglePass(goStmt->functionCall.get(), currentScope, depth + 1);
+            if (goStmt->functionCall->varRef && goStmt->functionCall->varRef->funcNode) {
+                asyncTargets.push_back(goStmt->functionCall->varRef->funcNode);
+            }
         }
     } else if (node->type == AstNodeType::FOR_STMT) {
         // Special handling for for loop - need to analyze init, condition, update in the for loop's scope
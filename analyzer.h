@@ -30,6 +30,11 @@ private:
     void addParentDep(LexicalScopeNode* scope, int depthIdx);
     void addDescendantDep(LexicalScopeNode* scope, int depthIdx);
     
+    // Escape analysis (runs after the single pass)
+    std::vector<LexicalScopeNode*> scopeNodes;    // Every scope seen by the single pass
+    std::vector<FunctionDeclNode*> asyncTargets;  // Functions started by go/setTimeout
+    void analyzeEscapes();
+    
 public:
     void analyze(LexicalScopeNode* root, const std::map<std::string, ClassDeclNode*>& classes);
 };
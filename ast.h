@@ -127,6 +127,12 @@ public:
     std::vector<int> allNeeded;     // Combined dependencies (parents first, then descendants, no duplicates)
     int totalSize = 0;              // Total packed size of this scope
     
+    // Escape analysis: false when no closure captures this scope and it is not
+    // a goroutine/timer target, so it can never be reached once it exits and
+    // codegen can place it on the goroutine's frame stack instead of the heap.
+    // Defaults to true so unanalyzed scopes stay on the GC heap.
+    bool escapes = true;
+    
     // For codegen: maps required depth -> parameter index in parent function
     // -1 means it's the immediate parent scope itself (stored in current scope)
     std::map<int, int> scopeDepthToParentParameterIndexMap;
@@ -0,0 +1,102 @@
+// Mark throughput vs. marker thread count.
+//
+// Builds a random object graph in the GC heap (every node has two object
+// fields pointing at random other nodes, reachable from a set of root scopes)
+// and times ParallelMarker::mark() for 1, 2, 4, ... threads.
+//
+// Usage: bench_parallel_mark [numNodes] [maxThreads] [repetitions]
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "gc.h"
+#include "gc_heap.h"
+#include "gc_marker.h"
+
+// Node layout: [metadata*][flags][left][right]
+static VarMetadata nodeFields[] = {
+    VarMetadata(16, DataType::OBJECT, nullptr, "left"),
+    VarMetadata(24, DataType::OBJECT, nullptr, "right"),
+};
+static ClassMetadata nodeClass("Node", 2, nodeFields, 16);
+
+// Root scope layout: [flags][metadata*][root]
+static VarMetadata rootVars[] = {
+    VarMetadata(0, DataType::OBJECT, nullptr, "root"),
+};
+static ScopeMetadata rootScopeMetadata(1, rootVars);
+
+int main(int argc, char* argv[]) {
+    size_t numNodes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 2000000;
+    size_t hardware = std::max<size_t>(1, std::thread::hardware_concurrency());
+    size_t maxThreads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : hardware;
+    int repetitions = argc > 3 ? std::atoi(argv[3]) : 5;
+
+    GCHeap& heap = GCHeap::getInstance();
+    std::mt19937_64 rng(42);
+
+    std::cout << "Building random graph with " << numNodes << " nodes..." << std::endl;
+    std::vector<void*> nodes(numNodes);
+    for (size_t i = 0; i < numNodes; i++) {
+        void* obj = heap.allocate(HeapSpace::OBJECT, 32);
+        static_cast<ObjectHeader*>(obj)->classMetadata = &nodeClass;
+        nodes[i] = obj;
+    }
+    std::uniform_int_distribution<size_t> pick(0, numNodes - 1);
+    for (void* obj : nodes) {
+        void** fields = reinterpret_cast<void**>(static_cast<uint8_t*>(obj) + 16);
+        fields[0] = nodes[pick(rng)];
+        fields[1] = nodes[pick(rng)];
+    }
+
+    // A handful of root scopes, like the scope stacks of a few goroutines
+    std::vector<void*> roots;
+    for (int i = 0; i < 64; i++) {
+        void* scope = heap.allocate(HeapSpace::SCOPE, 24);
+        ScopeHeader* header = static_cast<ScopeHeader*>(scope);
+        header->scopeMetadata = &rootScopeMetadata;
+        *reinterpret_cast<void**>(header->getDataStart()) = nodes[pick(rng)];
+        roots.push_back(scope);
+    }
+
+    std::vector<size_t> threadCounts;
+    for (size_t t = 1; t < maxThreads; t *= 2) {
+        threadCounts.push_back(t);
+    }
+    threadCounts.push_back(maxThreads);
+
+    std::cout << "Hardware threads: " << hardware << ", best of " << repetitions << " runs" << std::endl;
+    std::cout << std::setw(8) << "threads" << std::setw(12) << "cells"
+              << std::setw(12) << "time(ms)" << std::setw(14) << "Mcells/s"
+              << std::setw(10) << "speedup" << std::endl;
+
+    double baseline = 0;
+    for (size_t threads : threadCounts) {
+        ParallelMarker marker(threads);
+        double best = 1e100;
+        uint64_t traced = 0;
+
+        for (int rep = 0; rep < repetitions; rep++) {
+            heap.clearMarkBits();
+            auto start = std::chrono::steady_clock::now();
+            marker.mark(roots);
+            auto end = std::chrono::steady_clock::now();
+            best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+            traced = marker.getLastTracedCells();
+        }
+
+        if (baseline == 0) {
+            baseline = best;
+        }
+        std::cout << std::setw(8) << threads << std::setw(12) << traced
+                  << std::setw(12) << std::fixed << std::setprecision(2) << best
+                  << std::setw(14) << std::setprecision(1) << (traced / best / 1000.0)
+                  << std::setw(10) << std::setprecision(2) << (baseline / best) << std::endl;
+    }
+
+    return 0;
+}
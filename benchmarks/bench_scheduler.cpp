@@ -0,0 +1,107 @@
+// Scheduler wakeup latency and idle cost.
+//
+// On two workers: how late 1 ms timers come back, how long a goroutine
+// parked on a promise takes to run again once another goroutine resolves it
+// (waking a sleeping worker), the CPU the process uses while it only waits
+// for a timer, and how soon run() returns after the last goroutine.
+//
+// Usage: bench_scheduler [timerRounds] [promiseRounds] [idleMilliseconds]
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <sched.h>
+#include <vector>
+#include "gc.h"
+#include "goroutine.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double microseconds(Clock::duration duration) {
+    return std::chrono::duration<double, std::micro>(duration).count();
+}
+
+// CPU time the whole process used so far, all threads
+static double processCpuMilliseconds() {
+    timespec now;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1e6;
+}
+
+static double percentile(std::vector<double> samples, double fraction) {
+    std::sort(samples.begin(), samples.end());
+    return samples[static_cast<size_t>(fraction * (samples.size() - 1))];
+}
+
+int main(int argc, char* argv[]) {
+    int timerRounds = argc > 1 ? std::atoi(argv[1]) : 200;
+    int promiseRounds = argc > 2 ? std::atoi(argv[2]) : 200;
+    int idleMilliseconds = argc > 3 ? std::atoi(argv[3]) : 200;
+
+    setenv("TECHNOSCRIPT_WORKERS", "2", 1);
+    EventLoop& loop = EventLoop::getInstance();
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+
+    std::vector<double> timerLateness;
+    std::vector<double> promiseLatency;
+    double idleCpu = 0;
+    std::atomic<uint64_t> pending{0};
+    std::atomic<int64_t> resolvedAt{0};
+    std::atomic<int64_t> lastFinished{0};
+
+    loop.spawnGoroutine([&] {
+        for (int i = 0; i < timerRounds; i++) {
+            auto start = Clock::now();
+            runtime_await_promise(runtime_sleep(1));
+            timerLateness.push_back(microseconds(Clock::now() - start - std::chrono::milliseconds(1)));
+        }
+
+        // Nothing to do but wait for a timer: no thread should poll meanwhile
+        double cpuBefore = processCpuMilliseconds();
+        runtime_await_promise(runtime_sleep(idleMilliseconds));
+        idleCpu = processCpuMilliseconds() - cpuBefore;
+
+        loop.spawnGoroutine([&] {
+            for (int i = 0; i < promiseRounds; i++) {
+                uint64_t promise;
+                while ((promise = pending.exchange(0)) == 0) {
+                    sched_yield();
+                }
+                // Give the awaiting side the time to park, so its worker
+                // goes to sleep and has to be woken
+                auto deadline = Clock::now() + std::chrono::milliseconds(100);
+                while (loop.getSleepingWorkers() == 0 && Clock::now() < deadline) {
+                    sched_yield();
+                }
+                resolvedAt = Clock::now().time_since_epoch().count();
+                loop.resolvePromise(promise, i);
+            }
+            lastFinished = Clock::now().time_since_epoch().count();
+        });
+        for (int i = 0; i < promiseRounds; i++) {
+            uint64_t promise = loop.createPromise();
+            pending = promise;
+            runtime_await_promise(promise);
+            promiseLatency.push_back(microseconds(Clock::now().time_since_epoch() - Clock::duration(resolvedAt.load())));
+        }
+        int64_t now = Clock::now().time_since_epoch().count();
+        if (now > lastFinished.load()) {
+            lastFinished = now;
+        }
+    });
+
+    loop.run();
+    double shutdownDelay = microseconds(Clock::now().time_since_epoch() - Clock::duration(lastFinished.load()));
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    std::cout << "Timer wakeups late by:  " << percentile(timerLateness, 0.5) << " us (p50), "
+              << percentile(timerLateness, 0.99) << " us (p99)" << std::endl;
+    std::cout << "Promise wakeups:        " << percentile(promiseLatency, 0.5) << " us (p50), "
+              << percentile(promiseLatency, 0.99) << " us (p99)" << std::endl;
+    std::cout << "CPU while idle:         " << idleCpu << " ms over " << idleMilliseconds << " ms" << std::endl;
+    std::cout << "Loop ended after last:  " << shutdownDelay << " us" << std::endl;
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include "codegen.h"
 #include "gc.h"
+#include "gc_marker.h"
+#include "gc_profiler.h"
 #include <iostream>
 #include <cstdlib>
 #include <cstring>
@@ -43,7 +45,13 @@ void Codegen::run() {
     // Cast to function pointer and call
     typedef int (*MainFunc)();
     MainFunc func = reinterpret_cast<MainFunc>(generatedFunction);
+    
+    // The main program runs JIT code on this thread: take part in the GC's
+    // safepoint handshakes while it does
+    GoroutineGCState* gcState = GarbageCollector::getInstance().currentGCState();
+    gcState->enterManagedCode();
     int result = func();
+    gcState->leaveManagedCode();
     
     std::cout << "=== Execution Complete (returned " << result << ") ===" << std::endl;
 }
@@ -111,8 +119,16 @@ void* CodeGenerator::generateCode(ASTNode* root, const std::map<std::string, Cla
     
     std::cout << "Successfully generated code, size: " << code.codeSize() << " bytes" << std::endl;
     
+    // A stack overflow in this code may end just the goroutine it runs on
+    Goroutine::registerGeneratedCode(executableFunc, code.codeSize());
+    
     // NOW patch the metadata closures with actual function addresses
     patchMetadataClosures(executableFunc, classRegistry);
+    registerAllocationSites(executableFunc);
+    registerStackMaps(executableFunc);
+    
+    // Specialized marker trace routines for the layouts just compiled
+    generateTraceFunctions(classRegistry);
     
     // Get the code size for disassembly
     size_t codeSize = code.codeSize();
@@ -294,6 +310,19 @@ void CodeGenerator::visitNode(ASTNode* node) {
     }
 }
 
+// Name of the function a scope belongs to (the scope itself, for a function scope)
+static std::string enclosingFunctionName(LexicalScopeNode* scope) {
+    for (LexicalScopeNode* s = scope; s; s = s->parentFunctionScope) {
+        if (auto funcDecl = dynamic_cast<FunctionDeclNode*>(s)) {
+            return funcDecl->funcName;
+        }
+        if (s->parentFunctionScope == s) {
+            break;
+        }
+    }
+    return "(program)";
+}
+
 void CodeGenerator::allocateScope(LexicalScopeNode* scope) {
     std::cout << "Allocating scope of size: " << scope->totalSize << " bytes" << std::endl;
 
@@ -302,44 +331,104 @@ void CodeGenerator::allocateScope(LexicalScopeNode* scope) {
     // Set r14 to current r15 (the new scope's parent will be the current scope)
     cb->mov(x86::r14, x86::r15);
     
+    if (!scope->metadata) {
+        throw std::runtime_error("Scope metadata not initialized at compile time!");
+    }
     
-    // Call calloc to allocate and zero-initialize scope
-    // mov rdi, 1 (number of elements)
-    cb->mov(x86::rdi, 1);
-    // mov rsi, scope->totalSize (size of each element)
-    cb->mov(x86::rsi, scope->totalSize);
-    
-    // Call calloc - we need to call the actual calloc function
-    // For simplicity, we'll embed the function pointer directly
-    uint64_t callocAddr = reinterpret_cast<uint64_t>(&calloc_wrapper);
-    cb->mov(x86::rax, callocAddr);
-    cb->call(x86::rax);
+    if (!scope->escapes) {
+        // Escape analysis proved nothing can reach this scope after it exits:
+        // take a zeroed frame from the goroutine's frame stack. The runtime
+        // stores the metadata and pushes the frame as a root in one call, and
+        // generateScopeEpilogue releases it again.
+        cb->mov(x86::rdi, scope->totalSize);
+        cb->mov(x86::rsi, reinterpret_cast<uint64_t>(scope->metadata));
+        uint64_t gcEnterFrameAddr = reinterpret_cast<uint64_t>(&gc_enter_frame);
+        cb->mov(x86::r11, gcEnterFrameAddr);
+        cb->call(x86::r11);
+        cb->mov(x86::r15, x86::rax);
+        
+        currentScope = scope;
+        return;
+    }
     
+    // Allocate a zeroed cell in the GC heap's scope space with the
+    // pre-computed metadata pointer stored at offset 8.
+    // The metadata was created at compile time, so we just embed the pointer.
+    emitHeapAllocation(HeapSpace::SCOPE, scope->totalSize, scope->metadata,
+                       ScopeLayout::METADATA_OFFSET, reinterpret_cast<void*>(&gc_allocate_scope));
     
     // Store the allocated memory address in r15
     cb->mov(x86::r15, x86::rax);
     
-    // Store pre-computed metadata pointer at offset 8 in the scope
-    // The metadata was created at compile time, so we just load the pointer
-    if (!scope->metadata) {
-        throw std::runtime_error("Scope metadata not initialized at compile time!");
+    // Track scope in GC (push scope to roots)
+    emitShadowStackPush(x86::r15);
+    
+    currentScope = scope;
+}
+
+void CodeGenerator::emitHeapAllocation(HeapSpace space, int size, void* metadata, int metadataOffset, void* slowPathFunc) {
+    uint32_t sizeClass = HeapLayout::sizeClassFor(HeapLayout::roundToGranule(size == 0 ? 1 : size));
+    uint64_t metadataAddr = reinterpret_cast<uint64_t>(metadata);
+    
+    // The slow path's return address identifies this site to the allocation
+    // profiler: the function it is emitted in, and the class or scope
+    AllocationSite site;
+    site.returnAddress = cb->newLabel();
+    site.function = enclosingFunctionName(currentScope);
+    if (space == HeapSpace::OBJECT) {
+        ClassMetadata* classMetadata = static_cast<ClassMetadata*>(metadata);
+        site.allocation = std::string("new ") + (classMetadata && classMetadata->className ? classMetadata->className : "(unknown)");
+    } else {
+        ScopeMetadata* scopeMetadata = static_cast<ScopeMetadata*>(metadata);
+        site.allocation = std::string("(scope ") + (scopeMetadata && scopeMetadata->name ? scopeMetadata->name : "anonymous") + ")";
     }
-    cb->mov(x86::r11, reinterpret_cast<uint64_t>(scope->metadata));
-    cb->mov(x86::qword_ptr(x86::r15, ScopeLayout::METADATA_OFFSET), x86::r11);
     
-    // Track scope as an allocated object for GC
-    cb->mov(x86::rdi, x86::r15);  // First argument: scope pointer
-    uint64_t gcTrackAddr = reinterpret_cast<uint64_t>(&gc_track_object);
-    cb->mov(x86::r11, gcTrackAddr);
-    cb->call(x86::r11);
+    if (sizeClass == HeapLayout::NO_SIZE_CLASS) {
+        // Cells above the largest size class have no TLAB - always take the runtime path
+        cb->mov(x86::rdi, size);
+        cb->mov(x86::rsi, metadataAddr);
+        cb->mov(x86::rax, reinterpret_cast<uint64_t>(slowPathFunc));
+        cb->call(x86::rax);
+        cb->bind(site.returnAddress);
+        allocationSites.push_back(site);
+        return;
+    }
     
-    // Track scope in GC (push scope to roots)
-    cb->mov(x86::rdi, x86::r15);  // First argument: scope pointer
-    uint64_t gcPushScopeAddr = reinterpret_cast<uint64_t>(&gc_push_scope);
-    cb->mov(x86::r11, gcPushScopeAddr);
-    cb->call(x86::r11);
+    // Each size class has its own TLAB, bumped by the class size. The TLABs
+    // live in static TLS at a fixed offset from the fs base.
+    int cellSize = static_cast<int>(HeapLayout::SIZE_CLASSES[sizeClass]);
+    intptr_t tlabOffset = GCHeap::tlabThreadOffset(space, sizeClass);
+    x86::Mem tlabTop = x86::qword_ptr_abs(static_cast<uint64_t>(tlabOffset + TLABLayout::TOP_OFFSET));
+    tlabTop.setSegment(x86::fs);
+    x86::Mem tlabLimit = x86::qword_ptr_abs(static_cast<uint64_t>(tlabOffset + TLABLayout::LIMIT_OFFSET));
+    tlabLimit.setSegment(x86::fs);
     
-    currentScope = scope;
+    Label slowPath = cb->newLabel();
+    Label done = cb->newLabel();
+    
+    // Fast path: bump top, check limit
+    cb->mov(x86::rax, tlabTop);
+    cb->lea(x86::r11, x86::ptr(x86::rax, cellSize));
+    cb->cmp(x86::r11, tlabLimit);
+    cb->ja(slowPath);
+    
+    // Header store before publishing the new top, so the GC can always
+    // parse the TLAB up to top (the cell memory is already zero)
+    cb->mov(x86::r10, metadataAddr);
+    cb->mov(x86::qword_ptr(x86::rax, metadataOffset), x86::r10);
+    cb->mov(tlabTop, x86::r11);
+    cb->jmp(done);
+    
+    // Slow path: refill the TLAB (or take an allocation sample) in the runtime
+    cb->bind(slowPath);
+    cb->mov(x86::rdi, size);
+    cb->mov(x86::rsi, metadataAddr);
+    cb->mov(x86::rax, reinterpret_cast<uint64_t>(slowPathFunc));
+    cb->call(x86::rax);
+    cb->bind(site.returnAddress);
+    allocationSites.push_back(site);
+    
+    cb->bind(done);
 }
 
 void* CodeGenerator::createScopeMetadata(LexicalScopeNode* scope) {
@@ -367,13 +456,22 @@ void* CodeGenerator::createScopeMetadata(LexicalScopeNode* scope) {
             
             // Note: offset in VariableInfo is already adjusted for ScopeLayout::DATA_OFFSET
             // But we need the offset relative to data start for the metadata
-            trackedVars.emplace_back(varInfo.offset, varInfo.type, typeInfo);
+            trackedVars.emplace_back(varInfo.offset, varInfo.type, typeInfo,
+                                     strdup(varName.c_str()));  // Permanent storage, like class field names
         }
     }
     
     // Allocate metadata structure ONCE at compile time
     ScopeMetadata* metadata = new ScopeMetadata();
     metadata->numVars = trackedVars.size();
+    metadata->totalSize = scope->totalSize;  // Scope cell size, kept alongside the layout
+    
+    // Heap snapshots and allocation profiles group scopes by the function they belong to
+    std::string scopeName = enclosingFunctionName(scope);
+    if (!dynamic_cast<FunctionDeclNode*>(scope)) {
+        scopeName += " block";
+    }
+    metadata->name = strdup(scopeName.c_str());
     
     if (metadata->numVars > 0) {
         metadata->vars = new VarMetadata[metadata->numVars];
@@ -386,6 +484,7 @@ void* CodeGenerator::createScopeMetadata(LexicalScopeNode* scope) {
     
     std::cout << "Created scope metadata at compile time with " << metadata->numVars << " tracked variables" << std::endl;
     
+    createdScopeMetadata.push_back(metadata);
     return metadata;
 }
 
@@ -711,52 +810,284 @@ void CodeGenerator::storeVariableInScope(const std::string& varName, x86::Gp val
             cb->cmp(typeReg, static_cast<uint32_t>(DataType::OBJECT));
             cb->jne(skipObjectBarrier);
             
-            cb->mov(x86::rcx, x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET));  // Load flags
-            cb->test(x86::rcx, ObjectFlags::NEEDS_SET_FLAG);
+            emitSATBBarrier(valueReg);
             
-            Label skipWriteBarrier = cb->newLabel();
-            cb->jz(skipWriteBarrier);  // Jump if NEEDS_SET_FLAG not set
-            
-            cb->or_(x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET), ObjectFlags::SET_FLAG);
-            cb->mfence();
-            
-            cb->bind(skipWriteBarrier);
             cb->bind(skipObjectBarrier);
         }
+        
+        // Generational barrier: the scope now holds an object reference
+        Label skipRemember = cb->newLabel();
+        cb->cmp(typeReg, static_cast<uint32_t>(DataType::OBJECT));
+        cb->jne(skipRemember);
+        emitRememberedSetBarrier(x86::r15, ScopeLayout::FLAGS_OFFSET);
+        cb->bind(skipRemember);
         return;
     }
     
     // Store the value at [r15 + offset]
     cb->mov(x86::ptr(x86::r15, offset), valueReg);
     
+    // Generational barrier for object references (new objects included:
+    // they are the young cells the remembered set is for)
+    if (it->second.type == DataType::OBJECT) {
+        emitRememberedSetBarrier(x86::r15, ScopeLayout::FLAGS_OFFSET);
+    }
+    
     // If this is an object-typed variable and not a NEW expression, handle GC write barrier inline
     if (it->second.type == DataType::OBJECT && valueNode && valueNode->type != AstNodeType::NEW_EXPR) {
-        // Inline GC write barrier - check needs_set_flag and atomically set set_flag if needed
-        // This is much faster than a function call
-        
-        // Load flags from object header (at offset 8)
-        // flags is at [valueReg + 8]
-        cb->mov(x86::rcx, x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET));  // Load flags
-        
-        // Test if NEEDS_SET_FLAG (bit 0) is set
-        cb->test(x86::rcx, ObjectFlags::NEEDS_SET_FLAG);
-        
-        // Create a label for skipping if not needed
-        Label skipWriteBarrier = cb->newLabel();
-        cb->jz(skipWriteBarrier);  // Jump if zero (NEEDS_SET_FLAG not set)
-        
-        // NEEDS_SET_FLAG is set, so OR the SET_FLAG bit (no LOCK needed - idempotent)
-        // Using non-locked OR is safe because we're only setting a bit to 1
-        cb->or_(x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET), ObjectFlags::SET_FLAG);
-        
-        // Memory fence to ensure write visibility to GC thread
-        // This guarantees the set_flag write is visible before GC reads it in phase 3
-        cb->mfence();
-        
-        cb->bind(skipWriteBarrier);
+        // Inline GC write barrier - log the object if it is suspected dead
+        emitSATBBarrier(valueReg);
     }
 }
 
+void CodeGenerator::emitSATBBarrier(x86::Gp valueReg) {
+    // Fast path: the stored object is not suspected dead (no collection
+    // running, or it is known to be live)
+    Label skipWriteBarrier = cb->newLabel();
+    cb->test(x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET), ObjectFlags::NEEDS_SET_FLAG);
+    cb->jz(skipWriteBarrier);
+    
+    // Log it in the thread's SATB buffer (static TLS at a fixed fs offset).
+    // The GC collects the buffers at its safepoint handshake, so no fence
+    // is needed here.
+    intptr_t satbOffset = GarbageCollector::satbThreadOffset();
+    x86::Mem satbTop = x86::qword_ptr_abs(static_cast<uint64_t>(satbOffset + SATBLayout::TOP_OFFSET));
+    satbTop.setSegment(x86::fs);
+    x86::Mem satbLimit = x86::qword_ptr_abs(static_cast<uint64_t>(satbOffset + SATBLayout::LIMIT_OFFSET));
+    satbLimit.setSegment(x86::fs);
+    
+    Label slowPath = cb->newLabel();
+    cb->mov(x86::rcx, satbTop);
+    cb->cmp(x86::rcx, satbLimit);
+    cb->jae(slowPath);
+    cb->mov(x86::qword_ptr(x86::rcx), valueReg);
+    cb->add(satbTop, 8);
+    cb->jmp(skipWriteBarrier);
+    
+    // Slow path: buffer full (or not set up yet) - gc_satb_log(value). Save
+    // every caller-saved register so the barrier is invisible to the
+    // surrounding code.
+    cb->bind(slowPath);
+    cb->push(x86::rax);
+    cb->push(x86::rcx);
+    cb->push(x86::rdx);
+    cb->push(x86::rsi);
+    cb->push(x86::rdi);
+    cb->push(x86::r8);
+    cb->push(x86::r9);
+    cb->push(x86::r10);
+    cb->push(x86::r11);
+    cb->mov(x86::rdi, valueReg);
+    
+    // Align the stack for the C++ call
+    cb->push(x86::rbp);
+    cb->mov(x86::rbp, x86::rsp);
+    cb->and_(x86::rsp, -16);
+    cb->mov(x86::rax, reinterpret_cast<uint64_t>(&gc_satb_log));
+    cb->call(x86::rax);
+    cb->mov(x86::rsp, x86::rbp);
+    cb->pop(x86::rbp);
+    
+    cb->pop(x86::r11);
+    cb->pop(x86::r10);
+    cb->pop(x86::r9);
+    cb->pop(x86::r8);
+    cb->pop(x86::rdi);
+    cb->pop(x86::rsi);
+    cb->pop(x86::rdx);
+    cb->pop(x86::rcx);
+    cb->pop(x86::rax);
+    
+    cb->bind(skipWriteBarrier);
+}
+
+void CodeGenerator::emitRememberedSetBarrier(x86::Gp cellReg, int flagsOffset) {
+    // Fast path: the cell is already in the remembered set for this cycle
+    Label alreadyRemembered = cb->newLabel();
+    cb->test(x86::qword_ptr(cellReg, flagsOffset), ObjectFlags::REMEMBERED);
+    cb->jnz(alreadyRemembered);
+    
+    // Slow path (once per cell and cycle): gc_remember(cell). Save every
+    // caller-saved register so the barrier is invisible to the surrounding code.
+    cb->push(x86::rax);
+    cb->push(x86::rcx);
+    cb->push(x86::rdx);
+    cb->push(x86::rsi);
+    cb->push(x86::rdi);
+    cb->push(x86::r8);
+    cb->push(x86::r9);
+    cb->push(x86::r10);
+    cb->push(x86::r11);
+    cb->mov(x86::rdi, cellReg);
+    
+    // Align the stack for the C++ call
+    cb->push(x86::rbp);
+    cb->mov(x86::rbp, x86::rsp);
+    cb->and_(x86::rsp, -16);
+    cb->mov(x86::rax, reinterpret_cast<uint64_t>(&gc_remember));
+    cb->call(x86::rax);
+    cb->mov(x86::rsp, x86::rbp);
+    cb->pop(x86::rbp);
+    
+    cb->pop(x86::r11);
+    cb->pop(x86::r10);
+    cb->pop(x86::r9);
+    cb->pop(x86::r8);
+    cb->pop(x86::rdi);
+    cb->pop(x86::rsi);
+    cb->pop(x86::rdx);
+    cb->pop(x86::rcx);
+    cb->pop(x86::rax);
+    
+    cb->bind(alreadyRemembered);
+}
+
+void CodeGenerator::emitShadowStackPush(x86::Gp scopeReg) {
+    // The thread's current shadow stack lives in static TLS at a fixed fs offset
+    x86::Mem stackPtr = x86::qword_ptr_abs(static_cast<uint64_t>(GarbageCollector::shadowStackThreadOffset()));
+    stackPtr.setSegment(x86::fs);
+    
+    Label overflow = cb->newLabel();
+    Label done = cb->newLabel();
+    cb->mov(x86::r11, stackPtr);
+    cb->mov(x86::rdx, x86::qword_ptr(x86::r11, ShadowStackLayout::TOP_OFFSET));
+    cb->cmp(x86::rdx, x86::qword_ptr(x86::r11, ShadowStackLayout::CAPACITY_OFFSET));
+    cb->jae(overflow);
+    
+    // Sequence odd, entry, top, sequence even. x86 keeps the stores in this
+    // order, which is all the GC's seqlock read needs.
+    cb->add(x86::qword_ptr(x86::r11, ShadowStackLayout::SEQUENCE_OFFSET), 1);
+    cb->mov(x86::rcx, x86::qword_ptr(x86::r11, ShadowStackLayout::ENTRIES_OFFSET));
+    cb->mov(x86::qword_ptr(x86::rcx, x86::rdx, 3), scopeReg);
+    cb->add(x86::rdx, 1);
+    cb->mov(x86::qword_ptr(x86::r11, ShadowStackLayout::TOP_OFFSET), x86::rdx);
+    cb->add(x86::qword_ptr(x86::r11, ShadowStackLayout::SEQUENCE_OFFSET), 1);
+    cb->jmp(done);
+    
+    // Slow path: the entry array is full. gc_push_scope grows it and pushes
+    // (or ends the goroutine at ShadowStackLayout::CAPACITY). Nothing but the
+    // scope registers is live here: the scope was just allocated by a call.
+    cb->bind(overflow);
+    cb->mov(x86::rdi, scopeReg);
+    cb->mov(x86::rax, reinterpret_cast<uint64_t>(&gc_push_scope));
+    cb->call(x86::rax);
+    
+    cb->bind(done);
+}
+
+void CodeGenerator::emitShadowStackPop() {
+    x86::Mem stackPtr = x86::qword_ptr_abs(static_cast<uint64_t>(GarbageCollector::shadowStackThreadOffset()));
+    stackPtr.setSegment(x86::fs);
+    
+    Label done = cb->newLabel();
+    cb->mov(x86::r11, stackPtr);
+    cb->mov(x86::rdx, x86::qword_ptr(x86::r11, ShadowStackLayout::TOP_OFFSET));
+    cb->test(x86::rdx, x86::rdx);
+    cb->jz(done);
+    
+    cb->add(x86::qword_ptr(x86::r11, ShadowStackLayout::SEQUENCE_OFFSET), 1);
+    cb->sub(x86::rdx, 1);
+    cb->mov(x86::qword_ptr(x86::r11, ShadowStackLayout::TOP_OFFSET), x86::rdx);
+    
+    // During GC phase 2, scopes opened before it started stay roots only
+    // while they are open: follow the low-water mark down (it is 0 otherwise,
+    // so this never stores)
+    Label aboveLowWater = cb->newLabel();
+    cb->cmp(x86::rdx, x86::qword_ptr(x86::r11, ShadowStackLayout::LOW_WATER_OFFSET));
+    cb->jae(aboveLowWater);
+    cb->mov(x86::qword_ptr(x86::r11, ShadowStackLayout::LOW_WATER_OFFSET), x86::rdx);
+    cb->bind(aboveLowWater);
+    
+    cb->add(x86::qword_ptr(x86::r11, ShadowStackLayout::SEQUENCE_OFFSET), 1);
+    cb->bind(done);
+}
+
+void CodeGenerator::emitSafepointPoll(uint32_t liveRegisters) {
+    // Fast path: one load and compare of the GC's poll word
+    Label noSafepoint = cb->newLabel();
+    cb->mov(x86::r11, reinterpret_cast<uint64_t>(GarbageCollector::getInstance().safepointPollWord()));
+    cb->cmp(x86::dword_ptr(x86::r11), 0);
+    cb->je(noSafepoint);
+    
+    // Slow path: save every register into the area the stack map's register
+    // bits index (rax at 0 ... r15 at 120), then acknowledge the handshake
+    // with it and our rbp, from which the GC walks our frames. Write
+    // barriers never span a poll, so once this returns none of ours is in flight.
+    cb->sub(x86::rsp, StackMapLayout::REGISTER_AREA_SIZE);
+    for (int id = 0; id < StackMapLayout::NUM_REGISTERS; id++) {
+        if (id != StackMapLayout::RSP) {
+            cb->mov(x86::qword_ptr(x86::rsp, id * 8), x86::gpq(id));
+        }
+    }
+    cb->mov(x86::rdi, x86::rsp);
+    cb->mov(x86::rsi, x86::rbp);
+    cb->push(x86::rbp);
+    cb->mov(x86::rbp, x86::rsp);
+    cb->and_(x86::rsp, -16);
+    cb->mov(x86::rax, reinterpret_cast<uint64_t>(&gc_safepoint_poll));
+    cb->call(x86::rax);
+    recordStackMap(StackMap::Kind::SAFEPOINT, liveRegisters);
+    cb->mov(x86::rsp, x86::rbp);
+    cb->pop(x86::rbp);
+    
+    // The GC doesn't move cells, so the saved values are still current
+    for (int id = 0; id < StackMapLayout::NUM_REGISTERS; id++) {
+        if (id != StackMapLayout::RSP) {
+            cb->mov(x86::gpq(id), x86::qword_ptr(x86::rsp, id * 8));
+        }
+    }
+    cb->add(x86::rsp, StackMapLayout::REGISTER_AREA_SIZE);
+    
+    cb->bind(noSafepoint);
+}
+
+void CodeGenerator::emitStackCheck() {
+    // The limit lives in static TLS at a fixed fs offset. Off goroutine
+    // stacks it is 0, so main and the runtime's own threads never switch.
+    x86::Mem stackLimit = x86::qword_ptr_abs(static_cast<uint64_t>(Goroutine::stackLimitThreadOffset()));
+    stackLimit.setSegment(x86::fs);
+    
+    Label enough = cb->newLabel();
+    cb->cmp(x86::rsp, stackLimit);
+    cb->jae(enough);
+    
+    // Returns to `enough` on the next segment (or ends the goroutine when
+    // its stack may not grow any further)
+    cb->mov(x86::r11, reinterpret_cast<uint64_t>(&technoscript_morestack));
+    cb->call(x86::r11);
+    
+    cb->bind(enough);
+}
+
+void CodeGenerator::recordStackMap(StackMap::Kind kind, uint32_t registers, std::vector<int32_t> slots) {
+    if (kind == StackMap::Kind::CALL && (registers & ~StackMapLayout::CALLEE_SAVED)) {
+        throw std::runtime_error("Only r14 and r15 survive a call into generated code");
+    }
+    Label returnAddress = cb->newLabel();
+    cb->bind(returnAddress);
+    stackMaps.push_back(PendingStackMap{returnAddress, kind, registers, std::move(slots)});
+}
+
+void CodeGenerator::registerStackMaps(void* codeBase) {
+    std::vector<StackMap> maps;
+    maps.reserve(stackMaps.size());
+    for (PendingStackMap& pending : stackMaps) {
+        LabelEntry* labelEntry = code.labelEntry(pending.returnAddress.id());
+        if (!labelEntry || !labelEntry->isBound()) {
+            continue;
+        }
+        StackMap map;
+        map.returnAddress = static_cast<uint8_t*>(codeBase) + labelEntry->offset();
+        map.kind = pending.kind;
+        map.registers = pending.registers;
+        map.slots = std::move(pending.slots);
+        maps.push_back(std::move(map));
+    }
+    stackMaps.clear();
+    std::cout << "Registered " << maps.size() << " stack maps" << std::endl;
+    StackMapTable::getInstance().registerMaps(std::move(maps));
+}
+
 void CodeGenerator::loadParameterIntoRegister(int paramIndex, x86::Gp destReg, x86::Gp scopeReg) {
     // Load a parameter from the specified scope. Parameters can be:
     // - For functions: regular parameters + hidden parameters (parent scope pointers)
@@ -1008,6 +1339,190 @@ void CodeGenerator::patchMetadataClosures(void* codeBase, const std::map<std::st
     std::cout << "=== Patching Complete ===" << std::endl;
 }
 
+void CodeGenerator::registerAllocationSites(void* codeBase) {
+    AllocationProfiler& profiler = AllocationProfiler::getInstance();
+    for (const AllocationSite& site : allocationSites) {
+        LabelEntry* labelEntry = code.labelEntry(site.returnAddress.id());
+        if (!labelEntry || !labelEntry->isBound()) {
+            continue;
+        }
+        const void* address = static_cast<uint8_t*>(codeBase) + labelEntry->offset();
+        profiler.registerSite(address, site.function, site.allocation);
+    }
+    std::cout << "Registered " << allocationSites.size() << " allocation sites" << std::endl;
+}
+
+namespace {
+    // Reference slots of one class or scope layout, as offsets from the cell
+    struct TraceLayout {
+        std::vector<int> references;                  // Object pointer slots
+        std::vector<std::pair<int, int>> closures;    // Inline closures: (offset, offset of size within closure)
+        std::vector<int> closurePointers;             // Pointers to closures (method closures, size first)
+    };
+    
+    TraceLayout classTraceLayout(ClassMetadata* metadata) {
+        TraceLayout layout;
+        for (int i = 0; i < metadata->numMethods; i++) {
+            layout.closurePointers.push_back(ObjectLayout::HEADER_SIZE + i * 8);
+        }
+        for (int i = 0; i < metadata->numFields; i++) {
+            const VarMetadata& field = metadata->fields[i];
+            if (field.type == DataType::OBJECT) {
+                layout.references.push_back(field.offset);
+            } else if (field.type == DataType::CLOSURE) {
+                layout.closures.emplace_back(field.offset, 0);  // Field closures: [size][func_addr][scopes]
+            }
+        }
+        return layout;
+    }
+    
+    TraceLayout scopeTraceLayout(ScopeMetadata* metadata) {
+        TraceLayout layout;
+        for (int i = 0; i < metadata->numVars; i++) {
+            const VarMetadata& var = metadata->vars[i];
+            int offset = ScopeLayout::DATA_OFFSET + var.offset;
+            if (var.type == DataType::OBJECT) {
+                layout.references.push_back(offset);
+            } else if (var.type == DataType::CLOSURE) {
+                layout.closures.emplace_back(offset, 8);        // Scope closures: [func_addr][size][scopes]
+            }
+        }
+        return layout;
+    }
+    
+    // Hand the pointer in `slot` to the visitor if it points into the GC heap.
+    // rbx = cell, r12 = visitor context; clobbers rax, rdi, rsi, r11 and the
+    // caller-saved registers on the call.
+    void emitTraceVisit(x86::Assembler& a, const x86::Mem& slot) {
+        GCHeap& heap = GCHeap::getInstance();
+        Label skip = a.newLabel();
+        
+        // (ref - heapStart) < heapSize, unsigned: also rejects null
+        a.mov(x86::rsi, slot);
+        a.mov(x86::rax, x86::rsi);
+        a.mov(x86::r11, reinterpret_cast<uint64_t>(heap.rangeStart()));
+        a.sub(x86::rax, x86::r11);
+        a.mov(x86::r11, static_cast<uint64_t>(heap.rangeSize()));
+        a.cmp(x86::rax, x86::r11);
+        a.jae(skip);
+        
+        a.mov(x86::rdi, x86::r12);
+        a.mov(x86::rax, reinterpret_cast<uint64_t>(&ParallelMarker::visitReference));
+        a.call(x86::rax);
+        a.bind(skip);
+    }
+    
+    // Visit the scope pointers of a closure: r13 = first scope pointer,
+    // r14 = end of the closure
+    void emitTraceClosureScopes(x86::Assembler& a) {
+        Label loop = a.newLabel();
+        Label done = a.newLabel();
+        a.bind(loop);
+        a.cmp(x86::r13, x86::r14);
+        a.jae(done);
+        emitTraceVisit(a, x86::qword_ptr(x86::r13));
+        a.add(x86::r13, 8);
+        a.jmp(loop);
+        a.bind(done);
+    }
+    
+    // void trace(void* cell, void* context) for one layout. Every slot offset
+    // is baked in, so int/float slots and metadata lookups cost nothing.
+    void emitTraceFunction(x86::Assembler& a, const TraceLayout& layout) {
+        if (layout.references.empty() && layout.closures.empty() && layout.closurePointers.empty()) {
+            a.ret();
+            return;
+        }
+        
+        // Four pushes plus 8 bytes keep rsp 16-byte aligned at the calls
+        a.push(x86::rbx);
+        a.push(x86::r12);
+        a.push(x86::r13);
+        a.push(x86::r14);
+        a.sub(x86::rsp, 8);
+        a.mov(x86::rbx, x86::rdi);
+        a.mov(x86::r12, x86::rsi);
+        
+        for (int offset : layout.references) {
+            emitTraceVisit(a, x86::qword_ptr(x86::rbx, offset));
+        }
+        
+        // Closures stored in the cell: scope pointers from +16 up to +size
+        for (const auto& [offset, sizeOffset] : layout.closures) {
+            a.lea(x86::r13, x86::ptr(x86::rbx, offset + 16));
+            a.mov(x86::r14, x86::qword_ptr(x86::rbx, offset + sizeOffset));
+            a.lea(x86::r14, x86::ptr(x86::rbx, x86::r14, 0, offset));
+            emitTraceClosureScopes(a);
+        }
+        
+        // Closures the cell points to (method closures)
+        for (int offset : layout.closurePointers) {
+            Label none = a.newLabel();
+            a.mov(x86::r13, x86::qword_ptr(x86::rbx, offset));
+            a.test(x86::r13, x86::r13);
+            a.jz(none);
+            a.mov(x86::r14, x86::qword_ptr(x86::r13));
+            a.add(x86::r14, x86::r13);
+            a.add(x86::r13, 16);
+            emitTraceClosureScopes(a);
+            a.bind(none);
+        }
+        
+        a.add(x86::rsp, 8);
+        a.pop(x86::r14);
+        a.pop(x86::r13);
+        a.pop(x86::r12);
+        a.pop(x86::rbx);
+        a.ret();
+    }
+}
+
+void CodeGenerator::generateTraceFunctions(const std::map<std::string, ClassDeclNode*>& classRegistry) {
+    std::cout << "\n=== Generating Trace Functions ===" << std::endl;
+    
+    CodeHolder traceCode;
+    traceCode.init(rt.environment(), rt.cpuFeatures());
+    x86::Assembler a(&traceCode);
+    
+    // Each routine is bound to a label; its address is patched into the
+    // metadata once the buffer is committed
+    std::vector<std::pair<Label, TraceFunction*>> routines;
+    
+    for (const auto& entry : classRegistry) {
+        ClassMetadata* metadata = MetadataRegistry::getInstance().getClassMetadata(entry.first);
+        if (!metadata) {
+            continue;
+        }
+        Label label = a.newLabel();
+        a.align(AlignMode::kCode, 16);
+        a.bind(label);
+        emitTraceFunction(a, classTraceLayout(metadata));
+        routines.emplace_back(label, &metadata->traceFunction);
+    }
+    
+    for (ScopeMetadata* metadata : createdScopeMetadata) {
+        Label label = a.newLabel();
+        a.align(AlignMode::kCode, 16);
+        a.bind(label);
+        emitTraceFunction(a, scopeTraceLayout(metadata));
+        routines.emplace_back(label, &metadata->traceFunction);
+    }
+    
+    void* traceBase;
+    Error err = rt.add(&traceBase, &traceCode);
+    if (err) {
+        throw std::runtime_error("Failed to generate trace functions: " + std::string(DebugUtils::errorAsString(err)));
+    }
+    
+    for (const auto& [label, slot] : routines) {
+        size_t offset = traceCode.labelEntry(label.id())->offset();
+        *slot = reinterpret_cast<TraceFunction>(static_cast<uint8_t*>(traceBase) + offset);
+    }
+    
+    std::cout << "Generated " << routines.size() << " trace functions (" 
+              << traceCode.codeSize() << " bytes)" << std::endl;
+}
+
 void CodeGenerator::disassembleAndPrint(void* code, size_t codeSize) {
     cs_insn* insn;
     size_t count = cs_disasm(capstoneHandle, 
@@ -1043,6 +1558,10 @@ void CodeGenerator::createFunctionLabel(FunctionDeclNode* funcDecl) {
 void CodeGenerator::generateFunctionPrologue(FunctionDeclNode* funcDecl) {
     std::cout << "Generating prologue for function: " << funcDecl->funcName << std::endl;
     
+    // Make sure the frame (and the runtime calls it makes) fit the goroutine's
+    // current stack segment, before anything is pushed
+    emitStackCheck();
+    
     // Standard function prologue
     cb->push(x86::rbp);
     cb->mov(x86::rbp, x86::rsp);
@@ -1051,6 +1570,12 @@ void CodeGenerator::generateFunctionPrologue(FunctionDeclNode* funcDecl) {
     cb->push(x86::r14);
     cb->push(x86::r15);
     
+    // Nothing is live in caller-saved registers yet (arguments are passed in
+    // the scope), so this is where the GC can stop us cheaply. Our scope (r15)
+    // and its parent (r14) are the references; main has neither yet.
+    uint32_t scopeRegisters = (1u << StackMapLayout::R14) | (1u << StackMapLayout::R15);
+    emitSafepointPoll(funcDecl->funcName == "main" ? 0 : scopeRegisters);
+    
     // Special case: main function needs to allocate its own scope since it's not called via our convention
     if (funcDecl->funcName == "main") {
         std::cout << "Main function - allocating scope in prologue" << std::endl;
@@ -1236,15 +1761,20 @@ void CodeGenerator::generateScopePrologue(LexicalScopeNode* scope) {
 void CodeGenerator::generateScopeEpilogue(LexicalScopeNode* scope) {
     std::cout << "Generating scope epilogue for scope at depth: " << scope->depth << std::endl;
     
-    // Pop scope from GC roots - this removes it from the active scope stack
-    // but does NOT free the memory. The GC will handle scope destruction later.
-    uint64_t gcPopScopeAddr = reinterpret_cast<uint64_t>(&gc_pop_scope);
-    cb->mov(x86::rax, gcPopScopeAddr);
-    cb->call(x86::rax);
-    
-    // DO NOT call free() here! Scopes should only be destroyed by the garbage collector.
-    // The scope is now out of scope (removed from GC roots) but the memory remains
-    // until the GC determines it's safe to free.
+    if (!scope->escapes) {
+        // Frame scope (see allocateScope): pop it from the GC roots and
+        // release its frame-stack memory right away
+        uint64_t gcLeaveFrameAddr = reinterpret_cast<uint64_t>(&gc_leave_frame);
+        cb->mov(x86::rax, gcLeaveFrameAddr);
+        cb->call(x86::rax);
+    } else {
+        // Pop scope from GC roots - this removes it from the active scope stack
+        // but does NOT free the memory. The GC will handle scope destruction later.
+        emitShadowStackPop();
+        
+        // DO NOT call free() here! Heap scopes may still be captured by closures,
+        // so only the garbage collector can decide when to destroy them.
+    }
     
     // Restore r15 to the parent scope (from r14)
     cb->mov(x86::r15, x86::r14);
@@ -1388,11 +1918,13 @@ void CodeGenerator::generateFunctionCall(FunctionCallNode* funcCall) {
     cb->mov(x86::rax, x86::ptr(x86::rbx, 8)); // Load function address from closure (offset 8, after size)
     
     // Make the call - r15 already points to the pre-allocated and populated scope
-    // The callee will use this scope directly
+    // The callee will use this scope directly. Across it we hold our scope
+    // (r14) and the callee's (r15), which its prologue saves for the GC's walk.
     cb->call(x86::rax);
+    recordStackMap(StackMap::Kind::CALL, (1u << StackMapLayout::R14) | (1u << StackMapLayout::R15));
     
     // After call returns, the callee's epilogue has already:
-    // - Freed its scope (called gc_pop_scope)
+    // - Popped its scope off the shadow stack
     // - Done: mov r15, r14 (restored parent scope, which is our scope)
     // - Done: pop r14 (restored grandparent scope pointer)
     // So now r15 points back to our scope and r14 is restored
@@ -1626,15 +2158,13 @@ void CodeGenerator::generateNewExpr(NewExprNode* newExpr, x86::Gp destReg, x86::
             throw std::runtime_error("RawMemory allocation expects exactly one size argument");
         }
 
-        // Load size argument into rsi (second argument for calloc)
-        loadValue(newExpr->args[0].get(), x86::rsi, sourceScopeReg, DataType::INT64);
-
-        // Set number of elements to 1 (first argument for calloc)
-        cb->mov(x86::rdi, 1);
+        // Load size argument into rdi
+        loadValue(newExpr->args[0].get(), x86::rdi, sourceScopeReg, DataType::INT64);
 
-        // Call calloc wrapper to allocate zeroed memory
-        uint64_t callocAddr = reinterpret_cast<uint64_t>(&calloc_wrapper);
-        cb->mov(x86::rax, callocAddr);
+        // Zeroed block: large ones get their own page-aligned mapping (see
+        // GCHeap::allocateRaw), small ones come from malloc
+        uint64_t allocAddr = reinterpret_cast<uint64_t>(&gc_allocate_raw);
+        cb->mov(x86::rax, allocAddr);
         cb->call(x86::rax);
 
         // Result pointer returned in rax
@@ -1660,31 +2190,20 @@ void CodeGenerator::generateNewExpr(NewExprNode* newExpr, x86::Gp destReg, x86::
               << " (header=" << ObjectLayout::HEADER_SIZE 
               << ", packed fields=" << classDecl->totalSize << ")" << std::endl;
     
-    // Call calloc to allocate and zero-initialize object
-    // mov rdi, 1 (number of elements)
-    cb->mov(x86::rdi, 1);
-    // mov rsi, totalObjectSize (size of each element)
-    cb->mov(x86::rsi, totalObjectSize);
-    
-    // Call calloc
-    uint64_t callocAddr = reinterpret_cast<uint64_t>(&calloc_wrapper);
-    cb->mov(x86::rax, callocAddr);
-    cb->call(x86::rax);
-    
-    // Object pointer is now in rax
-    // We need to initialize the object header
-    
-    // Get class metadata from registry and store at offset 0
+    // Get class metadata from registry - it is stored at offset 0 by the allocation
     ClassMetadata* metadata = MetadataRegistry::getInstance().getClassMetadata(classDecl->className);
     if (!metadata) {
         throw std::runtime_error("Class metadata not found for: " + classDecl->className);
     }
-    uint64_t metadataAddr = reinterpret_cast<uint64_t>(metadata);
-    cb->mov(x86::r10, metadataAddr);
-    cb->mov(x86::qword_ptr(x86::rax, ObjectLayout::METADATA_OFFSET), x86::r10);
     
-    // Store flags at offset 8 (currently 0, zero-initialized by calloc)
-    // cb->mov(x86::qword_ptr(x86::rax, ObjectLayout::FLAGS_OFFSET), 0);  // Not needed, calloc already zeroed
+    // Allocate a zeroed cell in the GC heap's object space (inline TLAB bump)
+    emitHeapAllocation(HeapSpace::OBJECT, totalObjectSize, metadata,
+                       ObjectLayout::METADATA_OFFSET, reinterpret_cast<void*>(&gc_allocate_object));
+    
+    // Object pointer is now in rax, with its class metadata pointer stored
+    
+    // Store flags at offset 8 (currently 0, heap cells are zero-initialized)
+    // cb->mov(x86::qword_ptr(x86::rax, ObjectLayout::FLAGS_OFFSET), 0);  // Not needed, cell already zeroed
     
     // Initialize closure pointers in the object
     // Set closure pointers using the packed offsets
@@ -1713,14 +2232,6 @@ void CodeGenerator::generateNewExpr(NewExprNode* newExpr, x86::Gp destReg, x86::
     std::cout << "DEBUG generateNewExpr: Object allocated at runtime, class metadata stored at offset " 
               << ObjectLayout::METADATA_OFFSET << std::endl;
     
-    // Track object in GC (save rax first since it contains the object pointer)
-    cb->push(x86::rax);
-    cb->mov(x86::rdi, x86::rax);  // First argument: object pointer
-    uint64_t gcTrackAddr = reinterpret_cast<uint64_t>(&gc_track_object);
-    cb->mov(x86::r11, gcTrackAddr);
-    cb->call(x86::r11);
-    cb->pop(x86::rax);  // Restore object pointer
-    
     // Move result to destination register if different
     if (destReg.id() != x86::rax.id()) {
         cb->mov(destReg, x86::rax);
@@ -1736,11 +2247,11 @@ void CodeGenerator::generateRawMemoryRelease(MethodCallNode* methodCall) {
         throw std::runtime_error("RawMemory.release() does not take arguments");
     }
 
-    // Load the raw memory pointer into rdi (first argument for free)
+    // Load the raw memory pointer into rdi; mapped blocks are unmapped
     loadValue(methodCall->object.get(), x86::rdi, x86::r15, DataType::RAW_MEMORY);
 
-    uint64_t freeAddr = reinterpret_cast<uint64_t>(&free_wrapper);
-    cb->mov(x86::rax, freeAddr);
+    uint64_t releaseAddr = reinterpret_cast<uint64_t>(&gc_release_raw);
+    cb->mov(x86::rax, releaseAddr);
     cb->call(x86::rax);
 
     std::cout << "Emitted RawMemory release call" << std::endl;
@@ -1860,19 +2371,18 @@ void CodeGenerator::generateMemberAssign(MemberAssignNode* memberAssign) {
             cb->cmp(x86::rdx, static_cast<uint32_t>(DataType::OBJECT));
             cb->jne(skipObjectBarrier);
             
-            cb->mov(x86::rcx, x86::qword_ptr(x86::rax, ObjectLayout::FLAGS_OFFSET));
-            cb->test(x86::rcx, ObjectFlags::NEEDS_SET_FLAG);
-            
-            Label skipWriteBarrier = cb->newLabel();
-            cb->jz(skipWriteBarrier);
+            emitSATBBarrier(x86::rax);
             
-            cb->or_(x86::qword_ptr(x86::rax, ObjectLayout::FLAGS_OFFSET), ObjectFlags::SET_FLAG);
-            cb->mfence();
-            
-            cb->bind(skipWriteBarrier);
             cb->bind(skipObjectBarrier);
         }
         
+        // Generational barrier: the object now holds an object reference
+        Label skipRemember = cb->newLabel();
+        cb->cmp(x86::rdx, static_cast<uint32_t>(DataType::OBJECT));
+        cb->jne(skipRemember);
+        emitRememberedSetBarrier(objectPtrReg, ObjectLayout::FLAGS_OFFSET);
+        cb->bind(skipRemember);
+        
         std::cout << "Generated member assignment for ANY field" << std::endl;
         return;
     }
@@ -1894,30 +2404,12 @@ void CodeGenerator::generateMemberAssign(MemberAssignNode* memberAssign) {
         if (it != member->classRef->fields.end() && it->second.type == DataType::OBJECT) {
             // Skip write barrier for NEW expressions - they can't be suspected dead yet
             if (memberAssign->value->type != AstNodeType::NEW_EXPR) {
-                // Inline GC write barrier - check needs_set_flag and atomically set set_flag if needed
-                // This is much faster than a function call
-                
-                // Load flags from object header (at offset 8)
-                // flags is at [valueReg + 8]
-                cb->mov(x86::rcx, x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET));  // Load flags
-                
-                // Test if NEEDS_SET_FLAG (bit 0) is set
-                cb->test(x86::rcx, ObjectFlags::NEEDS_SET_FLAG);
-                
-                // Create a label for skipping if not needed
-                Label skipWriteBarrier = cb->newLabel();
-                cb->jz(skipWriteBarrier);  // Jump if zero (NEEDS_SET_FLAG not set)
-                
-                // NEEDS_SET_FLAG is set, so OR the SET_FLAG bit (no LOCK needed - idempotent)
-                // Using non-locked OR is safe because we're only setting a bit to 1
-                cb->or_(x86::qword_ptr(valueReg, ObjectLayout::FLAGS_OFFSET), ObjectFlags::SET_FLAG);
-                
-                // Memory fence to ensure write visibility to GC thread
-                // This guarantees the set_flag write is visible before GC reads it in phase 3
-                cb->mfence();
-                
-                cb->bind(skipWriteBarrier);
+                // Inline GC write barrier - log the object if it is suspected dead
+                emitSATBBarrier(valueReg);
             }
+            
+            // Generational barrier (for new objects too)
+            emitRememberedSetBarrier(objectPtrReg, ObjectLayout::FLAGS_OFFSET);
         }
     }
     
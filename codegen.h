@@ -5,6 +5,7 @@
 #include "library.h"
 #include "goroutine.h"
 #include "asm_library.h"
+#include "gc_stackmap.h"
 #include <asmjit/asmjit.h>
 #include <capstone/capstone.h>
 #include <memory>
@@ -113,6 +114,35 @@ private:
     // Patch method addresses into metadata closures after code commit
     void patchMetadataClosures(void* codeBase, const std::map<std::string, ClassDeclNode*>& classRegistry);
     
+    // Return addresses of the allocation slow-path calls, with the function
+    // and what they allocate, for the allocation profiler
+    struct AllocationSite {
+        Label returnAddress;
+        std::string function;
+        std::string allocation;
+    };
+    std::vector<AllocationSite> allocationSites;
+    void registerAllocationSites(void* codeBase);
+    
+    // Stack maps of the safepoint polls and calls into generated code, by the
+    // label bound at their return address (see gc_stackmap.h)
+    struct PendingStackMap {
+        Label returnAddress;
+        StackMap::Kind kind;
+        uint32_t registers;               // Bit per register (StackMapLayout)
+        std::vector<int32_t> slots;       // rbp offsets
+    };
+    std::vector<PendingStackMap> stackMaps;
+    
+    // Record the references live across the call just emitted: binds a
+    // label at the return address. Call sites may only list r14/r15.
+    void recordStackMap(StackMap::Kind kind, uint32_t registers, std::vector<int32_t> slots = {});
+    void registerStackMaps(void* codeBase);
+    
+    // Emit the marker's trace routine for every class and scope layout into a
+    // code buffer of their own and store them in the metadata (traceFunction)
+    void generateTraceFunctions(const std::map<std::string, ClassDeclNode*>& classRegistry);
+    
     // Function-related utilities
     void createFunctionLabel(FunctionDeclNode* funcDecl);
     void generateFunctionPrologue(FunctionDeclNode* funcDecl);
@@ -123,11 +153,46 @@ private:
     void generateScopePrologue(LexicalScopeNode* scope);
     void generateScopeEpilogue(LexicalScopeNode* scope);
     
+    // Inline TLAB bump allocation of a heap cell (result in rax). Stores the
+    // metadata pointer at metadataOffset and falls back to slowPathFunc
+    // (gc_allocate_object/gc_allocate_scope) when the TLAB is exhausted.
+    void emitHeapAllocation(HeapSpace space, int size, void* metadata, int metadataOffset, void* slowPathFunc);
+    
+    // Generational write barrier, emitted after storing an object reference
+    // into the cell in cellReg: records the cell in the GC's remembered set
+    // unless its REMEMBERED flag (at flagsOffset) is already set.
+    void emitRememberedSetBarrier(x86::Gp cellReg, int flagsOffset);
+    
+    // Resurrection barrier, emitted after storing the object in valueReg:
+    // appends it to the thread's SATB buffer if it is suspected dead (its
+    // NEEDS_SET_FLAG is set). Clobbers rcx.
+    void emitSATBBarrier(x86::Gp valueReg);
+    
+    // Push the scope in scopeReg onto / pop the top scope off the thread's
+    // shadow stack (the GC roots, see data_structures/shadow_stack.h) with
+    // plain stores inside a seqlock update. Clobber rcx, rdx and r11.
+    void emitShadowStackPush(x86::Gp scopeReg);
+    void emitShadowStackPop();
+    
+    // GC safepoint poll: calls gc_safepoint_poll when the GC has a handshake
+    // pending. Emitted at every function entry (and belongs on loop back-edges).
+    // liveRegisters (bit per register, StackMapLayout) are the ones holding
+    // references there; the slow path saves every register, so the GC can
+    // scan them, and restores them afterwards. Clobbers r11.
+    void emitSafepointPoll(uint32_t liveRegisters);
+    
+    // Segmented stack check, the first instructions of every function: when
+    // rsp is below the thread's stack limit (see GoroutineContext), call
+    // technoscript_morestack, which continues the function on the next
+    // segment. Clobbers r11 when it does.
+    void emitStackCheck();
+    
     // Metadata generation for GC
     // Scope metadata is created ONCE at compile time and stored in scope->metadata
     void initializeAllScopeMetadata(ASTNode* root, const std::vector<FunctionDeclNode*>& functionRegistry);
     void initializeScopeMetadataRecursive(ASTNode* node);  // Helper for recursive traversal
     void* createScopeMetadata(LexicalScopeNode* scope);  // Returns void* to avoid circular includes
+    std::vector<ScopeMetadata*> createdScopeMetadata;    // Everything createScopeMetadata returned
     
     // Block statement utilities
     void generateBlockStmt(BlockStmtNode* blockStmt);
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+// LIFO bump allocator for call-frame scopes that never escape their call.
+//
+// Frames are carved from a chain of blocks; push() bumps a pointer and pop()
+// moves it back, so entering and leaving a scope costs no heap allocation
+// and leaves nothing behind for the GC. Blocks are kept (not freed) when the
+// stack shrinks, so a steady call depth stops allocating entirely. The first
+// block is small and each new one twice the last, up to blockSize, so a
+// goroutine that only ever has a few frames doesn't hold 64 KB for them.
+//
+// Not thread safe: each goroutine owns its own frame stack.
+class FrameStack {
+public:
+    static constexpr size_t ALIGNMENT = 16;
+    static constexpr size_t DEFAULT_BLOCK_SIZE = 64 * 1024;
+    static constexpr size_t INITIAL_BLOCK_SIZE = 1024;
+
+private:
+    struct Block {
+        uint8_t* start;
+        uint8_t* end;
+    };
+
+    std::vector<Block> blocks;
+    size_t current = 0;         // Block the top frame lives in
+    uint8_t* top = nullptr;     // Next free byte in blocks[current]
+    size_t blockSize;
+
+    static Block newBlock(size_t bytes) {
+        void* memory = std::aligned_alloc(ALIGNMENT, bytes);
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        uint8_t* start = static_cast<uint8_t*>(memory);
+        return Block{start, start + bytes};
+    }
+
+    bool inBlock(const Block& block, const void* p) const {
+        return p >= block.start && p < block.end;
+    }
+
+    // Size of the next block to allocate, for a frame of `size` bytes
+    size_t nextBlockSize(size_t size) const {
+        size_t bytes = blocks.empty() ? INITIAL_BLOCK_SIZE
+                                      : static_cast<size_t>(blocks.back().end - blocks.back().start) * 2;
+        if (bytes > blockSize) {
+            bytes = blockSize;
+        }
+        return size > bytes ? size : bytes;
+    }
+
+public:
+    explicit FrameStack(size_t blockSize = DEFAULT_BLOCK_SIZE) : blockSize(blockSize) {}
+
+    ~FrameStack() {
+        for (Block& block : blocks) {
+            std::free(block.start);
+        }
+    }
+
+    FrameStack(const FrameStack&) = delete;
+    FrameStack& operator=(const FrameStack&) = delete;
+
+    // Allocate a zeroed, 16-byte aligned frame of `size` bytes
+    void* push(size_t size) {
+        size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        if (size == 0) {
+            size = ALIGNMENT;
+        }
+
+        if (blocks.empty()) {
+            blocks.push_back(newBlock(nextBlockSize(size)));
+            current = 0;
+            top = blocks[0].start;
+        } else if (top + size > blocks[current].end) {
+            // Move on to the next block, replacing it if it is too small
+            size_t next = current + 1;
+            if (next == blocks.size()) {
+                blocks.push_back(newBlock(nextBlockSize(size)));
+            } else if (static_cast<size_t>(blocks[next].end - blocks[next].start) < size) {
+                std::free(blocks[next].start);
+                blocks[next] = newBlock(size > blockSize ? size : blockSize);
+            }
+            current = next;
+            top = blocks[current].start;
+        }
+
+        uint8_t* frame = top;
+        top += size;
+        std::memset(frame, 0, size);
+        return frame;
+    }
+
+    // Release `frame` and everything pushed after it
+    void pop(void* frame) {
+        while (!inBlock(blocks[current], frame)) {
+            current--;
+        }
+        top = static_cast<uint8_t*>(frame);
+    }
+
+    bool empty() const {
+        return blocks.empty() || (current == 0 && top == blocks[0].start);
+    }
+
+    // Bytes currently held by live frames (including alignment padding)
+    size_t bytesInUse() const {
+        if (blocks.empty()) {
+            return 0;
+        }
+        size_t bytes = top - blocks[current].start;
+        for (size_t i = 0; i < current; i++) {
+            bytes += blocks[i].end - blocks[i].start;
+        }
+        return bytes;
+    }
+
+    bool contains(const void* p) const {
+        for (size_t i = 0; i <= current && i < blocks.size(); i++) {
+            if (inBlock(blocks[i], p)) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
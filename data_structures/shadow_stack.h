@@ -0,0 +1,218 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Field offsets of ShadowStack, used by the code generator to push and pop
+// scopes inline (see CodeGenerator::emitShadowStackPush/Pop)
+namespace ShadowStackLayout {
+    constexpr int TOP_OFFSET = 0;        // Number of live entries
+    constexpr int SEQUENCE_OFFSET = 8;   // Seqlock counter, odd while an update is in progress
+    constexpr int LOW_WATER_OFFSET = 16; // Lowest top since GC phase 2 started (0 outside phase 2)
+    constexpr int ENTRIES_OFFSET = 24;   // Pointer to the entry array
+    constexpr int CAPACITY_OFFSET = 32;  // Entries the array holds
+    constexpr size_t INITIAL_CAPACITY = 64;
+    constexpr size_t CAPACITY = 16384;   // Most entries a stack grows to (scope nesting depth)
+}
+
+// Stack of the lexical scopes a goroutine has open - its GC roots.
+//
+// It starts with room for INITIAL_CAPACITY entries and doubles up to
+// CAPACITY. A goroutine that never nests deeply (most of them, when there
+// are a million) costs half a kilobyte. Growing copies the entries into a
+// new array inside a seqlock update; the old array is kept until the stack
+// is destroyed, since a reader may still be copying from it.
+//
+// Exactly one thread (the goroutine's) writes the stack, with plain stores:
+// bump the sequence to odd, store the entry and the new top, bump the
+// sequence back to even. JIT code does this inline, without a call or a lock.
+// Any other thread reads it as a seqlock: copy the entries between two reads
+// of the sequence and retry if it was odd or has moved. On x86 stores are not
+// reordered with stores nor loads with loads, so neither side needs a fence
+// beyond what the atomics below already give.
+//
+// The low-water mark replaces the scope count the GC used to record when phase
+// 2 started: pops shrink it, pushes don't raise it, so scopes opened after
+// phase 2 began can be left out of the roots (they are new and marked live).
+class ShadowStack {
+private:
+    std::atomic<size_t> top{0};           // Offset 0
+    std::atomic<uint64_t> sequence{0};    // Offset 8
+    std::atomic<size_t> lowWater{0};      // Offset 16
+    std::atomic<std::atomic<void*>*> entries{nullptr};   // Offset 24
+    std::atomic<size_t> capacity{0};      // Offset 32
+    std::vector<std::atomic<void*>*> retired;  // Outgrown entry arrays
+
+    // Writer side of the seqlock (owning thread only)
+    void beginUpdate() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void endUpdate() {
+        sequence.store(sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    static std::atomic<void*>* allocateEntries(size_t count) {
+        void* memory = std::calloc(count, sizeof(void*));
+        if (!memory) {
+            throw std::bad_alloc();
+        }
+        return static_cast<std::atomic<void*>*>(memory);
+    }
+
+    // Double the entry array (owning thread only). The new array is
+    // published before the new capacity, so a reader that sees the capacity
+    // also sees the array.
+    void grow() {
+        size_t oldCapacity = capacity.load(std::memory_order_relaxed);
+        size_t newCapacity = oldCapacity * 2 < ShadowStackLayout::CAPACITY ? oldCapacity * 2 : ShadowStackLayout::CAPACITY;
+        std::atomic<void*>* oldEntries = entries.load(std::memory_order_relaxed);
+        std::atomic<void*>* newEntries = allocateEntries(newCapacity);
+        retired.reserve(retired.size() + 1);
+
+        beginUpdate();
+        size_t n = top.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < n; i++) {
+            newEntries[i].store(oldEntries[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        entries.store(newEntries, std::memory_order_release);
+        capacity.store(newCapacity, std::memory_order_release);
+        endUpdate();
+        retired.push_back(oldEntries);
+    }
+
+public:
+    ShadowStack() {
+        entries.store(allocateEntries(ShadowStackLayout::INITIAL_CAPACITY), std::memory_order_relaxed);
+        capacity.store(ShadowStackLayout::INITIAL_CAPACITY, std::memory_order_relaxed);
+    }
+
+    ~ShadowStack() {
+        std::free(entries.load(std::memory_order_relaxed));
+        for (std::atomic<void*>* old : retired) {
+            std::free(old);
+        }
+    }
+
+    ShadowStack(const ShadowStack&) = delete;
+    ShadowStack& operator=(const ShadowStack&) = delete;
+
+    // Returns false (and pushes nothing) when the stack is full. Throws
+    // std::bad_alloc when it can't grow.
+    bool push(void* scope) {
+        size_t n = top.load(std::memory_order_relaxed);
+        if (n >= capacity.load(std::memory_order_relaxed)) {
+            if (n >= ShadowStackLayout::CAPACITY) {
+                return false;
+            }
+            grow();
+        }
+        beginUpdate();
+        entries.load(std::memory_order_relaxed)[n].store(scope, std::memory_order_relaxed);
+        top.store(n + 1, std::memory_order_relaxed);
+        endUpdate();
+        return true;
+    }
+
+    void pop() {
+        size_t n = top.load(std::memory_order_relaxed);
+        if (n == 0) {
+            return;
+        }
+        beginUpdate();
+        top.store(n - 1, std::memory_order_relaxed);
+        if (n - 1 < lowWater.load(std::memory_order_relaxed)) {
+            lowWater.store(n - 1, std::memory_order_relaxed);
+        }
+        endUpdate();
+    }
+
+    // Remove the entry at `index`, shifting the ones above it down (a frame
+    // left under a goroutine's heap scope by a go statement)
+    void removeAt(size_t index) {
+        size_t n = top.load(std::memory_order_relaxed);
+        if (index >= n) {
+            return;
+        }
+        beginUpdate();
+        std::atomic<void*>* e = entries.load(std::memory_order_relaxed);
+        for (size_t i = index; i + 1 < n; i++) {
+            e[i].store(e[i + 1].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+        top.store(n - 1, std::memory_order_relaxed);
+        if (index < lowWater.load(std::memory_order_relaxed)) {
+            lowWater.store(lowWater.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+        endUpdate();
+    }
+
+    // Owning thread only
+    size_t size() const { return top.load(std::memory_order_relaxed); }
+    void* at(size_t index) const { return entries.load(std::memory_order_relaxed)[index].load(std::memory_order_relaxed); }
+    size_t getCapacity() const { return capacity.load(std::memory_order_relaxed); }
+
+    // Start tracking the low-water mark (called by the GC, not the owner).
+    // The owner may pop concurrently and lower the mark itself; whichever
+    // store lands last, re-reading top afterwards and storing again until it
+    // no longer drops keeps the mark at or below the real minimum.
+    void startLowWater() {
+        size_t mark = top.load(std::memory_order_seq_cst);
+        for (;;) {
+            lowWater.store(mark, std::memory_order_seq_cst);
+            size_t current = top.load(std::memory_order_seq_cst);
+            if (current >= mark) {
+                return;
+            }
+            mark = current;
+        }
+    }
+
+    // Stop tracking: with a mark of 0 no pop ever lowers it
+    void resetLowWater() {
+        lowWater.store(0, std::memory_order_relaxed);
+    }
+
+    // Append a consistent copy of the entries (up to the low-water mark when
+    // `belowLowWater`) to `out`. Safe from any thread.
+    void snapshot(std::vector<void*>& out, bool belowLowWater) const {
+        size_t base = out.size();
+        for (;;) {
+            uint64_t before = sequence.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            size_t n = top.load(std::memory_order_relaxed);
+            if (belowLowWater) {
+                size_t mark = lowWater.load(std::memory_order_relaxed);
+                n = mark < n ? mark : n;
+            }
+            // Capacity before the array: the array read is at least as
+            // large. Reading past it would be a torn read, retried below.
+            size_t limit = capacity.load(std::memory_order_acquire);
+            std::atomic<void*>* e = entries.load(std::memory_order_acquire);
+            if (n > limit) {
+                n = limit;
+            }
+            out.resize(base + n);
+            for (size_t i = 0; i < n; i++) {
+                out[base + i] = e[i].load(std::memory_order_relaxed);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence.load(std::memory_order_relaxed) == before) {
+                return;
+            }
+            out.resize(base);
+        }
+    }
+};
+
+static_assert(sizeof(std::atomic<void*>) == sizeof(void*), "JIT code stores plain pointers into the entries");
+static_assert(sizeof(std::atomic<std::atomic<void*>*>) == 8, "JIT code loads the entry array as a plain pointer");
+static_assert(sizeof(std::atomic<size_t>) == 8 && sizeof(std::atomic<uint64_t>) == 8, "ShadowStackLayout assumes 8-byte fields");
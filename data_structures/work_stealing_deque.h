@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Chase-Lev work-stealing deque (with the C11 memory orderings from
+// Le, Pop, Cohen, Zappa Nardelli - "Correct and Efficient Work-Stealing for
+// Weak Memory Models", PPoPP 2013).
+//
+// - push/pop: owner thread only, at the bottom (LIFO)
+// - steal:    any thread, from the top (FIFO)
+//
+// Items must be trivially copyable (pointers, tagged words). The buffer grows
+// on demand; retired buffers are kept until the deque is destroyed because a
+// thief may still be reading from one.
+template<typename T>
+class WorkStealingDeque {
+    static_assert(std::is_trivially_copyable<T>::value, "WorkStealingDeque items must be trivially copyable");
+
+private:
+    struct Buffer {
+        int64_t capacity;
+        int64_t mask;
+        std::atomic<T>* slots;
+
+        explicit Buffer(int64_t cap) : capacity(cap), mask(cap - 1), slots(new std::atomic<T>[cap]) {}
+        ~Buffer() { delete[] slots; }
+
+        T get(int64_t index) const { return slots[index & mask].load(std::memory_order_relaxed); }
+        void put(int64_t index, T item) { slots[index & mask].store(item, std::memory_order_relaxed); }
+    };
+
+    alignas(64) std::atomic<int64_t> top{0};
+    alignas(64) std::atomic<int64_t> bottom{0};
+    alignas(64) std::atomic<Buffer*> buffer;
+    std::vector<Buffer*> retired;   // Owner only
+
+    Buffer* grow(Buffer* old, int64_t b, int64_t t) {
+        Buffer* bigger = new Buffer(old->capacity * 2);
+        for (int64_t i = t; i < b; i++) {
+            bigger->put(i, old->get(i));
+        }
+        retired.push_back(old);
+        buffer.store(bigger, std::memory_order_release);
+        return bigger;
+    }
+
+public:
+    explicit WorkStealingDeque(int64_t initialCapacity = 1024) {
+        int64_t cap = 1;
+        while (cap < initialCapacity) cap <<= 1;
+        buffer.store(new Buffer(cap), std::memory_order_relaxed);
+    }
+
+    ~WorkStealingDeque() {
+        delete buffer.load(std::memory_order_relaxed);
+        for (Buffer* old : retired) {
+            delete old;
+        }
+    }
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // Owner: push an item at the bottom
+    void push(T item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        if (b - t > buf->capacity - 1) {
+            buf = grow(buf, b, t);
+        }
+        buf->put(b, item);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    // Owner: pop the most recently pushed item. Returns false when empty.
+    bool pop(T& out) {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        Buffer* buf = buffer.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+
+        out = buf->get(b);
+        if (t == b) {
+            // Last item - race against thieves for it
+            bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    // Any thread: steal the oldest item. Returns false when empty or when
+    // another thread won the race (callers simply try again elsewhere).
+    bool steal(T& out) {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+
+        if (t >= b) {
+            return false;
+        }
+
+        Buffer* buf = buffer.load(std::memory_order_acquire);
+        T item = buf->get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return false;
+        }
+        out = item;
+        return true;
+    }
+
+    // Best-effort size, exact only when called by the owner with no thieves
+    int64_t size() const {
+        int64_t b = bottom.load(std::memory_order_acquire);
+        int64_t t = top.load(std::memory_order_acquire);
+        return b > t ? b - t : 0;
+    }
+
+    bool empty() const { return size() == 0; }
+};
@@ -1,34 +1,28 @@
 #include "gc.h"
+#include "gc_marker.h"
+#include "gc_profiler.h"
+#include "gc_stackmap.h"
 #include "goroutine.h"
 #include "ast.h"
-#include "data_structures/safe_unordered_list.h"
 #include <iostream>
 #include <algorithm>
 #include <atomic>
+#include <cstdio>
 #include <cstring>
+#include <cstdlib>
+#include <stdexcept>
 #include <map>
-#include <signal.h>
-#include <pthread.h>
+#include <chrono>
+#include <iomanip>
+#include <fstream>
+#include <csignal>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/membarrier.h>
 
 // Thread-local current goroutine (defined in goroutine.cpp)
 extern thread_local std::shared_ptr<Goroutine> currentTask;
 
-// Signal handler for GC memory fence checkpoint
-extern "C" void gc_checkpoint_signal_handler(int sig) {
-    // The signal itself creates a memory fence - all pending writes
-    // must be visible before the handler executes (OS guarantees this)
-    
-    if (currentTask && currentTask->gcState) {
-        // Increment checkpoint counter atomically
-        // GC thread will wait for this to confirm the goroutine has reached the checkpoint
-        currentTask->gcState->checkpointCounter.fetch_add(1, std::memory_order_seq_cst);
-    }
-    
-    // Execute explicit memory fence for extra safety
-    // This ensures all prior writes are globally visible
-    std::atomic_thread_fence(std::memory_order_seq_cst);
-}
-
 // MetadataRegistry implementation
 MetadataRegistry& MetadataRegistry::getInstance() {
     static MetadataRegistry instance;
@@ -221,46 +215,151 @@ ClassMetadata* MetadataRegistry::getClassMetadata(const std::string& className)
     return (it != classMetadata.end()) ? it->second : nullptr;
 }
 
+// GC flags word of a heap cell (objects keep it at offset 8, scopes at offset 0)
+static std::atomic<uint64_t>& cellFlags(void* cell) {
+    if (HeapChunk::fromAddress(cell)->space == HeapSpace::SCOPE) {
+        return static_cast<ScopeHeader*>(cell)->flags;
+    }
+    return static_cast<ObjectHeader*>(cell)->flags;
+}
+
+// The calling thread's barrier log. Lives in static TLS so generated code
+// can reach it at a fixed offset from the fs base (see satbThreadOffset).
+static thread_local SATBBuffer threadSATB;
+
+SATBBuffer::~SATBBuffer() {
+    if (top && top != entries) {
+        GarbageCollector::getInstance().enqueueSATB(entries, top);
+    }
+}
+
+static size_t countMarked(const std::vector<void*>& cells) {
+    GCHeap& heap = GCHeap::getInstance();
+    return std::count_if(cells.begin(), cells.end(), [&](void* cell) { return heap.isMarked(cell); });
+}
+
+// The shadow stack generated code pushes scopes onto: that of the state
+// that entered managed code on this thread. Static TLS, so generated code can
+// load it at a fixed offset from the fs base (see shadowStackThreadOffset).
+static thread_local ShadowStack* threadShadowStack = nullptr;
+
 // GoroutineGCState methods
 void GoroutineGCState::pushScope(void* scope) {
-    // Lock to prevent race with GC thread reading scopeStack
-    std::lock_guard<std::mutex> lock(scopeStackMutex);
-    // Always push scopes - we need to track the current scope stack
-    scopeStack.push_back(scope);
+    if (!shadowStack.push(scope)) {
+        gc_shadow_stack_overflow();
+    }
 }
 
 void GoroutineGCState::popScope() {
-    // Lock to prevent race with GC thread reading scopeStack
-    std::lock_guard<std::mutex> lock(scopeStackMutex);
-    // Always pop scopes - we need to maintain accurate scope stack
-    if (!scopeStack.empty()) {
-        scopeStack.pop_back();
-        
-        // If we're in GC phase 2 and the stack is now smaller than the phase 2 size,
-        // decrement the phase 2 size to match (scope was destroyed)
-        if (isInGCPhase2 && scopeStack.size() < gcPhase2StackSize) {
-            gcPhase2StackSize = scopeStack.size();
+    // Lowers the phase 2 low-water mark too (scope was destroyed)
+    shadowStack.pop();
+}
+
+void* GoroutineGCState::pushFrame(size_t size, void* scopeMetadata) {
+    // Initialize the frame before it becomes visible to the GC as a root.
+    // REMEMBERED stays set for good: a frame is always a root, so the
+    // generational barrier never needs to record it.
+    ScopeHeader* header = static_cast<ScopeHeader*>(frames.push(size));
+    header->flags.store(ScopeFlags::REMEMBERED, std::memory_order_relaxed);
+    header->scopeMetadata = scopeMetadata;
+    
+    if (!shadowStack.push(header)) {
+        frames.pop(header);
+        gc_shadow_stack_overflow();
+    }
+    return header;
+}
+
+void GoroutineGCState::popFrame() {
+    // Release under the lock: the GC reads frames only while holding it
+    std::lock_guard<std::mutex> lock(framesMutex);
+    
+    // The top frame is normally the last entry, but a go statement leaves the
+    // goroutine's heap scope on the spawning stack, so search for it
+    for (size_t i = shadowStack.size(); i-- > 0;) {
+        void* frame = shadowStack.at(i);
+        if (!frames.contains(frame)) {
+            continue;
         }
+        shadowStack.removeAt(i);
+        frames.pop(frame);
+        return;
     }
 }
 
-// Add and remove object methods (defined here since they use SafeUnorderedList)
-void GoroutineGCState::addObject(void* obj) {
-    // Ensure list exists
-    if (!allocatedObjects) {
-        allocatedObjects = new SafeUnorderedList();
+void GoroutineGCState::enterManagedCode() {
+    threadShadowStack = &shadowStack;
+    inManagedCode.store(true, std::memory_order_seq_cst);
+}
+
+void GoroutineGCState::leaveManagedCode() {
+    GarbageCollector::flushThreadSATB();
+    
+    // Release: makes the barrier stores done in managed code visible
+    inManagedCode.store(false, std::memory_order_release);
+    threadShadowStack = nullptr;
+}
+
+ScopedOutsideManagedCode::ScopedOutsideManagedCode()
+    : state(GarbageCollector::getInstance().currentGCState()),
+      wasInManagedCode(state->inManagedCode.load(std::memory_order_relaxed)) {
+    if (wasInManagedCode) {
+        state->leaveManagedCode();
     }
-    allocatedObjects->add(obj);
 }
 
-void GoroutineGCState::removeObject(void* obj) {
-    if (!allocatedObjects) return;
-    allocatedObjects->remove(obj);
+ScopedOutsideManagedCode::~ScopedOutsideManagedCode() {
+    if (wasInManagedCode) {
+        state->enterManagedCode();
+    }
 }
 
 // GarbageCollector implementation
-GarbageCollector::GarbageCollector() {
-    std::cout << "GarbageCollector initialized with signal-based checkpointing" << std::endl;
+GarbageCollector::GarbageCollector()
+    : marker(std::make_unique<ParallelMarker>(ParallelMarker::defaultThreadCount())) {
+    // membarrier(2) lets the handshake flush every running thread with one
+    // syscall. It needs Linux 4.14+ and a one-time registration.
+    long supported = syscall(__NR_membarrier, MEMBARRIER_CMD_QUERY, 0);
+    if (supported > 0 && (supported & MEMBARRIER_CMD_PRIVATE_EXPEDITED) &&
+        syscall(__NR_membarrier, MEMBARRIER_CMD_REGISTER_PRIVATE_EXPEDITED, 0) == 0) {
+        membarrierAvailable = true;
+    }
+    
+    if (const char* env = std::getenv("TECHNOSCRIPT_GC_GROWTH")) {
+        long requested = std::strtol(env, nullptr, 10);
+        if (requested > 0) {
+            growthPercent.store(static_cast<size_t>(requested));
+        }
+    }
+    
+    if (std::getenv("TECHNOSCRIPT_GC_VERBOSE")) {
+        verbose.store(true);
+    }
+    if (const char* path = std::getenv("TECHNOSCRIPT_GC_TRACE")) {
+        try {
+            setTraceFile(path);
+        } catch (const std::exception& e) {
+            std::cerr << "GC trace disabled: " << e.what() << std::endl;
+        }
+    }
+    
+    // Starts sampling if TECHNOSCRIPT_ALLOC_PROFILE is set
+    AllocationProfiler::getInstance();
+    
+    // The heap calls back here when an allocation hits its limit
+    GCHeap& heap = GCHeap::getInstance();
+    heap.setHeapLimitHandler(&GarbageCollector::heapLimitReached);
+    if (heap.getHeapLimit() != SIZE_MAX) {
+        std::cout << "Heap limit: " << heap.getHeapLimit() << " bytes" << std::endl;
+    }
+    
+    if (const char* prefix = std::getenv("TECHNOSCRIPT_HEAP_SNAPSHOT")) {
+        heapSnapshotPrefix = prefix;
+    }
+    
+    std::cout << "GarbageCollector initialized with safepoint handshakes"
+              << (membarrierAvailable ? " (membarrier)" : "") << " and "
+              << marker->getThreadCount() << " marker threads" << std::endl;
 }
 
 GarbageCollector::~GarbageCollector() {
@@ -272,11 +371,102 @@ GarbageCollector& GarbageCollector::getInstance() {
     return instance;
 }
 
+void GarbageCollector::setMarkerThreads(size_t numThreads) {
+    // Don't resize the marker pool under a running cycle
+    std::lock_guard<std::mutex> lock(gcMutex);
+    marker->setThreadCount(numThreads);
+}
+
+size_t GarbageCollector::getMarkerThreads() const {
+    return marker->getThreadCount();
+}
+
+void GarbageCollector::setHeapGrowthPercent(size_t percent) {
+    growthPercent.store(percent > 0 ? percent : 1, std::memory_order_relaxed);
+}
+
+uint64_t GarbageCollector::getCompletedCycles() {
+    std::lock_guard<std::mutex> lock(pacerMutex);
+    return completedCycles;
+}
+
+GCStats GarbageCollector::getStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return stats;
+}
+
+void GarbageCollector::setTraceFile(const std::string& path) {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (traceFile.is_open()) {
+        traceFile.close();
+    }
+    if (path.empty()) {
+        return;
+    }
+    
+    traceFile.open(path, std::ios::out | std::ios::app);
+    if (!traceFile) {
+        throw std::runtime_error("Cannot open GC trace file: " + path);
+    }
+}
+
+void GarbageCollector::writeTraceLine(const GCCycleStats& cycle) {
+    // Plain numbers and booleans only, so no escaping is needed
+    traceFile << std::fixed << std::setprecision(3)
+              << "{\"cycle\":" << cycle.cycle
+              << ",\"type\":\"" << (cycle.minor ? "minor" : "full") << "\""
+              << ",\"requested\":" << (cycle.requested ? "true" : "false")
+              << ",\"phase1_ms\":" << cycle.phaseMs[0]
+              << ",\"phase2_ms\":" << cycle.phaseMs[1]
+              << ",\"phase3_ms\":" << cycle.phaseMs[2]
+              << ",\"phase4_ms\":" << cycle.phaseMs[3]
+              << ",\"total_ms\":" << cycle.totalMs
+              << ",\"roots\":" << cycle.roots
+              << ",\"objects_scanned\":" << cycle.objectsScanned
+              << ",\"scopes_scanned\":" << cycle.scopesScanned
+              << ",\"suspected_objects\":" << cycle.suspectedObjects
+              << ",\"suspected_scopes\":" << cycle.suspectedScopes
+              << ",\"saved_from_roots\":" << cycle.savedFromRoots
+              << ",\"late_resurrections\":" << cycle.lateResurrections
+              << ",\"handshake_rounds\":" << cycle.handshakeRounds
+              << ",\"stack_references\":" << cycle.stackReferences
+              << ",\"objects_freed\":" << cycle.objectsFreed
+              << ",\"scopes_freed\":" << cycle.scopesFreed
+              << ",\"bytes_reclaimed\":" << cycle.bytesReclaimed
+              << ",\"heap_bytes\":" << cycle.heapBytesAfter
+              << ",\"large_object_bytes\":" << cycle.largeObjectBytes
+              << ",\"fragmentation_pct\":" << cycle.fragmentationPercent
+              << ",\"draining_chunks\":" << cycle.drainingChunks
+              << "}\n";
+    traceFile.flush();
+}
+
+GoroutineGCState* GarbageCollector::currentGCState() {
+    if (currentTask && currentTask->gcState) {
+        return currentTask->gcState.get();
+    }
+    return &mainThreadState;
+}
+
 void GarbageCollector::start() {
     if (running.load()) {
         return;
     }
     
+    {
+        std::lock_guard<std::mutex> lock(pacerMutex);
+        GCHeap::getInstance().setAllocationTrigger(triggerBytes, &GarbageCollector::allocationTriggered);
+    }
+    
+    if (!heapSnapshotPrefix.empty()) {
+        struct sigaction action {};
+        action.sa_handler = &GarbageCollector::heapSnapshotSignalHandler;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGUSR2, &action, nullptr);
+        std::cout << "Heap snapshots on SIGUSR2 to " << heapSnapshotPrefix << ".*.heapsnapshot" << std::endl;
+    }
+    
     running.store(true);
     gcThread = std::make_unique<std::thread>(&GarbageCollector::gcThreadFunction, this);
     std::cout << "GC thread started" << std::endl;
@@ -287,86 +477,326 @@ void GarbageCollector::stop() {
         return;
     }
     
-    running.store(false);
+    {
+        // Under the lock, so the GC thread can't miss the wakeup between
+        // checking running and going to sleep
+        std::lock_guard<std::mutex> lock(pacerMutex);
+        running.store(false);
+    }
+    pacerWakeup.notify_all();
+    cycleDone.notify_all();
     if (gcThread && gcThread->joinable()) {
         gcThread->join();
     }
     std::cout << "GC thread stopped" << std::endl;
 }
 
-void GarbageCollector::gcThreadFunction() {
-    std::cout << "GC thread running" << std::endl;
+std::atomic<bool> GarbageCollector::heapSnapshotSignalled{false};
+
+void GarbageCollector::heapSnapshotSignalHandler(int) {
+    heapSnapshotSignalled.store(true);
+}
+
+std::vector<HeapSnapshot::TypeSummary> GarbageCollector::saveHeapSnapshot(const std::string& path) {
+    auto start = std::chrono::steady_clock::now();
+    HeapSnapshot snapshot;
+    {
+        // Nothing is freed outside a cycle, so holding the cycle lock keeps
+        // every cell the walk reaches valid without stopping the mutators
+        std::lock_guard<std::mutex> cycleLock(cycleMutex);
+        snapshot = HeapSnapshot::capture(collectAllRoots());
+    }
+    double walkMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
     
-    while (running.load()) {
-        // Sleep for a bit before next GC cycle
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-        
-        // Run a GC cycle
-        try {
-            phase1_initialMarkSweep();
-            
-            if (!suspectedDead.empty() || !suspectedDeadScopes.empty()) {
-                phase2_setFlagMonitoring();
-                phase3_secondMarkSweep();
-                phase4_cleanup();
-            }
-        } catch (const std::exception& e) {
-            std::cerr << "GC cycle error: " << e.what() << std::endl;
-        }
-        
-        // Clear state for next cycle
-        suspectedDead.clear();
-        suspectedDeadScopes.clear();
-        objectsToFree.clear();
-        scopesToFree.clear();
-        markedObjects.clear();
-        markedScopes.clear();
+    std::ofstream out(path, std::ios::trunc);
+    if (!out) {
+        throw std::runtime_error("Cannot open heap snapshot file: " + path);
+    }
+    snapshot.writeHeapSnapshot(out);
+    std::ofstream summaryOut(path + ".summary", std::ios::trunc);
+    if (!summaryOut) {
+        throw std::runtime_error("Cannot open heap snapshot summary: " + path + ".summary");
+    }
+    snapshot.writeSummary(summaryOut);
+    if (!out.flush() || !summaryOut.flush()) {
+        throw std::runtime_error("Failed to write heap snapshot: " + path);
     }
     
-    std::cout << "GC thread exiting" << std::endl;
+    std::cout << "Heap snapshot: " << snapshot.cellCount() << " cells, "
+              << snapshot.totalBytes() << " bytes reachable (walk " << std::fixed << std::setprecision(2)
+              << walkMs << " ms) -> " << path << std::defaultfloat << std::endl;
+    return snapshot.summary();
 }
 
-void GarbageCollector::requestCollection() {
-    // For now, just trigger immediately (could use condition variable for async)
-    std::cout << "Manual GC collection requested" << std::endl;
+std::vector<HeapSnapshot::TypeSummary> GarbageCollector::writeHeapSnapshot(const std::string& path) {
+    // A thread blocked in managed code would hold up a running cycle's
+    // safepoint handshake, and so its own wait for the cycle lock
+    ScopedOutsideManagedCode outside;
+    return saveHeapSnapshot(path);
 }
 
-std::vector<void*> GarbageCollector::collectAllAllocatedObjects() {
-    std::vector<void*> allObjects;
+void GarbageCollector::allocationTriggered() {
+    // Runs on an allocating thread, outside the heap lock. Taking pacerMutex
+    // orders this with the GC thread's predicate check.
+    GarbageCollector& gc = getInstance();
+    {
+        std::lock_guard<std::mutex> lock(gc.pacerMutex);
+    }
+    gc.pacerWakeup.notify_one();
+}
 
-    // Get all goroutines from EventLoop
-    auto allGoroutines = EventLoop::getInstance().getAllGoroutines();
+// Set while the heap limit handler runs on this thread: an allocation made
+// from inside it fails rather than starting another collection
+static thread_local bool threadHandlingHeapLimit = false;
 
-    for (auto& goroutine : allGoroutines) {
-        if (goroutine && goroutine->gcState) {
-            // Snapshot from per-goroutine SafeUnorderedList
-            std::vector<void*> snapshot;
-            if (goroutine->gcState->allocatedObjects) {
-                goroutine->gcState->allocatedObjects->snapshot(snapshot);
-                allObjects.insert(allObjects.end(), snapshot.begin(), snapshot.end());
-            }
+bool GarbageCollector::heapLimitReached(size_t requestedBytes, unsigned attempt) {
+    GarbageCollector& gc = getInstance();
+    // No collection makes room for more than the whole limit
+    bool hopeless = requestedBytes > GCHeap::getInstance().getHeapLimit();
+    if (hopeless || threadHandlingHeapLimit || attempt > GCPacing::HEAP_LIMIT_STALL_ROUNDS) {
+        std::lock_guard<std::mutex> lock(gc.statsMutex);
+        gc.stats.outOfMemoryErrors++;
+        return false;
+    }
+    // Cleared again however this returns: a collection may throw
+    threadHandlingHeapLimit = true;
+    struct HandlingHeapLimit {
+        ~HandlingHeapLimit() { threadHandlingHeapLimit = false; }
+    } handling;
+    
+    if (attempt == 0) {
+        // Emergency collection: full and synchronous, whatever the pacer says
+        if (gc.verbose) {
+            std::cout << "Heap limit reached (" << requestedBytes
+                      << " bytes requested): emergency collection" << std::endl;
+        }
+        {
+            std::lock_guard<std::mutex> lock(gc.statsMutex);
+            gc.stats.emergencyCollections++;
+        }
+        gc.requestCollection();
+    } else {
+        // Back-pressure: the last collection didn't free enough. Hold this
+        // thread back for a while, so other threads can drop what they hold,
+        // then collect again. Out of managed code while asleep so the
+        // thread doesn't hold up the safepoint handshake.
+        auto stallStart = std::chrono::steady_clock::now();
+        {
+            ScopedOutsideManagedCode outside;
+            std::this_thread::sleep_for(GCPacing::HEAP_LIMIT_FIRST_STALL * (1u << (attempt - 1)));
         }
+        gc.requestCollection();
+        
+        double stallMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - stallStart).count();
+        std::lock_guard<std::mutex> lock(gc.statsMutex);
+        gc.stats.allocationStalls++;
+        gc.stats.allocationStallMs += stallMs;
     }
+    return true;
+}
 
-    return allObjects;
+void GarbageCollector::runCycle(bool full) {
+    std::lock_guard<std::mutex> cycleLock(cycleMutex);
+    GCHeap& heap = GCHeap::getInstance();
+    
+    // Allocation from here on counts toward the next cycle
+    heap.resetAllocationCounter();
+    fullCycleRequested = full;
+    
+    using Clock = std::chrono::steady_clock;
+    auto elapsedMs = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+    auto cycleStart = Clock::now();
+    cycleStats = GCCycleStats();
+    cycleStats.requested = full;
+    
+    try {
+        auto phaseStart = Clock::now();
+        phase1_initialMarkSweep();
+        cycleStats.phaseMs[0] = elapsedMs(phaseStart);
+        
+        if (!suspectedDead.empty() || !suspectedDeadScopes.empty()) {
+            phaseStart = Clock::now();
+            phase2_setFlagMonitoring();
+            cycleStats.phaseMs[1] = elapsedMs(phaseStart);
+            
+            phaseStart = Clock::now();
+            phase3_secondMarkSweep();
+            cycleStats.phaseMs[2] = elapsedMs(phaseStart);
+            
+            phaseStart = Clock::now();
+            phase4_cleanup();
+            cycleStats.phaseMs[3] = elapsedMs(phaseStart);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "GC cycle error: " << e.what() << std::endl;
+    }
+    
+    // Everything that was allocated when the cycle started and is still
+    // allocated survived it: it is old from now on
+    heap.promoteSurvivors();
+    rememberedRoots.clear();
+    
+    // Clear state for next cycle
+    suspectedDead.clear();
+    suspectedDeadScopes.clear();
+    objectsToFree.clear();
+    scopesToFree.clear();
+    
+    // Next trigger: growth% of what survived, so the heap may grow to about
+    // (1 + growth/100) times its live size before collecting again
+    size_t liveBytes = heap.heapBytes();
+    size_t nextTrigger = std::max(GCPacing::MIN_TRIGGER_BYTES,
+                                  liveBytes / 100 * getHeapGrowthPercent());
+    
+    // Near the heap limit, collect before the headroom runs out so
+    // allocations rarely have to wait for an emergency collection
+    size_t heapLimit = heap.getHeapLimit();
+    if (heapLimit != SIZE_MAX) {
+        size_t inUse = liveBytes + heap.rawMemoryBytes();
+        size_t headroom = heapLimit > inUse ? heapLimit - inUse : 0;
+        nextTrigger = std::min(nextTrigger, std::max(GCPacing::HEAP_LIMIT_MIN_TRIGGER_BYTES, headroom / 2));
+    }
+    {
+        std::lock_guard<std::mutex> lock(pacerMutex);
+        triggerBytes = nextTrigger;
+        heap.setAllocationTrigger(triggerBytes, &GarbageCollector::allocationTriggered);
+    }
+    
+    cycleStats.minor = minorCycle;
+    cycleStats.heapBytesAfter = liveBytes;
+    cycleStats.largeObjectBytes = heap.largeObjectSpaceBytes();
+    cycleStats.fragmentationPercent = heap.fragmentationPercent();
+    cycleStats.drainingChunks = heap.drainingChunkCount();
+    cycleStats.totalMs = elapsedMs(cycleStart);
+    {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        cycleStats.cycle = ++stats.cycles;
+        stats.minorCycles += cycleStats.minor ? 1 : 0;
+        stats.totalMs += cycleStats.totalMs;
+        stats.maxCycleMs = std::max(stats.maxCycleMs, cycleStats.totalMs);
+        stats.objectsScanned += cycleStats.objectsScanned;
+        stats.scopesScanned += cycleStats.scopesScanned;
+        stats.objectsFreed += cycleStats.objectsFreed;
+        stats.scopesFreed += cycleStats.scopesFreed;
+        stats.bytesReclaimed += cycleStats.bytesReclaimed;
+        stats.resurrections += cycleStats.savedFromRoots + cycleStats.lateResurrections;
+        stats.lateResurrections += cycleStats.lateResurrections;
+        stats.lastCycle = cycleStats;
+        if (traceFile.is_open()) {
+            writeTraceLine(cycleStats);
+        }
+    }
+    
+    if (verbose) {
+        std::cout << "GC cycle " << cycleStats.cycle << " done in " << cycleStats.totalMs << " ms: "
+                  << liveBytes << " bytes in use, next cycle after " << nextTrigger
+                  << " bytes allocated" << std::endl;
+    }
 }
 
-std::vector<void*> GarbageCollector::collectAllAllocatedScopes() {
-    std::vector<void*> allScopes;
+void GarbageCollector::gcThreadFunction() {
+    std::cout << "GC thread running" << std::endl;
+    GCHeap& heap = GCHeap::getInstance();
+    
+    while (true) {
+        bool requested;
+        {
+            // Idle until enough has been allocated or someone asks for a
+            // cycle - a quiet heap costs nothing
+            std::unique_lock<std::mutex> lock(pacerMutex);
+            auto wakeup = [&] {
+                return !running.load() || collectionRequested ||
+                       heap.bytesAllocatedSinceCycle() >= triggerBytes;
+            };
+            // Finish the last cycle's sweep first, a batch of chunks at a
+            // time so allocators get the heap lock in between, and a trigger
+            // is never kept waiting for more than one batch
+            while (!wakeup() && heap.hasPendingSweep()) {
+                lock.unlock();
+                heap.sweepPending(GCPacing::SWEEP_BATCH_CHUNKS);
+                lock.lock();
+            }
+            if (heapSnapshotPrefix.empty()) {
+                pacerWakeup.wait(lock, wakeup);
+            } else {
+                // A signal handler can't notify the condition variable, so
+                // look for snapshot requests a few times a second
+                while (!wakeup() && !heapSnapshotSignalled.load()) {
+                    pacerWakeup.wait_for(lock, GCPacing::SNAPSHOT_POLL_INTERVAL);
+                }
+            }
+            if (!running.load()) {
+                break;
+            }
+            if (heapSnapshotSignalled.exchange(false)) {
+                lock.unlock();
+                std::string path = heapSnapshotPrefix + "." + std::to_string(getpid()) + "." +
+                                   std::to_string(++heapSnapshotsTaken) + ".heapsnapshot";
+                try {
+                    saveHeapSnapshot(path);
+                } catch (const std::exception& e) {
+                    std::cerr << "Heap snapshot failed: " << e.what() << std::endl;
+                }
+                continue;
+            }
+            requested = collectionRequested;
+            collectionRequested = false;
+            cycleInProgress = true;
+        }
+        
+        runCycle(requested);
+        
+        {
+            std::lock_guard<std::mutex> lock(pacerMutex);
+            cycleInProgress = false;
+            completedCycles++;
+        }
+        cycleDone.notify_all();
+    }
     
-    // Get all goroutines from EventLoop
-    auto allGoroutines = EventLoop::getInstance().getAllGoroutines();
+    std::cout << "GC thread exiting" << std::endl;
+}
+
+void GarbageCollector::requestCollection() {
+    // An allocation at the heap limit gets here on whatever stack it ran
+    // on, and a goroutine segment only guarantees its reserve below that:
+    // not enough for a cycle, which this runs when there is no GC thread
+    Goroutine::runOnWorkerStack([this] { collectNow(); });
+}
+
+void GarbageCollector::collectNow() {
+    if (verbose) {
+        std::cout << "Manual GC collection requested" << std::endl;
+    }
     
-    for (auto& goroutine : allGoroutines) {
-        if (goroutine && goroutine->gcState) {
-            std::lock_guard<std::mutex> lock(goroutine->gcState->allocationMutex);
-            allScopes.insert(allScopes.end(), 
-                           goroutine->gcState->allocatedScopes.begin(),
-                           goroutine->gcState->allocatedScopes.end());
+    // A thread blocked in managed code would hold up the cycle's safepoint
+    // handshake forever, so wait as if outside it
+    ScopedOutsideManagedCode outside;
+    
+    bool completed = false;
+    {
+        std::unique_lock<std::mutex> lock(pacerMutex);
+        if (running.load()) {
+            // A cycle already under way may have taken its roots before the
+            // caller's garbage was dropped: wait for the one after it
+            uint64_t target = completedCycles + (cycleInProgress ? 2 : 1);
+            collectionRequested = true;
+            pacerWakeup.notify_one();
+            cycleDone.wait(lock, [&] {
+                return completedCycles >= target || !running.load();
+            });
+            completed = completedCycles >= target;
         }
     }
     
-    return allScopes;
+    // No GC thread (never started, or stopped meanwhile): collect here
+    if (!completed) {
+        runCycle(true);
+        std::lock_guard<std::mutex> lock(pacerMutex);
+        completedCycles++;
+    }
 }
 
 std::vector<void*> GarbageCollector::collectAllRoots() {
@@ -376,16 +806,32 @@ std::vector<void*> GarbageCollector::collectAllRoots() {
     // If we're in GC mode, only collect scopes that existed before phase 2
     auto allGoroutines = EventLoop::getInstance().getAllGoroutines();
     
+    std::vector<GoroutineGCState*> states;
+    states.reserve(allGoroutines.size() + 1);
+    states.push_back(&mainThreadState);
     for (auto& goroutine : allGoroutines) {
         if (goroutine && goroutine->gcState) {
-            // Lock to prevent race with pushScope/popScope modifying scopeStack
-            std::lock_guard<std::mutex> lock(goroutine->gcState->scopeStackMutex);
-            
-            size_t limitSize = gcMode.load() ? goroutine->gcState->gcPhase2StackSize 
-                                             : goroutine->gcState->scopeStack.size();
-            
-            for (size_t i = 0; i < limitSize && i < goroutine->gcState->scopeStack.size(); i++) {
-                allRoots.push_back(goroutine->gcState->scopeStack[i]);
+            states.push_back(goroutine->gcState.get());
+        }
+    }
+    
+    GCHeap& heap = GCHeap::getInstance();
+    
+    std::vector<void*> scopes;
+    for (GoroutineGCState* state : states) {
+        // The shadow stack is read without stopping its owner (seqlock), but
+        // popFrame waits for us, so the frames in the copy stay valid
+        std::lock_guard<std::mutex> lock(state->framesMutex);
+        
+        scopes.clear();
+        state->shadowStack.snapshot(scopes, gcMode.load());
+        
+        for (void* scope : scopes) {
+            if (heap.contains(scope)) {
+                allRoots.push_back(scope);
+            } else {
+                // Frame scopes are not heap cells: their references are the roots
+                ParallelMarker::appendScopeReferences(scope, allRoots);
             }
         }
     }
@@ -393,55 +839,143 @@ std::vector<void*> GarbageCollector::collectAllRoots() {
     return allRoots;
 }
 
+std::vector<void*> GarbageCollector::collectCycleRoots() {
+    std::vector<void*> roots = collectAllRoots();
+    if (!minorCycle) {
+        return roots;
+    }
+    
+    // Old cells are not traced in a minor cycle, so every old cell that may
+    // point at a young one is a root: the snapshot taken at cycle start, plus
+    // whatever the barriers have recorded since
+    roots.insert(roots.end(), rememberedRoots.begin(), rememberedRoots.end());
+    std::lock_guard<std::mutex> lock(rememberedSetMutex);
+    roots.insert(roots.end(), rememberedSet.begin(), rememberedSet.end());
+    return roots;
+}
+
+void GarbageCollector::remember(void* cell) {
+    if (!cell || !GCHeap::getInstance().contains(cell)) {
+        return;
+    }
+    
+    // Only the thread that sets the flag records the cell
+    uint64_t old = cellFlags(cell).fetch_or(ObjectFlags::REMEMBERED, std::memory_order_acq_rel);
+    if (old & ObjectFlags::REMEMBERED) {
+        return;
+    }
+    
+    std::lock_guard<std::mutex> lock(rememberedSetMutex);
+    rememberedSet.push_back(cell);
+}
+
+void GarbageCollector::snapshotRememberedSet() {
+    {
+        std::lock_guard<std::mutex> lock(rememberedSetMutex);
+        rememberedRoots.swap(rememberedSet);
+        rememberedSet.clear();
+    }
+    
+    // Clear the flags so the next store into these cells records them again
+    // (for the next cycle)
+    for (void* cell : rememberedRoots) {
+        cellFlags(cell).fetch_and(~ObjectFlags::REMEMBERED, std::memory_order_acq_rel);
+    }
+}
+
+void GarbageCollector::purgeRememberedSet() {
+    // Exactly the cells phase 4 freed. "No longer allocated" would be wrong:
+    // a cell bump-allocated in a TLAB since phase 1 flushed them has no
+    // start bit yet, and dropping it would leave its REMEMBERED flag set
+    // with nothing ever clearing it, so later stores into it would skip
+    // the barrier's slow path.
+    if (objectsToFree.empty() && scopesToFree.empty()) {
+        return;
+    }
+    
+    std::vector<void*> freedCells(objectsToFree);
+    freedCells.insert(freedCells.end(), scopesToFree.begin(), scopesToFree.end());
+    std::sort(freedCells.begin(), freedCells.end());
+    std::lock_guard<std::mutex> lock(rememberedSetMutex);
+    rememberedSet.erase(std::remove_if(rememberedSet.begin(), rememberedSet.end(), [&](void* cell) {
+        return std::binary_search(freedCells.begin(), freedCells.end(), cell);
+    }), rememberedSet.end());
+}
+
 void GarbageCollector::phase1_initialMarkSweep() {
     std::lock_guard<std::mutex> lock(gcMutex);
     
-    // Step 1: Snapshot all allocated objects and scopes
-    std::vector<void*> allObjects = collectAllAllocatedObjects();
-    std::vector<void*> allScopes = collectAllAllocatedScopes();
+    GCHeap& heap = GCHeap::getInstance();
     
-    if (allObjects.empty() && allScopes.empty()) {
-        return; // Nothing to collect
-    }
+    // Minor cycles only collect young cells; every few cycles a full one
+    // collects old garbage too
+    minorCycle = cycleCount++ % (GCGenerations::MINOR_CYCLES_PER_FULL + 1) !=
+                 GCGenerations::MINOR_CYCLES_PER_FULL && !fullCycleRequested;
     
-    std::cout << "GC Phase 1: Mark-Sweep on " << allObjects.size() << " objects and " 
-              << allScopes.size() << " scopes" << std::endl;
+    // Step 1: Take the remembered set, then give start bits to everything
+    // bump-allocated in TLABs so far. Cells allocated after this point stay
+    // invisible to this cycle, and any store of one of them into an older
+    // cell lands in the next remembered set.
+    snapshotRememberedSet();
+    heap.flushTLABs();
     
-    // Step 2: Clear mark bits
-    markedObjects.clear();
-    markedScopes.clear();
+    // Nothing allocated, nothing to collect
+    if (heap.isEmpty()) {
+        return;
+    }
     
-    // Step 3: Mark all reachable objects from roots
-    std::vector<void*> roots = collectAllRoots();
-    std::cout << "  - Found " << roots.size() << " root scopes" << std::endl;
+    // Cells allocated so far become old if they survive this cycle
+    heap.beginTenuring();
     
-    for (void* root : roots) {
-        if (root) {
-            markScope(root);
-        }
+    if (verbose) {
+        std::cout << "GC Phase 1: " << (minorCycle ? "Minor" : "Full") << " mark-sweep on "
+                  << heap.chunkCount() << " heap chunks" << std::endl;
     }
     
-    // Step 4: Find unreachable objects and scopes (suspected dead)
-    suspectedDead.clear();
-    for (void* obj : allObjects) {
-        if (markedObjects.find(obj) == markedObjects.end()) {
-            suspectedDead.push_back(obj);
-        }
+    // Step 2: Clear mark bits and allocate black until the scan below is done.
+    // This replaces the old allocation-list snapshot: anything allocated after
+    // this point is treated as live for this cycle.
+    heap.beginMarking();
+    
+    // Step 3: Mark all reachable objects from roots (only young ones in a
+    // minor cycle, with the remembered cells as extra roots)
+    std::vector<void*> roots = collectCycleRoots();
+    cycleStats.roots = roots.size();
+    if (verbose) {
+        std::cout << "  - Found " << roots.size() << " roots (" << rememberedRoots.size()
+                  << " remembered cells)" << std::endl;
     }
     
+    markFrom(roots);
+    
+    // Step 4: Find unreachable objects and scopes (suspected dead) by scanning
+    // the chunk bitmaps for cells that are allocated but not marked
+    suspectedDead.clear();
+    heap.collectUnmarked(HeapSpace::OBJECT, suspectedDead, minorCycle);
+    
     suspectedDeadScopes.clear();
-    for (void* scope : allScopes) {
-        if (markedScopes.find(scope) == markedScopes.end()) {
-            suspectedDeadScopes.push_back(scope);
-        }
-    }
+    heap.collectUnmarked(HeapSpace::SCOPE, suspectedDeadScopes, minorCycle);
+    
+    heap.finishMarking();
     
-    std::cout << "  - Found " << suspectedDead.size() << " suspected dead objects and " 
-              << suspectedDeadScopes.size() << " suspected dead scopes" << std::endl;
+    cycleStats.suspectedObjects = suspectedDead.size();
+    cycleStats.suspectedScopes = suspectedDeadScopes.size();
+    if (verbose) {
+        std::cout << "  - Found " << suspectedDead.size() << " suspected dead objects and " 
+                  << suspectedDeadScopes.size() << " suspected dead scopes" << std::endl;
+    }
 }
 
 void GarbageCollector::phase2_setFlagMonitoring() {
-    std::cout << "GC Phase 2: Set Flag Monitoring" << std::endl;
+    if (verbose) {
+        std::cout << "GC Phase 2: Set Flag Monitoring" << std::endl;
+    }
+    
+    // Entries left over from the previous cycle are stale
+    {
+        std::lock_guard<std::mutex> lock(satbMutex);
+        satbQueue.clear();
+    }
     
     // Mark the current scope stack size before entering GC mode
     markAllGoroutinesPhase2Start();
@@ -449,45 +983,42 @@ void GarbageCollector::phase2_setFlagMonitoring() {
     // Enter GC mode (limits scope traversal to pre-phase-2 scopes)
     gcMode.store(true, std::memory_order_release);
     
-    // For each suspected dead object, set needs_set_flag and clear set_flag
+    // Set needs_set_flag on every suspected dead cell: from now on the write
+    // barriers log each store of one of them (see SATBBuffer)
     for (void* obj : suspectedDead) {
-        ObjectHeader* header = static_cast<ObjectHeader*>(obj);
-        
-        // Set needs_set_flag = 1, set_flag = 0 atomically
-        uint64_t expected = header->flags.load(std::memory_order_acquire);
-        uint64_t desired;
-        do {
-            desired = expected | ObjectFlags::NEEDS_SET_FLAG;
-            desired &= ~ObjectFlags::SET_FLAG;
-        } while (!header->flags.compare_exchange_weak(expected, desired, 
-                                                       std::memory_order_release,
-                                                       std::memory_order_acquire));
-    }
-    
-    // For each suspected dead scope, set needs_set_flag and clear set_flag
+        static_cast<ObjectHeader*>(obj)->flags.fetch_or(ObjectFlags::NEEDS_SET_FLAG, std::memory_order_acq_rel);
+    }
+    
     for (void* scope : suspectedDeadScopes) {
-        ScopeHeader* header = static_cast<ScopeHeader*>(scope);
-        
-        // Set needs_set_flag = 1, set_flag = 0 atomically
-        uint64_t expected = header->flags.load(std::memory_order_acquire);
-        uint64_t desired;
-        do {
-            desired = expected | ScopeFlags::NEEDS_SET_FLAG;
-            desired &= ~ScopeFlags::SET_FLAG;
-        } while (!header->flags.compare_exchange_weak(expected, desired,
-                                                       std::memory_order_release,
-                                                       std::memory_order_acquire));
-    }
-    
-    std::cout << "  - Monitoring " << suspectedDead.size() << " objects and " 
-              << suspectedDeadScopes.size() << " scopes for resurrection" << std::endl;
-    
-    // Wait a bit for program to potentially create new references
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        static_cast<ScopeHeader*>(scope)->flags.fetch_or(ScopeFlags::NEEDS_SET_FLAG, std::memory_order_acq_rel);
+    }
+    
+    if (verbose) {
+        std::cout << "  - Monitoring " << suspectedDead.size() << " objects and " 
+                  << suspectedDeadScopes.size() << " scopes for resurrection" << std::endl;
+    }
+}
+
+std::vector<void*> GarbageCollector::drainSATBQueue() {
+    std::vector<void*> logged;
+    {
+        std::lock_guard<std::mutex> lock(satbMutex);
+        logged.swap(satbQueue);
+    }
+    
+    // Keep the suspects that are not marked yet. Entries can be stale (from a
+    // racing barrier of an earlier cycle), so only trust allocated cells.
+    GCHeap& heap = GCHeap::getInstance();
+    logged.erase(std::remove_if(logged.begin(), logged.end(), [&](void* cell) {
+        return !cell || !heap.contains(cell) || !heap.isAllocated(cell) || heap.isMarked(cell);
+    }), logged.end());
+    return logged;
 }
 
 void GarbageCollector::phase3_secondMarkSweep() {
-    std::cout << "GC Phase 3: Second Mark-Sweep" << std::endl;
+    if (verbose) {
+        std::cout << "GC Phase 3: Second Mark-Sweep" << std::endl;
+    }
     
     // Exit GC mode and reset phase 2 markers
     gcMode.store(false, std::memory_order_release);
@@ -495,223 +1026,93 @@ void GarbageCollector::phase3_secondMarkSweep() {
     
     // STEP 1: Perform a full mark-sweep from roots to catch any new references
     // that were created during phase 2 (even those that didn't trigger the write barrier)
-    std::cout << "  - Performing second mark-sweep from roots..." << std::endl;
-    markedObjects.clear();
-    markedScopes.clear();
-    
-    std::vector<void*> roots = collectAllRoots();
-    for (void* root : roots) {
-        if (root) {
-            markScope(root);
-        }
-    }
-    
-    // STEP 2: Remove any suspected dead objects/scopes that are now reachable from roots
-    std::vector<void*> stillSuspectedDead;
-    std::vector<void*> stillSuspectedDeadScopes;
-    
-    for (void* obj : suspectedDead) {
-        if (markedObjects.find(obj) != markedObjects.end()) {
-            // Object was found to be reachable - it's alive!
-            // (descendants already marked recursively, so they're safe too)
-        } else {
-            // Still not reachable from roots
-            stillSuspectedDead.push_back(obj);
-        }
+    GCHeap& heap = GCHeap::getInstance();
+    heap.clearMarkBits();
+    
+    std::vector<void*> roots = collectCycleRoots();
+    markFrom(roots);
+    
+    size_t savedObjects = countMarked(suspectedDead);
+    size_t savedScopes = countMarked(suspectedDeadScopes);
+    cycleStats.savedFromRoots = savedObjects + savedScopes;
+    if (verbose) {
+        std::cout << "  - Saved from roots: " << savedObjects << " objects, " 
+                  << savedScopes << " scopes" << std::endl;
     }
     
-    for (void* scope : suspectedDeadScopes) {
-        if (markedScopes.find(scope) != markedScopes.end()) {
-            // Scope was found to be reachable - it's alive!
-            // (descendants already marked recursively, so they're safe too)
-        } else {
-            // Still not reachable from roots
-            stillSuspectedDeadScopes.push_back(scope);
-        }
-    }
-    
-    int objectsSavedFromRoots = suspectedDead.size() - stillSuspectedDead.size();
-    int scopesSavedFromRoots = suspectedDeadScopes.size() - stillSuspectedDeadScopes.size();
-    
-    std::cout << "  - Saved from roots: " << objectsSavedFromRoots << " objects, " 
-              << scopesSavedFromRoots << " scopes" << std::endl;
-    
-    // STEP 3: Iteratively check write barrier flags and mark resurrected items
-    // Loop until we reach a "quiet" state where no new set_flags are found
-    // This handles the case where resurrected objects create references to other
-    // suspected-dead objects during the resurrection process
-    
-    int iteration = 0;
-    bool foundNewResurrections = true;
-    
-    // Keep track of all items we've already resurrected across iterations
-    std::set<void*> allResurrectedObjects;
-    std::set<void*> allResurrectedScopes;
-    
-    while (foundNewResurrections) {
-        iteration++;
-        foundNewResurrections = false;
-        
-        std::cout << "  - Resurrection iteration " << iteration << std::endl;
-        
-        // Check flags on objects that haven't been resurrected yet
-        std::vector<void*> newlyResurrected;
-        for (void* obj : stillSuspectedDead) {
-            // Skip if already resurrected
-            if (allResurrectedObjects.find(obj) != allResurrectedObjects.end()) {
-                continue;
-            }
-            
-            ObjectHeader* header = static_cast<ObjectHeader*>(obj);
-            
-            // Check if set_flag was set (meaning new reference was created)
-            if (header->flags.load(std::memory_order_acquire) & ObjectFlags::SET_FLAG) {
-                newlyResurrected.push_back(obj);
-                allResurrectedObjects.insert(obj);
-                foundNewResurrections = true;
-            }
-        }
-        
-        // Check flags on scopes that haven't been resurrected yet
-        std::vector<void*> newlyResurrectedScopes;
-        for (void* scope : stillSuspectedDeadScopes) {
-            // Skip if already resurrected
-            if (allResurrectedScopes.find(scope) != allResurrectedScopes.end()) {
-                continue;
-            }
-            
-            ScopeHeader* header = static_cast<ScopeHeader*>(scope);
-            
-            // Check if set_flag was set (meaning new reference was created)
-            if (header->flags.load(std::memory_order_acquire) & ScopeFlags::SET_FLAG) {
-                newlyResurrectedScopes.push_back(scope);
-                allResurrectedScopes.insert(scope);
-                foundNewResurrections = true;
-            }
-        }
+    // STEP 2: Resurrect every suspect the write barriers logged. A safepoint
+    // handshake makes each thread hand over its log (and finish any barrier
+    // in flight); marking from the logged cells resurrects them and their
+    // descendants. Marks are only ever added, so a suspect counts as
+    // resurrected once it is marked. Repeat until a handshake turns up
+    // nothing new: the barriers of the mark we just did may log more.
+    int rounds = 0;
+    size_t resurrected = 0;
+    stackReferences.store(0, std::memory_order_relaxed);
+    
+    while (true) {
+        rounds++;
+        ensureAllWriteBarriersComplete();
         
-        if (newlyResurrected.empty() && newlyResurrectedScopes.empty()) {
-            std::cout << "    - No new resurrections found (quiet state reached)" << std::endl;
+        std::vector<void*> logged = drainSATBQueue();
+        if (logged.empty()) {
             break;
         }
         
-        std::cout << "    - Found " << newlyResurrected.size() << " new resurrected objects, "
-                  << newlyResurrectedScopes.size() << " new resurrected scopes" << std::endl;
-        
-        // Mark all newly resurrected objects/scopes and their descendants
-        // This will also set flags on any suspected-dead items they reference
-        markedObjects.clear();
-        markedScopes.clear();
-        
-        for (void* obj : newlyResurrected) {
-            markObject(obj);
-        }
-        for (void* scope : newlyResurrectedScopes) {
-            markScope(scope);
-        }
-        
-        // The descendants are now marked - add them to the resurrected set
-        for (void* obj : stillSuspectedDead) {
-            if (markedObjects.find(obj) != markedObjects.end()) {
-                allResurrectedObjects.insert(obj);
-            }
-        }
-        for (void* scope : stillSuspectedDeadScopes) {
-            if (markedScopes.find(scope) != markedScopes.end()) {
-                allResurrectedScopes.insert(scope);
-            }
-        }
-        
-        // Small delay to allow any cascading write barriers to trigger
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        resurrected += logged.size();
+        markFrom(logged);
     }
     
-    std::cout << "  - Resurrection loop complete after " << iteration << " iterations" << std::endl;
-    std::cout << "  - Total resurrected: " << allResurrectedObjects.size() << " objects, "
-              << allResurrectedScopes.size() << " scopes" << std::endl;
-    
-    // STEP 4: Final verification using signal-based memory fence
-    // This ensures all goroutines have completed any pending write barrier operations
-    // and all set_flag writes are globally visible
-    std::cout << "  - Performing final signal-based memory fence..." << std::endl;
-    ensureAllWriteBarriersComplete();
-    
-    // After the fence, do ONE final check for any late set_flags
-    std::cout << "  - Final post-fence check for late resurrections..." << std::endl;
-    int lateResurrections = 0;
-    
-    for (void* obj : stillSuspectedDead) {
-        if (allResurrectedObjects.find(obj) != allResurrectedObjects.end()) {
-            continue;
-        }
-        
-        ObjectHeader* header = static_cast<ObjectHeader*>(obj);
-        if (header->flags.load(std::memory_order_acquire) & ObjectFlags::SET_FLAG) {
-            allResurrectedObjects.insert(obj);
-            lateResurrections++;
-            
-            // Mark descendants too
-            markedObjects.clear();
-            markObject(obj);
-            for (void* descObj : stillSuspectedDead) {
-                if (markedObjects.find(descObj) != markedObjects.end()) {
-                    allResurrectedObjects.insert(descObj);
-                }
-            }
-        }
-    }
-    
-    for (void* scope : stillSuspectedDeadScopes) {
-        if (allResurrectedScopes.find(scope) != allResurrectedScopes.end()) {
-            continue;
-        }
-        
-        ScopeHeader* header = static_cast<ScopeHeader*>(scope);
-        if (header->flags.load(std::memory_order_acquire) & ScopeFlags::SET_FLAG) {
-            allResurrectedScopes.insert(scope);
-            lateResurrections++;
-            
-            // Mark descendants too
-            markedScopes.clear();
-            markScope(scope);
-            for (void* descScope : stillSuspectedDeadScopes) {
-                if (markedScopes.find(descScope) != markedScopes.end()) {
-                    allResurrectedScopes.insert(descScope);
-                }
-            }
-        }
+    cycleStats.handshakeRounds = rounds;
+    cycleStats.stackReferences = stackReferences.load(std::memory_order_relaxed);
+    cycleStats.lateResurrections = resurrected;
+    if (verbose) {
+        std::cout << "  - Drained barrier logs in " << rounds << " rounds, " 
+                  << resurrected << " cells resurrected" << std::endl;
     }
     
-    if (lateResurrections > 0) {
-        std::cout << "    - Caught " << lateResurrections << " late resurrections after fence!" << std::endl;
-    } else {
-        std::cout << "    - No late resurrections (fence verification passed)" << std::endl;
-    }
-    
-    // STEP 5: Build the final list of truly dead items (those not resurrected)
+    // STEP 3: Build the final list of truly dead items (those not resurrected),
+    // and stop logging the survivors
     objectsToFree.clear();
-    for (void* obj : stillSuspectedDead) {
-        if (allResurrectedObjects.find(obj) == allResurrectedObjects.end()) {
+    for (void* obj : suspectedDead) {
+        if (heap.isMarked(obj)) {
+            static_cast<ObjectHeader*>(obj)->flags.fetch_and(~ObjectFlags::NEEDS_SET_FLAG, std::memory_order_acq_rel);
+        } else {
             objectsToFree.push_back(obj);
         }
     }
     
     scopesToFree.clear();
-    for (void* scope : stillSuspectedDeadScopes) {
-        if (allResurrectedScopes.find(scope) == allResurrectedScopes.end()) {
+    for (void* scope : suspectedDeadScopes) {
+        if (heap.isMarked(scope)) {
+            static_cast<ScopeHeader*>(scope)->flags.fetch_and(~ScopeFlags::NEEDS_SET_FLAG, std::memory_order_acq_rel);
+        } else {
             scopesToFree.push_back(scope);
         }
     }
     
-    std::cout << "  - Final truly dead to free: " << objectsToFree.size() << " objects, " 
-              << scopesToFree.size() << " scopes" << std::endl;
+    if (verbose) {
+        std::cout << "  - Final truly dead to free: " << objectsToFree.size() << " objects, " 
+                  << scopesToFree.size() << " scopes" << std::endl;
+    }
 }
 
 void GarbageCollector::phase4_cleanup() {
-    std::cout << "GC Phase 4: Cleanup" << std::endl;
+    if (verbose) {
+        std::cout << "GC Phase 4: Cleanup" << std::endl;
+    }
     
-    // Get all goroutines for cleanup
-    auto allGoroutines = EventLoop::getInstance().getAllGoroutines();
+    GCHeap& heap = GCHeap::getInstance();
+    
+    // Size the dead cells before freeing any: in a mixed chunk a cell's size
+    // comes from the start bit of the cell after it
+    size_t reclaimed = 0;
+    for (void* obj : objectsToFree) {
+        reclaimed += heap.cellSize(obj);
+    }
+    for (void* scope : scopesToFree) {
+        reclaimed += heap.cellSize(scope);
+    }
     
     // Free all truly dead objects
     for (void* obj : objectsToFree) {
@@ -721,15 +1122,8 @@ void GarbageCollector::phase4_cleanup() {
         header->flags.store(0, std::memory_order_release);
         header->classMetadata = nullptr;
         
-        // Remove from all goroutines' allocation lists
-        for (auto& goroutine : allGoroutines) {
-            if (goroutine && goroutine->gcState) {
-                goroutine->gcState->removeObject(obj);
-            }
-        }
-        
-        // Free the memory
-        free(obj);
+        // Return the cell to the heap
+        heap.freeCell(obj);
     }
     
     // Free all truly dead scopes
@@ -740,144 +1134,43 @@ void GarbageCollector::phase4_cleanup() {
         header->flags.store(0, std::memory_order_release);
         header->scopeMetadata = nullptr;
         
-        // Remove from all goroutines' allocation lists
-        for (auto& goroutine : allGoroutines) {
-            if (goroutine && goroutine->gcState) {
-                goroutine->gcState->removeScope(scope);
-            }
-        }
-        
-        // Free the memory
-        free(scope);
-    }
-    
-    std::cout << "  - Freed " << objectsToFree.size() << " objects and " 
-              << scopesToFree.size() << " scopes" << std::endl;
-}
-
-void GarbageCollector::markObject(void* obj) {
-    if (!obj || markedObjects.find(obj) != markedObjects.end()) {
-        return; // Already marked or null
-    }
-    
-    markedObjects.insert(obj);
-    traceObject(obj);
-}
-
-void GarbageCollector::markScope(void* scope) {
-    if (!scope || markedScopes.find(scope) != markedScopes.end()) {
-        return; // Already marked or null
-    }
-    
-    markedScopes.insert(scope);
-    traceScope(scope);
-}
-
-void GarbageCollector::traceObject(void* obj) {
-    ObjectHeader* header = static_cast<ObjectHeader*>(obj);
-    ClassMetadata* metadata = header->getClassMetadata();
-    
-    if (!metadata) {
-        return;
+        // Return the cell to the heap
+        heap.freeCell(scope);
     }
     
-    // NOTE: With the new design, method closures are in metadata and shared
-    // Instances only have POINTERS to these closures
-    // We don't need to trace metadata closures since they're static and don't contain
-    // per-instance data. The closure scope pointers would be filled at instantiation
-    // if methods captured external scopes (currently they don't).
+    // Drop freed cells from the remembered set (their chunks may be released below)
+    purgeRememberedSet();
     
-    // Trace through closure pointers in the object
-    // Layout: [metadata*][flags][closure_ptr1]...[closure_ptrN][fields]
-    Closure** closurePtrs = header->getClosurePtrs();
-    
-    // For each method closure pointer, trace the scopes it captures
-    for (int i = 0; i < metadata->numMethods; i++) {
-        Closure* closure = closurePtrs[i];
-        if (!closure) continue;
-        
-        // Closure layout: [size(8)][func_addr(8)][scope_ptr1(8)][scope_ptr2(8)]...
-        int numScopes = (closure->size - 16) / 8;
-        
-        // Trace each scope pointer in the method closure
-        void** scopePtrs = closure->getScopePtrs();
-        for (int j = 0; j < numScopes; j++) {
-            void* scopePtr = scopePtrs[j];
-            if (scopePtr) {
-                markScope(scopePtr);
-            }
-        }
+    // Decommit chunks that no longer hold any live cells and turn the dead
+    // cells of size-class chunks into free runs for the next TLAB refills.
+    // Lazily: allocators sweep the chunks of the size class they need, and
+    // the GC thread the rest between cycles, so the heap lock is never held
+    // for a whole-heap pass. Without a GC thread it all happens here.
+    if (running.load()) {
+        heap.beginSweep();
+    } else {
+        heap.sweep();
     }
     
-    // Trace through object fields using metadata
-    // Note: field offsets in metadata account for header + closure pointers
-    uint8_t* objectStart = reinterpret_cast<uint8_t*>(obj);
-    
-    for (int i = 0; i < metadata->numFields; i++) {
-        const VarMetadata& field = metadata->fields[i];
-        
-        // Check if field is an object reference
-        if (field.type == DataType::OBJECT) {
-            void* fieldObj = *reinterpret_cast<void**>(objectStart + field.offset);
-            if (fieldObj) {
-                markObject(fieldObj);
-            }
-        }
-        // Handle closure fields - trace the scope pointers inside the closure
-        else if (field.type == DataType::CLOSURE) {
-            uint8_t* closurePtr = objectStart + field.offset;
-            // Closure layout: [size(8)][func_addr(8)][scope_ptr1(8)][scope_ptr2(8)]...
-            uint64_t closureSize = *reinterpret_cast<uint64_t*>(closurePtr);
-            int numScopes = (closureSize - 16) / 8;
-            
-            // Trace each scope pointer in the closure
-            for (int j = 0; j < numScopes; j++) {
-                void* scopePtr = *reinterpret_cast<void**>(closurePtr + 16 + (j * 8));
-                if (scopePtr) {
-                    markScope(scopePtr);
-                }
-            }
-        }
+    cycleStats.objectsFreed = objectsToFree.size();
+    cycleStats.scopesFreed = scopesToFree.size();
+    cycleStats.bytesReclaimed = reclaimed;
+    if (verbose) {
+        std::cout << "  - Freed " << objectsToFree.size() << " objects and " 
+                  << scopesToFree.size() << " scopes (" << reclaimed << " bytes)" << std::endl;
+        std::cout << "  - " << heap.freeRunBytes() << " bytes in free runs"
+                  << (heap.hasPendingSweep() ? ", more after lazy sweeping" : "") << std::endl;
     }
 }
 
-void GarbageCollector::traceScope(void* scope) {
-    ScopeHeader* header = static_cast<ScopeHeader*>(scope);
-    ScopeMetadata* metadata = header->getScopeMetadata();
-    
-    if (!metadata) {
-        return; // No metadata, nothing to trace
-    }
-    
-    // Trace through scope variables using metadata
-    uint8_t* dataStart = header->getDataStart();
-    
-    for (int i = 0; i < metadata->numVars; i++) {
-        const VarMetadata& var = metadata->vars[i];
-        
-        // Check if variable is an object reference
-        if (var.type == DataType::OBJECT) {
-            void* varObj = *reinterpret_cast<void**>(dataStart + var.offset);
-            if (varObj) {
-                markObject(varObj);
-            }
-        }
-        // Handle closure variables - trace the scope pointers inside the closure
-        else if (var.type == DataType::CLOSURE) {
-            uint8_t* closurePtr = dataStart + var.offset;
-            // Closure layout: [func_addr(8)][size(8)][scope_ptr1(8)][scope_ptr2(8)]...
-            uint64_t closureSize = *reinterpret_cast<uint64_t*>(closurePtr + 8);
-            int numScopes = (closureSize - 16) / 8;
-            
-            // Trace each scope pointer in the closure
-            for (int j = 0; j < numScopes; j++) {
-                void* scopePtr = *reinterpret_cast<void**>(closurePtr + 16 + (j * 8));
-                if (scopePtr) {
-                    markScope(scopePtr);
-                }
-            }
-        }
-    }
+void GarbageCollector::markFrom(const std::vector<void*>& cells) {
+    // Iterative and parallel: see ParallelMarker (gc_marker.cpp) for the
+    // object/scope tracing rules
+    marker->mark(cells, minorCycle);
+    
+    uint64_t scopes = marker->getLastTracedScopes();
+    cycleStats.scopesScanned += scopes;
+    cycleStats.objectsScanned += marker->getLastTracedCells() - scopes;
 }
 
 void GarbageCollector::markAllGoroutinesPhase2Start() {
@@ -889,8 +1182,11 @@ void GarbageCollector::markAllGoroutinesPhase2Start() {
             goroutine->gcState->markGCPhase2Start();
         }
     }
+    mainThreadState.markGCPhase2Start();
     
-    std::cout << "  - Marked phase 2 start for " << allGoroutines.size() << " goroutines" << std::endl;
+    if (verbose) {
+        std::cout << "  - Marked phase 2 start for " << allGoroutines.size() << " goroutines" << std::endl;
+    }
 }
 
 void GarbageCollector::resetAllGoroutinesPhase2() {
@@ -902,175 +1198,246 @@ void GarbageCollector::resetAllGoroutinesPhase2() {
             goroutine->gcState->resetGCPhase2();
         }
     }
+    mainThreadState.resetGCPhase2();
     
-    std::cout << "  - Reset phase 2 for " << allGoroutines.size() << " goroutines" << std::endl;
+    if (verbose) {
+        std::cout << "  - Reset phase 2 for " << allGoroutines.size() << " goroutines" << std::endl;
+    }
 }
 
 void GarbageCollector::ensureAllWriteBarriersComplete() {
+    // Write barriers are straight-line code between safepoint polls, so a
+    // thread that acknowledges a request made now has finished every barrier
+    // it started before it. Threads outside JIT code have none in flight.
     auto allGoroutines = EventLoop::getInstance().getAllGoroutines();
     
-    if (allGoroutines.empty()) {
-        return; // No goroutines to fence
+    std::vector<GoroutineGCState*> states;
+    states.reserve(allGoroutines.size() + 1);
+    states.push_back(&mainThreadState);
+    for (auto& goroutine : allGoroutines) {
+        if (goroutine && goroutine->gcState) {
+            states.push_back(goroutine->gcState.get());
+        }
     }
     
-    std::cout << "  - Initiating signal-based memory fence for " << allGoroutines.size() 
-              << " goroutines..." << std::endl;
-    
-    // Step 1: Record current checkpoint values for each goroutine
-    std::vector<uint64_t> initialCheckpoints;
-    initialCheckpoints.reserve(allGoroutines.size());
-    
-    for (auto& g : allGoroutines) {
-        if (g && g->gcState) {
-            initialCheckpoints.push_back(
-                g->gcState->checkpointCounter.load(std::memory_order_acquire)
-            );
-        } else {
-            initialCheckpoints.push_back(0); // No gcState - will skip
-        }
+    if (verbose) {
+        std::cout << "  - Safepoint handshake with " << states.size() << " goroutines..." << std::endl;
     }
     
-    // Step 2: Send SIGUSR1 to all goroutine threads
-    // This interrupts each thread and forces it to execute the signal handler
-    // The signal handler creates a memory fence and increments checkpointCounter
-    for (auto& g : allGoroutines) {
-        if (g && g->gcState) {
-            int result = pthread_kill(g->gcState->threadId, SIGUSR1);
-            if (result != 0) {
-                std::cerr << "    - Warning: Failed to send signal to goroutine (error " 
-                         << result << ")" << std::endl;
-            }
-        }
+    // Step 1: Publish the request. The seq_cst store pairs with
+    // enterManagedCode(): a thread either shows up as in managed code below,
+    // or its next poll sees the request.
+    uint64_t epoch = safepointRequest.fetch_add(1, std::memory_order_acq_rel) + 1;
+    safepointPending.store(1, std::memory_order_seq_cst);
+    
+    // Fast path: one syscall makes every running thread execute a full
+    // barrier, so the request is visible everywhere right away and barrier
+    // stores issued so far are globally visible
+    if (membarrierAvailable) {
+        syscall(__NR_membarrier, MEMBARRIER_CMD_PRIVATE_EXPEDITED, 0);
     }
     
-    // Step 3: Wait for all goroutines to acknowledge by changing their counters
-    // We check if the value is DIFFERENT (not specifically +1) to handle wraparound
-    // Use a timeout to avoid hanging forever if a goroutine is stuck
-    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
-    bool allAcknowledged = false;
+    // Step 2: Wait for each thread in managed code to pass a poll. Spin
+    // briefly (polls are at every function entry), then back off.
+    auto pending = [epoch](GoroutineGCState* state) {
+        return state->inManagedCode.load(std::memory_order_acquire) &&
+               state->safepointEpoch.load(std::memory_order_acquire) < epoch;
+    };
+    
+    // No deadline: the cycle frees what it didn't mark once this returns, so
+    // going on with a thread still in managed code and unpolled could free a
+    // cell its barrier hasn't logged yet. Runtime code that blocks leaves
+    // managed code (ScopedOutsideManagedCode), so only generated code is
+    // waited for, and that polls at every function entry.
+    auto start = std::chrono::steady_clock::now();
+    bool warned = false;
     int checkCount = 0;
     
-    while (!allAcknowledged && std::chrono::steady_clock::now() < deadline) {
-        allAcknowledged = true;
+    while (true) {
         checkCount++;
-        
-        for (size_t i = 0; i < allGoroutines.size(); i++) {
-            auto& g = allGoroutines[i];
-            if (g && g->gcState) {
-                uint64_t current = g->gcState->checkpointCounter.load(
-                    std::memory_order_acquire
-                );
-                
-                // Check if counter has changed (signal handler ran)
-                // This handles wraparound correctly - we just care that it's different
-                if (current == initialCheckpoints[i]) {
-                    allAcknowledged = false;
-                    break; // Still waiting for this goroutine
-                }
-            }
+        size_t waitingFor = std::count_if(states.begin(), states.end(), pending);
+        if (waitingFor == 0) {
+            break;
         }
-        
-        if (!allAcknowledged) {
-            // Brief sleep before checking again
-            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        if (!warned && std::chrono::steady_clock::now() - start >= std::chrono::seconds(1)) {
+            // Still waiting, not giving up: a native call that never returns
+            // stalls the collector rather than letting it free live cells
+            std::cerr << "    - Warning: Still waiting for " << waitingFor 
+                      << " goroutines to reach a safepoint" << std::endl;
+            warned = true;
+        }
+        if (checkCount < 64) {
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
         }
     }
     
-    if (allAcknowledged) {
-        std::cout << "    - All goroutines reached checkpoint (checked " << checkCount 
+    safepointPending.store(0, std::memory_order_release);
+    
+    if (verbose) {
+        std::cout << "    - All goroutines passed a safepoint (checked " << checkCount 
                   << " times)" << std::endl;
-        std::cout << "    - Memory fence complete: all write barriers are globally visible" 
-                  << std::endl;
-    } else {
-        std::cerr << "    - Warning: Timeout waiting for goroutines to reach checkpoint" 
-                  << std::endl;
-        std::cerr << "    - Some goroutines may not have completed write barriers" 
-                  << std::endl;
-        
-        // Log which goroutines didn't respond
-        for (size_t i = 0; i < allGoroutines.size(); i++) {
-            auto& g = allGoroutines[i];
-            if (g && g->gcState) {
-                uint64_t current = g->gcState->checkpointCounter.load(
-                    std::memory_order_acquire
-                );
-                if (current == initialCheckpoints[i]) {
-                    std::cerr << "      - Goroutine " << i << " did not respond" << std::endl;
-                }
+    }
+}
+
+void GarbageCollector::enqueueSATB(void* const* begin, void* const* end) {
+    std::lock_guard<std::mutex> lock(satbMutex);
+    satbQueue.insert(satbQueue.end(), begin, end);
+}
+
+void GarbageCollector::flushThreadSATB() {
+    SATBBuffer& buffer = threadSATB;
+    if (buffer.top && buffer.top != buffer.entries) {
+        getInstance().enqueueSATB(buffer.entries, buffer.top);
+    }
+    buffer.top = buffer.entries;
+    buffer.limit = buffer.entries + SATBLayout::BUFFER_ENTRIES;
+}
+
+intptr_t GarbageCollector::satbThreadOffset() {
+    return reinterpret_cast<intptr_t>(&threadSATB) - reinterpret_cast<intptr_t>(__builtin_thread_pointer());
+}
+
+intptr_t GarbageCollector::shadowStackThreadOffset() {
+    return reinterpret_cast<intptr_t>(&threadShadowStack) - reinterpret_cast<intptr_t>(__builtin_thread_pointer());
+}
+
+void GarbageCollector::acknowledgeSafepoint(const void* pc, const uint64_t* registers, const void* framePointer) {
+    GoroutineGCState* state = currentGCState();
+    uint64_t request = safepointRequest.load(std::memory_order_acquire);
+    
+    // A reference only our JIT frames hold (in a register or a frame slot)
+    // is resurrected like one the barrier logged: the scan logs every heap
+    // cell the stack maps point at, and phase 3 marks the unmarked ones.
+    // The poll word stays set until every thread has answered, so scan once
+    // per request; each handshake round makes a new one.
+    if (framePointer && state->safepointEpoch.load(std::memory_order_relaxed) < request) {
+        GCHeap& heap = GCHeap::getInstance();
+        size_t found = 0;
+        StackMapTable::getInstance().scanFrames(pc, framePointer, registers, [&](void* reference) {
+            if (heap.contains(reference)) {
+                gc_satb_log(reference);
+                found++;
             }
-        }
+        });
+        stackReferences.fetch_add(found, std::memory_order_relaxed);
     }
+    
+    // Entries logged before this poll must reach the GC with the acknowledgement
+    flushThreadSATB();
+    
+    state->safepointEpoch.store(request, std::memory_order_release);
+}
+
+// The allocation entry points are called from generated code, which can't be
+// unwound: an allocation that fails (OutOfMemoryError at the heap limit, or
+// malloc giving up) ends the goroutine instead of throwing into it. The
+// message is copied out so the exception is finished with before
+// technoscript_goroutine_fail leaves for good.
+template <typename Allocate>
+static void* allocateOrFail(Allocate allocate) {
+    char message[160];
+    try {
+        return allocate();
+    } catch (const std::bad_alloc& e) {
+        snprintf(message, sizeof(message), "%s", e.what());
+    }
+    technoscript_goroutine_fail(message);
 }
 
 // Runtime functions
 extern "C" {
-    void gc_track_object(void* obj) {
-        if (!obj) return;
-        
-        if (currentTask && currentTask->gcState) {
-            currentTask->gcState->addObject(obj);
-        }
+    // The return address identifies the allocation site for the sampling
+    // profiler (see AllocationProfiler::registerSite)
+    void* gc_allocate_object(size_t size, void* classMetadata) {
+        const void* site = __builtin_return_address(0);
+        return allocateOrFail([&] {
+            return GCHeap::getInstance().allocateInTLAB(HeapSpace::OBJECT, size, classMetadata, site);
+        });
     }
     
-    void gc_track_scope(void* scope) {
-        if (!scope) return;
-        
-        if (currentTask && currentTask->gcState) {
-            currentTask->gcState->addScope(scope);
-        }
+    void* gc_allocate_scope(size_t size, void* scopeMetadata) {
+        const void* site = __builtin_return_address(0);
+        return allocateOrFail([&] {
+            return GCHeap::getInstance().allocateInTLAB(HeapSpace::SCOPE, size, scopeMetadata, site);
+        });
+    }
+    
+    void gc_safepoint_poll(const uint64_t* registers, const void* framePointer) {
+        GarbageCollector::getInstance().acknowledgeSafepoint(__builtin_return_address(0), registers, framePointer);
     }
     
     void gc_push_scope(void* scope) {
         if (!scope) return;
         
-        if (currentTask && currentTask->gcState) {
-            currentTask->gcState->pushScope(scope);
+        GarbageCollector::getInstance().currentGCState()->pushScope(scope);
+    }
+    
+    void* gc_enter_frame(size_t size, void* scopeMetadata) {
+        return GarbageCollector::getInstance().currentGCState()->pushFrame(size, scopeMetadata);
+    }
+    
+    void gc_leave_frame() {
+        GarbageCollector::getInstance().currentGCState()->popFrame();
+    }
+    
+    void gc_pop_scope() {
+        GarbageCollector::getInstance().currentGCState()->popScope();
+    }
+    
+    void gc_shadow_stack_overflow() {
+        // Called from generated code: nothing may be thrown through it
+        char message[80];
+        snprintf(message, sizeof(message), "shadow stack overflow (more than %zu nested scopes)",
+                 ShadowStackLayout::CAPACITY);
+        technoscript_goroutine_fail(message);
+    }
+    
+    void gc_satb_log(void* cell) {
+        SATBBuffer& buffer = threadSATB;
+        if (buffer.top == buffer.limit) {
+            GarbageCollector::flushThreadSATB();
         }
+        *buffer.top++ = cell;
     }
     
-void gc_pop_scope() {
-    if (currentTask && currentTask->gcState) {
-        currentTask->gcState->popScope();
+    void gc_remember(void* cell) {
+        GarbageCollector::getInstance().remember(cell);
     }
-}
     
-    // NOTE: gc_handle_assignment and gc_handle_scope_assignment are now inlined
-    // directly in the generated assembly code for better performance.
-    // The inline version does:
-    //   1. Load flags from object header
-    //   2. Test if NEEDS_SET_FLAG is set
-    //   3. If set, atomically OR the SET_FLAG bit using LOCK OR instruction
-    // This avoids the function call overhead while maintaining thread safety.
-    
-    /*
-    void gc_handle_assignment(void* targetObj) {
-        if (!targetObj) return;
-        
-        ObjectHeader* header = static_cast<ObjectHeader*>(targetObj);
-        
-        // Check if needs_set_flag is set
-        uint64_t flags = header->flags.load(std::memory_order_acquire);
-        if (flags & ObjectFlags::NEEDS_SET_FLAG) {
-            // Set the set_flag to indicate a new reference was created
-            header->flags.fetch_or(ObjectFlags::SET_FLAG, std::memory_order_release);
+    void* gc_allocate_raw(size_t size) {
+        if (size >= HeapLayout::LARGE_OBJECT_THRESHOLD) {
+            return allocateOrFail([&] { return GCHeap::getInstance().allocateRaw(size); });
         }
+        void* block = calloc(1, size == 0 ? 1 : size);
+        if (!block) {
+            technoscript_goroutine_fail("out of memory");
+        }
+        return block;
     }
     
-    void gc_handle_scope_assignment(void* targetScope) {
-        if (!targetScope) return;
-        
-        ScopeHeader* header = static_cast<ScopeHeader*>(targetScope);
-        
-        // Check if needs_set_flag is set
-        uint64_t flags = header->flags.load(std::memory_order_acquire);
-        if (flags & ScopeFlags::NEEDS_SET_FLAG) {
-            // Set the set_flag to indicate a new reference was created
-            header->flags.fetch_or(ScopeFlags::SET_FLAG, std::memory_order_release);
+    void gc_release_raw(void* block) {
+        if (!block) {
+            return;
+        }
+        // Small blocks came from malloc; anything else must be a mapped block
+        if (!GCHeap::getInstance().releaseRaw(block)) {
+            free(block);
         }
     }
-    */
     
     void gc_collect() {
         GarbageCollector::getInstance().requestCollection();
     }
+    
+    bool gc_heap_snapshot(const char* path) {
+        try {
+            GarbageCollector::getInstance().writeHeapSnapshot(path);
+            return true;
+        } catch (const std::exception& e) {
+            std::cerr << "Heap snapshot failed: " << e.what() << std::endl;
+            return false;
+        }
+    }
 }
@@ -3,16 +3,23 @@
 #include "ast.h"  // For DataType enum and forward declarations
 #include <cstdint>
 #include <vector>
-#include <unordered_set>
 #include <atomic>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <algorithm>
 #include <map>
-#include "data_structures/safe_unordered_list.h"
+#include <string>
+#include <fstream>
+#include "gc_heap.h"
+#include "gc_snapshot.h"
+#include "data_structures/frame_stack.h"
+#include "data_structures/shadow_stack.h"
 
 // Forward declarations
 class Goroutine;
+class ParallelMarker;
 
 // Runtime metadata structures (AOT-compatible)
 struct VarMetadata {
@@ -25,11 +32,22 @@ struct VarMetadata {
         : offset(o), type(t), typeInfo(ti), name(n) {}
 };
 
+// Trace routine for one class or scope layout, emitted by the code generator
+// (CodeGenerator::generateTraceFunctions). Calls
+// ParallelMarker::visitReference(context, ref) for every reference held in
+// `cell` that points into the GC heap, and touches nothing else - int and
+// float slots cost nothing. Null in metadata built at runtime; the marker
+// then walks the VarMetadata array instead.
+using TraceFunction = void (*)(void* cell, void* context);
+
 struct ScopeMetadata {
     int numVars;              // Number of variables in this scope
     VarMetadata* vars;        // Array of variable metadata
+    int totalSize;            // Size of a scope cell in bytes (header included)
+    TraceFunction traceFunction = nullptr;  // Specialized tracer for this layout
+    const char* name = nullptr;             // Function (or enclosing function of a block), for heap snapshots
     
-    ScopeMetadata(int n = 0, VarMetadata* v = nullptr) : numVars(n), vars(v) {}
+    ScopeMetadata(int n = 0, VarMetadata* v = nullptr, int size = 0) : numVars(n), vars(v), totalSize(size) {}
 };
 
 // Closure structure embedded in metadata
@@ -61,6 +79,8 @@ struct ClassMetadata {
     const char** parentNames; // Array of parent class names
     int* parentOffsets;       // Array of offsets to parent data in object layout
     
+    TraceFunction traceFunction = nullptr;  // Specialized tracer for this layout
+    
     ClassMetadata(const char* name = nullptr, int nf = 0, VarMetadata* f = nullptr, int size = 0,
                   int nm = 0, Closure** mc = nullptr,
                   int np = 0, const char** pn = nullptr, int* po = nullptr)
@@ -90,16 +110,45 @@ public:
 
 // Object header flags (bit positions in the FLAGS field at offset 0)
 namespace ObjectFlags {
-    constexpr uint64_t NEEDS_SET_FLAG = 1ULL << 0;  // Bit 0: Object is suspected dead, track new refs
-    constexpr uint64_t SET_FLAG = 1ULL << 1;        // Bit 1: New reference was created during GC
+    constexpr uint64_t NEEDS_SET_FLAG = 1ULL << 0;  // Bit 0: Object is suspected dead, log stores of it
     constexpr uint64_t GC_MARKED = 1ULL << 2;       // Bit 2: Marked as reachable during GC
+    constexpr uint64_t REMEMBERED = 1ULL << 3;      // Bit 3: In the remembered set (pointer stored since last cycle)
 }
 
 // Scope header flags (bit positions in the FLAGS field at offset 0)
 namespace ScopeFlags {
-    constexpr uint64_t NEEDS_SET_FLAG = 1ULL << 0;  // Bit 0: Scope is suspected dead, track new refs
-    constexpr uint64_t SET_FLAG = 1ULL << 1;        // Bit 1: New reference was created during GC
+    constexpr uint64_t NEEDS_SET_FLAG = 1ULL << 0;  // Bit 0: Scope is suspected dead, log stores of it
     constexpr uint64_t GC_MARKED = 1ULL << 2;       // Bit 2: Marked as reachable during GC
+    constexpr uint64_t REMEMBERED = 1ULL << 3;      // Bit 3: In the remembered set (pointer stored since last cycle)
+}
+
+// Generational collection settings
+namespace GCGenerations {
+    // Every (MINOR_CYCLES_PER_FULL + 1)th cycle is a full collection; the
+    // others only collect young cells (those that have not survived a cycle)
+    constexpr uint64_t MINOR_CYCLES_PER_FULL = 7;
+}
+
+// Allocation-driven pacing. A cycle starts once the bytes allocated since
+// the previous one reach growth% of the heap that survived it (but at least
+// MIN_TRIGGER_BYTES), so a quiet heap is never collected.
+namespace GCPacing {
+    constexpr size_t DEFAULT_GROWTH_PERCENT = 100;         // Overridden by TECHNOSCRIPT_GC_GROWTH
+    constexpr size_t MIN_TRIGGER_BYTES = 4 * 1024 * 1024;  // Floor for small heaps
+    // Chunks the GC thread sweeps per heap lock hold between cycles
+    constexpr size_t SWEEP_BATCH_CHUNKS = 16;
+    // How often an idle GC thread checks for a SIGUSR2 heap snapshot request
+    constexpr std::chrono::milliseconds SNAPSHOT_POLL_INTERVAL{200};
+    
+    // Heap limit (GCHeap::setHeapLimit, TECHNOSCRIPT_HEAP_LIMIT). Near the
+    // limit a cycle starts once half the remaining headroom is allocated,
+    // but never more often than every HEAP_LIMIT_MIN_TRIGGER_BYTES.
+    constexpr size_t HEAP_LIMIT_MIN_TRIGGER_BYTES = 1024 * 1024;
+    // An allocation that hits the limit gets an emergency collection, then
+    // this many rounds of back-pressure (sleep, collect again, retry) with
+    // the sleep doubling from HEAP_LIMIT_FIRST_STALL, then OutOfMemoryError
+    constexpr unsigned HEAP_LIMIT_STALL_ROUNDS = 6;
+    constexpr std::chrono::milliseconds HEAP_LIMIT_FIRST_STALL{1};
 }
 
 // Object header structure (must match ObjectLayout in codegen.h)
@@ -148,56 +197,130 @@ struct ScopeHeader {
     }
 };
 
+// Statistics of one GC cycle (GarbageCollector::getStats, trace output)
+struct GCCycleStats {
+    uint64_t cycle = 0;               // 1 for the first cycle
+    bool minor = false;               // Young-only collection
+    bool requested = false;           // Started by gc_collect rather than the pacer
+    double phaseMs[4] = {0, 0, 0, 0}; // Wall time of phases 1-4
+    double totalMs = 0;               // Whole cycle, including promotion
+    size_t roots = 0;                 // Root cells of the phase 1 mark
+    uint64_t objectsScanned = 0;      // Objects traced by all marks of the cycle
+    uint64_t scopesScanned = 0;       // Scopes traced by all marks of the cycle
+    size_t suspectedObjects = 0;      // Unreached by the phase 1 mark
+    size_t suspectedScopes = 0;
+    size_t savedFromRoots = 0;        // Suspects reached again by the phase 3 re-mark
+    size_t lateResurrections = 0;     // Suspects only found in the barrier logs after the handshake
+    size_t handshakeRounds = 0;       // Safepoint handshakes in phase 3
+    size_t stackReferences = 0;       // References found in JIT frames at those handshakes
+    size_t objectsFreed = 0;
+    size_t scopesFreed = 0;
+    size_t bytesReclaimed = 0;        // Cell bytes returned to the heap
+    size_t heapBytesAfter = 0;        // GCHeap::heapBytes() after the sweep
+    size_t largeObjectBytes = 0;      // Part of heapBytesAfter in the large object space
+    double fragmentationPercent = 0;  // Free share of the size-class chunks (GCHeap::fragmentationPercent)
+    size_t drainingChunks = 0;        // Sparse chunks being drained (GCHeap::setDefragmentation)
+};
+
+// Totals since startup, plus the most recent cycle
+struct GCStats {
+    uint64_t cycles = 0;
+    uint64_t minorCycles = 0;
+    double totalMs = 0;               // Time spent in cycles on the GC thread
+    double maxCycleMs = 0;
+    uint64_t objectsScanned = 0;
+    uint64_t scopesScanned = 0;
+    uint64_t objectsFreed = 0;
+    uint64_t scopesFreed = 0;
+    uint64_t bytesReclaimed = 0;
+    uint64_t resurrections = 0;       // savedFromRoots + lateResurrections
+    uint64_t lateResurrections = 0;
+    uint64_t emergencyCollections = 0; // Collections run by allocations at the heap limit
+    uint64_t allocationStalls = 0;    // Back-pressure rounds at the heap limit
+    double allocationStallMs = 0;     // Time allocating threads spent in them
+    uint64_t outOfMemoryErrors = 0;   // Allocations that failed at the heap limit
+    GCCycleStats lastCycle;
+};
+
+// Per-thread write barrier log. While a collection runs, the inline barrier
+// appends every stored reference whose NEEDS_SET_FLAG is set (a suspected-dead
+// cell that just got a new reference) - load top, compare against limit,
+// store, bump top. The buffer is handed to the GC when it fills up, when the
+// thread acknowledges a safepoint, when it leaves JIT code and when it exits,
+// and phase 3 resurrects whatever it finds in the handed-over logs.
+namespace SATBLayout {
+    constexpr int TOP_OFFSET = 0;
+    constexpr int LIMIT_OFFSET = 8;
+    constexpr size_t BUFFER_ENTRIES = 256;
+}
+
+struct SATBBuffer {
+    void** top = nullptr;    // Offset 0: next free entry (bumped by generated code)
+    void** limit = nullptr;  // Offset 8: end of entries (null until first use)
+    void* entries[SATBLayout::BUFFER_ENTRIES];
+    
+    ~SATBBuffer();  // Hands the remaining entries to the GC on thread exit
+};
+
 // Per-goroutine GC state
 struct GoroutineGCState {
-    // All objects allocated by this goroutine (thread-local list)
-    SafeUnorderedList* allocatedObjects = nullptr;
-    std::vector<void*> allocatedScopes;   // All scopes allocated by this goroutine
-    std::vector<void*> scopeStack;        // Stack of active lexical scopes (roots)
-    std::mutex allocationMutex;           // Protects allocatedObjects and allocatedScopes lists
-    std::mutex scopeStackMutex;           // Protects scopeStack and phase2 tracking variables
-    size_t gcPhase2StackSize = 0;         // Size of scope stack when phase 2 started
-    bool isInGCPhase2 = false;            // True when in GC phase 2
-    
-    // Signal-based memory fence support
-    std::atomic<uint64_t> checkpointCounter{0};  // Incremented when signal handler runs
-    pthread_t threadId;                           // Thread ID for sending signals
-    
-    void addObject(void* obj);
-    void removeObject(void* obj);
-    
-    void addScope(void* scope) {
-        std::lock_guard<std::mutex> lock(allocationMutex);
-        allocatedScopes.push_back(scope);
-    }
-    
-    void removeScope(void* scope) {
-        std::lock_guard<std::mutex> lock(allocationMutex);
-        auto it = std::find(allocatedScopes.begin(), allocatedScopes.end(), scope);
-        if (it != allocatedScopes.end()) {
-            allocatedScopes.erase(it);
-        }
-    }
-    
-    // Push scope to stack (called when entering a scope)
+    // Allocated cells are not tracked here: they are found through the heap
+    // bitmaps and the thread-local allocation buffers (see gc_heap.h)
+    ShadowStack shadowStack;              // Active lexical scopes (roots), see data_structures/shadow_stack.h
+    FrameStack frames;                    // Scopes that never escape their call (not in the GC heap)
+    std::mutex framesMutex;               // Held by popFrame and by the GC while it reads frames
+    
+    // Safepoint handshake support (see GarbageCollector::ensureAllWriteBarriersComplete)
+    std::atomic<bool> inManagedCode{false};      // Running JIT code, so possibly inside a write barrier
+    std::atomic<uint64_t> safepointEpoch{0};     // Last safepoint request acknowledged at a poll
+    
+    // Push scope to stack (called when entering a scope). JIT code pushes
+    // and pops heap scopes inline; these are the runtime equivalents.
     void pushScope(void* scope);
     
     // Pop scope from stack (called when exiting a scope)
     void popScope();
     
-    // Mark the current stack size at start of GC phase 2
+    // Allocate a non-escaping scope on the frame stack and push it as a root
+    void* pushFrame(size_t size, void* scopeMetadata);
+    
+    // Pop the top scope (a frame) and release its memory
+    void popFrame();
+    
+    // Start tracking the scopes that were open when GC phase 2 started
     void markGCPhase2Start() {
-        std::lock_guard<std::mutex> lock(scopeStackMutex);
-        gcPhase2StackSize = scopeStack.size();
-        isInGCPhase2 = true;
+        shadowStack.startLowWater();
     }
     
     // Reset after GC phase 2
     void resetGCPhase2() {
-        std::lock_guard<std::mutex> lock(scopeStackMutex);
-        gcPhase2StackSize = 0;
-        isInGCPhase2 = false;
+        shadowStack.resetLowWater();
     }
+    
+    // Bracket every stretch of JIT code this state runs. Outside of it the
+    // thread cannot be in the middle of a write barrier, so the safepoint
+    // handshake doesn't wait for it. Also makes this state's shadow stack the
+    // one the thread's JIT code pushes scopes onto.
+    void enterManagedCode();
+    
+    // Also hands this thread's barrier log to the GC
+    void leaveManagedCode();
+};
+
+// Runtime code that may block (waits for a GC cycle, sleeps, I/O) holds
+// this while it does: a thread blocked in managed code would hold up the
+// safepoint handshake. Leaves the calling thread's managed code if it is in
+// it, and enters it again when destroyed, also when an exception unwinds.
+class ScopedOutsideManagedCode {
+public:
+    ScopedOutsideManagedCode();
+    ~ScopedOutsideManagedCode();
+    ScopedOutsideManagedCode(const ScopedOutsideManagedCode&) = delete;
+    ScopedOutsideManagedCode& operator=(const ScopedOutsideManagedCode&) = delete;
+
+private:
+    GoroutineGCState* state;
+    bool wasInManagedCode;
 };
 
 // Main garbage collector
@@ -213,8 +336,56 @@ private:
     std::vector<void*> suspectedDeadScopes; // Scopes suspected dead after phase 1
     std::vector<void*> objectsToFree;      // Final list of truly dead objects to free in phase 4
     std::vector<void*> scopesToFree;       // Final list of truly dead scopes to free in phase 4
-    std::unordered_set<void*> markedObjects;
-    std::unordered_set<void*> markedScopes;
+    
+    // Parallel work-stealing marker (see gc_marker.h)
+    std::unique_ptr<ParallelMarker> marker;
+    
+    // Generations. The write barriers add every cell that gets a pointer
+    // stored into it to the remembered set, once per cycle (the REMEMBERED
+    // header flag). A minor cycle takes the set as extra roots, which covers
+    // every old-to-young reference created since the previous cycle.
+    std::vector<void*> rememberedSet;      // Filled by gc_remember
+    std::mutex rememberedSetMutex;
+    std::vector<void*> rememberedRoots;    // Snapshot taken at the start of the current cycle
+    bool minorCycle = false;               // Current cycle only collects young cells
+    bool fullCycleRequested = false;       // Next cycle is full (gc_collect)
+    uint64_t cycleCount = 0;
+    
+    // Pacing. The GC thread sleeps on pacerWakeup until the heap's allocation
+    // trigger fires or a collection is requested; requesters wait on cycleDone.
+    std::mutex pacerMutex;
+    std::condition_variable pacerWakeup;
+    std::condition_variable cycleDone;
+    bool collectionRequested = false;      // Guarded by pacerMutex
+    bool cycleInProgress = false;          // Guarded by pacerMutex
+    uint64_t completedCycles = 0;          // Guarded by pacerMutex
+    size_t triggerBytes = GCPacing::MIN_TRIGGER_BYTES;  // Guarded by pacerMutex
+    std::atomic<size_t> growthPercent{GCPacing::DEFAULT_GROWTH_PERCENT};
+    std::mutex cycleMutex;                 // Serializes runCycle
+    
+    // Telemetry. The phases fill cycleStats (GC thread only); runCycle folds
+    // it into stats and appends it to the trace file, if one is open.
+    GCCycleStats cycleStats;
+    GCStats stats;                         // Guarded by statsMutex
+    std::ofstream traceFile;               // Guarded by statsMutex
+    std::mutex statsMutex;
+    std::atomic<bool> verbose{false};      // Per-phase progress on stdout (TECHNOSCRIPT_GC_VERBOSE)
+    
+    // One JSON object per line, for TECHNOSCRIPT_GC_TRACE
+    void writeTraceLine(const GCCycleStats& cycle);
+    
+    // Heap snapshots on SIGUSR2, written by the GC thread between cycles to
+    // <prefix>.<pid>.<n>.heapsnapshot (TECHNOSCRIPT_HEAP_SNAPSHOT=<prefix>)
+    std::string heapSnapshotPrefix;
+    uint64_t heapSnapshotsTaken = 0;       // GC thread only
+    static std::atomic<bool> heapSnapshotSignalled;
+    static void heapSnapshotSignalHandler(int);
+    // writeHeapSnapshot without leaving managed code (GC thread)
+    std::vector<HeapSnapshot::TypeSummary> saveHeapSnapshot(const std::string& path);
+    
+    // GC state for JIT code running outside any goroutine (the main program).
+    // Its scope stack is a root set like any goroutine's.
+    GoroutineGCState mainThreadState;
     
     // GC algorithm phases
     void phase1_initialMarkSweep();
@@ -222,21 +393,48 @@ private:
     void phase3_secondMarkSweep();
     void phase4_cleanup();
     
-    // Signal-based memory fence to ensure all write barriers complete
+    // Take the handed-over barrier log entries that are unmarked suspects
+    std::vector<void*> drainSATBQueue();
+    
+    // Safepoint handshake: returns once every thread running JIT code has
+    // passed a safepoint poll, so no write barrier is still in flight
     void ensureAllWriteBarriersComplete();
     
+    // Safepoints. JIT code polls safepointPending at every function entry;
+    // a thread that sees it set acknowledges safepointRequest in its state.
+    std::atomic<uint32_t> safepointPending{0};
+    std::atomic<uint64_t> safepointRequest{0};
+    std::atomic<size_t> stackReferences{0};   // Found by the frame scans at acknowledgements
+    bool membarrierAvailable = false;      // MEMBARRIER_CMD_PRIVATE_EXPEDITED registered
+    
+    // Barrier log entries handed over by the threads' SATB buffers
+    std::vector<void*> satbQueue;
+    std::mutex satbMutex;
+    
     // Mark all goroutines for phase 2 start
     void markAllGoroutinesPhase2Start();
     void resetAllGoroutinesPhase2();
     
     // Helper methods
-    void markObject(void* obj);
-    void markScope(void* scope);
-    void traceObject(void* obj);
-    void traceScope(void* scope);
-    std::vector<void*> collectAllAllocatedObjects();
-    std::vector<void*> collectAllAllocatedScopes();
+    // Mark everything reachable from the given objects/scopes. Mark state
+    // lives in the heap's side bitmaps (see gc_heap.h).
+    void markFrom(const std::vector<void*>& cells);
     std::vector<void*> collectAllRoots();
+    // Roots of the current cycle: scope stacks, plus the remembered set in a minor cycle
+    std::vector<void*> collectCycleRoots();
+    // Swap out the remembered set and clear the REMEMBERED flags of its cells
+    void snapshotRememberedSet();
+    // Drop freed cells from the remembered set before their chunks can be released
+    void purgeRememberedSet();
+    
+    // Run one full GC cycle (phases 1-4 and promotion)
+    void runCycle(bool full);
+    // Heap allocation trigger callback: wakes the GC thread
+    static void allocationTriggered();
+    // Heap limit handler: emergency collection, then back-pressure
+    static bool heapLimitReached(size_t requestedBytes, unsigned attempt);
+    // requestCollection's work, on a stack with room for a cycle
+    void collectNow();
     
     // Main GC loop
     void gcThreadFunction();
@@ -247,31 +445,121 @@ public:
     
     void start();
     void stop();
-    void requestCollection();  // Request a GC cycle
+    // Request a full GC cycle and block until one has completed. Runs the
+    // cycle on the calling thread when the GC thread is not started, on the
+    // worker's stack if called on a goroutine's (Goroutine::runOnWorkerStack).
+    void requestCollection();
+    
+    // Collect after allocating `percent`% of the heap that survived the last
+    // cycle. Defaults to TECHNOSCRIPT_GC_GROWTH, or DEFAULT_GROWTH_PERCENT.
+    void setHeapGrowthPercent(size_t percent);
+    size_t getHeapGrowthPercent() const { return growthPercent.load(std::memory_order_relaxed); }
+    
+    // Cycles completed since startup
+    uint64_t getCompletedCycles();
+    
+    // Snapshot of the GC statistics
+    GCStats getStats();
+    
+    // Append one JSON line per cycle to `path` (empty: stop tracing).
+    // Defaults to TECHNOSCRIPT_GC_TRACE. Throws if the file can't be opened.
+    void setTraceFile(const std::string& path);
+    
+    // Write a heap snapshot of everything reachable to `path` (Chrome DevTools
+    // .heapsnapshot format) and the per-class and per-scope totals to
+    // `path`.summary (JSON lines). Waits for a running cycle and keeps the
+    // next one from starting until the walk is done; the mutators keep
+    // running. Throws if a file can't be written.
+    std::vector<HeapSnapshot::TypeSummary> writeHeapSnapshot(const std::string& path);
+    
+    // Print each phase's progress (default: TECHNOSCRIPT_GC_VERBOSE set)
+    void setVerbose(bool enabled) { verbose.store(enabled); }
+    
+    // Number of threads used for marking (including the GC thread itself).
+    // Defaults to TECHNOSCRIPT_GC_THREADS, or the hardware thread count capped at 8.
+    void setMarkerThreads(size_t numThreads);
+    size_t getMarkerThreads() const;
     
     bool isGCMode() const { return gcMode.load(std::memory_order_acquire); }
     
+    // Add a cell to the remembered set (write barrier slow path)
+    void remember(void* cell);
+    
+    // GC state of the calling thread: its goroutine's state, or the main thread state
+    GoroutineGCState* currentGCState();
+    
+    // Word the JIT safepoint poll tests (non-zero: call gc_safepoint_poll)
+    const std::atomic<uint32_t>* safepointPollWord() const { return &safepointPending; }
+    
+    // Safepoint poll slow path: scan the calling thread's JIT frames with
+    // their stack maps (see gc_stackmap.h) and acknowledge the pending
+    // request. `pc` is the poll's return address, `registers` its register
+    // save area and `framePointer` the polling function's rbp; without a
+    // frame pointer only the acknowledgement is done.
+    void acknowledgeSafepoint(const void* pc, const uint64_t* registers, const void* framePointer);
+    
+    // Hand logged barrier entries to the GC (see SATBBuffer)
+    void enqueueSATB(void* const* begin, void* const* end);
+    // Hand the calling thread's SATB buffer to the GC and reset it
+    static void flushThreadSATB();
+    // Offset of the calling thread's SATB buffer from the fs base
+    static intptr_t satbThreadOffset();
+    // Offset from the fs base of the thread's current ShadowStack pointer (the
+    // stack of the state that last entered managed code on this thread)
+    static intptr_t shadowStackThreadOffset();
+    
     // Singleton access
     static GarbageCollector& getInstance();
 };
 
 // Runtime functions callable from generated code
 extern "C" {
-    // Track object allocation (called after malloc in generated code)
-    void gc_track_object(void* obj);
-    
-    // Track scope allocation (called after scope allocation in generated code)
-    void gc_track_scope(void* scope);
-    
-    // Push/Pop scope from GC roots (called on scope entry/exit)
+    // Allocate a zeroed object / scope cell with its metadata pointer stored.
+    // Generated code bump-allocates from the thread's TLAB inline and only
+    // calls these when the TLAB is exhausted (or the cell is too large).
+    // Past the heap limit they end the goroutine (technoscript_goroutine_fail).
+    void* gc_allocate_object(size_t size, void* classMetadata);
+    void* gc_allocate_scope(size_t size, void* scopeMetadata);
+    
+    // Safepoint poll slow path (generated code calls it when the poll word is
+    // set), with the poll's register save area (StackMapLayout) and rbp
+    void gc_safepoint_poll(const uint64_t* registers, const void* framePointer);
+    
+    // Write barrier log slow path: the thread's SATB buffer is full (or not
+    // set up yet). Hands it to the GC and logs the cell.
+    void gc_satb_log(void* cell);
+    
+    // Push/Pop scope from GC roots (called on scope entry/exit). Generated
+    // code does both inline on the thread's shadow stack instead, and calls
+    // gc_push_scope only when the stack's entry array has to grow.
     void gc_push_scope(void* scope);
     void gc_pop_scope();
     
-    // NOTE: gc_handle_assignment and gc_handle_scope_assignment are now inlined
-    // directly in generated assembly code for performance. See codegen.cpp.
-    // void gc_handle_assignment(void* targetObj);
-    // void gc_handle_scope_assignment(void* targetScope);
+    // A push found the shadow stack at ShadowStackLayout::CAPACITY: ends the
+    // goroutine (technoscript_goroutine_fail)
+    [[noreturn]] void gc_shadow_stack_overflow();
+    
+    // Enter/leave a scope that escape analysis proved non-escaping. The scope
+    // lives on the goroutine's frame stack instead of the GC heap and is
+    // released on exit; it is a root while it is on the scope stack.
+    void* gc_enter_frame(size_t size, void* scopeMetadata);
+    void gc_leave_frame();
+    
+    // Write barrier slow path: generated code calls this after storing a
+    // pointer into a cell whose REMEMBERED flag is clear
+    void gc_remember(void* cell);
+    
+    // RawMemory allocation/release (new RawMemory(n) / .release()). Blocks
+    // of LARGE_OBJECT_THRESHOLD bytes and up are page-aligned mappings of
+    // their own, smaller ones come from malloc. Zeroed; never traced. Fails
+    // like gc_allocate_object.
+    void* gc_allocate_raw(size_t size);
+    void gc_release_raw(void* block);
     
     // Manual GC trigger
     void gc_collect();
+    
+    // Write a heap snapshot (see GarbageCollector::writeHeapSnapshot).
+    // Returns false, after printing why, if it could not be written.
+    bool gc_heap_snapshot(const char* path);
 }
@@ -0,0 +1,1030 @@
+#include "gc_heap.h"
+#include <iostream>
+#include <new>
+#include <algorithm>
+#include <iterator>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <cstdio>
+#include <sys/mman.h>
+
+// The calling thread's TLABs. Lives in static TLS so generated code can reach
+// it at a fixed offset from the fs base (see GCHeap::tlabThreadOffset).
+static thread_local ThreadAllocationBuffers threadTLABs;
+
+HeapChunk::HeapChunk(HeapSpace s, uint32_t units, uint32_t sizeClass)
+    : space(s), numUnits(units), sizeClass(sizeClass),
+      cellSize(sizeClass == HeapLayout::NO_SIZE_CLASS ? 0 : HeapLayout::SIZE_CLASSES[sizeClass]) {
+    top = cellAreaStart();
+    limit = reinterpret_cast<uint8_t*>(this) + units * HeapLayout::CHUNK_SIZE;
+    for (size_t i = 0; i < HeapLayout::BITMAP_WORDS; i++) {
+        startBits[i].store(0, std::memory_order_relaxed);
+        markBits[i].store(0, std::memory_order_relaxed);
+        oldBits[i].store(0, std::memory_order_relaxed);
+        tenureBits[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+GCHeap::GCHeap() {
+    // Reserve (but do not commit) the whole heap range. Over-reserve by one
+    // chunk so the start can be aligned to CHUNK_SIZE.
+    size_t bytes = HeapLayout::RESERVATION_SIZE + HeapLayout::CHUNK_SIZE;
+    void* base = mmap(nullptr, bytes, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (base == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+
+    uintptr_t aligned = (reinterpret_cast<uintptr_t>(base) + HeapLayout::CHUNK_SIZE - 1)
+                        & ~(HeapLayout::CHUNK_SIZE - 1);
+    reservationStart = reinterpret_cast<uint8_t*>(aligned);
+    reservationEnd = reservationStart + HeapLayout::RESERVATION_SIZE;
+    reservationTop = reservationStart;
+
+    hugePageAdvice = std::getenv("TECHNOSCRIPT_GC_HUGEPAGES") != nullptr;
+
+    // TECHNOSCRIPT_HEAP_LIMIT=<bytes>, with an optional k/m/g suffix
+    if (const char* env = std::getenv("TECHNOSCRIPT_HEAP_LIMIT")) {
+        char* suffix = nullptr;
+        unsigned long long bytes = std::strtoull(env, &suffix, 10);
+        switch (*suffix) {
+            case 'g': case 'G': bytes <<= 10; [[fallthrough]];
+            case 'm': case 'M': bytes <<= 10; [[fallthrough]];
+            case 'k': case 'K': bytes <<= 10; break;
+            default: break;
+        }
+        if (bytes > 0) {
+            heapLimit.store(static_cast<size_t>(bytes), std::memory_order_relaxed);
+        }
+    }
+
+    if (const char* env = std::getenv("TECHNOSCRIPT_GC_DEFRAG")) {
+        long percent = std::strtol(env, nullptr, 10);
+        defragThreshold.store(percent > 0 ? static_cast<size_t>(percent) : HeapDefrag::DEFAULT_THRESHOLD_PERCENT,
+                              std::memory_order_relaxed);
+    }
+}
+
+GCHeap::~GCHeap() {
+    // The reservation is process-lifetime; the OS reclaims it on exit.
+}
+
+GCHeap& GCHeap::getInstance() {
+    static GCHeap instance;
+    return instance;
+}
+
+OutOfMemoryError::OutOfMemoryError(size_t requestedBytes, size_t limitBytes)
+    : requested(requestedBytes), limit(limitBytes) {
+    std::snprintf(message, sizeof(message), "Out of memory: %zu more bytes would exceed the %zu byte heap limit",
+                  requestedBytes, limitBytes);
+}
+
+void GCHeap::commitWithinLimit(size_t bytes) {
+    size_t limit = heapLimit.load(std::memory_order_relaxed);
+    if (committed + bytes > limit && pendingSweepChunks.load(std::memory_order_relaxed) != 0) {
+        // Empty chunks may still be waiting for the sweeper
+        sweepPendingLocked(SIZE_MAX);
+    }
+    if (committed + bytes > limit) {
+        // Space held back in draining chunks is better than failing
+        stopDrainingLocked();
+    }
+    if (committed + bytes > limit) {
+        throw OutOfMemoryError(bytes, limit);
+    }
+    committed += bytes;
+}
+
+template <typename Allocate>
+auto GCHeap::retryAtHeapLimit(Allocate allocate) -> decltype(allocate()) {
+    // The handler collects, and so needs the heap lock free
+    for (unsigned attempt = 0;; attempt++) {
+        try {
+            return allocate();
+        } catch (const OutOfMemoryError& e) {
+            HeapLimitHandler handler = heapLimitHandler.load(std::memory_order_acquire);
+            if (!handler || !handler(e.requestedBytes(), attempt)) {
+                throw;
+            }
+        }
+    }
+}
+
+void GCHeap::setHeapLimit(size_t bytes) {
+    heapLimit.store(bytes, std::memory_order_relaxed);
+}
+
+void GCHeap::setHeapLimitHandler(HeapLimitHandler handler) {
+    heapLimitHandler.store(handler, std::memory_order_release);
+}
+
+size_t GCHeap::committedBytes() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return committed;
+}
+
+HeapChunk* GCHeap::acquireChunk(HeapSpace space, size_t numUnits, uint32_t sizeClass) {
+    uint8_t* base = nullptr;
+    size_t bytes = numUnits * HeapLayout::CHUNK_SIZE;
+    commitWithinLimit(bytes);
+
+    // Single-unit chunks prefer recycled units; multi-unit runs must be contiguous
+    if (numUnits == 1 && !freeUnits.empty()) {
+        base = freeUnits.back();
+        freeUnits.pop_back();
+    } else {
+        if (reservationTop + bytes > reservationEnd) {
+            committed -= bytes;
+            throw std::bad_alloc();
+        }
+        base = reservationTop;
+        reservationTop += bytes;
+    }
+
+    // Commit the chunk. Fresh and recycled (MADV_DONTNEED) pages read as zero,
+    // so cells handed out by bump allocation are already zero-initialized
+    // (reused free runs are cleared when they are handed out).
+    if (mprotect(base, bytes, PROT_READ | PROT_WRITE) != 0) {
+        committed -= bytes;
+        if (numUnits == 1) {
+            freeUnits.push_back(base);
+        }
+        throw std::bad_alloc();
+    }
+
+    HeapChunk* chunk = new (base) HeapChunk(space, static_cast<uint32_t>(numUnits), sizeClass);
+    chunks.push_back(chunk);
+    return chunk;
+}
+
+void GCHeap::releaseChunk(HeapChunk* chunk) {
+    uint8_t* base = reinterpret_cast<uint8_t*>(chunk);
+    size_t numUnits = chunk->numUnits;
+    size_t bytes = numUnits * HeapLayout::CHUNK_SIZE;
+
+    if (chunk->draining) {
+        drainingChunks--;
+    }
+
+    if (chunk->largeObject) {
+        largeObjectBytes -= chunk->limit - base;
+        committed -= chunk->limit - base;
+        chunk->~HeapChunk();
+        releaseLargeRange(base, bytes);
+        return;
+    }
+
+    chunk->~HeapChunk();
+    committed -= bytes;
+
+    // Drop the physical pages and make the range inaccessible until reused
+    madvise(base, bytes, MADV_DONTNEED);
+    mprotect(base, bytes, PROT_NONE);
+
+    for (size_t i = 0; i < numUnits; i++) {
+        freeUnits.push_back(base + i * HeapLayout::CHUNK_SIZE);
+    }
+}
+
+HeapChunk* GCHeap::chunkWithRoom(HeapSpace space, size_t cellSize) {
+    // Large cells get a mapping of their own; keep bumping in the current chunk
+    if (cellSize > HeapLayout::LARGE_OBJECT_THRESHOLD) {
+        return acquireLargeChunk(space, cellSize);
+    }
+
+    size_t spaceIndex = static_cast<size_t>(space);
+    HeapChunk* chunk = currentChunk[spaceIndex];
+    if (chunk && chunk->top + cellSize <= chunk->limit) {
+        return chunk;
+    }
+
+    chunk = acquireChunk(space, 1, HeapLayout::NO_SIZE_CLASS);
+    currentChunk[spaceIndex] = chunk;
+    return chunk;
+}
+
+size_t GCHeap::largeCellOffset() {
+    return HeapLayout::roundToPage(sizeof(HeapChunk));
+}
+
+uint8_t* GCHeap::reserveLargeRange(size_t bytes) {
+    // First fit among released ranges; there are few of them, one per dead
+    // large cell at most, and neighbours are merged on release
+    for (auto it = largeFreeRanges.begin(); it != largeFreeRanges.end(); ++it) {
+        if (it->second < bytes) {
+            continue;
+        }
+        uint8_t* base = it->first;
+        size_t rest = it->second - bytes;
+        largeFreeRanges.erase(it);
+        if (rest > 0) {
+            largeFreeRanges.emplace(base + bytes, rest);
+        }
+        return base;
+    }
+
+    if (reservationTop + bytes > reservationEnd) {
+        throw std::bad_alloc();
+    }
+    uint8_t* base = reservationTop;
+    reservationTop += bytes;
+    return base;
+}
+
+void GCHeap::releaseLargeRange(uint8_t* base, size_t bytes) {
+    // Replacing the mapping (rather than madvise) also drops the VMA and its
+    // huge page advice; the range stays reserved
+    if (mmap(base, bytes, PROT_NONE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) == MAP_FAILED) {
+        std::cerr << "GCHeap: failed to unmap large object range" << std::endl;
+    }
+
+    auto next = largeFreeRanges.lower_bound(base);
+    if (next != largeFreeRanges.end() && base + bytes == next->first) {
+        bytes += next->second;
+        next = largeFreeRanges.erase(next);
+    }
+    if (next != largeFreeRanges.begin()) {
+        auto prev = std::prev(next);
+        if (prev->first + prev->second == base) {
+            prev->second += bytes;
+            return;
+        }
+    }
+    largeFreeRanges.emplace(base, bytes);
+}
+
+HeapChunk* GCHeap::acquireLargeChunk(HeapSpace space, size_t cellSize) {
+    size_t mappedBytes = HeapLayout::roundToPage(largeCellOffset() + cellSize);
+    size_t reservedBytes = (mappedBytes + HeapLayout::CHUNK_SIZE - 1) & ~(HeapLayout::CHUNK_SIZE - 1);
+    commitWithinLimit(mappedBytes);
+    uint8_t* base;
+    try {
+        base = reserveLargeRange(reservedBytes);
+    } catch (...) {
+        committed -= mappedBytes;
+        throw;
+    }
+
+    // A private mapping of just header + cell; fresh anonymous pages read as zero
+    if (mmap(base, mappedBytes, PROT_READ | PROT_WRITE, MAP_FIXED | MAP_PRIVATE | MAP_ANONYMOUS, -1, 0) == MAP_FAILED) {
+        committed -= mappedBytes;
+        releaseLargeRange(base, reservedBytes);
+        throw std::bad_alloc();
+    }
+    adviseHugePages(base, mappedBytes);
+
+    HeapChunk* chunk = new (base) HeapChunk(space, static_cast<uint32_t>(reservedBytes / HeapLayout::CHUNK_SIZE),
+                                            HeapLayout::NO_SIZE_CLASS);
+    chunk->largeObject = true;
+    chunk->top = base + largeCellOffset();
+    chunk->limit = base + mappedBytes;
+    largeObjectBytes += mappedBytes;
+    chunks.push_back(chunk);
+    return chunk;
+}
+
+void GCHeap::adviseHugePages(void* base, size_t bytes) {
+    // Advice only: the kernel backs the 2 MB-aligned parts of the range with
+    // huge pages when THP is in "madvise" or "always" mode
+    if (hugePageAdvice && bytes >= HeapLayout::HUGE_PAGE_SIZE) {
+        madvise(base, bytes, MADV_HUGEPAGE);
+    }
+}
+
+void* GCHeap::allocateRaw(size_t size) {
+    size_t bytes = HeapLayout::roundToPage(size == 0 ? 1 : size);
+    // Count the block against the heap limit before mapping it
+    bool huge = retryAtHeapLimit([&] {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        commitWithinLimit(bytes);
+        return hugePageAdvice && bytes >= HeapLayout::HUGE_PAGE_SIZE;
+    });
+
+    // Huge-page candidates are over-mapped so the block can start on a huge
+    // page boundary, then trimmed
+    size_t mapBytes = huge ? bytes + HeapLayout::HUGE_PAGE_SIZE : bytes;
+    void* mapping = mmap(nullptr, mapBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        committed -= bytes;
+        throw std::bad_alloc();
+    }
+
+    uint8_t* block = static_cast<uint8_t*>(mapping);
+    if (huge) {
+        uint8_t* aligned = reinterpret_cast<uint8_t*>(
+            (reinterpret_cast<uintptr_t>(block) + HeapLayout::HUGE_PAGE_SIZE - 1) & ~(HeapLayout::HUGE_PAGE_SIZE - 1));
+        if (aligned > block) {
+            munmap(block, aligned - block);
+        }
+        size_t tail = (block + mapBytes) - (aligned + bytes);
+        if (tail > 0) {
+            munmap(aligned + bytes, tail);
+        }
+        block = aligned;
+        madvise(block, bytes, MADV_HUGEPAGE);
+    }
+
+    std::lock_guard<std::mutex> lock(heapMutex);
+    rawBlocks.emplace(block, bytes);
+    rawBlockBytes += bytes;
+    return block;
+}
+
+bool GCHeap::releaseRaw(void* block) {
+    size_t bytes;
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        auto it = rawBlocks.find(block);
+        if (it == rawBlocks.end()) {
+            return false;
+        }
+        bytes = it->second;
+        rawBlocks.erase(it);
+        rawBlockBytes -= bytes;
+        committed -= bytes;
+    }
+    munmap(block, bytes);
+    return true;
+}
+
+void GCHeap::setHugePageAdvice(bool enabled) {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    hugePageAdvice = enabled;
+}
+
+size_t GCHeap::largeObjectSpaceBytes() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return largeObjectBytes;
+}
+
+size_t GCHeap::rawMemoryBytes() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return rawBlockBytes;
+}
+
+void GCHeap::publishCell(void* cell) {
+    HeapChunk* chunk = HeapChunk::fromAddress(cell);
+    size_t index = chunk->granuleIndex(cell);
+    uint64_t mask = 1ULL << (index & 63);
+
+    // Publish the mark bit before the start bit: a concurrent bitmap scan that
+    // sees the start bit is then guaranteed to also see the mark bit
+    if (allocateBlack) {
+        chunk->markBits[index >> 6].fetch_or(mask, std::memory_order_relaxed);
+    }
+    chunk->startBits[index >> 6].fetch_or(mask, std::memory_order_release);
+    chunk->liveCells.fetch_add(1, std::memory_order_relaxed);
+}
+
+void* GCHeap::allocate(HeapSpace space, size_t size) {
+    size_t cellSize = HeapLayout::roundToGranule(size == 0 ? 1 : size);
+
+    void* cell = retryAtHeapLimit([&] {
+        std::lock_guard<std::mutex> lock(heapMutex);
+
+        HeapChunk* chunk = chunkWithRoom(space, cellSize);
+        void* bumped = chunk->top;
+        chunk->top += cellSize;
+
+        publishCell(bumped);
+        return bumped;
+    });
+
+    if (countAllocation(cellSize)) {
+        callAllocationTrigger();
+    }
+    return cell;
+}
+
+void* GCHeap::allocateInTLAB(HeapSpace space, size_t size, void* metadata, const void* site) {
+    size_t cellSize = HeapLayout::roundToGranule(size == 0 ? 1 : size);
+    uint32_t sizeClass = HeapLayout::sizeClassFor(cellSize);
+    ThreadAllocationBuffers& buffers = threadTLABs;
+
+    if (sizeClass == HeapLayout::NO_SIZE_CLASS) {
+        // Too big for a size class - straight from the shared mixed chunk
+        uint8_t* cell = static_cast<uint8_t*>(allocate(space, cellSize));
+        *reinterpret_cast<void**>(cell + HeapLayout::metadataOffset(space)) = metadata;
+        if (sampleMeanBytes.load(std::memory_order_relaxed)) {
+            buffers.untlabbedUntilSample -= static_cast<int64_t>(cellSize);
+            if (buffers.untlabbedUntilSample < 0) {
+                buffers.untlabbedUntilSample = static_cast<int64_t>(nextSampleDistance(buffers));
+                recordSample(site, space, metadata, cellSize);
+            }
+        }
+        return cell;
+    }
+
+    TLAB& tlab = buffers.tlabs[static_cast<size_t>(space)][sizeClass];
+    size_t classSize = HeapLayout::SIZE_CLASSES[sizeClass];
+
+    uint8_t* cell = tlab.top.load(std::memory_order_relaxed);
+    bool sampled = false;
+    if (!cell || cell + classSize > tlab.end) {
+        retryAtHeapLimit([&] {
+            std::lock_guard<std::mutex> lock(heapMutex);
+
+            if (!buffers.registered) {
+                tlabOwners.push_back(&buffers);
+                buffers.registered = true;
+            }
+
+            // Retire the exhausted buffer (its unused tail is picked up by the
+            // next sweep) and take a new one
+            retireTLAB(tlab);
+            refillTLAB(space, sizeClass, tlab);
+            cell = tlab.top.load(std::memory_order_relaxed);
+        });
+
+        if (countAllocation(tlab.end - cell)) {
+            callAllocationTrigger();
+        }
+        tlab.limit = sampleLimit(buffers, tlab, cell);
+    } else if (cell + classSize > tlab.limit) {
+        // Room left, but this cell crosses the sample point (or sampling was
+        // turned off since the limit was set)
+        sampled = tlab.limit != tlab.end && sampleMeanBytes.load(std::memory_order_relaxed) != 0;
+        tlab.limit = sampleLimit(buffers, tlab, cell + classSize);
+    }
+
+    // Same order as the inline sequence: header first, then publish the new top
+    *reinterpret_cast<void**>(cell + HeapLayout::metadataOffset(space)) = metadata;
+    tlab.top.store(cell + classSize, std::memory_order_release);
+    if (sampled) {
+        recordSample(site, space, metadata, classSize);
+    }
+    return cell;
+}
+
+size_t GCHeap::nextSampleDistance(ThreadAllocationBuffers& buffers) {
+    size_t mean = sampleMeanBytes.load(std::memory_order_relaxed);
+    if (buffers.sampleRng == 0) {
+        buffers.sampleRng = reinterpret_cast<uintptr_t>(&buffers) | 1;
+    }
+    // xorshift64, then -mean * ln(u) for u uniform in (0, 1]
+    uint64_t x = buffers.sampleRng;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    buffers.sampleRng = x;
+    double u = (static_cast<double>(x >> 11) + 1.0) / 9007199254740992.0;
+    return static_cast<size_t>(-std::log(u) * static_cast<double>(mean)) + 1;
+}
+
+uint8_t* GCHeap::sampleLimit(ThreadAllocationBuffers& buffers, TLAB& tlab, uint8_t* from) {
+    if (!sampleMeanBytes.load(std::memory_order_relaxed)) {
+        return tlab.end;
+    }
+    size_t distance = nextSampleDistance(buffers);
+    return static_cast<size_t>(tlab.end - from) > distance ? from + distance : tlab.end;
+}
+
+void GCHeap::recordSample(const void* site, HeapSpace space, void* metadata, size_t cellSize) {
+    AllocationSampleCallback callback = sampleCallback.load(std::memory_order_acquire);
+    size_t mean = sampleMeanBytes.load(std::memory_order_relaxed);
+    if (!callback || !mean) {
+        return;
+    }
+    // A cell of size s is caught with probability 1 - exp(-s/mean), so it
+    // stands for s / (1 - exp(-s/mean)) bytes (about mean for small cells)
+    double probability = 1.0 - std::exp(-static_cast<double>(cellSize) / static_cast<double>(mean));
+    size_t weight = static_cast<size_t>(static_cast<double>(cellSize) / probability);
+    callback(site, space, metadata, cellSize, weight);
+}
+
+void GCHeap::setAllocationSampling(size_t meanBytes, AllocationSampleCallback callback) {
+    sampleCallback.store(callback, std::memory_order_release);
+    sampleMeanBytes.store(meanBytes, std::memory_order_relaxed);
+}
+
+void GCHeap::refillTLAB(HeapSpace space, uint32_t sizeClass, TLAB& tlab) {
+    size_t cellSize = HeapLayout::SIZE_CLASSES[sizeClass];
+    size_t maxBytes = std::max(cellSize, HeapLayout::TLAB_SIZE / cellSize * cellSize);
+    SizeClassState& state = sizeClasses[static_cast<size_t>(space)][sizeClass];
+
+    HeapChunk* chunk = nullptr;
+    uint8_t* start = nullptr;
+    size_t bytes = 0;
+
+    // Sweep the class's chunks left from the last collection until one
+    // yields free cells
+    while (state.freeRuns.empty() && !state.unswept.empty()) {
+        HeapChunk* unswept = state.unswept.back();
+        state.unswept.pop_back();
+        sweepChunkLocked(unswept, false);
+    }
+
+    if (!state.freeRuns.empty()) {
+        // Reuse swept cells first. They still hold their old contents.
+        FreeRun& run = state.freeRuns.back();
+        start = run.start;
+        bytes = std::min<size_t>(maxBytes, run.end - run.start);
+        run.start += bytes;
+        if (run.start == run.end) {
+            state.freeRuns.pop_back();
+        }
+        std::memset(start, 0, bytes);
+        chunk = HeapChunk::fromAddress(start);
+    } else {
+        // Carve from the untouched tail of the size class's chunk
+        chunk = state.bumpChunk;
+        if (!chunk || chunk->top + cellSize > chunk->limit) {
+            chunk = acquireChunk(space, 1, sizeClass);
+            state.bumpChunk = chunk;
+        }
+        start = chunk->top;
+        bytes = std::min<size_t>(maxBytes, (chunk->limit - chunk->top) / cellSize * cellSize);
+        chunk->top += bytes;
+    }
+
+    chunk->activeTLABs++;
+    tlab.chunk = chunk;
+    tlab.scanned = start;
+    tlab.end = start + bytes;
+    tlab.limit = tlab.end;  // Lowered to the sample point by the caller
+    tlab.top.store(start, std::memory_order_relaxed);
+}
+
+void GCHeap::flushTLAB(TLAB& tlab, uint8_t* upTo) {
+    size_t cellSize = tlab.chunk->cellSize;
+    uint8_t* p = tlab.scanned;
+    while (p < upTo) {
+        publishCell(p);
+        p += cellSize;
+    }
+    tlab.scanned = p;
+}
+
+void GCHeap::retireTLAB(TLAB& tlab) {
+    if (!tlab.chunk) {
+        return;
+    }
+    flushTLAB(tlab, tlab.top.load(std::memory_order_relaxed));
+    tlab.chunk->activeTLABs--;
+
+    tlab.chunk = nullptr;
+    tlab.scanned = nullptr;
+    tlab.limit = nullptr;
+    tlab.end = nullptr;
+    tlab.top.store(nullptr, std::memory_order_relaxed);
+}
+
+void GCHeap::flushTLABs() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (ThreadAllocationBuffers* owner : tlabOwners) {
+        for (auto& spaceTLABs : owner->tlabs) {
+            for (TLAB& tlab : spaceTLABs) {
+                if (tlab.chunk) {
+                    flushTLAB(tlab, tlab.top.load(std::memory_order_acquire));
+                }
+            }
+        }
+    }
+}
+
+intptr_t GCHeap::tlabThreadOffset(HeapSpace space, uint32_t sizeClass) {
+    TLAB* tlab = &threadTLABs.tlabs[static_cast<size_t>(space)][sizeClass];
+    return reinterpret_cast<intptr_t>(tlab) - reinterpret_cast<intptr_t>(__builtin_thread_pointer());
+}
+
+ThreadAllocationBuffers::~ThreadAllocationBuffers() {
+    if (!registered) {
+        return;
+    }
+
+    GCHeap& heap = GCHeap::getInstance();
+    std::lock_guard<std::mutex> lock(heap.heapMutex);
+    for (auto& spaceTLABs : tlabs) {
+        for (TLAB& tlab : spaceTLABs) {
+            heap.retireTLAB(tlab);
+        }
+    }
+    heap.tlabOwners.erase(std::remove(heap.tlabOwners.begin(), heap.tlabOwners.end(), this),
+                          heap.tlabOwners.end());
+}
+
+void GCHeap::beginMarking() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (HeapChunk* chunk : chunks) {
+        chunk->clearMarkBits();
+    }
+    allocateBlack = true;
+}
+
+void GCHeap::finishMarking() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    allocateBlack = false;
+}
+
+void GCHeap::clearMarkBits() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (HeapChunk* chunk : chunks) {
+        chunk->clearMarkBits();
+    }
+}
+
+void GCHeap::collectUnmarked(HeapSpace space, std::vector<void*>& out, bool youngOnly) {
+    std::vector<HeapChunk*> snapshot;
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        snapshot = chunks;
+    }
+
+    for (HeapChunk* chunk : snapshot) {
+        if (chunk->space != space) {
+            continue;
+        }
+
+        for (size_t word = 0; word < HeapLayout::BITMAP_WORDS; word++) {
+            uint64_t allocated = chunk->startBits[word].load(std::memory_order_acquire);
+            uint64_t unmarked = allocated & ~chunk->markBits[word].load(std::memory_order_acquire);
+            if (youngOnly) {
+                unmarked &= ~chunk->oldBits[word].load(std::memory_order_relaxed);
+            }
+
+            while (unmarked) {
+                int bit = __builtin_ctzll(unmarked);
+                out.push_back(chunk->cellAtGranule(word * 64 + bit));
+                unmarked &= unmarked - 1;
+            }
+        }
+    }
+}
+
+size_t GCHeap::cellSize(const void* cell) const {
+    HeapChunk* chunk = HeapChunk::fromAddress(cell);
+    if (chunk->cellSize != 0) {
+        return chunk->cellSize;
+    }
+
+    // A large-object chunk holds a single cell
+    if (chunk->largeObject) {
+        return chunk->top - static_cast<const uint8_t*>(cell);
+    }
+
+    // Mixed chunk: cells are packed, so the next start bit ends this one
+    size_t index = chunk->granuleIndex(cell) + 1;
+    size_t end = chunk->granuleIndex(chunk->top);
+    while (index < end) {
+        uint64_t bits = chunk->startBits[index >> 6].load(std::memory_order_acquire) >> (index & 63);
+        if (bits) {
+            index += __builtin_ctzll(bits);
+            break;
+        }
+        index = (index | 63) + 1;
+    }
+    return (std::min(index, end) - chunk->granuleIndex(cell)) * HeapLayout::GRANULE_SIZE;
+}
+
+void GCHeap::freeCell(void* cell) {
+    HeapChunk* chunk = HeapChunk::fromAddress(cell);
+    size_t index = chunk->granuleIndex(cell);
+    uint64_t mask = 1ULL << (index & 63);
+
+    uint64_t old = chunk->startBits[index >> 6].fetch_and(~mask, std::memory_order_acq_rel);
+    if (old & mask) {
+        chunk->markBits[index >> 6].fetch_and(~mask, std::memory_order_relaxed);
+        chunk->oldBits[index >> 6].fetch_and(~mask, std::memory_order_relaxed);
+        chunk->tenureBits[index >> 6].fetch_and(~mask, std::memory_order_relaxed);
+        chunk->liveCells.fetch_sub(1, std::memory_order_relaxed);
+    }
+}
+
+void GCHeap::beginTenuring() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (HeapChunk* chunk : chunks) {
+        for (size_t word = 0; word < HeapLayout::BITMAP_WORDS; word++) {
+            chunk->tenureBits[word].store(chunk->startBits[word].load(std::memory_order_acquire),
+                                          std::memory_order_relaxed);
+        }
+    }
+}
+
+void GCHeap::promoteSurvivors() {
+    // Dead cells already lost their tenure bits in freeCell(), so whatever is
+    // left survived the cycle
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (HeapChunk* chunk : chunks) {
+        for (size_t word = 0; word < HeapLayout::BITMAP_WORDS; word++) {
+            uint64_t survivors = chunk->tenureBits[word].exchange(0, std::memory_order_relaxed) &
+                                 chunk->startBits[word].load(std::memory_order_acquire);
+            if (survivors) {
+                chunk->oldBits[word].fetch_or(survivors, std::memory_order_relaxed);
+            }
+        }
+    }
+}
+
+size_t GCHeap::oldCellCount() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    size_t count = 0;
+    for (HeapChunk* chunk : chunks) {
+        for (size_t word = 0; word < HeapLayout::BITMAP_WORDS; word++) {
+            count += __builtin_popcountll(chunk->oldBits[word].load(std::memory_order_relaxed));
+        }
+    }
+    return count;
+}
+
+bool GCHeap::isReleasable(HeapChunk* chunk) {
+    if (chunk->liveCells.load(std::memory_order_acquire) != 0) {
+        return false;
+    }
+    size_t spaceIndex = static_cast<size_t>(chunk->space);
+    if (chunk == currentChunk[spaceIndex]) {
+        return false; // Still bump-allocating into it
+    }
+    if (chunk->sizeClass != HeapLayout::NO_SIZE_CLASS &&
+        chunk == sizeClasses[spaceIndex][chunk->sizeClass].bumpChunk) {
+        return false; // New TLABs are still carved from it
+    }
+    if (chunk->activeTLABs != 0) {
+        return false; // A thread may still allocate into its TLAB here
+    }
+    return true;
+}
+
+size_t GCHeap::reclaimableBytes(HeapChunk* chunk) {
+    if (isReleasable(chunk)) {
+        return chunk->largeObject ? chunk->limit - reinterpret_cast<uint8_t*>(chunk)
+                                  : chunk->numUnits * HeapLayout::CHUNK_SIZE;
+    }
+    if (chunk->sizeClass == HeapLayout::NO_SIZE_CLASS || chunk->activeTLABs != 0) {
+        return 0;
+    }
+    // Every cell below the bump top without a start bit ends up in a free run
+    size_t cells = (chunk->top - chunk->cellAreaStart()) / chunk->cellSize;
+    return (cells - chunk->liveCells.load(std::memory_order_acquire)) * chunk->cellSize;
+}
+
+void GCHeap::beginSweepLocked() {
+    // Free runs and queues are rebuilt from scratch; runs left over from the
+    // last sweep may point into chunks released since
+    for (auto& spaceClasses : sizeClasses) {
+        for (SizeClassState& state : spaceClasses) {
+            state.freeRuns.clear();
+            state.unswept.clear();
+        }
+    }
+    unsweptMixed.clear();
+    pendingSweepBytes = 0;
+    drainingFreeBytes = 0;
+
+    // Dead large cells go at once: one unmap each, for the most memory
+    auto it = std::remove_if(chunks.begin(), chunks.end(), [this](HeapChunk* chunk) {
+        if (chunk->largeObject && isReleasable(chunk)) {
+            releaseChunk(chunk);
+            return true;
+        }
+        return false;
+    });
+    chunks.erase(it, chunks.end());
+
+    planDefragmentationLocked();
+
+    // Everything else is queued. Mixed chunks only need sweeping once empty.
+    size_t queued = 0;
+    for (HeapChunk* chunk : chunks) {
+        if (chunk->sizeClass != HeapLayout::NO_SIZE_CLASS) {
+            sizeClasses[static_cast<size_t>(chunk->space)][chunk->sizeClass].unswept.push_back(chunk);
+        } else if (isReleasable(chunk)) {
+            unsweptMixed.push_back(chunk);
+        } else {
+            continue;
+        }
+        chunk->unsweptFreeBytes = reclaimableBytes(chunk);
+        pendingSweepBytes += chunk->unsweptFreeBytes;
+        queued++;
+    }
+    pendingSweepChunks.store(queued, std::memory_order_relaxed);
+}
+
+bool GCHeap::sweepChunkLocked(HeapChunk* chunk, bool release) {
+    pendingSweepBytes -= chunk->unsweptFreeBytes;
+    chunk->unsweptFreeBytes = 0;
+    pendingSweepChunks.fetch_sub(1, std::memory_order_relaxed);
+
+    if (release && isReleasable(chunk)) {
+        releaseChunk(chunk);
+        return true;
+    }
+    if (chunk->sizeClass == HeapLayout::NO_SIZE_CLASS || chunk->activeTLABs != 0) {
+        return false; // Left for the next sweep
+    }
+
+    // Every run of cells without a start bit below the chunk's bump top is
+    // free (dead cells and tails of retired TLABs alike). A draining chunk's
+    // runs are not reused: their pages go back to the OS instead.
+    SizeClassState& state = sizeClasses[static_cast<size_t>(chunk->space)][chunk->sizeClass];
+    auto addRun = [&](uint8_t* start, uint8_t* end) {
+        if (chunk->draining) {
+            drainingFreeBytes += end - start;
+            purgeRun(start, end);
+        } else {
+            state.freeRuns.push_back({start, end});
+        }
+    };
+    size_t cellSize = chunk->cellSize;
+    uint8_t* runStart = nullptr;
+    uint8_t* p = chunk->cellAreaStart();
+    for (; p + cellSize <= chunk->top; p += cellSize) {
+        if (chunk->isAllocated(p)) {
+            if (runStart) {
+                addRun(runStart, p);
+                runStart = nullptr;
+            }
+        } else if (!runStart) {
+            runStart = p;
+        }
+    }
+    if (runStart) {
+        addRun(runStart, p);
+    }
+    return false;
+}
+
+bool GCHeap::isDefragCandidate(HeapChunk* chunk) {
+    return chunk->sizeClass != HeapLayout::NO_SIZE_CLASS && chunk->activeTLABs == 0 &&
+           chunk != sizeClasses[static_cast<size_t>(chunk->space)][chunk->sizeClass].bumpChunk &&
+           chunk->liveCells.load(std::memory_order_acquire) != 0;
+}
+
+void GCHeap::planDefragmentationLocked() {
+    // Fragmentation: the free share of the cell area the size-class chunks
+    // have used so far. Empty chunks don't count - the sweep releases them.
+    size_t usedBytes = 0;
+    size_t liveBytes = 0;
+    for (HeapChunk* chunk : chunks) {
+        if (isDefragCandidate(chunk)) {
+            usedBytes += chunk->top - chunk->cellAreaStart();
+            liveBytes += chunk->liveCells.load(std::memory_order_relaxed) * chunk->cellSize;
+        }
+    }
+    fragmentation = usedBytes ? 100.0 * static_cast<double>(usedBytes - liveBytes) / static_cast<double>(usedBytes) : 0;
+
+    size_t threshold = defragThreshold.load(std::memory_order_relaxed);
+    bool drain = threshold != 0 && fragmentation >= static_cast<double>(threshold);
+    drainingChunks = 0;
+    for (HeapChunk* chunk : chunks) {
+        chunk->draining = false;
+        if (drain && isDefragCandidate(chunk)) {
+            size_t chunkLive = chunk->liveCells.load(std::memory_order_relaxed) * chunk->cellSize;
+            size_t chunkUsed = chunk->top - chunk->cellAreaStart();
+            chunk->draining = chunkLive * 100 < chunkUsed * HeapDefrag::SPARSE_PERCENT;
+            drainingChunks += chunk->draining ? 1 : 0;
+        }
+    }
+}
+
+void GCHeap::stopDrainingLocked() {
+    if (drainingChunks == 0) {
+        return;
+    }
+    for (HeapChunk* chunk : chunks) {
+        chunk->draining = false;
+    }
+    drainingChunks = 0;
+    // Nothing is draining any more; the runs counted here are picked up as
+    // ordinary free runs by the next sweep
+    drainingFreeBytes = 0;
+}
+
+void GCHeap::purgeRun(uint8_t* start, uint8_t* end) {
+    // Only whole pages; the cells around them may share a page with live ones.
+    // The pages stay mapped and read as zero when touched again.
+    uint8_t* first = reinterpret_cast<uint8_t*>(HeapLayout::roundToPage(reinterpret_cast<uintptr_t>(start)));
+    uint8_t* last = reinterpret_cast<uint8_t*>(reinterpret_cast<uintptr_t>(end) & ~(HeapLayout::PAGE_SIZE - 1));
+    if (last > first) {
+        madvise(first, last - first, MADV_DONTNEED);
+        purgedBytes += last - first;
+    }
+}
+
+void GCHeap::setDefragmentation(size_t thresholdPercent) {
+    defragThreshold.store(thresholdPercent, std::memory_order_relaxed);
+}
+
+double GCHeap::fragmentationPercent() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return fragmentation;
+}
+
+size_t GCHeap::drainingChunkCount() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return drainingChunks;
+}
+
+size_t GCHeap::purgedBytesTotal() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return purgedBytes;
+}
+
+bool GCHeap::sweepPendingLocked(size_t maxChunks) {
+    std::vector<HeapChunk*> released;
+    auto sweepFrom = [&](std::vector<HeapChunk*>& queue) {
+        while (maxChunks > 0 && !queue.empty()) {
+            HeapChunk* chunk = queue.back();
+            queue.pop_back();
+            maxChunks--;
+            if (sweepChunkLocked(chunk, true)) {
+                released.push_back(chunk);
+            }
+        }
+    };
+    sweepFrom(unsweptMixed);
+    for (auto& spaceClasses : sizeClasses) {
+        for (SizeClassState& state : spaceClasses) {
+            sweepFrom(state.unswept);
+        }
+    }
+
+    if (!released.empty()) {
+        std::sort(released.begin(), released.end());
+        auto it = std::remove_if(chunks.begin(), chunks.end(), [&](HeapChunk* chunk) {
+            return std::binary_search(released.begin(), released.end(), chunk);
+        });
+        chunks.erase(it, chunks.end());
+    }
+    return pendingSweepChunks.load(std::memory_order_relaxed) != 0;
+}
+
+void GCHeap::beginSweep() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    beginSweepLocked();
+}
+
+bool GCHeap::sweepPending(size_t maxChunks) {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return sweepPendingLocked(maxChunks);
+}
+
+void GCHeap::sweep() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    beginSweepLocked();
+    sweepPendingLocked(SIZE_MAX);
+}
+
+bool GCHeap::countAllocation(size_t bytes) {
+    size_t before = allocatedSinceCycle.fetch_add(bytes, std::memory_order_relaxed);
+    size_t trigger = allocationTriggerBytes.load(std::memory_order_relaxed);
+    return before < trigger && before + bytes >= trigger;
+}
+
+void GCHeap::callAllocationTrigger() {
+    void (*callback)() = allocationTrigger.load(std::memory_order_acquire);
+    if (callback) {
+        callback();
+    }
+}
+
+void GCHeap::setAllocationTrigger(size_t triggerBytes, void (*callback)()) {
+    allocationTrigger.store(callback, std::memory_order_release);
+    allocationTriggerBytes.store(triggerBytes, std::memory_order_relaxed);
+}
+
+size_t GCHeap::heapBytes() {
+    size_t total = 0;
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        for (HeapChunk* chunk : chunks) {
+            total += chunk->largeObject ? chunk->limit - reinterpret_cast<uint8_t*>(chunk)
+                                        : chunk->numUnits * HeapLayout::CHUNK_SIZE;
+        }
+    }
+    size_t free = freeRunBytes();
+    {
+        std::lock_guard<std::mutex> lock(heapMutex);
+        free += pendingSweepBytes + drainingFreeBytes;
+    }
+    return total > free ? total - free : 0;
+}
+
+size_t GCHeap::freeRunBytes() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    size_t total = 0;
+    for (auto& spaceClasses : sizeClasses) {
+        for (SizeClassState& state : spaceClasses) {
+            for (const FreeRun& run : state.freeRuns) {
+                total += run.end - run.start;
+            }
+        }
+    }
+    return total;
+}
+
+bool GCHeap::isEmpty() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    for (HeapChunk* chunk : chunks) {
+        if (chunk->liveCells.load(std::memory_order_acquire) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t GCHeap::chunkCount() {
+    std::lock_guard<std::mutex> lock(heapMutex);
+    return chunks.size();
+}
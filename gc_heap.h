@@ -0,0 +1,532 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Heap spaces - every chunk only ever holds cells of one space, so the GC can
+// tell objects and scopes apart without reading their headers
+enum class HeapSpace : uint32_t {
+    OBJECT = 0,
+    SCOPE = 1,
+};
+
+constexpr size_t kNumHeapSpaces = 2;
+
+// Heap memory layout constants
+namespace HeapLayout {
+    constexpr size_t CHUNK_SIZE = 256 * 1024;     // Chunks are CHUNK_SIZE-aligned so the chunk of a cell is a mask away
+    constexpr size_t GRANULE_SIZE = 16;           // Cells are 16-byte aligned; one bitmap bit per granule
+    constexpr size_t GRANULES_PER_CHUNK = CHUNK_SIZE / GRANULE_SIZE;
+    constexpr size_t BITMAP_WORDS = GRANULES_PER_CHUNK / 64;
+    constexpr size_t RESERVATION_SIZE = 32ULL * 1024 * 1024 * 1024;  // Virtual range reserved once at startup
+    constexpr size_t TLAB_SIZE = 32 * 1024;       // Thread-local allocation buffer size
+    constexpr size_t PAGE_SIZE = 4096;
+    constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;   // Transparent huge page size (x86-64)
+
+    // Cells larger than this go to the large object space: a mapping of
+    // their own, unmapped when the cell dies. Smaller cells share chunks.
+    constexpr size_t LARGE_OBJECT_THRESHOLD = 64 * 1024;
+
+    constexpr size_t roundToGranule(size_t size) {
+        return (size + GRANULE_SIZE - 1) & ~(GRANULE_SIZE - 1);
+    }
+
+    constexpr size_t roundToPage(size_t size) {
+        return (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    }
+
+    // Size classes for small cells: every granule up to 128 bytes, then four
+    // classes per power of two (at most 25% internal waste). Each small-cell
+    // chunk holds cells of a single class, so its cells can be walked without
+    // reading headers and dead cells can be reused in place.
+    constexpr size_t NUM_SIZE_CLASSES = 32;
+    constexpr uint32_t NO_SIZE_CLASS = 0xFFFFFFFF;    // Medium/large cells: mixed bump chunks
+    constexpr size_t SIZE_CLASSES[NUM_SIZE_CLASSES] = {
+        16, 32, 48, 64, 80, 96, 112, 128,
+        160, 192, 224, 256, 320, 384, 448, 512,
+        640, 768, 896, 1024, 1280, 1536, 1792, 2048,
+        2560, 3072, 3584, 4096, 5120, 6144, 7168, 8192,
+    };
+    constexpr size_t MAX_SMALL_CELL = SIZE_CLASSES[NUM_SIZE_CLASSES - 1];
+
+    // Size class of a cell of `size` bytes, or NO_SIZE_CLASS when too large.
+    // Generated code resolves this at compile time from the class/scope size.
+    constexpr uint32_t sizeClassFor(size_t size) {
+        for (uint32_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+            if (size <= SIZE_CLASSES[i]) {
+                return i;
+            }
+        }
+        return NO_SIZE_CLASS;
+    }
+
+    // Offset of the metadata pointer in a cell's header (must match
+    // ObjectLayout::METADATA_OFFSET and ScopeLayout::METADATA_OFFSET in codegen.h)
+    constexpr size_t metadataOffset(HeapSpace space) {
+        return space == HeapSpace::OBJECT ? 0 : 8;
+    }
+}
+
+// Defragmentation (GCHeap::setDefragmentation). Cells never move, so a
+// fragmented heap is shrunk by draining its sparse chunks instead.
+namespace HeapDefrag {
+    // Default threshold: free share of the size-class chunks' used space
+    constexpr size_t DEFAULT_THRESHOLD_PERCENT = 40;
+    // Chunks whose live cells fill less than this are drained
+    constexpr size_t SPARSE_PERCENT = 25;
+}
+
+struct HeapChunk;
+
+// Thrown when an allocation would take the heap past its limit
+// (GCHeap::setHeapLimit) and the limit handler could not make room.
+// A std::bad_alloc, so existing handlers catch it too.
+class OutOfMemoryError : public std::bad_alloc {
+public:
+    OutOfMemoryError(size_t requestedBytes, size_t limitBytes);
+
+    const char* what() const noexcept override { return message; }
+    size_t requestedBytes() const { return requested; }
+    size_t limitBytes() const { return limit; }
+
+private:
+    size_t requested;
+    size_t limit;
+    char message[128];
+};
+
+// Called (outside the heap lock) when an allocation needs `requestedBytes`
+// more than the heap limit allows. `attempt` counts the calls for the same
+// allocation from 0. Returns true once it has made room to retry, false to
+// give up and throw OutOfMemoryError.
+using HeapLimitHandler = bool (*)(size_t requestedBytes, unsigned attempt);
+
+// Called for each sampled allocation: the allocating site (a return address
+// in generated code, or null), the cell's space, metadata and size, and the
+// number of allocated bytes the sample stands for
+using AllocationSampleCallback = void (*)(const void* site, HeapSpace space, void* metadata,
+                                          size_t cellSize, size_t weightBytes);
+
+// Thread-local allocation buffer - a run of free cells of one size class,
+// owned by one thread. Generated code allocates from it inline: load top,
+// bump by the class size, compare against limit, store the cell's metadata
+// pointer, then store the new top. Only a failed limit check calls into the
+// runtime (gc_allocate_object/scope), which refills the buffer from the size
+// class's swept free runs or from fresh chunk space.
+//
+// Cells in a TLAB get no start bits when allocated. All cells of a buffer have
+// the same size, so the heap gives start bits to [scanned, top) in one pass
+// when the TLAB is retired or when the GC flushes all TLABs.
+//
+// With allocation sampling on (GCHeap::setAllocationSampling), limit stops
+// short of the buffer's end at the next sample point, so the allocation that
+// crosses it takes the slow path and gets recorded there.
+struct TLAB {
+    std::atomic<uint8_t*> top{nullptr};   // Offset 0: next free byte (bumped by generated code)
+    uint8_t* limit = nullptr;             // Offset 8: end of the buffer, or the next sample point before it
+    uint8_t* end = nullptr;               // End of the buffer
+    uint8_t* scanned = nullptr;           // Cells below this already have start bits
+    HeapChunk* chunk = nullptr;           // Chunk the buffer was carved from
+};
+
+namespace TLABLayout {
+    constexpr int TOP_OFFSET = 0;
+    constexpr int LIMIT_OFFSET = 8;
+}
+
+// One TLAB per heap space and size class for every thread that allocates
+struct ThreadAllocationBuffers {
+    TLAB tlabs[kNumHeapSpaces][HeapLayout::NUM_SIZE_CLASSES];
+    bool registered = false;
+    uint64_t sampleRng = 0;               // xorshift state for sample distances (0: unseeded)
+    int64_t untlabbedUntilSample = 0;     // Sampling countdown for cells without a TLAB
+
+    ~ThreadAllocationBuffers();  // Retires the buffers on thread exit
+};
+
+// Chunk header - lives at the start of every chunk, cells follow it.
+// The side bitmaps have one bit per granule of the chunk:
+//   - startBits:  a cell starts at this granule (the cell is allocated)
+//   - markBits:   the cell starting at this granule was reached in the current mark
+//   - oldBits:    the cell survived a collection (old generation)
+//   - tenureBits: the cell existed when the current collection started; it
+//                 becomes old if it is still allocated when the cycle ends
+// Keeping mark state out of the cells means marking is a single atomic OR and
+// finding unreached cells is a word-at-a-time scan of (startBits & ~markBits).
+struct HeapChunk {
+    HeapSpace space;
+    uint32_t numUnits;                  // CHUNK_SIZE units spanned (> 1 only for a single large cell)
+    uint32_t sizeClass;                 // Size class of every cell, or NO_SIZE_CLASS for a mixed chunk
+    uint32_t cellSize;                  // Cell size of the size class (0 for a mixed chunk)
+    bool largeObject = false;           // Holds one large cell in its own mapping (see GCHeap)
+    uint8_t* top;                       // Bump allocation pointer
+    uint8_t* limit;                     // End of the cell area
+    std::atomic<uint64_t> liveCells{0}; // Number of start bits currently set
+    uint32_t activeTLABs = 0;           // Live TLABs carved from this chunk (guarded by the heap mutex)
+    size_t unsweptFreeBytes = 0;        // Bytes its pending sweep will reclaim (guarded by the heap mutex)
+    bool draining = false;              // Sparse: gets no new cells, free pages purged (guarded by the heap mutex)
+    std::atomic<uint64_t> startBits[HeapLayout::BITMAP_WORDS];
+    std::atomic<uint64_t> markBits[HeapLayout::BITMAP_WORDS];
+    std::atomic<uint64_t> oldBits[HeapLayout::BITMAP_WORDS];
+    std::atomic<uint64_t> tenureBits[HeapLayout::BITMAP_WORDS];
+
+    HeapChunk(HeapSpace s, uint32_t units, uint32_t sizeClass);
+
+    static HeapChunk* fromAddress(const void* p) {
+        return reinterpret_cast<HeapChunk*>(reinterpret_cast<uintptr_t>(p) & ~(HeapLayout::CHUNK_SIZE - 1));
+    }
+
+    // First byte usable for cells (header rounded up to a granule)
+    uint8_t* cellAreaStart() {
+        return reinterpret_cast<uint8_t*>(this) + HeapLayout::roundToGranule(sizeof(HeapChunk));
+    }
+
+    size_t granuleIndex(const void* p) const {
+        return (reinterpret_cast<uintptr_t>(p) - reinterpret_cast<uintptr_t>(this)) / HeapLayout::GRANULE_SIZE;
+    }
+
+    void* cellAtGranule(size_t index) {
+        return reinterpret_cast<uint8_t*>(this) + index * HeapLayout::GRANULE_SIZE;
+    }
+
+    // Atomically set the mark bit. Returns true if this call marked the cell.
+    bool tryMark(const void* cell) {
+        size_t index = granuleIndex(cell);
+        uint64_t mask = 1ULL << (index & 63);
+        uint64_t old = markBits[index >> 6].fetch_or(mask, std::memory_order_acq_rel);
+        return (old & mask) == 0;
+    }
+
+    bool isMarked(const void* cell) const {
+        size_t index = granuleIndex(cell);
+        return (markBits[index >> 6].load(std::memory_order_acquire) >> (index & 63)) & 1;
+    }
+
+    bool isAllocated(const void* cell) const {
+        size_t index = granuleIndex(cell);
+        return (startBits[index >> 6].load(std::memory_order_acquire) >> (index & 63)) & 1;
+    }
+
+    bool isOld(const void* cell) const {
+        size_t index = granuleIndex(cell);
+        return (oldBits[index >> 6].load(std::memory_order_relaxed) >> (index & 63)) & 1;
+    }
+
+    void clearMarkBits() {
+        for (auto& word : markBits) {
+            word.store(0, std::memory_order_relaxed);
+        }
+    }
+};
+
+// Chunked heap for TechnoScript objects and lexical scopes.
+// The whole heap lives inside one reserved virtual range, so "is this a heap
+// pointer" is a range check and chunk lookup is a mask. Chunks are committed
+// on demand and decommitted (and recycled) once every cell in them is dead.
+// Large cells get a chunk-aligned mapping of their own inside the range.
+class GCHeap {
+private:
+    uint8_t* reservationStart = nullptr;
+    uint8_t* reservationEnd = nullptr;
+    uint8_t* reservationTop = nullptr;      // Next never-used chunk address
+
+    std::vector<HeapChunk*> chunks;         // All chunks currently holding cells
+    std::vector<uint8_t*> freeUnits;        // Decommitted single chunk units ready for reuse
+    HeapChunk* currentChunk[kNumHeapSpaces] = {nullptr, nullptr};  // Mixed bump chunk per space
+    std::mutex heapMutex;                   // Protects allocation and the chunk lists
+
+    // A run of free cells of one size class, found by sweeping
+    struct FreeRun {
+        uint8_t* start;
+        uint8_t* end;
+    };
+
+    // Per space and size class: swept free runs (reused first), chunks not
+    // swept since the last collection, and the chunk whose untouched tail
+    // new TLABs are carved from
+    struct SizeClassState {
+        std::vector<FreeRun> freeRuns;
+        std::vector<HeapChunk*> unswept;
+        HeapChunk* bumpChunk = nullptr;
+    };
+    SizeClassState sizeClasses[kNumHeapSpaces][HeapLayout::NUM_SIZE_CLASSES];
+
+    // While set, new cells are born marked. Set for the duration of the
+    // phase-1 mark so cells allocated after marking started (and only held in
+    // registers so far) are never reported as suspected dead.
+    bool allocateBlack = false;
+
+    // Large object space. A large cell's chunk is a CHUNK_SIZE-aligned range
+    // of the reservation with a private mapping covering just the chunk
+    // header and the cell (page-aligned, see LARGE_CELL_OFFSET). When the
+    // cell dies the mapping is replaced by a fresh PROT_NONE one, which
+    // returns the pages, and the range goes back to largeFreeRanges.
+    std::map<uint8_t*, size_t> largeFreeRanges;  // Range start -> bytes (coalesced)
+    size_t largeObjectBytes = 0;            // Mapped bytes of live large cells
+    bool hugePageAdvice = false;            // MADV_HUGEPAGE on mappings of a huge page or more
+
+    // RawMemory blocks of LARGE_OBJECT_THRESHOLD or more: separate anonymous
+    // mappings outside the reservation, released explicitly (releaseRaw)
+    std::map<void*, size_t> rawBlocks;      // Block -> mapped bytes
+    size_t rawBlockBytes = 0;
+
+    // Heap limit. Committed bytes are everything the heap holds from the
+    // OS: chunk units, large cell mappings and raw blocks (guarded by
+    // heapMutex). A commit that would pass the limit throws
+    // OutOfMemoryError, which the allocation entry points catch outside
+    // the lock to call the handler and retry.
+    size_t committed = 0;
+    std::atomic<size_t> heapLimit{SIZE_MAX};
+    std::atomic<HeapLimitHandler> heapLimitHandler{nullptr};
+
+    // Count `bytes` as committed, or throw if that would pass the limit (heapMutex held)
+    void commitWithinLimit(size_t bytes);
+    // Run `allocate` until it succeeds or the limit handler gives up
+    template <typename Allocate>
+    auto retryAtHeapLimit(Allocate allocate) -> decltype(allocate());
+
+    // Take `bytes` (a CHUNK_SIZE multiple) of never-mapped or recycled
+    // reservation, first fit (heapMutex held)
+    uint8_t* reserveLargeRange(size_t bytes);
+    // Unmap a range and make it available again (heapMutex held)
+    void releaseLargeRange(uint8_t* base, size_t bytes);
+    // Give a fresh cell its own chunk in the large object space (heapMutex held)
+    HeapChunk* acquireLargeChunk(HeapSpace space, size_t cellSize);
+    // Huge page advice for a new mapping, if enabled and big enough
+    void adviseHugePages(void* base, size_t bytes);
+
+    // Threads with TLABs, for flushing (guarded by heapMutex)
+    std::vector<ThreadAllocationBuffers*> tlabOwners;
+
+    // Allocation pacing. Counted when memory is handed out - whole TLABs and
+    // shared-chunk cells - so the inline fast path pays nothing. Crossing
+    // allocationTriggerBytes calls allocationTrigger once (outside heapMutex).
+    std::atomic<size_t> allocatedSinceCycle{0};
+    std::atomic<size_t> allocationTriggerBytes{SIZE_MAX};
+    std::atomic<void (*)()> allocationTrigger{nullptr};
+
+    // Count `bytes` as allocated; true if this crossed the trigger
+    bool countAllocation(size_t bytes);
+    // Call allocationTrigger if set; it may be set while allocators run
+    void callAllocationTrigger();
+
+    // Allocation sampling: one sample per sampleMeanBytes allocated on
+    // average, at exponentially distributed distances (a Poisson process
+    // over allocated bytes). 0 disables sampling.
+    std::atomic<size_t> sampleMeanBytes{0};
+    std::atomic<AllocationSampleCallback> sampleCallback{nullptr};
+
+    // Bytes to the next sample point of the calling thread
+    size_t nextSampleDistance(ThreadAllocationBuffers& buffers);
+    // Sample point for a TLAB whose next free byte is `from`: the end, when not sampling
+    uint8_t* sampleLimit(ThreadAllocationBuffers& buffers, TLAB& tlab, uint8_t* from);
+    // Report a sampled cell to the callback (outside heapMutex)
+    void recordSample(const void* site, HeapSpace space, void* metadata, size_t cellSize);
+
+    HeapChunk* acquireChunk(HeapSpace space, size_t numUnits, uint32_t sizeClass);
+    void releaseChunk(HeapChunk* chunk);
+
+    // Current mixed chunk of `space` if it has cellSize bytes left, otherwise
+    // a new one (a dedicated run for large cells) (heapMutex held)
+    HeapChunk* chunkWithRoom(HeapSpace space, size_t cellSize);
+    // Point `tlab` at a zeroed run of free cells of the size class (heapMutex held)
+    void refillTLAB(HeapSpace space, uint32_t sizeClass, TLAB& tlab);
+    // Set the start bit of a cell (and its mark bit when allocating black)
+    void publishCell(void* cell);
+    // Give start bits to the TLAB's cells in [scanned, upTo) (heapMutex held)
+    void flushTLAB(TLAB& tlab, uint8_t* upTo);
+    // Flush a TLAB and detach it from its chunk (heapMutex held)
+    void retireTLAB(TLAB& tlab);
+    // Lazy sweeping (see sweep()). Empty mixed chunks wait in unsweptMixed,
+    // size-class chunks in their class's unswept list; pendingSweepBytes is
+    // what sweeping them will reclaim, so heapBytes() is right before that.
+    std::vector<HeapChunk*> unsweptMixed;
+    size_t pendingSweepBytes = 0;
+    std::atomic<size_t> pendingSweepChunks{0};
+
+    // Defragmentation. When the free share of the size-class chunks reaches
+    // defragThreshold percent, beginSweep() marks the sparse ones draining:
+    // their free runs are not handed out again and whole free pages in them
+    // go back to the OS at once (MADV_DONTNEED), and the chunk is released
+    // when its last cell dies. 0 disables it.
+    std::atomic<size_t> defragThreshold{0};
+    double fragmentation = 0;               // Percent, measured by the last beginSweep()
+    size_t drainingChunks = 0;
+    size_t drainingFreeBytes = 0;           // Free cells of swept draining chunks
+    size_t purgedBytes = 0;                 // Total given back from draining chunks
+
+    // Size-class chunk whose occupancy counts for fragmentation (heapMutex held)
+    bool isDefragCandidate(HeapChunk* chunk);
+    // Measure fragmentation and pick the chunks to drain (heapMutex held)
+    void planDefragmentationLocked();
+    // Hand the draining chunks' free cells out again from the next sweep on (heapMutex held)
+    void stopDrainingLocked();
+    // Give the whole pages inside a free run back to the OS
+    void purgeRun(uint8_t* start, uint8_t* end);
+
+    // No live cells and nothing allocates into it (heapMutex held)
+    bool isReleasable(HeapChunk* chunk);
+    // Bytes sweeping the chunk now would reclaim (heapMutex held)
+    size_t reclaimableBytes(HeapChunk* chunk);
+    // Release dead large cells and queue every other chunk (heapMutex held)
+    void beginSweepLocked();
+    // Build the free runs of a queued chunk, or release it when empty and
+    // `release` is set. True if it was released; the caller must then drop
+    // it from `chunks` (heapMutex held).
+    bool sweepChunkLocked(HeapChunk* chunk, bool release);
+    // Sweep up to maxChunks queued chunks; true if any are left (heapMutex held)
+    bool sweepPendingLocked(size_t maxChunks);
+
+    friend struct ThreadAllocationBuffers;
+
+public:
+    GCHeap();
+    ~GCHeap();
+
+    // Allocate a zeroed cell of at least `size` bytes from the shared chunk
+    void* allocate(HeapSpace space, size_t size);
+
+    // Allocate a zeroed cell from the calling thread's TLAB for the size
+    // class of `size` and store `metadata` in its header. This is the slow
+    // path behind the inline allocation sequence in generated code: it
+    // refills the TLAB when needed and sends cells larger than MAX_SMALL_CELL
+    // to the shared mixed chunk.
+    // `site` identifies the caller for allocation sampling (generated code
+    // passes its return address).
+    void* allocateInTLAB(HeapSpace space, size_t size, void* metadata, const void* site = nullptr);
+
+    // Give start bits to every cell allocated in any thread's TLAB so far
+    void flushTLABs();
+
+    // Offset of a large cell from its chunk: the chunk header rounded up to a
+    // page, so the cell is page-aligned and ends with its mapping
+    static size_t largeCellOffset();
+
+    // Zeroed, page-aligned block of at least `size` bytes for RawMemory
+    // (only for sizes of LARGE_OBJECT_THRESHOLD and up; smaller blocks come
+    // from malloc). The GC does not trace RawMemory: releaseRaw() unmaps it.
+    void* allocateRaw(size_t size);
+    // Unmap a block from allocateRaw(); false if `block` is not one
+    bool releaseRaw(void* block);
+
+    // Advise transparent huge pages for large cells and raw blocks of at
+    // least HUGE_PAGE_SIZE. Defaults to TECHNOSCRIPT_GC_HUGEPAGES being set.
+    void setHugePageAdvice(bool enabled);
+
+    // Mapped bytes of live large cells / raw blocks
+    size_t largeObjectSpaceBytes();
+    size_t rawMemoryBytes();
+
+    // Hard limit on committed bytes (SIZE_MAX: none). Allocations that would
+    // pass it call the limit handler, then throw OutOfMemoryError. Lowering
+    // the limit below what is committed only stops further growth.
+    void setHeapLimit(size_t bytes);
+    size_t getHeapLimit() const { return heapLimit.load(std::memory_order_relaxed); }
+    void setHeapLimitHandler(HeapLimitHandler handler);
+    // Chunk, large object and raw block bytes currently held from the OS
+    size_t committedBytes();
+
+    // Offset of the calling thread's TLAB for `space` and `sizeClass` from
+    // the thread pointer (fs base). The TLABs live in static TLS, so the
+    // offset is the same on every thread and can be baked into generated code.
+    static intptr_t tlabThreadOffset(HeapSpace space, uint32_t sizeClass);
+
+    bool contains(const void* p) const {
+        return p >= reservationStart && p < reservationEnd;
+    }
+
+    // The reserved range, for range checks baked into generated code
+    const uint8_t* rangeStart() const { return reservationStart; }
+    size_t rangeSize() const { return reservationEnd - reservationStart; }
+
+    // Marking - callers must only pass cell start addresses inside the heap
+    bool tryMark(const void* cell) { return HeapChunk::fromAddress(cell)->tryMark(cell); }
+    bool isMarked(const void* cell) const { return HeapChunk::fromAddress(cell)->isMarked(cell); }
+    bool isOld(const void* cell) const { return HeapChunk::fromAddress(cell)->isOld(cell); }
+    // False once freeCell() has returned the cell
+    bool isAllocated(const void* cell) const { return HeapChunk::fromAddress(cell)->isAllocated(cell); }
+    // Bytes the allocated cell occupies: its size class, the whole cell in
+    // the large object space, or up to the next cell (or the bump pointer)
+    // in a mixed chunk
+    size_t cellSize(const void* cell) const;
+
+    // Clear all mark bits and start allocating black (phase 1 start)
+    void beginMarking();
+    // Stop allocating black (phase 1 end)
+    void finishMarking();
+    // Clear all mark bits without touching allocation colour
+    void clearMarkBits();
+
+    // Linear bitmap scan: append every allocated, unmarked cell of `space`
+    // (only young ones when `youngOnly` is set, for a minor collection)
+    void collectUnmarked(HeapSpace space, std::vector<void*>& out, bool youngOnly = false);
+
+    // Generations. Cells are never moved: a cell is young until it survives
+    // a collection, then its old bit is set. beginTenuring() records the
+    // cells allocated so far (call it right after flushTLABs() at the start
+    // of a cycle); promoteSurvivors() makes those still allocated old.
+    // Cells allocated during the cycle stay young.
+    void beginTenuring();
+    void promoteSurvivors();
+    size_t oldCellCount();
+
+    // Return a dead cell to the heap
+    void freeCell(void* cell);
+
+    // Sweep after freeing: decommit chunks with no live cells left and
+    // rebuild the per-size-class free runs from the start bitmaps. Chunks a
+    // thread is still allocating into are left for the next sweep.
+    //
+    // sweep() does it all at once. beginSweep() only unmaps dead large cells
+    // and queues the other chunks: a TLAB refill sweeps its own size class's
+    // queue until it finds free cells, sweepPending() works through the rest
+    // a batch at a time (the GC thread, between cycles), and a commit that
+    // would pass the heap limit finishes the queue first.
+    void sweep();
+    void beginSweep();
+    bool sweepPending(size_t maxChunks);   // True if chunks are still queued
+    bool hasPendingSweep() const { return pendingSweepChunks.load(std::memory_order_relaxed) != 0; }
+
+    // Drain sparse chunks when the free share of the size-class chunks
+    // reaches `thresholdPercent` (0: off). Defaults to TECHNOSCRIPT_GC_DEFRAG
+    // (a percentage, or DEFAULT_THRESHOLD_PERCENT if not a number); off when unset.
+    void setDefragmentation(size_t thresholdPercent);
+    size_t getDefragmentation() const { return defragThreshold.load(std::memory_order_relaxed); }
+    // Free share of the size-class chunks at the last sweep, in percent
+    double fragmentationPercent();
+    size_t drainingChunkCount();
+    // Bytes draining chunks have given back to the OS since startup
+    size_t purgedBytesTotal();
+
+    // Total bytes in swept free runs, waiting to be reused
+    size_t freeRunBytes();
+
+    // Bytes held by chunks, minus swept free runs: the heap's footprint
+    // after a collection (live cells plus fragmentation)
+    size_t heapBytes();
+
+    // Pacing (see GCPacing in gc.h). The counter covers everything handed
+    // out since the last resetAllocationCounter(); `callback` runs on the
+    // allocating thread once it reaches `triggerBytes`.
+    size_t bytesAllocatedSinceCycle() const { return allocatedSinceCycle.load(std::memory_order_relaxed); }
+    void resetAllocationCounter() { allocatedSinceCycle.store(0, std::memory_order_relaxed); }
+    void setAllocationTrigger(size_t triggerBytes, void (*callback)());
+
+    // Sample roughly one allocation per `meanBytes` allocated (0: off) and
+    // hand each to `callback` on the allocating thread, with the bytes it
+    // stands for. Inline allocations cost nothing extra: the TLAB limit is
+    // lowered to the sample point. Only allocateInTLAB() calls are sampled.
+    void setAllocationSampling(size_t meanBytes, AllocationSampleCallback callback);
+    size_t getAllocationSampling() const { return sampleMeanBytes.load(std::memory_order_relaxed); }
+
+    bool isEmpty();
+    size_t chunkCount();
+
+    // Singleton access
+    static GCHeap& getInstance();
+};
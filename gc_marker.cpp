@@ -0,0 +1,396 @@
+#include "gc_marker.h"
+#include "gc.h"
+#include <cstdlib>
+#include <iostream>
+
+namespace {
+    constexpr size_t ROOT_BATCH = 32;          // Roots claimed per fetch_add
+    constexpr size_t MAX_DEFAULT_THREADS = 8;
+    constexpr int SPINS_BEFORE_YIELD = 64;
+
+    inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    }
+
+    inline uint64_t nextRandom(uint64_t& state) {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+}
+
+size_t ParallelMarker::defaultThreadCount() {
+    if (const char* env = std::getenv("TECHNOSCRIPT_GC_THREADS")) {
+        long requested = std::strtol(env, nullptr, 10);
+        if (requested > 0) {
+            return static_cast<size_t>(requested);
+        }
+    }
+
+    size_t hardware = std::thread::hardware_concurrency();
+    if (hardware == 0) {
+        return 1;
+    }
+    return hardware < MAX_DEFAULT_THREADS ? hardware : MAX_DEFAULT_THREADS;
+}
+
+ParallelMarker::ParallelMarker(size_t numThreads) : heap(GCHeap::getInstance()) {
+    startHelpers(numThreads);
+}
+
+ParallelMarker::~ParallelMarker() {
+    stopHelpers();
+}
+
+void ParallelMarker::setThreadCount(size_t numThreads) {
+    std::lock_guard<std::mutex> lock(markMutex);
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+    if (numThreads == workers.size()) {
+        return;
+    }
+    stopHelpers();
+    startHelpers(numThreads);
+}
+
+void ParallelMarker::startHelpers(size_t numThreads) {
+    if (numThreads == 0) {
+        numThreads = 1;
+    }
+
+    workers.clear();
+    for (size_t i = 0; i < numThreads; i++) {
+        auto worker = std::make_unique<Worker>();
+        worker->rngState = 0x9E3779B97F4A7C15ULL * (i + 1);
+        worker->marker = this;
+        workers.push_back(std::move(worker));
+    }
+
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        shuttingDown = false;
+        epoch = markEpoch;
+    }
+
+    // Worker 0 is whichever thread calls mark()
+    for (size_t i = 1; i < numThreads; i++) {
+        workers[i]->thread = std::thread(&ParallelMarker::helperLoop, this, i, epoch);
+    }
+}
+
+void ParallelMarker::stopHelpers() {
+    {
+        std::lock_guard<std::mutex> lock(poolMutex);
+        shuttingDown = true;
+    }
+    helpersWakeup.notify_all();
+
+    for (auto& worker : workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+    workers.clear();
+}
+
+void ParallelMarker::helperLoop(size_t index, uint64_t seenEpoch) {
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(poolMutex);
+            helpersWakeup.wait(lock, [&] { return shuttingDown || markEpoch != seenEpoch; });
+            if (shuttingDown) {
+                return;
+            }
+            seenEpoch = markEpoch;
+        }
+
+        drain(index);
+
+        {
+            std::lock_guard<std::mutex> lock(poolMutex);
+            helpersFinished++;
+        }
+        helpersDone.notify_one();
+    }
+}
+
+void ParallelMarker::mark(const std::vector<void*>& rootCells, bool youngOnly) {
+    std::lock_guard<std::mutex> lock(markMutex);
+
+    roots = &rootCells;
+    this->youngOnly = youngOnly;
+    nextRoot.store(0, std::memory_order_relaxed);
+    idleWorkers.store(0, std::memory_order_relaxed);
+    for (auto& worker : workers) {
+        worker->tracedCells = 0;
+        worker->tracedScopes = 0;
+    }
+
+    size_t numHelpers = workers.size() - 1;
+    if (numHelpers > 0) {
+        {
+            std::lock_guard<std::mutex> poolLock(poolMutex);
+            helpersFinished = 0;
+            markEpoch++;
+        }
+        helpersWakeup.notify_all();
+    }
+
+    drain(0);
+
+    if (numHelpers > 0) {
+        std::unique_lock<std::mutex> poolLock(poolMutex);
+        helpersDone.wait(poolLock, [&] { return helpersFinished == numHelpers; });
+    }
+
+    uint64_t traced = 0;
+    uint64_t tracedScopes = 0;
+    for (auto& worker : workers) {
+        traced += worker->tracedCells;
+        tracedScopes += worker->tracedScopes;
+    }
+    lastTracedCells.store(traced, std::memory_order_relaxed);
+    lastTracedScopes.store(tracedScopes, std::memory_order_relaxed);
+    roots = nullptr;
+}
+
+void ParallelMarker::drain(size_t index) {
+    Worker& self = *workers[index];
+    size_t numWorkers = workers.size();
+    void* cell = nullptr;
+
+    while (true) {
+        // Local work first (LIFO keeps the mark stack shallow), then unclaimed
+        // roots, then other workers' deques
+        while (self.markStack.pop(cell)) {
+            traceCell(self, cell);
+        }
+        if (claimRoots(self)) {
+            continue;
+        }
+        if (stealWork(index, cell)) {
+            traceCell(self, cell);
+            continue;
+        }
+
+        // Nothing found anywhere: go idle. The mark is complete once every
+        // worker is idle at the same time - an idle worker's deque is empty
+        // and only its owner pushes to it, so no new work can appear.
+        idleWorkers.fetch_add(1, std::memory_order_seq_cst);
+        int spins = 0;
+        while (true) {
+            if (idleWorkers.load(std::memory_order_seq_cst) == numWorkers) {
+                return;
+            }
+            if (anyWorkVisible()) {
+                idleWorkers.fetch_sub(1, std::memory_order_seq_cst);
+                break;
+            }
+            if (++spins < SPINS_BEFORE_YIELD) {
+                cpuRelax();
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+}
+
+bool ParallelMarker::claimRoots(Worker& self) {
+    size_t total = roots->size();
+    if (nextRoot.load(std::memory_order_relaxed) >= total) {
+        return false;
+    }
+
+    size_t begin = nextRoot.fetch_add(ROOT_BATCH, std::memory_order_relaxed);
+    if (begin >= total) {
+        return false;
+    }
+
+    size_t end = begin + ROOT_BATCH < total ? begin + ROOT_BATCH : total;
+    for (size_t i = begin; i < end; i++) {
+        markRoot(self, (*roots)[i]);
+    }
+    return true;
+}
+
+bool ParallelMarker::stealWork(size_t index, void*& cell) {
+    size_t numWorkers = workers.size();
+    if (numWorkers == 1) {
+        return false;
+    }
+
+    // Start at a random victim so thieves spread out
+    size_t start = nextRandom(workers[index]->rngState) % numWorkers;
+    for (size_t i = 0; i < numWorkers; i++) {
+        size_t victim = (start + i) % numWorkers;
+        if (victim == index) {
+            continue;
+        }
+        if (workers[victim]->markStack.steal(cell)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ParallelMarker::anyWorkVisible() const {
+    if (nextRoot.load(std::memory_order_relaxed) < roots->size()) {
+        return true;
+    }
+    for (const auto& worker : workers) {
+        if (!worker->markStack.empty()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ParallelMarker::markRoot(Worker& self, void* cell) {
+    if (!cell || !heap.contains(cell)) {
+        return; // Null or not a heap cell
+    }
+    if (heap.tryMark(cell)) {
+        self.markStack.push(cell);
+    }
+}
+
+void ParallelMarker::markChild(Worker& self, void* cell) {
+    if (!cell || !heap.contains(cell)) {
+        return; // Null or not a heap cell
+    }
+    if (youngOnly && heap.isOld(cell)) {
+        return; // Old cells are not collected by a minor mark
+    }
+    if (heap.tryMark(cell)) {
+        self.markStack.push(cell);
+    }
+}
+
+void ParallelMarker::traceCell(Worker& self, void* cell) {
+    self.tracedCells++;
+    if (HeapChunk::fromAddress(cell)->space == HeapSpace::SCOPE) {
+        self.tracedScopes++;
+        traceScope(self, cell);
+    } else {
+        traceObject(self, cell);
+    }
+}
+
+void ParallelMarker::visitReference(void* context, void* cell) {
+    Worker* self = static_cast<Worker*>(context);
+    self->marker->markChild(*self, cell);
+}
+
+void ParallelMarker::traceClosureScopes(Worker& self, void** scopePtrs, int numScopes) {
+    for (int j = 0; j < numScopes; j++) {
+        markChild(self, scopePtrs[j]);
+    }
+}
+
+void ParallelMarker::traceObject(Worker& self, void* obj) {
+    ObjectHeader* header = static_cast<ObjectHeader*>(obj);
+    ClassMetadata* metadata = header->getClassMetadata();
+
+    if (!metadata) {
+        return;
+    }
+
+    if (metadata->traceFunction) {
+        metadata->traceFunction(obj, &self);
+        return;
+    }
+
+    // Trace the scopes captured by each method closure the instance points to
+    // Layout: [metadata*][flags][closure_ptr1]...[closure_ptrN][fields]
+    Closure** closurePtrs = header->getClosurePtrs();
+    for (int i = 0; i < metadata->numMethods; i++) {
+        Closure* closure = closurePtrs[i];
+        if (!closure) continue;
+
+        // Closure layout: [size(8)][func_addr(8)][scope_ptr1(8)][scope_ptr2(8)]...
+        int numScopes = (closure->size - 16) / 8;
+        traceClosureScopes(self, closure->getScopePtrs(), numScopes);
+    }
+
+    // Trace object fields using metadata
+    // Note: field offsets in metadata account for header + closure pointers
+    uint8_t* objectStart = reinterpret_cast<uint8_t*>(obj);
+
+    for (int i = 0; i < metadata->numFields; i++) {
+        const VarMetadata& field = metadata->fields[i];
+
+        if (field.type == DataType::OBJECT) {
+            markChild(self, *reinterpret_cast<void**>(objectStart + field.offset));
+        }
+        else if (field.type == DataType::CLOSURE) {
+            uint8_t* closurePtr = objectStart + field.offset;
+            // Closure layout: [size(8)][func_addr(8)][scope_ptr1(8)][scope_ptr2(8)]...
+            uint64_t closureSize = *reinterpret_cast<uint64_t*>(closurePtr);
+            int numScopes = (closureSize - 16) / 8;
+            traceClosureScopes(self, reinterpret_cast<void**>(closurePtr + 16), numScopes);
+        }
+    }
+}
+
+void ParallelMarker::traceScope(Worker& self, void* scope) {
+    ScopeHeader* header = static_cast<ScopeHeader*>(scope);
+    ScopeMetadata* metadata = header->getScopeMetadata();
+
+    if (!metadata) {
+        return; // No metadata, nothing to trace
+    }
+
+    if (metadata->traceFunction) {
+        metadata->traceFunction(scope, &self);
+        return;
+    }
+
+    uint8_t* dataStart = header->getDataStart();
+
+    for (int i = 0; i < metadata->numVars; i++) {
+        const VarMetadata& var = metadata->vars[i];
+
+        if (var.type == DataType::OBJECT) {
+            markChild(self, *reinterpret_cast<void**>(dataStart + var.offset));
+        }
+        else if (var.type == DataType::CLOSURE) {
+            uint8_t* closurePtr = dataStart + var.offset;
+            // Closure layout: [func_addr(8)][size(8)][scope_ptr1(8)][scope_ptr2(8)]...
+            uint64_t closureSize = *reinterpret_cast<uint64_t*>(closurePtr + 8);
+            int numScopes = (closureSize - 16) / 8;
+            traceClosureScopes(self, reinterpret_cast<void**>(closurePtr + 16), numScopes);
+        }
+    }
+}
+
+void ParallelMarker::appendScopeReferences(void* scope, std::vector<void*>& out) {
+    // Same slots as traceScope()
+    ScopeHeader* header = static_cast<ScopeHeader*>(scope);
+    ScopeMetadata* metadata = header->getScopeMetadata();
+
+    if (!metadata) {
+        return;
+    }
+
+    uint8_t* dataStart = header->getDataStart();
+
+    for (int i = 0; i < metadata->numVars; i++) {
+        const VarMetadata& var = metadata->vars[i];
+
+        if (var.type == DataType::OBJECT) {
+            out.push_back(*reinterpret_cast<void**>(dataStart + var.offset));
+        }
+        else if (var.type == DataType::CLOSURE) {
+            uint8_t* closurePtr = dataStart + var.offset;
+            uint64_t closureSize = *reinterpret_cast<uint64_t*>(closurePtr + 8);
+            int numScopes = (closureSize - 16) / 8;
+            void** scopePtrs = reinterpret_cast<void**>(closurePtr + 16);
+            out.insert(out.end(), scopePtrs, scopePtrs + numScopes);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "data_structures/work_stealing_deque.h"
+#include "gc_heap.h"
+
+// Parallel mark for the GC heap.
+//
+// Marking is iterative: every worker owns a Chase-Lev deque used as its mark
+// stack, so deep object graphs never recurse on the native stack. The thread
+// that calls mark() is worker 0; numThreads - 1 helper threads are parked on
+// a condition variable between marks and steal from each other (and from
+// worker 0) whenever their own deque runs dry.
+//
+// A cell is pushed only by the thread that flipped its mark bit
+// (GCHeap::tryMark), so every reachable cell is traced exactly once.
+// Objects and scopes are told apart by the heap space of their chunk.
+//
+// Cells whose metadata carries a traceFunction (emitted by the code generator
+// for each class and scope layout) are traced by calling it; it hands every
+// reference slot to visitReference(). Other cells are traced by walking
+// their VarMetadata arrays.
+//
+// A young-only mark (minor collection) traces the roots but does not follow
+// references into old cells; old-to-young references must then be among the
+// roots (the remembered set).
+class ParallelMarker {
+private:
+    struct Worker {
+        WorkStealingDeque<void*> markStack;
+        uint64_t rngState = 0;          // xorshift state for victim selection
+        uint64_t tracedCells = 0;       // Cells traced by this worker in the current mark
+        uint64_t tracedScopes = 0;      // ... of which scopes
+        std::thread thread;             // Unused for worker 0 (the calling thread)
+        ParallelMarker* marker = nullptr;  // For visitReference()
+    };
+
+    GCHeap& heap;
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::mutex markMutex;               // Serializes mark() and setThreadCount()
+
+    // Helper parking
+    std::mutex poolMutex;
+    std::condition_variable helpersWakeup;
+    std::condition_variable helpersDone;
+    uint64_t markEpoch = 0;             // Bumped to start a mark
+    size_t helpersFinished = 0;
+    bool shuttingDown = false;
+
+    // Per-mark shared state
+    const std::vector<void*>* roots = nullptr;
+    std::atomic<size_t> nextRoot{0};    // Roots are claimed in batches by index
+    std::atomic<size_t> idleWorkers{0}; // Workers that found no work anywhere
+    bool youngOnly = false;             // Stop at old cells (minor collection)
+    std::atomic<uint64_t> lastTracedCells{0};
+    std::atomic<uint64_t> lastTracedScopes{0};
+
+    void startHelpers(size_t numThreads);
+    void stopHelpers();
+    void helperLoop(size_t index, uint64_t seenEpoch);
+
+    // Work loop run by every worker until global termination
+    void drain(size_t index);
+    bool claimRoots(Worker& self);
+    bool stealWork(size_t index, void*& cell);
+    bool anyWorkVisible() const;
+
+    // Mark-and-push a root (traced even when old)
+    void markRoot(Worker& self, void* cell);
+    // Mark-and-push a child reference found while tracing
+    void markChild(Worker& self, void* cell);
+    void traceCell(Worker& self, void* cell);
+    void traceObject(Worker& self, void* obj);
+    void traceScope(Worker& self, void* scope);
+    void traceClosureScopes(Worker& self, void** scopePtrs, int numScopes);
+
+public:
+    explicit ParallelMarker(size_t numThreads);
+    ~ParallelMarker();
+
+    ParallelMarker(const ParallelMarker&) = delete;
+    ParallelMarker& operator=(const ParallelMarker&) = delete;
+
+    // Mark everything reachable from `rootCells` (objects and/or scopes).
+    // Null and non-heap pointers are ignored. Blocks until the mark is complete.
+    // With `youngOnly`, references to old cells are not followed.
+    void mark(const std::vector<void*>& rootCells, bool youngOnly = false);
+
+    // Change the number of marking threads (including the caller). Takes effect
+    // for the next mark; must not be called from inside a mark.
+    void setThreadCount(size_t numThreads);
+    size_t getThreadCount() const { return workers.size(); }
+
+    // Visitor called by generated trace functions (see TraceFunction in
+    // gc.h): `context` is the tracing worker, `cell` a non-null heap pointer
+    static void visitReference(void* context, void* cell);
+
+    // Cells traced by the most recent mark()
+    uint64_t getLastTracedCells() const { return lastTracedCells.load(std::memory_order_relaxed); }
+    // Scopes among them (the rest are objects)
+    uint64_t getLastTracedScopes() const { return lastTracedScopes.load(std::memory_order_relaxed); }
+
+    // Append the cells a scope references (object variables and the scopes
+    // captured by closure variables), for scopes that are roots but not heap
+    // cells (frame-stack scopes, see GoroutineGCState::frames)
+    static void appendScopeReferences(void* scope, std::vector<void*>& out);
+
+    // Default thread count: TECHNOSCRIPT_GC_THREADS if set, otherwise the
+    // number of hardware threads capped at 8
+    static size_t defaultThreadCount();
+};
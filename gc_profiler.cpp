@@ -0,0 +1,127 @@
+#include "gc_profiler.h"
+#include "gc.h"
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+AllocationProfiler& AllocationProfiler::getInstance() {
+    static AllocationProfiler instance;
+    return instance;
+}
+
+AllocationProfiler::AllocationProfiler() {
+    if (const char* path = std::getenv("TECHNOSCRIPT_ALLOC_PROFILE")) {
+        outputPath = path;
+        size_t meanBytes = AllocationProfiling::DEFAULT_SAMPLE_BYTES;
+        if (const char* env = std::getenv("TECHNOSCRIPT_ALLOC_SAMPLE_BYTES")) {
+            long requested = std::strtol(env, nullptr, 10);
+            if (requested > 0) {
+                meanBytes = static_cast<size_t>(requested);
+            }
+        }
+        start(meanBytes);
+        std::cout << "Allocation profiler sampling every " << meanBytes << " bytes -> " << outputPath << std::endl;
+    }
+}
+
+void AllocationProfiler::start(size_t meanBytes) {
+    GCHeap::getInstance().setAllocationSampling(meanBytes, meanBytes ? &AllocationProfiler::onSample : nullptr);
+}
+
+void AllocationProfiler::stop() {
+    GCHeap::getInstance().setAllocationSampling(0, nullptr);
+}
+
+bool AllocationProfiler::isRunning() const {
+    return GCHeap::getInstance().getAllocationSampling() != 0;
+}
+
+void AllocationProfiler::registerSite(const void* returnAddress, const std::string& function,
+                                      const std::string& allocation) {
+    std::lock_guard<std::mutex> lock(mutex);
+    sites[returnAddress] = Site{function, allocation};
+}
+
+void AllocationProfiler::reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+    siteTotals.clear();
+    otherTotals.clear();
+}
+
+std::string AllocationProfiler::describe(HeapSpace space, void* metadata) {
+    if (space == HeapSpace::SCOPE) {
+        const ScopeMetadata* scopeMetadata = static_cast<const ScopeMetadata*>(metadata);
+        return std::string("(scope ") + (scopeMetadata && scopeMetadata->name ? scopeMetadata->name : "anonymous") + ")";
+    }
+    const ClassMetadata* classMetadata = static_cast<const ClassMetadata*>(metadata);
+    return std::string("new ") + (classMetadata && classMetadata->className ? classMetadata->className : "(unknown)");
+}
+
+void AllocationProfiler::onSample(const void* site, HeapSpace space, void* metadata, size_t cellSize,
+                                  size_t weightBytes) {
+    // Samples are rare (one per sampling interval), so a lock is fine here
+    AllocationProfiler& profiler = getInstance();
+    std::lock_guard<std::mutex> lock(profiler.mutex);
+    Totals* totals;
+    if (site && profiler.sites.count(site)) {
+        totals = &profiler.siteTotals[site];
+    } else {
+        totals = &profiler.otherTotals[describe(space, metadata)];
+    }
+    totals->samples++;
+    totals->bytes += weightBytes;
+}
+
+std::vector<AllocationProfiler::SiteProfile> AllocationProfiler::getProfile() const {
+    std::vector<SiteProfile> profile;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const auto& [address, totals] : siteTotals) {
+            const Site& site = sites.at(address);
+            profile.push_back(SiteProfile{site.function, site.allocation, totals.samples, totals.bytes});
+        }
+        for (const auto& [allocation, totals] : otherTotals) {
+            profile.push_back(SiteProfile{"(runtime)", allocation, totals.samples, totals.bytes});
+        }
+    }
+    std::sort(profile.begin(), profile.end(), [](const SiteProfile& a, const SiteProfile& b) {
+        return a.bytes != b.bytes ? a.bytes > b.bytes : a.function + a.allocation < b.function + b.allocation;
+    });
+    return profile;
+}
+
+void AllocationProfiler::writeFolded(std::ostream& out) const {
+    // Sites with the same function and allocation (e.g. two `new Foo` in one
+    // function) fold into one line
+    std::vector<SiteProfile> profile = getProfile();
+    std::vector<std::pair<std::string, uint64_t>> lines;
+    std::unordered_map<std::string, size_t> lineIndex;
+    for (const SiteProfile& site : profile) {
+        std::string stack = site.function + ";" + site.allocation;
+        auto it = lineIndex.find(stack);
+        if (it == lineIndex.end()) {
+            lineIndex.emplace(stack, lines.size());
+            lines.emplace_back(stack, site.bytes);
+        } else {
+            lines[it->second].second += site.bytes;
+        }
+    }
+    for (const auto& [stack, bytes] : lines) {
+        out << stack << " " << bytes << "\n";
+    }
+}
+
+bool AllocationProfiler::writeConfiguredProfile() {
+    if (outputPath.empty()) {
+        return false;
+    }
+    std::ofstream out(outputPath, std::ios::trunc);
+    if (!out) {
+        std::cerr << "Cannot write allocation profile: " << outputPath << std::endl;
+        return false;
+    }
+    writeFolded(out);
+    std::cout << "Allocation profile written to " << outputPath << std::endl;
+    return static_cast<bool>(out.flush());
+}
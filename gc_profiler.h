@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "gc_heap.h"
+
+namespace AllocationProfiling {
+    // Mean bytes between samples, overridden by TECHNOSCRIPT_ALLOC_SAMPLE_BYTES
+    constexpr size_t DEFAULT_SAMPLE_BYTES = 512 * 1024;
+}
+
+// Sampling allocation profiler keyed by allocation site.
+//
+// The heap samples about one allocation per sampling interval
+// (GCHeap::setAllocationSampling) and reports the return address of the
+// slow-path call. The code generator registers every allocation call it
+// emits (CodeGenerator::emitHeapAllocation) with the function it sits in and
+// what it allocates - `new <Class>` or a scope - so samples map back to
+// source. Each sample is weighted by the bytes it stands for, so the totals
+// estimate the real allocation volume per site.
+//
+// Output is folded stacks ("function;allocation bytes" per line), the input
+// format of flamegraph.pl, speedscope and `pprof -raw`-style converters.
+//
+// With TECHNOSCRIPT_ALLOC_PROFILE=<path> set, profiling starts with the
+// runtime and writeConfiguredProfile() (called when the program finishes)
+// writes the folded profile to <path>.
+class AllocationProfiler {
+public:
+    // Totals for one allocation site
+    struct SiteProfile {
+        std::string function;     // Function containing the allocation
+        std::string allocation;   // "new <Class>" or "(scope <name>)"
+        uint64_t samples = 0;
+        uint64_t bytes = 0;       // Estimated bytes allocated
+    };
+
+private:
+    struct Site {
+        std::string function;
+        std::string allocation;
+    };
+
+    struct Totals {
+        uint64_t samples = 0;
+        uint64_t bytes = 0;
+    };
+
+    mutable std::mutex mutex;
+    std::unordered_map<const void*, Site> sites;            // By return address
+    std::unordered_map<const void*, Totals> siteTotals;     // Samples from registered sites
+    std::unordered_map<std::string, Totals> otherTotals;    // Unregistered sites, by allocation name
+    std::string outputPath;                                 // TECHNOSCRIPT_ALLOC_PROFILE
+
+    AllocationProfiler();
+
+    static void onSample(const void* site, HeapSpace space, void* metadata, size_t cellSize, size_t weightBytes);
+    static std::string describe(HeapSpace space, void* metadata);
+
+public:
+    AllocationProfiler(const AllocationProfiler&) = delete;
+    AllocationProfiler& operator=(const AllocationProfiler&) = delete;
+
+    static AllocationProfiler& getInstance();
+
+    // Start sampling every `meanBytes` on average (0: stop)
+    void start(size_t meanBytes = AllocationProfiling::DEFAULT_SAMPLE_BYTES);
+    void stop();
+    bool isRunning() const;
+
+    // Map the return address of an allocation call to its source
+    void registerSite(const void* returnAddress, const std::string& function, const std::string& allocation);
+
+    // Drop the samples taken so far (registered sites are kept)
+    void reset();
+
+    // Per-site totals, most bytes first
+    std::vector<SiteProfile> getProfile() const;
+
+    void writeFolded(std::ostream& out) const;
+
+    // Write the profile to the TECHNOSCRIPT_ALLOC_PROFILE path, if set.
+    // Returns false if none is configured or it could not be written.
+    bool writeConfiguredProfile();
+};
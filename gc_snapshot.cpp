@@ -0,0 +1,417 @@
+#include "gc_snapshot.h"
+#include "gc.h"
+#include "gc_heap.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+    constexpr uint32_t NO_NODE = std::numeric_limits<uint32_t>::max();
+
+    // Fields per node record in the DevTools format (see writeHeapSnapshot)
+    constexpr size_t NODE_FIELDS = 7;
+
+    // Indices into the DevTools node_types list
+    constexpr int NODE_TYPE_OBJECT = 3;
+    constexpr int NODE_TYPE_SYNTHETIC = 9;
+
+    void writeJsonString(std::ostream& out, const std::string& s) {
+        out << '"';
+        for (char c : s) {
+            switch (c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        static const char hex[] = "0123456789abcdef";
+                        out << "\\u00" << hex[(c >> 4) & 0xF] << hex[c & 0xF];
+                    } else {
+                        out << c;
+                    }
+            }
+        }
+        out << '"';
+    }
+}
+
+uint32_t HeapSnapshot::internString(const std::string& s) {
+    auto it = stringIds.find(s);
+    if (it != stringIds.end()) {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(strings.size());
+    strings.push_back(s);
+    stringIds.emplace(s, id);
+    return id;
+}
+
+uint32_t HeapSnapshot::typeOf(void* cell) {
+    bool scope = HeapChunk::fromAddress(cell)->space == HeapSpace::SCOPE;
+    const void* metadata = scope ? static_cast<ScopeHeader*>(cell)->scopeMetadata
+                                 : static_cast<ObjectHeader*>(cell)->classMetadata;
+
+    // Scope and class metadata never share an address, so one cache serves both
+    auto cached = metadataTypes.find(metadata);
+    if (cached != metadataTypes.end()) {
+        return cached->second;
+    }
+
+    std::string name;
+    if (scope) {
+        const ScopeMetadata* scopeMetadata = static_cast<const ScopeMetadata*>(metadata);
+        name = scopeMetadata && scopeMetadata->name ? scopeMetadata->name : "(anonymous)";
+    } else {
+        const ClassMetadata* classMetadata = static_cast<const ClassMetadata*>(metadata);
+        name = classMetadata && classMetadata->className ? classMetadata->className : "(unknown)";
+    }
+
+    std::string key = (scope ? "scope:" : "class:") + name;
+    auto it = typeIds.find(key);
+    uint32_t type;
+    if (it != typeIds.end()) {
+        type = it->second;
+    } else {
+        type = static_cast<uint32_t>(types.size());
+        TypeSummary summary;
+        summary.name = name;
+        summary.scope = scope;
+        types.push_back(summary);
+        typeNameStrings.push_back(internString(scope ? "(scope " + name + ")" : name));
+        typeIds.emplace(key, type);
+    }
+    metadataTypes.emplace(metadata, type);
+    return type;
+}
+
+uint32_t HeapSnapshot::nodeFor(void* cell) {
+    auto it = nodeIds.find(cell);
+    if (it != nodeIds.end()) {
+        return it->second;
+    }
+
+    uint32_t id = static_cast<uint32_t>(nodes.size());
+    uint32_t type = typeOf(cell);
+    uint32_t size = static_cast<uint32_t>(GCHeap::getInstance().cellSize(cell));
+    nodes.push_back(Node{cell, type, size, 0, 0, NO_NODE, size});
+    nodeIds.emplace(cell, id);
+    types[type].count++;
+    types[type].shallowBytes += size;
+    return id;
+}
+
+void HeapSnapshot::addEdge(EdgeKind kind, uint32_t name, void* target) {
+    if (!target || !GCHeap::getInstance().contains(target)) {
+        return; // Null or not a heap cell
+    }
+    edges.push_back(Edge{nodeFor(target), name, kind});
+}
+
+void HeapSnapshot::addClosureEdges(EdgeKind kind, uint32_t name, void** scopePtrs, uint64_t closureSize) {
+    // Closure layout: [size(8)][func_addr(8)][scope_ptr1(8)]...[scope_ptrN(8)]
+    if (closureSize < 16) {
+        return;
+    }
+    uint64_t numScopes = (closureSize - 16) / 8;
+    for (uint64_t j = 0; j < numScopes; j++) {
+        addEdge(kind, name, scopePtrs[j]);
+    }
+}
+
+void HeapSnapshot::appendEdges(uint32_t node) {
+    // Same slots as ParallelMarker::traceObject / traceScope
+    void* cell = nodes[node].cell;
+    uint32_t firstEdge = static_cast<uint32_t>(edges.size());
+
+    if (HeapChunk::fromAddress(cell)->space == HeapSpace::SCOPE) {
+        ScopeHeader* header = static_cast<ScopeHeader*>(cell);
+        ScopeMetadata* metadata = header->getScopeMetadata();
+        uint8_t* dataStart = header->getDataStart();
+
+        for (int i = 0; metadata && i < metadata->numVars; i++) {
+            const VarMetadata& var = metadata->vars[i];
+            uint32_t name = internString(var.name ? var.name : "@" + std::to_string(var.offset));
+            if (var.type == DataType::OBJECT) {
+                addEdge(EdgeKind::PROPERTY, name, *reinterpret_cast<void**>(dataStart + var.offset));
+            } else if (var.type == DataType::CLOSURE) {
+                uint8_t* closurePtr = dataStart + var.offset;
+                addClosureEdges(EdgeKind::CONTEXT, name, reinterpret_cast<void**>(closurePtr + 16),
+                                *reinterpret_cast<uint64_t*>(closurePtr + 8));
+            }
+        }
+    } else {
+        ObjectHeader* header = static_cast<ObjectHeader*>(cell);
+        ClassMetadata* metadata = header->getClassMetadata();
+
+        if (metadata) {
+            Closure** closurePtrs = header->getClosurePtrs();
+            uint32_t methodName = internString("(method closure)");
+            for (int i = 0; i < metadata->numMethods; i++) {
+                Closure* closure = closurePtrs[i];
+                if (closure) {
+                    addClosureEdges(EdgeKind::INTERNAL, methodName, closure->getScopePtrs(), closure->size);
+                }
+            }
+
+            uint8_t* objectStart = static_cast<uint8_t*>(cell);
+            for (int i = 0; i < metadata->numFields; i++) {
+                const VarMetadata& field = metadata->fields[i];
+                uint32_t name = internString(field.name ? field.name : "@" + std::to_string(field.offset));
+                if (field.type == DataType::OBJECT) {
+                    addEdge(EdgeKind::PROPERTY, name, *reinterpret_cast<void**>(objectStart + field.offset));
+                } else if (field.type == DataType::CLOSURE) {
+                    uint8_t* closurePtr = objectStart + field.offset;
+                    addClosureEdges(EdgeKind::CONTEXT, name, reinterpret_cast<void**>(closurePtr + 16),
+                                    *reinterpret_cast<uint64_t*>(closurePtr));
+                }
+            }
+        }
+    }
+
+    nodes[node].firstEdge = firstEdge;
+    nodes[node].edgeCount = static_cast<uint32_t>(edges.size()) - firstEdge;
+}
+
+HeapSnapshot HeapSnapshot::capture(const std::vector<void*>& roots) {
+    HeapSnapshot snapshot;
+    snapshot.internString("");
+
+    // Type 0 is the synthetic root's (left out of the summaries)
+    TypeSummary rootType;
+    rootType.name = "(GC roots)";
+    snapshot.types.push_back(rootType);
+    snapshot.typeNameStrings.push_back(snapshot.internString(rootType.name));
+    snapshot.nodes.push_back(Node{nullptr, 0, 0, 0, 0, 0, 0});
+
+    // Root edges are numbered like array elements
+    GCHeap& heap = GCHeap::getInstance();
+    uint32_t index = 0;
+    for (void* root : roots) {
+        if (root && heap.contains(root)) {
+            snapshot.edges.push_back(Edge{snapshot.nodeFor(root), index++, EdgeKind::ELEMENT});
+        }
+    }
+    snapshot.nodes[0].edgeCount = static_cast<uint32_t>(snapshot.edges.size());
+
+    // Breadth first: nodes are numbered as they are discovered, so expanding
+    // them in number order visits each one once, with no recursion
+    for (uint32_t node = 1; node < snapshot.nodes.size(); node++) {
+        snapshot.appendEdges(node);
+    }
+
+    snapshot.computeRetainedSizes(snapshot.computeDominators());
+    return snapshot;
+}
+
+std::vector<uint32_t> HeapSnapshot::computeDominators() {
+    size_t count = nodes.size();
+
+    // Postorder numbers from an iterative depth-first walk of the root
+    std::vector<uint32_t> postorderIndex(count, NO_NODE);
+    std::vector<uint32_t> postorder;
+    postorder.reserve(count);
+    std::vector<bool> visited(count, false);
+    std::vector<std::pair<uint32_t, uint32_t>> stack;  // (node, next edge)
+    stack.emplace_back(0, 0);
+    visited[0] = true;
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next < nodes[node].edgeCount) {
+            uint32_t to = edges[nodes[node].firstEdge + next].to;
+            next++;
+            if (!visited[to]) {
+                visited[to] = true;
+                stack.emplace_back(to, 0);
+            }
+            continue;
+        }
+        postorderIndex[node] = static_cast<uint32_t>(postorder.size());
+        postorder.push_back(node);
+        stack.pop_back();
+    }
+
+    // Predecessor lists (CSR)
+    std::vector<uint32_t> predecessorStart(count + 1, 0);
+    for (const Edge& edge : edges) {
+        predecessorStart[edge.to + 1]++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        predecessorStart[i + 1] += predecessorStart[i];
+    }
+    std::vector<uint32_t> predecessors(edges.size());
+    std::vector<uint32_t> fill(predecessorStart.begin(), predecessorStart.end() - 1);
+    for (uint32_t node = 0; node < count; node++) {
+        for (uint32_t e = 0; e < nodes[node].edgeCount; e++) {
+            predecessors[fill[edges[nodes[node].firstEdge + e].to]++] = node;
+        }
+    }
+
+    // Cooper, Harvey, Kennedy: "A Simple, Fast Dominance Algorithm"
+    auto intersect = [&](uint32_t a, uint32_t b) {
+        while (a != b) {
+            while (postorderIndex[a] < postorderIndex[b]) {
+                a = nodes[a].dominator;
+            }
+            while (postorderIndex[b] < postorderIndex[a]) {
+                b = nodes[b].dominator;
+            }
+        }
+        return a;
+    };
+
+    nodes[0].dominator = 0;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        // Reverse postorder, skipping the root (last in postorder)
+        for (size_t i = postorder.size() - 1; i-- > 0;) {
+            uint32_t node = postorder[i];
+            uint32_t newDominator = NO_NODE;
+            for (uint32_t p = predecessorStart[node]; p < predecessorStart[node + 1]; p++) {
+                uint32_t predecessor = predecessors[p];
+                if (nodes[predecessor].dominator == NO_NODE) {
+                    continue; // Not processed yet
+                }
+                newDominator = newDominator == NO_NODE ? predecessor : intersect(predecessor, newDominator);
+            }
+            if (nodes[node].dominator != newDominator) {
+                nodes[node].dominator = newDominator;
+                changed = true;
+            }
+        }
+    }
+
+    return postorder;
+}
+
+void HeapSnapshot::computeRetainedSizes(const std::vector<uint32_t>& postorder) {
+    // A dominator comes after everything it dominates in postorder, so one
+    // pass in postorder adds each subtree to its parent once it is complete
+    for (uint32_t node : postorder) {
+        if (node != 0) {
+            nodes[nodes[node].dominator].retainedSize += nodes[node].retainedSize;
+        }
+    }
+
+    // Per type, count only the outermost instances on each dominator tree
+    // path: an instance dominated by another of its type is already part of
+    // that one's retained size
+    size_t count = nodes.size();
+    std::vector<uint32_t> childStart(count + 1, 0);
+    for (uint32_t node = 1; node < count; node++) {
+        childStart[nodes[node].dominator + 1]++;
+    }
+    for (size_t i = 0; i < count; i++) {
+        childStart[i + 1] += childStart[i];
+    }
+    std::vector<uint32_t> children(count > 0 ? count - 1 : 0);
+    std::vector<uint32_t> fill(childStart.begin(), childStart.end() - 1);
+    for (uint32_t node = 1; node < count; node++) {
+        children[fill[nodes[node].dominator]++] = node;
+    }
+
+    std::vector<uint32_t> openInstances(types.size(), 0);
+    std::vector<std::pair<uint32_t, uint32_t>> stack;  // (node, next child)
+    stack.emplace_back(0, childStart[0]);
+    while (!stack.empty()) {
+        auto& [node, next] = stack.back();
+        if (next < childStart[node + 1]) {
+            uint32_t child = children[next++];
+            uint32_t type = nodes[child].type;
+            if (openInstances[type]++ == 0) {
+                types[type].retainedBytes += nodes[child].retainedSize;
+            }
+            stack.emplace_back(child, childStart[child]);
+            continue;
+        }
+        if (node != 0) {
+            openInstances[nodes[node].type]--;
+        }
+        stack.pop_back();
+    }
+}
+
+std::vector<HeapSnapshot::TypeSummary> HeapSnapshot::summary() const {
+    std::vector<TypeSummary> result(types.begin() + (types.empty() ? 0 : 1), types.end());
+    std::stable_sort(result.begin(), result.end(), [](const TypeSummary& a, const TypeSummary& b) {
+        return a.retainedBytes > b.retainedBytes;
+    });
+    return result;
+}
+
+void HeapSnapshot::writeSummary(std::ostream& out) const {
+    for (const TypeSummary& type : summary()) {
+        out << "{\"kind\":\"" << (type.scope ? "scope" : "class") << "\",\"name\":";
+        writeJsonString(out, type.name);
+        out << ",\"count\":" << type.count
+            << ",\"shallow_bytes\":" << type.shallowBytes
+            << ",\"retained_bytes\":" << type.retainedBytes
+            << "}\n";
+    }
+}
+
+void HeapSnapshot::writeHeapSnapshot(std::ostream& out) const {
+    // Field layout as documented for V8's heap snapshots
+    out << "{\"snapshot\":{\"meta\":{"
+        << "\"node_fields\":[\"type\",\"name\",\"id\",\"self_size\",\"edge_count\",\"trace_node_id\",\"detachedness\"],"
+        << "\"node_types\":[[\"hidden\",\"array\",\"string\",\"object\",\"code\",\"closure\",\"regexp\",\"number\","
+        << "\"native\",\"synthetic\",\"concatenated string\",\"sliced string\",\"symbol\",\"bigint\",\"object shape\"],"
+        << "\"string\",\"number\",\"number\",\"number\",\"number\",\"number\"],"
+        << "\"edge_fields\":[\"type\",\"name_or_index\",\"to_node\"],"
+        << "\"edge_types\":[[\"context\",\"element\",\"property\",\"internal\",\"hidden\",\"shortcut\",\"weak\"],"
+        << "\"string_or_number\",\"node\"],"
+        << "\"trace_function_info_fields\":[\"function_id\",\"name\",\"script_name\",\"script_id\",\"line\",\"column\"],"
+        << "\"trace_node_fields\":[\"id\",\"function_info_index\",\"count\",\"size\",\"children\"],"
+        << "\"sample_fields\":[\"timestamp_us\",\"last_assigned_id\"],"
+        << "\"location_fields\":[\"object_index\",\"script_id\",\"line\",\"column\"]},"
+        << "\"node_count\":" << nodes.size()
+        << ",\"edge_count\":" << edges.size()
+        << ",\"trace_function_count\":0},\n";
+
+    // Node ids are odd, like V8's for heap objects
+    out << "\"nodes\":[";
+    for (size_t i = 0; i < nodes.size(); i++) {
+        const Node& node = nodes[i];
+        out << (i ? ",\n" : "")
+            << (i == 0 ? NODE_TYPE_SYNTHETIC : NODE_TYPE_OBJECT) << ','
+            << typeNameStrings[node.type] << ','
+            << (2 * i + 1) << ','
+            << node.selfSize << ','
+            << node.edgeCount << ",0,0";
+    }
+
+    // Edge types are indices into edge_types
+    out << "],\n\"edges\":[";
+    for (size_t i = 0; i < edges.size(); i++) {
+        const Edge& edge = edges[i];
+        int type = 0;
+        switch (edge.kind) {
+            case EdgeKind::CONTEXT:  type = 0; break;
+            case EdgeKind::ELEMENT:  type = 1; break;
+            case EdgeKind::PROPERTY: type = 2; break;
+            case EdgeKind::INTERNAL: type = 3; break;
+        }
+        out << (i ? ",\n" : "") << type << ',' << edge.name << ',' << edge.to * NODE_FIELDS;
+    }
+
+    out << "],\n\"trace_function_infos\":[],\"trace_tree\":[],\"samples\":[],\"locations\":[],\n\"strings\":[";
+    for (size_t i = 0; i < strings.size(); i++) {
+        out << (i ? ",\n" : "");
+        writeJsonString(out, strings[i]);
+    }
+    out << "]}\n";
+}
+
+uint64_t HeapSnapshot::retainedSize(void* cell) const {
+    auto it = nodeIds.find(cell);
+    return it == nodeIds.end() ? 0 : nodes[it->second].retainedSize;
+}
+
+void* HeapSnapshot::dominatorOf(void* cell) const {
+    auto it = nodeIds.find(cell);
+    if (it == nodeIds.end()) {
+        return nullptr;
+    }
+    return nodes[nodes[it->second].dominator].cell;
+}
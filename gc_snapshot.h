@@ -0,0 +1,106 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Heap snapshot: the graph of cells reachable from a root set, with the
+// dominator tree and retained sizes worked out.
+//
+// capture() walks from the roots (GarbageCollector::collectAllRoots) the way
+// the marker does - ClassMetadata fields and method closures for objects,
+// ScopeMetadata variables for scopes - but records every edge instead of
+// setting mark bits, so it does not disturb a collection. Dominators are
+// computed with the iterative Cooper-Harvey-Kennedy algorithm over a
+// synthetic "(GC roots)" node; a cell's retained size is its own size plus
+// that of every cell it dominates (what a collection would free if the cell
+// became unreachable).
+//
+// Node types are named after the class (objects) or the function or block
+// the scope belongs to (ScopeMetadata::name, shown as "(scope <name>)").
+//
+// Not synchronized with the mutators: the caller makes sure no cell can be
+// freed during capture() (the GC runs it under its cycle lock). References
+// rewritten while it runs may be seen before or after the change.
+class HeapSnapshot {
+public:
+    // Totals for one class or scope layout
+    struct TypeSummary {
+        std::string name;
+        bool scope = false;
+        uint64_t count = 0;
+        uint64_t shallowBytes = 0;
+        // Retained by the instances not dominated by another instance of the
+        // same type, so nested instances are not counted twice
+        uint64_t retainedBytes = 0;
+    };
+
+private:
+    struct Node {
+        void* cell;
+        uint32_t type;          // Index into types
+        uint32_t selfSize;
+        uint32_t firstEdge;     // Edges of a node are contiguous
+        uint32_t edgeCount;
+        uint32_t dominator;     // Immediate dominator (the root dominates itself)
+        uint64_t retainedSize;
+    };
+
+    enum class EdgeKind : uint8_t {
+        ELEMENT,                // Root list entry (name is the index)
+        PROPERTY,               // Object field or scope variable
+        CONTEXT,                // Scope captured by a closure
+        INTERNAL,               // Scope captured by a method closure
+    };
+
+    struct Edge {
+        uint32_t to;
+        uint32_t name;          // String index, or the index for ELEMENT
+        EdgeKind kind;
+    };
+
+    std::vector<Node> nodes;    // nodes[0] is the synthetic root
+    std::vector<Edge> edges;
+    std::vector<TypeSummary> types;
+    std::vector<std::string> strings;
+    std::vector<uint32_t> typeNameStrings;  // DevTools node name of each type
+    std::unordered_map<void*, uint32_t> nodeIds;
+    std::unordered_map<std::string, uint32_t> stringIds;
+    std::unordered_map<std::string, uint32_t> typeIds;       // Keyed by kind and name
+    std::unordered_map<const void*, uint32_t> metadataTypes; // Cache of the above per metadata
+
+    uint32_t internString(const std::string& s);
+    uint32_t typeOf(void* cell);
+    uint32_t nodeFor(void* cell);
+    void addEdge(EdgeKind kind, uint32_t name, void* target);
+    void addClosureEdges(EdgeKind kind, uint32_t name, void** scopePtrs, uint64_t closureSize);
+    void appendEdges(uint32_t node);
+    // Fills in Node::dominator, returns the nodes in postorder
+    std::vector<uint32_t> computeDominators();
+    void computeRetainedSizes(const std::vector<uint32_t>& postorder);
+
+public:
+    // Walk everything reachable from `roots` (null and non-heap pointers are
+    // ignored)
+    static HeapSnapshot capture(const std::vector<void*>& roots);
+
+    // Chrome DevTools .heapsnapshot JSON (Memory panel, "Load profile")
+    void writeHeapSnapshot(std::ostream& out) const;
+
+    // One JSON object per line and type, largest retained size first
+    void writeSummary(std::ostream& out) const;
+
+    // Per-type totals, largest retained size first
+    std::vector<TypeSummary> summary() const;
+
+    // Reachable cells (the synthetic root not included)
+    size_t cellCount() const { return nodes.empty() ? 0 : nodes.size() - 1; }
+    uint64_t totalBytes() const { return nodes.empty() ? 0 : nodes[0].retainedSize; }
+
+    // Retained size of a cell, 0 if it was not reached
+    uint64_t retainedSize(void* cell) const;
+    // Immediate dominator of a cell (nullptr: only the roots dominate it)
+    void* dominatorOf(void* cell) const;
+};
@@ -0,0 +1,80 @@
+#include "gc_stackmap.h"
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+StackMapTable& StackMapTable::getInstance() {
+    static StackMapTable instance;
+    return instance;
+}
+
+static std::string describe(const StackMap& map) {
+    std::ostringstream out;
+    out << (map.kind == StackMap::Kind::CALL ? "call" : "safepoint") << " at " << map.returnAddress;
+    return out.str();
+}
+
+void StackMapTable::registerMaps(std::vector<StackMap> newMaps) {
+    using namespace StackMapLayout;
+
+    // Validate before touching the table, so a bad batch leaves it unchanged
+    for (const StackMap& map : newMaps) {
+        if (!map.returnAddress) {
+            throw std::runtime_error("Stack map without a return address");
+        }
+        if (map.registers >> NUM_REGISTERS || map.registers & (1u << RSP)) {
+            throw std::runtime_error("Stack map lists an invalid register: " + describe(map));
+        }
+        if (map.kind == StackMap::Kind::CALL && (map.registers & ~CALLEE_SAVED)) {
+            throw std::runtime_error("Stack map lists a register the callee doesn't preserve: " + describe(map));
+        }
+    }
+
+    std::sort(newMaps.begin(), newMaps.end(), [](const StackMap& a, const StackMap& b) {
+        return a.returnAddress < b.returnAddress;
+    });
+
+    std::lock_guard<std::mutex> lock(mutex);
+    for (size_t i = 0; i < newMaps.size(); i++) {
+        if ((i > 0 && newMaps[i].returnAddress == newMaps[i - 1].returnAddress) ||
+            findLocked(newMaps[i].returnAddress)) {
+            throw std::runtime_error("Duplicate stack map: " + describe(newMaps[i]));
+        }
+    }
+
+    size_t oldSize = maps.size();
+    maps.insert(maps.end(), std::make_move_iterator(newMaps.begin()), std::make_move_iterator(newMaps.end()));
+    std::inplace_merge(maps.begin(), maps.begin() + oldSize, maps.end(), [](const StackMap& a, const StackMap& b) {
+        return a.returnAddress < b.returnAddress;
+    });
+}
+
+void StackMapTable::clear() {
+    std::lock_guard<std::mutex> lock(mutex);
+    maps.clear();
+}
+
+void StackMapTable::setSegmentReturnAddress(const void* address) {
+    std::lock_guard<std::mutex> lock(mutex);
+    segmentReturn = address;
+}
+
+size_t StackMapTable::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return maps.size();
+}
+
+bool StackMapTable::contains(const void* returnAddress) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return findLocked(returnAddress) != nullptr;
+}
+
+const StackMap* StackMapTable::findLocked(const void* returnAddress) const {
+    auto it = std::lower_bound(maps.begin(), maps.end(), returnAddress, [](const StackMap& map, const void* address) {
+        return map.returnAddress < address;
+    });
+    if (it == maps.end() || it->returnAddress != returnAddress) {
+        return nullptr;
+    }
+    return &*it;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// Frame layout every generated function shares, which the stack walk relies on
+namespace StackMapLayout {
+    // Register save area the safepoint poll hands to gc_safepoint_poll: one
+    // qword per general purpose register, indexed by its x86 encoding
+    // (rax = 0 ... r15 = 15; the rsp entry is unused)
+    constexpr int NUM_REGISTERS = 16;
+    constexpr int REGISTER_AREA_SIZE = NUM_REGISTERS * 8;
+    constexpr int RSP = 4;
+    constexpr int R14 = 14;
+    constexpr int R15 = 15;
+
+    // Prologue: push rbp; mov rbp, rsp; push r14; push r15. Offsets from rbp.
+    constexpr int SAVED_FRAME_POINTER_OFFSET = 0;
+    constexpr int RETURN_ADDRESS_OFFSET = 8;
+    constexpr int SAVED_R14_OFFSET = -8;
+    constexpr int SAVED_R15_OFFSET = -16;
+    
+    // A frame at the top of a goroutine stack segment returns into
+    // technoscript_lessstack, with the caller's rsp (pointing at the real
+    // return address) right above that (see goroutine.cpp)
+    constexpr int SEGMENT_CALLER_STACK_OFFSET = 16;
+
+    // The registers a call site may list: the ones every callee saves in its
+    // prologue, so the walk can read them back from the callee's frame
+    constexpr uint32_t CALLEE_SAVED = (1u << R14) | (1u << R15);
+
+    // Upper bound on the frames walked (guards against a broken rbp chain)
+    constexpr size_t MAX_FRAMES = 1 << 16;
+}
+
+// Where a function keeps its references at one place it can be stopped.
+//
+// A stack map describes the frame of the function that contains the call: a
+// safepoint poll (the call to gc_safepoint_poll) or a call into another
+// generated function. It is keyed by the return address of that call.
+// References live in the registers of the `registers` mask and in the frame
+// slots at `slots` (offsets from the function's rbp).
+struct StackMap {
+    enum class Kind : uint8_t {
+        SAFEPOINT,      // Poll: every register is in the save area
+        CALL,           // Call into generated code: only CALLEE_SAVED registers survive it
+    };
+
+    const void* returnAddress = nullptr;
+    Kind kind = Kind::SAFEPOINT;
+    uint32_t registers = 0;         // Bit n: register n holds a reference (or null)
+    std::vector<int32_t> slots;     // Frame slots holding a reference (or null)
+};
+
+// Stack maps of all generated code, and the walk over a thread's JIT frames.
+//
+// The code generator registers the maps of the code it commits
+// (CodeGenerator::registerStackMaps). A thread acknowledging a safepoint
+// handshake walks its own frames from the poll outwards through the rbp
+// chain: the poll's map first, then at each frame the map of the return
+// address its caller pushed. The walk ends at the first return address
+// without a map, where generated code was entered from the runtime
+// (Codegen::run, Goroutine::run). Going up a frame, r14 and r15 are read
+// back from where the callee's prologue saved them; nothing else survives a
+// call, which registerMaps enforces. A frame that returns into the segment
+// return address continues with the real one from the caller's segment.
+class StackMapTable {
+private:
+    mutable std::mutex mutex;
+    std::vector<StackMap> maps;     // Sorted by return address
+    const void* segmentReturn = nullptr;
+
+    StackMapTable() = default;
+
+    // Map of a return address, or null. Caller holds the mutex.
+    const StackMap* findLocked(const void* returnAddress) const;
+
+public:
+    StackMapTable(const StackMapTable&) = delete;
+    StackMapTable& operator=(const StackMapTable&) = delete;
+
+    static StackMapTable& getInstance();
+
+    // Add the maps of newly committed code. Throws std::runtime_error for a
+    // map that lists rsp or, at a call, a register the callee doesn't
+    // preserve, and for a return address that already has a map.
+    void registerMaps(std::vector<StackMap> newMaps);
+
+    // Drop every map (tests)
+    void clear();
+    
+    // technoscript_lessstack, set by the event loop
+    void setSegmentReturnAddress(const void* address);
+
+    size_t size() const;
+    bool contains(const void* returnAddress) const;
+
+    // Call visit(reference) for every non-null reference in the JIT frames
+    // above a safepoint: `pc` is the poll's return address, `framePointer`
+    // the rbp of the function that polled and `registers` the poll's save
+    // area. Returns the number of frames walked (0 when pc has no map).
+    template<typename Visitor>
+    size_t scanFrames(const void* pc, const void* framePointer, const uint64_t* registers, Visitor&& visit) const;
+};
+
+template<typename Visitor>
+size_t StackMapTable::scanFrames(const void* pc, const void* framePointer, const uint64_t* registers,
+                                 Visitor&& visit) const {
+    using namespace StackMapLayout;
+
+    uint64_t values[NUM_REGISTERS];
+    for (int i = 0; i < NUM_REGISTERS; i++) {
+        values[i] = registers ? registers[i] : 0;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    const uint8_t* frame = static_cast<const uint8_t*>(framePointer);
+    size_t frames = 0;
+
+    while (frame && frames < MAX_FRAMES) {
+        const StackMap* map = findLocked(pc);
+        if (!map) {
+            break;
+        }
+        frames++;
+
+        for (int reg = 0; reg < NUM_REGISTERS; reg++) {
+            if ((map->registers & (1u << reg)) && values[reg]) {
+                visit(reinterpret_cast<void*>(values[reg]));
+            }
+        }
+        for (int32_t slot : map->slots) {
+            void* reference = *reinterpret_cast<void* const*>(frame + slot);
+            if (reference) {
+                visit(reference);
+            }
+        }
+
+        // Up to the caller: its r14/r15 at the call are what our prologue saved
+        values[R14] = *reinterpret_cast<const uint64_t*>(frame + SAVED_R14_OFFSET);
+        values[R15] = *reinterpret_cast<const uint64_t*>(frame + SAVED_R15_OFFSET);
+        pc = *reinterpret_cast<const void* const*>(frame + RETURN_ADDRESS_OFFSET);
+        if (pc && pc == segmentReturn) {
+            pc = **reinterpret_cast<const void* const* const*>(frame + SEGMENT_CALLER_STACK_OFFSET);
+        }
+        frame = *reinterpret_cast<const uint8_t* const*>(frame + SAVED_FRAME_POINTER_OFFSET);
+    }
+    return frames;
+}
@@ -1,17 +1,20 @@
 #include "goroutine.h"
 #include "lockfree_queue.h"
 #include "gc.h"
+#include "gc_stackmap.h"
 #include <iostream>
 #include <algorithm>
 #include <cstring>
 #include <cstdlib>
-#include <asmjit/asmjit.h>
 #include <mutex>
-#include <pthread.h>
+#include <exception>
+#include <stdexcept>
 #include <signal.h>
-
-// Forward declaration of GC signal handler from gc.cpp
-extern "C" void gc_checkpoint_signal_handler(int sig);
+#include <ucontext.h>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 // Static member initialization
 uint64_t Goroutine::nextId = 0;
@@ -20,12 +23,330 @@ uint64_t EventLoop::nextPromiseId = 1;
 // Thread-local current task being processed by this worker thread (thread-local)
 thread_local std::shared_ptr<Goroutine> currentTask = nullptr;
 
+// Sleep while *word == expected (or until the timeout, relative). Returns
+// at once if it has changed already; spurious returns are allowed, so
+// callers recheck.
+static void futexWait(std::atomic<uint32_t>* word, uint32_t expected, const timespec* timeout = nullptr) {
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be a plain 32-bit word");
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAIT_PRIVATE, expected, timeout, nullptr, 0);
+}
+
+static void futexWake(std::atomic<uint32_t>* word, int count) {
+    syscall(SYS_futex, reinterpret_cast<uint32_t*>(word), FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+}
+
+// Worker this thread is, if any: where scheduleGoroutine queues goroutines
+static thread_local WorkerThread* currentWorker = nullptr;
+
+// Goroutine whose stack this thread is on, for the stack overflow handler
+// and the segment switches (a plain pointer: a signal handler can't touch
+// currentTask)
+static thread_local Goroutine* runningGoroutine = nullptr;
+
+// What generated code compares rsp against at function entry (see
+// Goroutine::stackLimitThreadOffset). 0 lets everything through.
+static thread_local uintptr_t threadStackLimit = 0;
+
+// Context switch. Both sides push the same frame (ContextLayout): rbp, rbx,
+// r12-r15 and the SSE/x87 control words, which the SysV ABI requires a
+// callee to preserve. Everything else is caller-saved, so the C++ caller of
+// technoscript_switch_context has already spilled what it needs.
+//
+// A new goroutine stack holds that frame with the trampoline as return
+// address and the Goroutine* in r12. The trampoline calls
+// technoscript_goroutine_main on a 16-byte aligned stack; rbp = 0 and the
+// undefined return address end the frame chain (stack walks, debuggers).
+asm(R"(
+    .text
+    .globl technoscript_switch_context
+    .type technoscript_switch_context, @function
+technoscript_switch_context:
+    .cfi_startproc
+    pushq %rbp
+    pushq %rbx
+    pushq %r12
+    pushq %r13
+    pushq %r14
+    pushq %r15
+    subq $8, %rsp
+    stmxcsr (%rsp)
+    fnstcw 4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 4(%rsp)
+    addq $8, %rsp
+    popq %r15
+    popq %r14
+    popq %r13
+    popq %r12
+    popq %rbx
+    popq %rbp
+    ret
+    .cfi_endproc
+    .size technoscript_switch_context, .-technoscript_switch_context
+
+    .globl technoscript_goroutine_trampoline
+    .type technoscript_goroutine_trampoline, @function
+technoscript_goroutine_trampoline:
+    .cfi_startproc
+    .cfi_undefined rip
+    movq %r12, %rdi
+    call technoscript_goroutine_main@PLT
+    ud2
+    .cfi_endproc
+    .size technoscript_goroutine_trampoline, .-technoscript_goroutine_trampoline
+)");
+
+// Segment switches. morestack is called at a generated function's entry,
+// so [rsp] is where the function continues and [rsp+8] its return address;
+// nothing but r14/r15 (callee-saved) is live, but it keeps the argument and
+// scratch registers anyway. technoscript_stack_grow lays out the top of the
+// next segment as
+//
+//   top-16: caller's rsp (pointing at the function's return address)
+//   top-24: technoscript_lessstack   <- the function's return address now
+//   top-32: where the function continues
+//
+// and returns top-32, which morestack switches to and returns through. The
+// function then runs there, and its ret lands in lessstack with rsp at
+// top-16: back to the caller's segment, restore the limit, return for it.
+asm(R"(
+    .text
+    .globl technoscript_morestack
+    .type technoscript_morestack, @function
+technoscript_morestack:
+    .cfi_startproc
+    pushq %rax
+    .cfi_adjust_cfa_offset 8
+    pushq %rcx
+    .cfi_adjust_cfa_offset 8
+    pushq %rdx
+    .cfi_adjust_cfa_offset 8
+    pushq %rsi
+    .cfi_adjust_cfa_offset 8
+    pushq %rdi
+    .cfi_adjust_cfa_offset 8
+    pushq %r8
+    .cfi_adjust_cfa_offset 8
+    pushq %r9
+    .cfi_adjust_cfa_offset 8
+    pushq %r10
+    .cfi_adjust_cfa_offset 8
+    leaq 64(%rsp), %rdi
+    call technoscript_stack_grow@PLT
+    movq %rax, %r11
+    popq %r10
+    popq %r9
+    popq %r8
+    popq %rdi
+    popq %rsi
+    popq %rdx
+    popq %rcx
+    popq %rax
+    movq %r11, %rsp
+    ret
+    .cfi_endproc
+    .size technoscript_morestack, .-technoscript_morestack
+
+    .globl technoscript_lessstack
+    .type technoscript_lessstack, @function
+technoscript_lessstack:
+    .cfi_startproc
+    .cfi_undefined rip
+    movq (%rsp), %rsp
+    pushq %rax
+    pushq %rdx
+    subq $40, %rsp
+    movdqu %xmm0, (%rsp)
+    movdqu %xmm1, 16(%rsp)
+    call technoscript_stack_shrink@PLT
+    movdqu (%rsp), %xmm0
+    movdqu 16(%rsp), %xmm1
+    addq $40, %rsp
+    popq %rdx
+    popq %rax
+    ret
+    .cfi_endproc
+    .size technoscript_lessstack, .-technoscript_lessstack
+)");
+
+// Calls function(argument) with rsp at stackTop (16-byte aligned) and comes
+// back to the caller's stack. rbp keeps the caller's frame, which the CFI
+// follows, so debuggers see through it. Nothing may unwind through it.
+asm(R"(
+    .text
+    .globl technoscript_call_on_stack
+    .type technoscript_call_on_stack, @function
+technoscript_call_on_stack:
+    .cfi_startproc
+    pushq %rbp
+    .cfi_adjust_cfa_offset 8
+    .cfi_rel_offset rbp, 0
+    movq %rsp, %rbp
+    .cfi_def_cfa_register rbp
+    movq %rdi, %rsp
+    movq %rdx, %rdi
+    call *%rsi
+    movq %rbp, %rsp
+    popq %rbp
+    .cfi_def_cfa rsp, 8
+    ret
+    .cfi_endproc
+    .size technoscript_call_on_stack, .-technoscript_call_on_stack
+)");
+
+extern "C" void technoscript_goroutine_trampoline();
+
+static struct sigaction previousSegvAction;
+
+// Generated code ranges (Goroutine::registerGeneratedCode). A range is
+// written before the count that makes it visible to the handler.
+struct CodeRange {
+    uintptr_t start;
+    uintptr_t end;
+};
+static CodeRange generatedCode[Goroutine::MAX_CODE_RANGES];
+static std::atomic<size_t> generatedCodeRanges{0};
+static std::mutex generatedCodeMutex;
+
+void Goroutine::registerGeneratedCode(const void* start, size_t size) {
+    std::lock_guard<std::mutex> lock(generatedCodeMutex);
+    size_t count = generatedCodeRanges.load(std::memory_order_relaxed);
+    if (count == MAX_CODE_RANGES) {
+        throw std::runtime_error("Too many generated code ranges");
+    }
+    uintptr_t begin = reinterpret_cast<uintptr_t>(start);
+    generatedCode[count] = {begin, begin + size};
+    generatedCodeRanges.store(count + 1, std::memory_order_release);
+}
+
+bool Goroutine::isGeneratedCode(const void* address) {
+    uintptr_t a = reinterpret_cast<uintptr_t>(address);
+    size_t count = generatedCodeRanges.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        if (a >= generatedCode[i].start && a < generatedCode[i].end) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A goroutine that runs past the bottom of a segment faults in its guard.
+// In generated code (a frame larger than the reserve) the handler, on the
+// thread's signal stack, resumes the thread in technoscript_goroutine_overflow
+// on the top of its first segment, which ends just that goroutine: JIT frames
+// can't be unwound, but they hold no locks and own nothing to destroy.
+// Runtime C++ code (a call that needed more than the reserve) may hold the
+// pool's, the promise table's or malloc's locks, so abandoning its stack
+// could hang every other thread: that overflow is fatal, and goes to the
+// previous handler like any other fault.
+static void stackOverflowHandler(int signal, siginfo_t* info, void* uc) {
+    Goroutine* goroutine = runningGoroutine;
+    ucontext_t* context = static_cast<ucontext_t*>(uc);
+    const void* pc = reinterpret_cast<const void*>(context->uc_mcontext.gregs[REG_RIP]);
+    if (goroutine && goroutine->context->inGuard(info->si_addr) && Goroutine::isGeneratedCode(pc)) {
+        uintptr_t top = reinterpret_cast<uintptr_t>(goroutine->context->segments[0].top()) & ~uintptr_t(15);
+        context->uc_mcontext.gregs[REG_RSP] = static_cast<greg_t>(top - ContextLayout::FRAME_SIZE - 8);  // As if called
+        context->uc_mcontext.gregs[REG_RBP] = 0;
+        context->uc_mcontext.gregs[REG_RDI] = reinterpret_cast<greg_t>(goroutine);
+        context->uc_mcontext.gregs[REG_RIP] = reinterpret_cast<greg_t>(&technoscript_goroutine_overflow);
+        return;
+    }
+    if (goroutine && goroutine->context->inGuard(info->si_addr)) {
+        // No iostreams in a signal handler
+        static const char message[] = "Fatal error: stack overflow in runtime code on a goroutine stack\n";
+        ssize_t written = write(STDERR_FILENO, message, sizeof(message) - 1);
+        (void)written;
+    }
+    
+    if (previousSegvAction.sa_flags & SA_SIGINFO) {
+        previousSegvAction.sa_sigaction(signal, info, uc);
+    } else if (previousSegvAction.sa_handler != SIG_DFL && previousSegvAction.sa_handler != SIG_IGN) {
+        previousSegvAction.sa_handler(signal);
+    } else {
+        // Default action: restore it, and the faulting instruction reruns into it
+        sigaction(SIGSEGV, &previousSegvAction, nullptr);
+    }
+}
+
+static void installStackOverflowHandler() {
+    struct sigaction action = {};
+    action.sa_sigaction = stackOverflowHandler;
+    action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(SIGSEGV, &action, &previousSegvAction) != 0) {
+        std::cerr << "Warning: could not install the goroutine stack overflow handler" << std::endl;
+    }
+}
+
+GoroutineContext::GoroutineContext(size_t stackSz) : stackPointer(nullptr), schedulerStackPointer(nullptr) {
+    segments.push_back(GoroutineStackPool::getInstance().acquire(stackSz));
+}
+
+GoroutineContext::~GoroutineContext() {
+    for (const GoroutineStack& stack : segments) {
+        GoroutineStackPool::getInstance().release(stack);
+    }
+}
+
+uint8_t* GoroutineContext::pushSegment() {
+    GoroutineStackPool& pool = GoroutineStackPool::getInstance();
+    
+    // A spare is what the last call that needed one left: reuse it, so a
+    // call at a segment boundary in a loop doesn't go to the pool every time
+    if (segment + 1 == segments.size()) {
+        size_t total = 0;
+        for (const GoroutineStack& stack : segments) {
+            total += stack.size;
+        }
+        size_t next = std::min(segments.back().size * 2, StackPoolLayout::MAX_SEGMENT_SIZE);
+        if (total + next > pool.getMaxStackSize()) {
+            return nullptr;
+        }
+        segments.push_back(pool.acquire(next));
+    }
+    segment++;
+    return segments[segment].top();
+}
+
+void GoroutineContext::releaseSpareSegments() {
+    GoroutineStackPool& pool = GoroutineStackPool::getInstance();
+    while (segments.size() > segment + 1) {
+        pool.release(segments.back());
+        segments.pop_back();
+    }
+}
+
+bool GoroutineContext::inGuard(const void* address) const {
+    for (const GoroutineStack& stack : segments) {
+        if (stack.inGuard(address)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GoroutineContext::prepare(Goroutine* goroutine) {
+    using namespace ContextLayout;
+    
+    // The trampoline starts 16-byte aligned, right above the initial frame
+    uintptr_t top = reinterpret_cast<uintptr_t>(segments[0].top()) & ~uintptr_t(15);
+    uint8_t* frame = reinterpret_cast<uint8_t*>(top - 16 - FRAME_SIZE);
+    std::memset(frame, 0, FRAME_SIZE);
+    
+    *reinterpret_cast<uint32_t*>(frame + MXCSR_OFFSET) = DEFAULT_MXCSR;
+    *reinterpret_cast<uint16_t*>(frame + FPU_CONTROL_OFFSET) = DEFAULT_FPU_CONTROL;
+    *reinterpret_cast<Goroutine**>(frame + R12_OFFSET) = goroutine;
+    *reinterpret_cast<void**>(frame + RETURN_ADDRESS_OFFSET) = reinterpret_cast<void*>(&technoscript_goroutine_trampoline);
+    stackPointer = frame;
+}
+
 // Goroutine implementation
 Goroutine::Goroutine(std::function<void()> entry) : id(++nextId), state(GoroutineState::READY), entryPoint(std::move(entry)) {
     context = std::make_unique<GoroutineContext>();
+    context->prepare(this);
     gcState = std::make_unique<GoroutineGCState>();
-    // initialize per-goroutine allocated objects list
-    gcState->allocatedObjects = new SafeUnorderedList();
     allocatedItemsListPointer = malloc((3 + 8) * sizeof(uint64_t)); // initial space for 8 items + 3 metadata
     // set first 0, second 8, third, 0
     uint64_t* ptr = reinterpret_cast<uint64_t*>(allocatedItemsListPointer);
@@ -35,37 +356,77 @@ Goroutine::Goroutine(std::function<void()> entry) : id(++nextId), state(Goroutin
 }
 
 void Goroutine::run() {
-    if (state != GoroutineState::READY && state != GoroutineState::AWAITING_PROMISE) {
+    if (state != GoroutineState::READY) {
         return;
     }
     
     state = GoroutineState::RUNNING;
     
-    try {
-        // Set up stack context and run the goroutine
-        if (setjmp(context->registers) == 0) {
-            // First time - set up stack and call entry point
-            entryPoint();
-        }
-        // If we return here via longjmp, check if we were resumed from await
-        else if (state == GoroutineState::AWAITING_PROMISE) {
-            // We were resumed from an await - continue execution
-            // The promise result is already stored in promiseResolvedValue
-            return; // Let the goroutine continue from where it left off
+    // The GC's safepoint handshake waits for this goroutine until it leaves
+    // JIT code again (see GoroutineGCState::enterManagedCode). Parked, it
+    // is outside: its scopes stay roots through its shadow stack.
+    gcState->enterManagedCode();
+    
+    // The overflow handler runs on the signal stack
+    GoroutineStackPool::prepareThread();
+    
+    // Runs the goroutine on its own stack until it finishes or parks
+    runningGoroutine = this;
+    threadStackLimit = context->stackLimit();
+    technoscript_switch_context(&context->schedulerStackPointer, context->stackPointer);
+    threadStackLimit = 0;
+    runningGoroutine = nullptr;
+    
+    gcState->leaveManagedCode();
+}
+
+void Goroutine::runOnWorkerStack(const std::function<void()>& work) {
+    Goroutine* goroutine = runningGoroutine;
+    if (!goroutine) {
+        work();
+        return;
+    }
+    
+    struct Call {
+        const std::function<void()>* work;
+        std::exception_ptr error;
+    } call{&work, nullptr};
+    
+    // The worker's stack is free below the frame technoscript_switch_context
+    // left there. Off the goroutine's stack for the call: a nested call runs
+    // in place, and no stack limit applies.
+    uintptr_t top = reinterpret_cast<uintptr_t>(goroutine->context->schedulerStackPointer) & ~uintptr_t(15);
+    uintptr_t limit = threadStackLimit;
+    runningGoroutine = nullptr;
+    threadStackLimit = 0;
+    technoscript_call_on_stack(reinterpret_cast<void*>(top), [](void* argument) {
+        Call* call = static_cast<Call*>(argument);
+        try {
+            (*call->work)();
+        } catch (...) {
+            call->error = std::current_exception();
         }
-        
-        // If we reach here naturally, the goroutine finished
-        state = GoroutineState::DEAD;
-    } catch (const std::exception& e) {
-        std::cerr << "Goroutine " << id << " crashed: " << e.what() << std::endl;
-        state = GoroutineState::DEAD;
+    }, &call);
+    threadStackLimit = limit;
+    runningGoroutine = goroutine;
+    
+    if (call.error) {
+        std::rethrow_exception(call.error);
     }
 }
 
+intptr_t Goroutine::stackLimitThreadOffset() {
+    return reinterpret_cast<intptr_t>(&threadStackLimit) - reinterpret_cast<intptr_t>(__builtin_thread_pointer());
+}
+
 void Goroutine::suspend(uint64_t promiseId) {
     awaitingPromiseId = promiseId;
     state = GoroutineState::AWAITING_PROMISE;
-    // The actual suspension happens via longjmp in the runtime
+    
+    // Back to the worker, which finishes parking us (EventLoop::parkGoroutine).
+    // We may come back on another worker thread: thread-locals read before
+    // this point are stale after it.
+    technoscript_switch_context(&context->stackPointer, context->schedulerStackPointer);
 }
 
 void Goroutine::resume(int64_t resolvedValue) {
@@ -73,12 +434,25 @@ void Goroutine::resume(int64_t resolvedValue) {
     awaitingPromiseId = 0;
     state = GoroutineState::READY;
     // Note: Goroutine is re-enqueued directly by EventLoop::resolvePromise()
-    // No need to enqueue here - keeps promise resolution and task queueing unified
+    // (or parkGoroutine) - keeps promise resolution and task queueing unified
 }
 
 // EventLoop implementation
 EventLoop::EventLoop() : maxWorkers(std::thread::hardware_concurrency()) {
     if (maxWorkers == 0) maxWorkers = 4; // Fallback
+    if (const char* env = std::getenv("TECHNOSCRIPT_WORKERS")) {
+        long requested = std::strtol(env, nullptr, 10);
+        if (requested > 0) {
+            maxWorkers = static_cast<size_t>(requested);
+        }
+    }
+    // Workers index workerThreads without the lock
+    workerThreads.reserve(maxWorkers);
+    installStackOverflowHandler();
+    
+    // Frames at the top of a segment return into technoscript_lessstack;
+    // the GC's stack walk steps over it to the real caller
+    StackMapTable::getInstance().setSegmentReturnAddress(reinterpret_cast<const void*>(&technoscript_lessstack));
     std::cout << "EventLoop initialized with max " << maxWorkers << " workers (lazy instantiation)" << std::endl;
 }
 
@@ -86,16 +460,45 @@ EventLoop::~EventLoop() {
     shutdown();
 }
 
-void EventLoop::spawnGoroutine(std::function<void()> entryPoint) {
+std::shared_ptr<Goroutine> EventLoop::registerGoroutine(std::function<void()> entryPoint) {
     auto goroutine = std::make_shared<Goroutine>(std::move(entryPoint));
     
     // Register goroutine in the global registry for GC
-    {
-        std::lock_guard<std::mutex> lock(goroutineRegistryMutex);
-        allGoroutines.insert(goroutine);
+    std::lock_guard<std::mutex> lock(goroutineRegistryMutex);
+    allGoroutines.insert(goroutine);
+    return goroutine;
+}
+
+void EventLoop::spawnGoroutine(std::function<void()> entryPoint) {
+    auto goroutine = registerGoroutine(std::move(entryPoint));
+    uint64_t id = goroutine->id;
+    outstandingWork.fetch_add(1);
+    scheduleGoroutine(std::move(goroutine));
+    
+    std::cout << "Spawned goroutine " << id << std::endl;
+}
+
+void EventLoop::scheduleGoroutine(std::shared_ptr<Goroutine> goroutine) {
+    if (WorkerThread* worker = currentWorker) {
+        // On a worker: its own run queue, nothing shared touched. The
+        // registry keeps the goroutine alive while it waits there.
+        worker->runQueue.push(goroutine.get());
+        
+        // Get an idle worker to steal it, unless one is already looking.
+        // Pairs with the fence a worker issues before it sleeps: either it
+        // sees this goroutine, or we see it sleeping (or still spinning).
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (spinningWorkers.load(std::memory_order_relaxed) == 0) {
+            if (sleepingWorkers.load(std::memory_order_relaxed) > 0) {
+                wakeupSleepingWorkers(1);
+            } else if (activeWorkers.load(std::memory_order_relaxed) < maxWorkers) {
+                createWorkerIfNeeded(true);
+            }
+        }
+        return;
     }
     
-    // Try to assign to a sleeping worker first
+    // From outside the workers: try to assign to a sleeping worker first
     if (!assignTaskToSleepingWorker(goroutine)) {
         // No sleeping workers, add to lock-free task queue
         taskQueue.enqueue(new std::shared_ptr<Goroutine>(goroutine));
@@ -103,25 +506,31 @@ void EventLoop::spawnGoroutine(std::function<void()> entryPoint) {
         // Create worker thread if we need more capacity and assign it this task
         createWorkerIfNeeded();
         
-        // Wake up sleeping workers
+        // A worker that went to sleep since we looked: it either sees the
+        // queued goroutine when it rechecks, or we see it sleeping here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
         wakeupSleepingWorkers(1);
     }
-    
-    std::cout << "Spawned goroutine " << goroutine->id << std::endl;
 }
 
 void EventLoop::addTimer(std::chrono::milliseconds delay, std::function<void()> callback) {
     auto expireTime = std::chrono::steady_clock::now() + delay;
     
+    // Outstanding until its goroutine has run
+    outstandingWork.fetch_add(1);
+    bool earliest;
     {
         std::lock_guard<std::mutex> lock(timerMutex);
+        earliest = unexpiredTimers.empty() || expireTime < unexpiredTimers.top().expireTime;
         unexpiredTimers.emplace(expireTime, std::move(callback));
     }
     
     std::cout << "Timer scheduled for " << delay.count() << "ms from now" << std::endl;
     
-    // Wake up sleeping workers in case they need to process expired timers
-    wakeupSleepingWorkers(1);
+    // The main loop sleeps until the earliest timer: this one is sooner
+    if (earliest) {
+        wakeMainLoop();
+    }
 }
 
 void EventLoop::moveExpiredTimersToQueue() {
@@ -146,8 +555,9 @@ std::shared_ptr<Goroutine> EventLoop::checkExpiredTimers() {
     if (expiredTimerPtr) {
         ExpiredTimer* expiredTimer = expiredTimerPtr;
         
-        // Convert timer callback to goroutine for unified execution
-        auto goroutine = std::make_shared<Goroutine>(std::move(expiredTimer->callback));
+        // Convert timer callback to goroutine for unified execution. It may
+        // spawn or resume others, which then sit on a run queue.
+        auto goroutine = registerGoroutine(std::move(expiredTimer->callback));
         
         delete expiredTimer;  // Clean up memory
         return goroutine;
@@ -156,21 +566,37 @@ std::shared_ptr<Goroutine> EventLoop::checkExpiredTimers() {
     return nullptr; // No expired timers ready
 }
 
-void EventLoop::createWorkerIfNeeded() {
+std::shared_ptr<Goroutine> EventLoop::dequeueTask() {
+    auto taskPtr = taskQueue.dequeue();
+    if (!taskPtr) {
+        return nullptr;
+    }
+    std::shared_ptr<Goroutine> task = std::move(*taskPtr);
+    delete taskPtr;
+    return task;
+}
+
+void EventLoop::createWorkerIfNeeded(bool toSteal) {
+    // Workers spawn and resume goroutines too, so creation can race. Readers
+    // don't lock: they only look at entries below publishedWorkers, and
+    // workerThreads never reallocates (see the constructor).
+    std::lock_guard<std::mutex> lock(workersMutex);
     size_t currentActive = activeWorkers.load();
     size_t currentSleeping = sleepingWorkers.load();
     
-    // Only create new worker if all workers are busy/sleeping and we haven't hit the limit
-    if (currentSleeping == currentActive && currentActive < maxWorkers) {
+    // Only create a new worker if none is sleeping (they get tasks assigned
+    // directly) and we haven't hit the limit
+    if (currentSleeping == 0 && currentActive < maxWorkers) {
         // First, try to get a task from the queue to assign to the new worker
-        auto taskPtr = taskQueue.dequeue();
-        if (!taskPtr) {
-            return; // No task available, don't create worker
+        // (one started to steal finds its own)
+        std::shared_ptr<Goroutine> task;
+        if (!toSteal) {
+            task = dequeueTask();
+            if (!task) {
+                return; // No task available, don't create worker
+            }
         }
         
-        std::shared_ptr<Goroutine> task = *taskPtr;
-        delete taskPtr;
-        
         // Try to atomically increment activeWorkers
         if (activeWorkers.compare_exchange_strong(currentActive, currentActive + 1)) {
             uint32_t workerId = static_cast<uint32_t>(currentActive);
@@ -178,19 +604,25 @@ void EventLoop::createWorkerIfNeeded() {
             
             // Assign the task to the new worker BEFORE starting it
             worker->assignedTask = task;
+            if (!task) {
+                worker->spinning = true;
+                spinningWorkers.fetch_add(1);
+            }
             // Set state to RUNNING since we're about to start it with a task
             worker->state.store(WorkerState::RUNNING, std::memory_order_release);
             
             // Add worker to vector BEFORE starting thread to avoid race condition
             workerThreads.push_back(std::move(worker));
+            publishedWorkers.store(workerThreads.size(), std::memory_order_release);
             
             // Create the worker thread AFTER adding to vector
             workerThreads[workerId]->thread = std::make_unique<std::thread>([this, workerId]() {
                 workerThreadFunction(workerId);
             });
             
-            std::cout << "Created worker thread " << workerId << " with assigned task (total: " << (currentActive + 1) << ")" << std::endl;
-        } else {
+            std::cout << "Created worker thread " << workerId << (task ? " with assigned task" : " to steal")
+                      << " (total: " << (currentActive + 1) << ")" << std::endl;
+        } else if (task) {
             // Failed to create worker, put task back in queue
             taskQueue.enqueue(new std::shared_ptr<Goroutine>(task));
         }
@@ -198,131 +630,188 @@ void EventLoop::createWorkerIfNeeded() {
 }
 
 void EventLoop::wakeupSleepingWorkers(size_t count) {
-    if (sleepingWorkers.load() > 0) {
-        std::lock_guard<std::mutex> lock(sleepMutex);
-        // Wake up the requested number of workers (or all if count is larger)
-        for (size_t i = 0; i < count; ++i) {
-            workerWakeup.notify_one();
+    for (size_t i = 0; i < count; ++i) {
+        if (!assignTaskToSleepingWorker(nullptr)) {
+            break;
         }
     }
 }
 
 bool EventLoop::assignTaskToSleepingWorker(std::shared_ptr<Goroutine> task) {
-    std::lock_guard<std::mutex> lock(sleepMutex);
+    if (sleepingWorkers.load() == 0) {
+        return false;
+    }
     
-    // Find a sleeping worker to assign the task to
-    for (auto& worker : workerThreads) {
-        if (worker->state.load() == WorkerState::SLEEPING && worker->assignedTask == nullptr) {
-            // Assign task and update state synchronously BEFORE waking worker
-            worker->assignedTask = task;
-            worker->state.store(WorkerState::RUNNING, std::memory_order_release);
-            // Decrement sleepingWorkers count atomically when assigning task
-            sleepingWorkers.fetch_sub(1, std::memory_order_release);
-            workerWakeup.notify_one();
-            return true;
+    size_t count = publishedWorkers.load(std::memory_order_acquire);
+    const std::unique_ptr<WorkerThread>* workers = workerThreads.data();
+    for (size_t i = 0; i < count; i++) {
+        WorkerThread* worker = workers[i].get();
+        
+        // Claim it: only one waker (or the worker itself, see
+        // workerThreadFunction) gets it out of SLEEPING
+        WorkerState sleeping = WorkerState::SLEEPING;
+        if (worker->state.load(std::memory_order_relaxed) != WorkerState::SLEEPING ||
+            !worker->state.compare_exchange_strong(sleeping, WorkerState::RUNNING)) {
+            continue;
         }
+        sleepingWorkers.fetch_sub(1);
+        
+        // Published by the bump: the worker reads it once it sees parkWord move
+        worker->assignedTask = std::move(task);
+        worker->parkWord.fetch_add(1, std::memory_order_release);
+        futexWake(&worker->parkWord, 1);
+        return true;
     }
     return false; // No sleeping workers available
 }
 
 void EventLoop::workerThreadFunction(uint32_t workerId) {
     std::cout << "Worker " << workerId << " started" << std::endl;
+    WorkerThread* worker = workerThreads[workerId].get();
+    currentWorker = worker;
     
-    // Install signal handler for GC checkpoint on this thread
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(sa));
-    sa.sa_handler = gc_checkpoint_signal_handler;
-    sigemptyset(&sa.sa_mask);
-    sa.sa_flags = SA_RESTART;  // Restart interrupted syscalls
+    // Get the initial task that was assigned to this worker (none when it
+    // was started to steal)
+    currentTask = worker->assignedTask;
+    worker->assignedTask = nullptr; // Clear assignment
     
-    if (sigaction(SIGUSR1, &sa, nullptr) == -1) {
-        std::cerr << "Worker " << workerId 
-                  << ": Warning - Failed to install GC checkpoint signal handler" << std::endl;
-    }
-    
-    // Get the initial task that was assigned to this worker
-    currentTask = workerThreads[workerId]->assignedTask;
-    workerThreads[workerId]->assignedTask = nullptr; // Clear assignment
-    
-    if (!currentTask) {
-        std::cerr << "ERROR: Worker " << workerId << " started without assigned task!" << std::endl;
-        return;
-    }
-    
-    // Set thread ID for GC signal-based checkpointing
-    if (currentTask->gcState) {
-        currentTask->gcState->threadId = pthread_self();
-    }
-    
-    // High-performance loop: while we have a goroutine to execute
-    while (currentTask != nullptr) {
+    while (true) {
+        if (currentTask == nullptr) {
+            currentTask = findRunnable(worker);
+        }
+        
+        if (worker->spinning) {
+            worker->spinning = false;
+            // The last worker looking found something: there may be more,
+            // so get the next one looking
+            if (spinningWorkers.fetch_sub(1) == 1 && currentTask != nullptr && hasStealableWork()) {
+                wakeupSleepingWorkers(1);
+            }
+        }
+        
+        if (currentTask == nullptr) {
+            // No work found - park on our futex until a waker claims us
+            // (assignTaskToSleepingWorker) with a task, or to look again
+            uint32_t parked = worker->parkWord.load(std::memory_order_acquire);
+            worker->state.store(WorkerState::SLEEPING);
+            sleepingWorkers.fetch_add(1);
+            
+            // Pairs with the fences in scheduleGoroutine: whoever queued
+            // something either sees us sleeping and wakes us, or we see it
+            // here. Same for shutdown and running.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!running.load() || hasStealableWork() || !taskQueue.empty() || !expiredTimerQueue.empty()) {
+                WorkerState sleeping = WorkerState::SLEEPING;
+                if (worker->state.compare_exchange_strong(sleeping, WorkerState::RUNNING)) {
+                    sleepingWorkers.fetch_sub(1);
+                    if (!running.load()) {
+                        break;
+                    }
+                    continue;
+                }
+                // A waker claimed us meanwhile and is about to hand over
+            }
+            
+            while (worker->parkWord.load(std::memory_order_acquire) == parked) {
+                futexWait(&worker->parkWord, parked);
+            }
+            
+            // The task we were woken with; none: look for one (or stop)
+            currentTask = std::move(worker->assignedTask);
+            worker->assignedTask = nullptr;
+            if (currentTask == nullptr) {
+                if (!running.load()) {
+                    break;
+                }
+                worker->spinning = true;
+                spinningWorkers.fetch_add(1);
+            }
+            continue;
+        }
         
         // Execute the goroutine (it's already set as current executing context)
         currentTask->run();
         
-        // If goroutine finished, remove it from registry
+        // If goroutine finished, remove it from registry; if it parked, it is
+        // off its stack now and can be handed to its promise
         if (currentTask->isFinished()) {
             std::lock_guard<std::mutex> lock(goroutineRegistryMutex);
             allGoroutines.erase(currentTask);
+        } else if (currentTask->state == GoroutineState::AWAITING_PROMISE) {
+            parkGoroutine(currentTask);
         }
         
         // Clear current goroutine context after execution
         currentTask = nullptr;
-        
-        // Check for more work AFTER completing the task
-        // Check expired timers first (higher priority)
-        currentTask = checkExpiredTimers();
-        if (currentTask != nullptr) {
-            // Set thread ID for new task
-            if (currentTask->gcState) {
-                currentTask->gcState->threadId = pthread_self();
-            }
-            continue; // Found timer task, continue loop
+        workDone();
+    }
+    
+    currentWorker = nullptr;
+    std::cout << "Worker " << workerId << " shutting down" << std::endl;
+}
+
+std::shared_ptr<Goroutine> EventLoop::findRunnable(WorkerThread* worker) {
+    // Check expired timers first (higher priority)
+    if (auto timer = checkExpiredTimers()) {
+        return timer;
+    }
+    
+    if (++worker->schedulerTick % SchedulerTuning::GLOBAL_QUEUE_INTERVAL == 0) {
+        if (auto task = dequeueTask()) {
+            return task;
         }
+    }
+    
+    // Newest first: it is the one whose data is still in this core's cache
+    Goroutine* goroutine = nullptr;
+    if (worker->runQueue.pop(goroutine)) {
+        return goroutine->shared_from_this();
+    }
+    
+    if (auto task = dequeueTask()) {
+        return task;
+    }
+    return stealGoroutine(worker);
+}
+
+std::shared_ptr<Goroutine> EventLoop::stealGoroutine(WorkerThread* worker) {
+    // workerThreads never reallocates (see the constructor), and entries
+    // below publishedWorkers are complete
+    size_t count = publishedWorkers.load(std::memory_order_acquire);
+    if (count < 2) {
+        return nullptr;
+    }
+    const std::unique_ptr<WorkerThread>* workers = workerThreads.data();
+    
+    for (int round = 0; round < SchedulerTuning::STEAL_ROUNDS; round++) {
+        // Start at a random victim, so idle workers don't all pile on one
+        uint64_t& seed = worker->stealSeed;
+        seed ^= seed << 13;
+        seed ^= seed >> 7;
+        seed ^= seed << 17;
+        size_t start = seed % count;
         
-        // Check global task queue for more work
-        auto taskPtr = taskQueue.dequeue();
-        if (taskPtr) {
-            currentTask = *taskPtr;
-            delete taskPtr;
-            // Set thread ID for new task
-            if (currentTask->gcState) {
-                currentTask->gcState->threadId = pthread_self();
+        for (size_t i = 0; i < count; i++) {
+            WorkerThread* victim = workers[(start + i) % count].get();
+            Goroutine* goroutine = nullptr;
+            if (victim != worker && victim->runQueue.steal(goroutine)) {
+                stolenGoroutines.fetch_add(1, std::memory_order_relaxed);
+                return goroutine->shared_from_this();
             }
-            continue; // Found task, continue loop
         }
-        
-        // No work found - go to sleep and wait for main thread to assign task
-        workerThreads[workerId]->state.store(WorkerState::SLEEPING, std::memory_order_release);
-        
-        
-        {
-            std::unique_lock<std::mutex> lock(sleepMutex);
-            sleepingWorkers.fetch_add(1, std::memory_order_acq_rel);
-            
-            // Notify main loop that we're going to sleep
-            mainLoopWakeup.notify_one();
-            
-            // Wait for main thread to assign us a task and wake us up
-            workerWakeup.wait(lock, [this, workerId]() {
-                // Wake up if we have an assigned task or shutdown
-                return workerThreads[workerId]->assignedTask != nullptr || !running.load();
-            });
-        }
-        
-        // Get the task assigned by main thread (or nullptr for shutdown)
-        currentTask = workerThreads[workerId]->assignedTask;
-        workerThreads[workerId]->assignedTask = nullptr; // Clear assignment
-        
-        // Set thread ID for assigned task
-        if (currentTask && currentTask->gcState) {
-            currentTask->gcState->threadId = pthread_self();
+    }
+    return nullptr;
+}
+
+bool EventLoop::hasStealableWork() {
+    size_t count = publishedWorkers.load(std::memory_order_acquire);
+    const std::unique_ptr<WorkerThread>* workers = workerThreads.data();
+    for (size_t i = 0; i < count; i++) {
+        if (!workers[i]->runQueue.empty()) {
+            return true;
         }
-        
-        // Continue loop with assigned task (or exit if nullptr)
     }
-    
-    std::cout << "Worker " << workerId << " shutting down" << std::endl;
+    return false;
 }
 
 uint64_t EventLoop::createPromise() {
@@ -335,7 +824,8 @@ uint64_t EventLoop::createPromise() {
 
 // Promise resolution is unified with the task queue:
 // - Pending promises are stored in the promises map for O(1) lookup by ID
-// - When resolved, the waiting goroutine is enqueued directly to taskQueue
+// - When resolved, the waiting goroutine is scheduled directly: on the
+//   resolving worker's run queue, or taskQueue from outside the workers
 // - There is no separate "promise queue" - resolved promises ARE tasks
 
 void EventLoop::resolvePromise(uint64_t promiseId, int64_t value) {
@@ -359,24 +849,45 @@ void EventLoop::resolvePromise(uint64_t promiseId, int64_t value) {
         promise.resolvedValue = value;
         goroutineToResume = promise.waitingGoroutine;
         
-        // Clean up resolved promise immediately for better memory usage
-        promises.erase(it);
+        // Clean up resolved promise immediately for better memory usage.
+        // Without a waiter yet, keep it for the await (or the park) to come.
+        if (goroutineToResume) {
+            promises.erase(it);
+        }
     }
     
     // Resume the goroutine and enqueue it directly to the task queue
     // This unifies the promise system with the task queue - when a promise resolves,
     // it becomes a task to execute. No separate promise queue needed.
     if (goroutineToResume) {
-        goroutineToResume->promiseResolvedValue = value;
-        goroutineToResume->awaitingPromiseId = 0;
-        goroutineToResume->state = GoroutineState::READY;
-        
-        // Enqueue directly to task queue - this IS the task queue, unified
-        taskQueue.enqueue(new std::shared_ptr<Goroutine>(goroutineToResume));
+        goroutineToResume->resume(value);
+        outstandingWork.fetch_add(1);
+        scheduleGoroutine(std::move(goroutineToResume));
+    }
+}
+
+void EventLoop::parkGoroutine(std::shared_ptr<Goroutine> goroutine) {
+    // Before anyone else can resume it
+    goroutine->context->releaseSpareSegments();
+    
+    {
+        std::lock_guard<std::mutex> lock(promisesMutex);
+        auto it = promises.find(goroutine->awaitingPromiseId);
+        if (it != promises.end() && it->second.state == Promise::State::PENDING) {
+            it->second.waitingGoroutine = goroutine;
+            return;
+        }
         
-        // Wake up a sleeping worker to handle the resumed goroutine
-        wakeupSleepingWorkers(1);
+        // Resolved between the await's check and now
+        int64_t value = 0;
+        if (it != promises.end()) {
+            value = it->second.resolvedValue;
+            promises.erase(it);
+        }
+        goroutine->resume(value);
     }
+    outstandingWork.fetch_add(1);
+    scheduleGoroutine(std::move(goroutine));
 }
 
 int64_t EventLoop::awaitPromise(uint64_t promiseId, std::shared_ptr<Goroutine> currentGoroutine) {
@@ -398,11 +909,11 @@ int64_t EventLoop::awaitPromise(uint64_t promiseId, std::shared_ptr<Goroutine> c
             promises.erase(it);  // Clean up
             return result;
         }
-        
-        // Promise is still pending, register goroutine and suspend
-        promise.waitingGoroutine = currentGoroutine;
     }
     
+    // Promise is still pending: park. The worker registers us as the waiter
+    // once we are off our stack, so no resolver can resume us while we are
+    // still running on it.
     std::cout << "Goroutine " << currentGoroutine->id << " awaiting promise " << promiseId << std::endl;
     currentGoroutine->suspend(promiseId);
     
@@ -410,95 +921,78 @@ int64_t EventLoop::awaitPromise(uint64_t promiseId, std::shared_ptr<Goroutine> c
     return currentGoroutine->promiseResolvedValue;
 }
 
+void EventLoop::workDone() {
+    if (outstandingWork.fetch_sub(1) == 1) {
+        wakeMainLoop();
+    }
+}
+
+void EventLoop::wakeMainLoop() {
+    mainLoopWakeups.fetch_add(1, std::memory_order_release);
+    futexWake(&mainLoopWakeups, 1);
+}
+
+void EventLoop::dispatchExpiredTimers() {
+    // Straight to sleeping workers. With none left, busy workers pick the
+    // rest up (they look at expired timers first); the global queue only
+    // gets one to start a worker when there isn't any.
+    while (true) {
+        auto timerTask = checkExpiredTimers();
+        if (!timerTask) {
+            break; // No more expired timers
+        }
+        
+        if (!assignTaskToSleepingWorker(timerTask)) {
+            taskQueue.enqueue(new std::shared_ptr<Goroutine>(timerTask));
+            createWorkerIfNeeded();
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wakeupSleepingWorkers(1);
+            break;
+        }
+    }
+}
+
 void EventLoop::run() {
     std::cout << "Starting EventLoop main loop" << std::endl;
     
+    // The main thread only keeps time: workers wake each other directly
+    // (spawns, promise resolutions). It sleeps on mainLoopWakeups until the
+    // earliest timer is due, an earlier one is added, or the last
+    // outstanding work is done.
     while (true) {
-        // Efficiently move expired timers to the expired queue
-        moveExpiredTimersToQueue();
-        
-        // Assign expired timer tasks to sleeping workers
-        while (true) {
-            auto timerTask = checkExpiredTimers();
-            if (!timerTask) {
-                break; // No more expired timers
-            }
-            
-            // Try to assign to a sleeping worker
-            if (!assignTaskToSleepingWorker(timerTask)) {
-                // No sleeping workers, put back in queue for workers to pick up
-                // Convert expired timer back to task queue entry
-                taskQueue.enqueue(new std::shared_ptr<Goroutine>(timerTask));
-                break;
-            }
+        // Read before looking at the state, so a wake after that is not lost
+        uint32_t wakeups = mainLoopWakeups.load(std::memory_order_acquire);
+        if (outstandingWork.load() == 0) {
+            std::cout << "No outstanding work, shutting down event loop" << std::endl;
+            break;
         }
         
-        // Check work availability efficiently 
-        bool hasExpiredTimers = !expiredTimerQueue.empty();
-        bool hasTasks = !taskQueue.empty();
-        bool hasUnexpiredTimers = false;
+        moveExpiredTimersToQueue();
+        dispatchExpiredTimers();
+        
+        bool hasTimers = false;
+        std::chrono::steady_clock::time_point nextTimer;
         {
             std::lock_guard<std::mutex> lock(timerMutex);
-            hasUnexpiredTimers = !unexpiredTimers.empty();
-        }
-        
-        bool hasWork = hasExpiredTimers || hasTasks || hasUnexpiredTimers;
-        
-        size_t currentSleeping = sleepingWorkers.load(std::memory_order_acquire);
-        size_t currentActive = activeWorkers.load(std::memory_order_acquire);
-        
-        // Efficient worker management
-        if (hasWork && currentSleeping > 0) {
-            // We have work and sleeping workers - wake them up
-            wakeupSleepingWorkers(std::min(currentSleeping, static_cast<size_t>(2))); // Wake up to 2 workers
-        }
-        
-        // Create more workers if all are busy/sleeping and we're under the limit
-        if (currentSleeping == currentActive && hasWork && currentActive < maxWorkers) {
-            createWorkerIfNeeded();
-        }
-        
-        // If all threads are busy working, wait efficiently
-        if (currentSleeping == 0 && currentActive > 0) {
-            // Wait for workers to go to sleep or for new work to arrive
-            std::unique_lock<std::mutex> lock(sleepMutex);
-            mainLoopWakeup.wait_for(lock, std::chrono::milliseconds(50), [this]() {
-                return sleepingWorkers.load() > 0;
-            });
-            continue;
-        }
-        
-        // If we have no work and all workers are sleeping, check for shutdown conditions
-        if (!hasWork && currentSleeping == currentActive && currentActive > 0) {
-            // Brief wait to allow for any incoming work before shutting down
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-            
-            // Double-check for work after the brief wait
-            moveExpiredTimersToQueue();
-            bool stillHasWork = !expiredTimerQueue.empty() || !taskQueue.empty();
-            {
-                std::lock_guard<std::mutex> lock(timerMutex);
-                stillHasWork = stillHasWork || !unexpiredTimers.empty();
-            }
-            
-            if (!stillHasWork) {
-                std::cout << "No work and all workers sleeping, shutting down event loop" << std::endl;
-                break;
+            if (!unexpiredTimers.empty()) {
+                hasTimers = true;
+                nextTimer = unexpiredTimers.top().expireTime;
             }
         }
         
-        // If we have no workers at all and no work, shut down
-        if (currentActive == 0 && !hasWork) {
-            std::cout << "No workers and no work, shutting down event loop" << std::endl;
-            break;
+        if (!hasTimers) {
+            futexWait(&mainLoopWakeups, wakeups);
+            continue;
         }
-        
-        // Adaptive pause based on system state
-        if (!hasWork) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        } else {
-            std::this_thread::yield(); // Just yield CPU if there's work
+        auto delay = nextTimer - std::chrono::steady_clock::now();
+        if (delay <= std::chrono::steady_clock::duration::zero()) {
+            continue;
         }
+        auto nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(delay).count();
+        timespec timeout;
+        timeout.tv_sec = static_cast<time_t>(nanoseconds / 1000000000);
+        timeout.tv_nsec = static_cast<long>(nanoseconds % 1000000000);
+        futexWait(&mainLoopWakeups, wakeups, &timeout);
     }
     
     shutdown();
@@ -508,7 +1002,9 @@ void EventLoop::shutdown() {
     std::cout << "Shutting down EventLoop" << std::endl;
     running.store(false);
     
-    // Wake up all sleeping worker threads so they can see the shutdown signal
+    // Wake up all sleeping worker threads so they can see the shutdown
+    // signal; the others see it before they would sleep
+    std::atomic_thread_fence(std::memory_order_seq_cst);
     wakeupSleepingWorkers(maxWorkers);
     
     // Wait for all worker threads to finish
@@ -519,6 +1015,7 @@ void EventLoop::shutdown() {
         }
     }
     
+    publishedWorkers.store(0);
     workerThreads.clear();
     activeWorkers.store(0);
     sleepingWorkers.store(0);
@@ -532,8 +1029,21 @@ EventLoop& EventLoop::getInstance() {
 }
 
 // C runtime functions
+// Back to the worker for good; it drops the goroutine (and returns its
+// stack to the pool)
+[[noreturn]] static void exitGoroutine(Goroutine* goroutine) {
+    goroutine->state = GoroutineState::DEAD;
+    void* deadStackPointer;
+    technoscript_switch_context(&deadStackPointer, goroutine->context->schedulerStackPointer);
+    std::abort();
+}
+
+// The runtime calls generated code makes wait for locks and write to
+// stdout, which may block: each runs outside managed code, so the GC's
+// safepoint handshake doesn't wait for it (ScopedOutsideManagedCode)
 extern "C" {
     uint64_t runtime_sleep(int64_t milliseconds) {
+        ScopedOutsideManagedCode outside;
         auto& eventLoop = EventLoop::getInstance();
         uint64_t promiseId = eventLoop.createPromise();
         
@@ -550,6 +1060,8 @@ extern "C" {
     }
     
     int64_t runtime_await_promise(uint64_t promiseId) {
+        // A goroutine that parks is left outside by its worker anyway
+        ScopedOutsideManagedCode outside;
         std::cout << "runtime_await_promise: Awaiting promise " << promiseId << std::endl;
         
         // Get the current task on this worker thread
@@ -562,6 +1074,7 @@ extern "C" {
     }
 
     void runtime_spawn_goroutine(void* funcPtr, void* scopePtr, void* parentScopePtr) {
+        ScopedOutsideManagedCode outside;
         // Create a lambda that captures the function pointer and scope
         // The scope is already allocated and populated with parameters by the caller
         auto entryPoint = [funcPtr, scopePtr, parentScopePtr]() {
@@ -584,7 +1097,7 @@ extern "C" {
             #error "Only x86_64 architecture is supported"
             #endif
             
-            // Note: The function's epilogue will call gc_pop_scope to free the scope
+            // Note: The function's epilogue pops the scope off the shadow stack
             // and restore r15/r14, so we don't need to free the scope here
         };
         
@@ -592,6 +1105,7 @@ extern "C" {
     }
     
     void runtime_set_timeout(void (*func)(void*), void* args, size_t argsSize, int delayMs) {
+        ScopedOutsideManagedCode outside;
         // Create a lambda that captures the function and arguments
         auto callback = [func, args, argsSize]() {
             // Spawn the function as a goroutine when timer expires
@@ -605,6 +1119,64 @@ extern "C" {
         EventLoop::getInstance().addTimer(std::chrono::milliseconds(delayMs), std::move(callback));
     }
     
+    void technoscript_goroutine_main(Goroutine* goroutine) {
+        try {
+            goroutine->entryPoint();
+        } catch (const std::exception& e) {
+            std::cerr << "Goroutine " << goroutine->id << " crashed: " << e.what() << std::endl;
+        }
+        exitGoroutine(goroutine);
+    }
+    
+    void technoscript_goroutine_overflow(Goroutine* goroutine) {
+        size_t size = 0;
+        for (const GoroutineStack& stack : goroutine->context->segments) {
+            size += stack.size;
+        }
+        std::cerr << "Goroutine " << goroutine->id << " crashed: stack overflow ("
+                  << size << " bytes of stack)" << std::endl;
+        exitGoroutine(goroutine);
+    }
+    
+    void technoscript_goroutine_fail(const char* message) {
+        Goroutine* goroutine = runningGoroutine;
+        if (!goroutine) {
+            std::cout.flush();
+            std::cerr << "Fatal error: " << message << std::endl;
+            std::_Exit(EXIT_FAILURE);
+        }
+        std::cerr << "Goroutine " << goroutine->id << " crashed: " << message << std::endl;
+        exitGoroutine(goroutine);
+    }
+    
+    void* technoscript_stack_grow(void** callerStack) {
+        Goroutine* goroutine = runningGoroutine;
+        GoroutineContext* context = goroutine->context.get();
+        
+        // Runs in the reserve of the segment we're leaving
+        uint8_t* top = nullptr;
+        try {
+            top = context->pushSegment();
+        } catch (const std::bad_alloc&) {
+        }
+        if (!top) {
+            technoscript_goroutine_overflow(goroutine);
+        }
+        threadStackLimit = context->stackLimit();
+        
+        void** frame = reinterpret_cast<void**>(top);
+        frame[-2] = &callerStack[1];
+        frame[-3] = reinterpret_cast<void*>(&technoscript_lessstack);
+        frame[-4] = callerStack[0];
+        return &frame[-4];
+    }
+    
+    void technoscript_stack_shrink() {
+        GoroutineContext* context = runningGoroutine->context.get();
+        context->popSegment();
+        threadStackLimit = context->stackLimit();
+    }
+    
     void runtime_start_event_loop() {
         std::cout << "Starting event loop" << std::endl;
         EventLoop::getInstance().run();
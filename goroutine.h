@@ -8,13 +8,13 @@
 #include <functional>
 #include <atomic>
 #include <memory>
-#include <csetjmp>
 #include <map>
 #include <unordered_set>
 #include <array>
 #include <iostream>
 #include <cstdlib>
 #include "lockfree_queue.h"
+#include "goroutine_stack.h"
 
 // Forward declarations
 class Goroutine;
@@ -42,17 +42,78 @@ enum class GoroutineState {
     DEAD        // Finished execution
 };
 
-// Goroutine context - saves register state
+// Frame technoscript_switch_context leaves on the stack it switches away
+// from, and pops from the one it switches to. A new goroutine stack starts
+// with one whose return address is the entry trampoline.
+namespace ContextLayout {
+    constexpr int MXCSR_OFFSET = 0;            // SSE control/status (4 bytes)
+    constexpr int FPU_CONTROL_OFFSET = 4;      // x87 control word (2 bytes)
+    constexpr int R15_OFFSET = 8;
+    constexpr int R14_OFFSET = 16;
+    constexpr int R13_OFFSET = 24;
+    constexpr int R12_OFFSET = 32;             // New stacks: the Goroutine* to run
+    constexpr int RBX_OFFSET = 40;
+    constexpr int RBP_OFFSET = 48;             // New stacks: 0, ending the frame chain
+    constexpr int RETURN_ADDRESS_OFFSET = 56;
+    constexpr int FRAME_SIZE = 64;
+    
+    constexpr uint32_t DEFAULT_MXCSR = 0x1F80;       // All exceptions masked, round to nearest
+    constexpr uint16_t DEFAULT_FPU_CONTROL = 0x037F;
+}
+
+// Run queue scheduling (see EventLoop::findRunnable)
+namespace SchedulerTuning {
+    // A worker looks at the global queue before its own every this many
+    // picks, so goroutines injected from outside aren't starved by a worker
+    // that keeps its own queue full (the interval Go uses)
+    constexpr uint32_t GLOBAL_QUEUE_INTERVAL = 61;
+    
+    // Passes over the other workers' queues before an idle worker gives up:
+    // a steal that loses a race fails even though the queue has work
+    constexpr int STEAL_ROUNDS = 4;
+}
+
+// Goroutine context: its own stack, and the saved stack pointers of both
+// sides of a switch. Registers live on the stacks themselves (ContextLayout).
+//
+// The stack is a chain of segments from GoroutineStackPool. A goroutine
+// starts on one INITIAL_SEGMENT_SIZE segment; a generated function that
+// finds less than RESERVE bytes left at its entry continues on the next one
+// (technoscript_morestack), and its return switches back
+// (technoscript_lessstack). Nothing is copied or moved, so pointers into
+// the stack stay valid.
 struct GoroutineContext {
-    jmp_buf registers;
-    void* stackPointer;
-    size_t stackSize;
-    std::unique_ptr<uint8_t[]> stack;
-    
-    GoroutineContext(size_t stackSz = 64 * 1024) : stackSize(stackSz) {
-        stack = std::make_unique<uint8_t[]>(stackSize);
-        stackPointer = stack.get() + stackSize; // Stack grows downward
+    void* stackPointer;                 // Goroutine's rsp while it is switched out
+    void* schedulerStackPointer;        // Worker's rsp while the goroutine runs on it
+    std::vector<GoroutineStack> segments;  // [0]: where the goroutine started
+    size_t segment = 0;                 // Segment it is running on. Those above are spares.
+    
+    // Segments come from the pool as they are (not zeroed), and only the
+    // pages the goroutine touches are committed. prepare() writes the initial
+    // frame. stackSz 0: INITIAL_SEGMENT_SIZE.
+    explicit GoroutineContext(size_t stackSz = 0);
+    ~GoroutineContext();
+    GoroutineContext(const GoroutineContext&) = delete;
+    GoroutineContext& operator=(const GoroutineContext&) = delete;
+    
+    // Make the first switch onto this stack enter technoscript_goroutine_main(goroutine)
+    void prepare(Goroutine* goroutine);
+    
+    // Lowest rsp a generated function may start at on the current segment
+    uintptr_t stackLimit() const {
+        return reinterpret_cast<uintptr_t>(segments[segment].base()) + StackPoolLayout::RESERVE;
     }
+    
+    // Move on to the next segment (a spare, or a new one twice the size of
+    // the current, up to MAX_SEGMENT_SIZE) and return its top; null when
+    // that would take the stack past the pool's maximum stack size
+    uint8_t* pushSegment();
+    void popSegment() { segment--; }
+    
+    // Give back the spares (a parked goroutine has no use for them)
+    void releaseSpareSegments();
+    
+    bool inGuard(const void* address) const;
 };
 
 // Individual goroutine
@@ -74,16 +135,44 @@ public:
     
     Goroutine(std::function<void()> entry);
     
+    // Switch the calling worker onto the goroutine's stack. Returns when the
+    // goroutine finishes (DEAD) or parks on a promise (AWAITING_PROMISE).
     void run();
+    
+    // Called on the goroutine's own stack: park until the promise resolves.
+    // Switches back to the worker that ran us; when we are scheduled again
+    // (on any worker), returns there.
     void suspend(uint64_t promiseId);
     void resume(int64_t resolvedValue);
     bool isFinished() const { return state == GoroutineState::DEAD; }
+    
+    // Runtime code that needs more stack than a segment's reserve guarantees
+    // (a collection started by an allocation) runs it through this: on a
+    // goroutine, it calls work on the stack of the worker running it and
+    // passes on what it throws; elsewhere it just calls it. work must not
+    // suspend the goroutine.
+    static void runOnWorkerStack(const std::function<void()>& work);
+    
+    // Offset from the fs base of the thread's stack limit, which generated
+    // code compares rsp against at every function entry: the running
+    // goroutine's GoroutineContext::stackLimit(), 0 off goroutine stacks
+    static intptr_t stackLimitThreadOffset();
+    
+    // Generated code, registered when it is committed. A guard fault there
+    // ends just the goroutine; one in runtime C++ code is fatal, as that
+    // code may hold locks or own objects. Read by the SIGSEGV handler
+    // without a lock, so the ranges live in a fixed table.
+    static constexpr size_t MAX_CODE_RANGES = 64;
+    static void registerGeneratedCode(const void* start, size_t size);
+    static bool isGeneratedCode(const void* address);
 };
 
 // Main event loop managing all goroutines
 class EventLoop {
 private:
-    // Lock-free queues for high performance
+    // Goroutines made runnable outside the workers (main thread, tests).
+    // Workers queue what they spawn and resume on their own run queue
+    // (WorkerThread::runQueue) instead.
     LockFreeQueue<std::shared_ptr<Goroutine>> taskQueue;
     LockFreeQueue<ExpiredTimer> expiredTimerQueue;  // Higher priority than regular tasks
     
@@ -104,21 +193,61 @@ private:
     std::vector<std::unique_ptr<WorkerThread>> workerThreads;
     size_t maxWorkers;
     std::atomic<size_t> activeWorkers{0};     // Number of workers currently created
-    std::atomic<size_t> sleepingWorkers{0};   // Number of workers sleeping on CV
+    std::atomic<size_t> sleepingWorkers{0};   // Number of workers parked on their futex
+    std::atomic<size_t> spinningWorkers{0};   // Workers looking for a run queue to steal from
+    std::atomic<size_t> publishedWorkers{0};  // workerThreads entries thieves may read
+    std::atomic<uint64_t> stolenGoroutines{0};
     
-    // Synchronization for sleeping workers
-    std::mutex sleepMutex;
-    std::condition_variable workerWakeup;     // Wake up sleeping workers
-    std::condition_variable mainLoopWakeup;   // Wake up main loop when workers sleep
+    std::mutex workersMutex;                  // Serializes starting workers
     std::atomic<bool> running{true};
     
+    // Goroutines spawned or resumed and not yet finished or parked again,
+    // plus pending timers. run() ends when it drops to 0: nothing left
+    // could make a goroutine runnable again.
+    std::atomic<int64_t> outstandingWork{0};
+    
+    // Futex the main loop sleeps on (see run), bumped by wakeMainLoop
+    std::atomic<uint32_t> mainLoopWakeups{0};
+    
     // Internal methods for performance optimization
     void moveExpiredTimersToQueue();  // Move expired timers from priority queue to expired queue
     std::shared_ptr<Goroutine> checkExpiredTimers();  // Get next expired timer as goroutine
     void workerThreadFunction(uint32_t workerId);
-    void createWorkerIfNeeded();
+    
+    // A goroutine a worker ran finished or parked (or a timer fired into
+    // one): the last outstanding work wakes the main loop to shut down
+    void workDone();
+    void wakeMainLoop();
+    
+    // Hand expired timers to sleeping workers, or to the global queue
+    void dispatchExpiredTimers();
+    
+    // Create a goroutine and add it to the registry, which keeps it alive
+    // while it sits on a run queue
+    std::shared_ptr<Goroutine> registerGoroutine(std::function<void()> entryPoint);
+    
+    // Next goroutine for a worker: expired timers, its own run queue (the
+    // global queue first every GLOBAL_QUEUE_INTERVAL picks), the global
+    // queue, then other workers' queues. Null when there is none.
+    std::shared_ptr<Goroutine> findRunnable(WorkerThread* worker);
+    std::shared_ptr<Goroutine> stealGoroutine(WorkerThread* worker);
+    std::shared_ptr<Goroutine> dequeueTask();
+    bool hasStealableWork();
+    
+    // Start a worker for the first task on the global queue, or - with
+    // toSteal - one without a task that steals from the run queues
+    void createWorkerIfNeeded(bool toSteal = false);
+    
+    // Claim a sleeping worker, hand it the task (none: it looks for work
+    // itself) and wake it. False when no worker is sleeping.
+    bool assignTaskToSleepingWorker(std::shared_ptr<Goroutine> task);
     void wakeupSleepingWorkers(size_t count = 1);
-    bool assignTaskToSleepingWorker(std::shared_ptr<Goroutine> task);  // Assign task to sleeping worker
+    void scheduleGoroutine(std::shared_ptr<Goroutine> goroutine);      // Hand a runnable goroutine to a worker
+    
+    // Worker side of Goroutine::suspend, once the goroutine is off its
+    // stack: register it as the promise's waiter, or reschedule it if the
+    // promise was resolved meanwhile
+    void parkGoroutine(std::shared_ptr<Goroutine> goroutine);
     
 public:
     EventLoop();
@@ -142,6 +271,7 @@ public:
     // Worker monitoring
     size_t getActiveWorkers() const { return activeWorkers.load(); }
     size_t getSleepingWorkers() const { return sleepingWorkers.load(); }
+    uint64_t getStolenGoroutines() const { return stolenGoroutines.load(); }
     bool isEmpty() const { 
         // Best-effort check without taking locks for performance
         if (!taskQueue.empty() || !expiredTimerQueue.empty()) {
@@ -183,4 +313,41 @@ extern "C" {
     
     // Shutdown the runtime
     void runtime_shutdown();
+    
+    // Save the callee-saved registers, rbp and the SSE/x87 control words on
+    // the current stack, store rsp in *saveStackPointer, then load
+    // loadStackPointer and restore the same from there (goroutine.cpp)
+    void technoscript_switch_context(void** saveStackPointer, void* loadStackPointer);
+    
+    // Call function(argument) with rsp at stackTop, then return on the
+    // caller's stack (goroutine.cpp)
+    void technoscript_call_on_stack(void* stackTop, void (*function)(void*), void* argument);
+    
+    // First code run on a goroutine stack (entered from the trampoline the
+    // initial frame returns into). Runs the entry point and never returns.
+    [[noreturn]] void technoscript_goroutine_main(Goroutine* goroutine);
+    
+    // Where the SIGSEGV handler sends a goroutine that ran into a guard, and
+    // where technoscript_morestack goes when the stack may not grow further:
+    // reports the overflow and ends the goroutine, on its abandoned stack
+    [[noreturn]] void technoscript_goroutine_overflow(Goroutine* goroutine);
+    
+    // A runtime error that can't be thrown through generated code (its
+    // frames have no unwind info): reports it and ends the running goroutine
+    // the same way, without unwinding. Off goroutines it ends the process.
+    [[noreturn]] void technoscript_goroutine_fail(const char* message);
+    
+    // Called (not jumped to) at a generated function's entry when rsp is
+    // below the stack limit. Switches to the goroutine's next segment and
+    // returns into the function there, with its return address replaced by
+    // technoscript_lessstack. Preserves every register but r11.
+    void technoscript_morestack();
+    
+    // Return address of the first frame on a segment: switches back to the
+    // caller's segment and returns to it, preserving the return value
+    void technoscript_lessstack();
+    
+    // C++ halves of the two above (goroutine.cpp)
+    void* technoscript_stack_grow(void** callerStack);
+    void technoscript_stack_shrink();
 }
\ No newline at end of file
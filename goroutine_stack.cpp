@@ -0,0 +1,185 @@
+#include "goroutine_stack.h"
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static size_t sizeFromEnvironment(const char* name, size_t fallback) {
+    if (const char* env = std::getenv(name)) {
+        long requested = std::strtol(env, nullptr, 10);
+        if (requested > 0) {
+            return static_cast<size_t>(requested);
+        }
+    }
+    return fallback;
+}
+
+// Guard regions that don't split the mapping (Linux 6.13)
+#ifndef MADV_GUARD_INSTALL
+#define MADV_GUARD_INSTALL 102
+#endif
+
+GoroutineStackPool::GoroutineStackPool()
+    : maxStackSize(sizeFromEnvironment("TECHNOSCRIPT_STACK_SIZE", StackPoolLayout::DEFAULT_MAX_STACK_SIZE)),
+      poolLimit(sizeFromEnvironment("TECHNOSCRIPT_STACK_POOL", StackPoolLayout::DEFAULT_POOL_LIMIT)) {
+}
+
+GoroutineStackPool& GoroutineStackPool::getInstance() {
+    static GoroutineStackPool instance;
+    return instance;
+}
+
+size_t GoroutineStackPool::sizeClassFor(size_t size) {
+    size_t sizeClass = 0;
+    while (sizeClass < NUM_SIZE_CLASSES && classSize(sizeClass) < size) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+void GoroutineStackPool::mapArena(size_t sizeClass) {
+    using namespace StackPoolLayout;
+    
+    size_t slotSize = GUARD_SIZE + classSize(sizeClass);
+    size_t slots = ARENA_SIZE / slotSize > 0 ? ARENA_SIZE / slotSize : 1;
+    
+    // MAP_NORESERVE: a segment only counts against overcommit for the pages
+    // a goroutine actually touches
+    void* memory = mmap(nullptr, slots * slotSize, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (memory == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    
+    uint8_t* arena = static_cast<uint8_t*>(memory);
+    std::vector<GoroutineStack>& cold = coldStacks[sizeClass];
+    // Hand out the lowest slot first
+    for (size_t i = slots; i-- > 0;) {
+        GoroutineStack stack;
+        stack.mapping = arena + i * slotSize;
+        stack.size = classSize(sizeClass);
+        
+        if (guardRegions && madvise(stack.mapping, GUARD_SIZE, MADV_GUARD_INSTALL) != 0) {
+            guardRegions = false;
+        }
+        if (!guardRegions && mprotect(stack.mapping, GUARD_SIZE, PROT_NONE) != 0) {
+            // Out of mappings (vm.max_map_count): the slots above are usable,
+            // this one and those below are lost
+            if (cold.empty()) {
+                throw std::bad_alloc();
+            }
+            break;
+        }
+        cold.push_back(stack);
+        mappedStacks++;
+    }
+}
+
+GoroutineStack GoroutineStackPool::acquire(size_t size) {
+    size_t sizeClass = sizeClassFor(size);
+    if (sizeClass == NUM_SIZE_CLASSES) {
+        throw std::bad_alloc();
+    }
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<GoroutineStack>& warm = warmStacks[sizeClass];
+    if (!warm.empty()) {
+        GoroutineStack stack = warm.back();
+        warm.pop_back();
+        warmCount--;
+        return stack;
+    }
+    
+    std::vector<GoroutineStack>& cold = coldStacks[sizeClass];
+    if (cold.empty()) {
+        mapArena(sizeClass);
+    }
+    GoroutineStack stack = cold.back();
+    cold.pop_back();
+    return stack;
+}
+
+void GoroutineStackPool::release(const GoroutineStack& stack) {
+    using namespace StackPoolLayout;
+    
+    if (!stack.mapping) {
+        return;
+    }
+    size_t sizeClass = sizeClassFor(stack.size);
+    
+    // Drop everything but the top page; the first poolLimit idle segments
+    // keep that for the next goroutine. The segment is reused as is:
+    // whatever the last goroutine left there is dead, and the next one
+    // starts from a freshly written initial frame.
+    bool warm;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        warm = warmCount < poolLimit;
+        if (warm) {
+            warmCount++;
+        }
+    }
+    size_t keep = warm && stack.size > KEEP_COMMITTED ? KEEP_COMMITTED : 0;
+    madvise(stack.base(), stack.size - keep, MADV_DONTNEED);
+    
+    std::lock_guard<std::mutex> lock(mutex);
+    (warm ? warmStacks : coldStacks)[sizeClass].push_back(stack);
+}
+
+size_t GoroutineStackPool::getPooledStacks() {
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t pooled = 0;
+    for (size_t i = 0; i < NUM_SIZE_CLASSES; i++) {
+        pooled += warmStacks[i].size() + coldStacks[i].size();
+    }
+    return pooled;
+}
+
+size_t GoroutineStackPool::getMappedStacks() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return mappedStacks;
+}
+
+namespace {
+    // The calling thread's alternate signal stack, removed when it exits
+    struct SignalStack {
+        void* memory = nullptr;
+        
+        SignalStack() {
+            // Keep one someone else (a sanitizer, the embedder) already set up
+            stack_t current = {};
+            if (sigaltstack(nullptr, &current) == 0 && !(current.ss_flags & SS_DISABLE)) {
+                return;
+            }
+            
+            memory = mmap(nullptr, StackPoolLayout::SIGNAL_STACK_SIZE, PROT_READ | PROT_WRITE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                memory = nullptr;
+                std::cerr << "Warning: no signal stack for this thread; goroutine stack overflows will crash it" << std::endl;
+                return;
+            }
+            stack_t stack = {};
+            stack.ss_sp = memory;
+            stack.ss_size = StackPoolLayout::SIGNAL_STACK_SIZE;
+            sigaltstack(&stack, nullptr);
+        }
+        
+        ~SignalStack() {
+            if (!memory) {
+                return;
+            }
+            stack_t disable = {};
+            disable.ss_flags = SS_DISABLE;
+            sigaltstack(&disable, nullptr);
+            munmap(memory, StackPoolLayout::SIGNAL_STACK_SIZE);
+        }
+    };
+}
+
+void GoroutineStackPool::prepareThread() {
+    thread_local SignalStack signalStack;
+    (void)signalStack;
+}
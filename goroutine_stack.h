@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace StackPoolLayout {
+    // A goroutine starts on one small segment and gets more as its calls
+    // need them (see GoroutineContext). Segments double up to the maximum.
+    constexpr size_t INITIAL_SEGMENT_SIZE = 16 * 1024;
+    constexpr size_t MAX_SEGMENT_SIZE = 1024 * 1024;
+
+    // Total a goroutine's segments may add up to before it is ended with a
+    // stack overflow (TECHNOSCRIPT_STACK_SIZE overrides)
+    constexpr size_t DEFAULT_MAX_STACK_SIZE = 64 * 1024 * 1024;
+
+    // Bytes at the bottom of a segment generated code leaves to the runtime:
+    // a function only starts on a segment with more than this left, so the
+    // C++ runtime calls it makes (which don't check) fit below it
+    constexpr size_t RESERVE = 8 * 1024;
+
+    // PROT_NONE region below every segment. Larger than a page so a frame
+    // that allocates a few KB at once still lands in it instead of skipping
+    // over it into the segment below.
+    constexpr size_t GUARD_SIZE = 16 * 1024;
+
+    // Segments of one size are carved from arenas of about this many bytes,
+    // so a million stacks don't need a million mappings
+    constexpr size_t ARENA_SIZE = 4 * 1024 * 1024;
+
+    // Idle segments that keep their top page committed for the next
+    // goroutine (TECHNOSCRIPT_STACK_POOL overrides). Beyond that, idle
+    // segments hold no memory at all.
+    constexpr size_t DEFAULT_POOL_LIMIT = 1024;
+
+    // Pages left committed when a segment goes back to the pool: the top of
+    // the segment, which the next goroutine touches first
+    constexpr size_t KEEP_COMMITTED = 4096;
+
+    // Alternate signal stack of each thread running goroutines, so the
+    // overflow handler has a stack to run on
+    constexpr size_t SIGNAL_STACK_SIZE = 64 * 1024;
+}
+
+// One stack segment: `size` usable bytes above a GUARD_SIZE guard. Pages are
+// committed by the kernel as the goroutine first touches them, from the top
+// down.
+struct GoroutineStack {
+    uint8_t* mapping = nullptr;     // Start of the slot (the guard)
+    size_t size = 0;                // Usable bytes above the guard
+
+    uint8_t* base() const { return mapping + StackPoolLayout::GUARD_SIZE; }
+    uint8_t* top() const { return base() + size; }
+
+    bool inGuard(const void* address) const {
+        const uint8_t* a = static_cast<const uint8_t*>(address);
+        return mapping && a >= mapping && a < base();
+    }
+};
+
+// Recycles stack segments, so a spawn normally costs a pop from a free list
+// instead of an mmap (and no zero-filling at all).
+//
+// Segment sizes are powers of two from INITIAL_SEGMENT_SIZE to
+// MAX_SEGMENT_SIZE, each with its own free list, refilled an arena at a
+// time. Guards are installed with MADV_GUARD_INSTALL where the kernel has it
+// (Linux 6.13), which keeps an arena a single mapping; elsewhere with
+// mprotect, which splits it and so counts against vm.max_map_count.
+// Arenas are never unmapped: release() hands a segment's pages back to the
+// kernel (MADV_DONTNEED), keeping the top one for the first poolLimit idle
+// segments.
+class GoroutineStackPool {
+public:
+    static constexpr size_t NUM_SIZE_CLASSES = 7;   // 16 KB ... 1 MB
+
+private:
+    std::mutex mutex;
+    // Idle segments per size class: those that kept their top page (handed
+    // out first) and those that hold no memory
+    std::vector<GoroutineStack> warmStacks[NUM_SIZE_CLASSES];
+    std::vector<GoroutineStack> coldStacks[NUM_SIZE_CLASSES];
+    size_t warmCount = 0;
+    size_t maxStackSize;
+    size_t poolLimit;
+    size_t mappedStacks = 0;        // Segments carved so far, idle or not
+    bool guardRegions = true;       // MADV_GUARD_INSTALL works
+
+    GoroutineStackPool();
+
+    static size_t sizeClassFor(size_t size);
+    static size_t classSize(size_t sizeClass) { return StackPoolLayout::INITIAL_SEGMENT_SIZE << sizeClass; }
+
+    // Map an arena for a size class and add its segments to the free list.
+    // Caller holds the mutex.
+    void mapArena(size_t sizeClass);
+
+public:
+    GoroutineStackPool(const GoroutineStackPool&) = delete;
+    GoroutineStackPool& operator=(const GoroutineStackPool&) = delete;
+
+    static GoroutineStackPool& getInstance();
+
+    // A segment of at least `size` usable bytes, rounded up to a power of
+    // two (0 means INITIAL_SEGMENT_SIZE). Throws std::bad_alloc for more
+    // than MAX_SEGMENT_SIZE or when the address space is exhausted.
+    GoroutineStack acquire(size_t size);
+    void release(const GoroutineStack& stack);
+
+    size_t getPooledStacks();
+    size_t getMappedStacks();
+    size_t getMaxStackSize() const { return maxStackSize; }
+
+    // Give the calling thread an alternate signal stack, once. A goroutine
+    // that overflows faults with rsp in the guard, so the SIGSEGV handler
+    // can't run on the goroutine's own stack.
+    static void prepareThread();
+};
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <cstring>
 #include <cstdio>
+#include "gc.h"  // Must be before goroutine.h since goroutine uses GoroutineGCState
 #include "goroutine.h"
 #include "ast.h"
 
@@ -12,14 +13,17 @@ extern "C" uint64_t runtime_sleep(int64_t milliseconds);
 // Extern C functions for TechnoScript runtime
 extern "C" {
     void print_int64(int64_t value) {
+        ScopedOutsideManagedCode outside;  // stdout may block
         std::printf("%lld\n", static_cast<long long>(value));
     }
 
     void print_float64(double value) {
+        ScopedOutsideManagedCode outside;  // stdout may block
         std::printf("%g\n", value);
     }
 
     void print_any(uint64_t type, uint64_t value) {
+        ScopedOutsideManagedCode outside;  // stdout may block
         if (type == static_cast<uint64_t>(DataType::FLOAT64)) {
             union {
                 uint64_t u;
@@ -35,6 +39,7 @@ extern "C" {
     }
 
     void print_string(const char* str) {
+        ScopedOutsideManagedCode outside;  // stdout may block
         std::cout << str << std::endl;
     }
 
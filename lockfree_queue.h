@@ -115,6 +115,7 @@ struct ExpiredTimer {
 #pragma once
 #include <atomic>
 #include <memory>
+#include "data_structures/work_stealing_deque.h"
 
 // Forward declarations
 class Goroutine;
@@ -122,7 +123,7 @@ class Goroutine;
 enum class WorkerState {
     IDLE,       // Worker is waiting for tasks
     RUNNING,    // Worker is executing a goroutine  
-    SLEEPING,   // Worker is sleeping on condition variable
+    SLEEPING,   // Worker is parked on its futex
     STOPPING    // Worker is shutting down
 };
 
@@ -130,8 +131,21 @@ enum class WorkerState {
 struct WorkerThread {
     std::unique_ptr<std::thread> thread;
     std::atomic<WorkerState> state{WorkerState::IDLE};
-    std::shared_ptr<Goroutine> assignedTask{nullptr};  // Task assigned by main thread
+    std::shared_ptr<Goroutine> assignedTask{nullptr};  // Task handed over by whoever woke us
     uint32_t id;
     
-    WorkerThread(uint32_t workerId) : id(workerId) {}
+    // Futex a SLEEPING worker waits on. Whoever moves it from SLEEPING to
+    // RUNNING (EventLoop::assignTaskToSleepingWorker) sets assignedTask,
+    // then bumps this and wakes it.
+    std::atomic<uint32_t> parkWord{0};
+    
+    // Goroutines this worker made runnable (spawned, resumed): it pops the
+    // newest, idle workers steal the oldest. Plain pointers - the event
+    // loop's goroutine registry keeps them alive until they finish.
+    WorkStealingDeque<Goroutine*> runQueue{256};
+    bool spinning = false;          // Woken or started without a task, looking for one to steal
+    uint32_t schedulerTick = 0;     // Goroutines picked so far (see EventLoop::findRunnable)
+    uint64_t stealSeed;             // xorshift state picking the first victim
+    
+    WorkerThread(uint32_t workerId) : id(workerId), stealSeed(0x9E3779B97F4A7C15ull * (workerId + 1)) {}
 };
\ No newline at end of file
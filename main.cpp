@@ -3,6 +3,7 @@
 #include "ast_printer.h"
 #include "goroutine.h"
 #include "gc.h"
+#include "gc_profiler.h"
 #include <iostream>
 #include "codegen.h"
 
@@ -60,5 +61,8 @@ print(x[0]);
     codeGen.run();
     std::cout << "=== Program finished ===" << std::endl;
     
+    // TECHNOSCRIPT_ALLOC_PROFILE: dump the sampled allocation sites
+    AllocationProfiler::getInstance().writeConfiguredProfile();
+    
     return 0;
 }
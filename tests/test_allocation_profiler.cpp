@@ -0,0 +1,114 @@
+#include <cassert>
+#include <cmath>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "gc.h"
+#include "gc_heap.h"
+#include "gc_profiler.h"
+
+static ClassMetadata pointClass("Point", 0, nullptr, 16);
+static ClassMetadata bufferClass("Buffer", 0, nullptr, 48);
+static ScopeMetadata loopScope(0, nullptr, 32);
+
+// Stand-ins for the return addresses of generated slow-path calls
+static char siteA, siteB;
+
+// The calling thread's TLAB of a space and size class, where generated code finds it
+static TLAB& threadTLAB(HeapSpace space, uint32_t sizeClass) {
+    uint8_t* threadPointer = static_cast<uint8_t*>(__builtin_thread_pointer());
+    return *reinterpret_cast<TLAB*>(threadPointer + GCHeap::tlabThreadOffset(space, sizeClass));
+}
+
+// The inline allocation sequence: bump within limit, else call the slow path
+static void* allocateInline(GCHeap& heap, size_t size, ClassMetadata* metadata, const void* site) {
+    uint32_t sizeClass = HeapLayout::sizeClassFor(HeapLayout::roundToGranule(size));
+    size_t cellSize = HeapLayout::SIZE_CLASSES[sizeClass];
+    TLAB& tlab = threadTLAB(HeapSpace::OBJECT, sizeClass);
+    uint8_t* cell = tlab.top.load(std::memory_order_relaxed);
+    if (cell && cell + cellSize <= tlab.limit) {
+        *reinterpret_cast<void**>(cell) = metadata;
+        tlab.top.store(cell + cellSize, std::memory_order_release);
+        return cell;
+    }
+    return heap.allocateInTLAB(HeapSpace::OBJECT, size, metadata, site);
+}
+
+static bool near(uint64_t estimate, uint64_t actual, double tolerance) {
+    return std::fabs(static_cast<double>(estimate) - static_cast<double>(actual)) <= tolerance * actual;
+}
+
+int main() {
+    GCHeap& heap = GCHeap::getInstance();
+    AllocationProfiler& profiler = AllocationProfiler::getInstance();
+    profiler.registerSite(&siteA, "makePoints", "new Point");
+    profiler.registerSite(&siteB, "makeBuffers", "new Buffer");
+
+    // Off by default: TLAB limits reach the end of the buffer
+    assert(!profiler.isRunning());
+    heap.allocateInTLAB(HeapSpace::OBJECT, 32, &pointClass, &siteA);
+    uint32_t pointClassIndex = HeapLayout::sizeClassFor(32);
+    assert(threadTLAB(HeapSpace::OBJECT, pointClassIndex).limit == threadTLAB(HeapSpace::OBJECT, pointClassIndex).end);
+
+    // Sampling: estimates track the real volume per site, although most
+    // allocations never leave the inline path
+    constexpr size_t MEAN = 4096;
+    profiler.start(MEAN);
+    assert(profiler.isRunning());
+    size_t pointBytes = 0, bufferBytes = 0;
+    for (int i = 0; i < 200000; i++) {
+        allocateInline(heap, 32, &pointClass, &siteA);
+        pointBytes += HeapLayout::SIZE_CLASSES[pointClassIndex];
+        if (i % 2 == 0) {
+            allocateInline(heap, 64, &bufferClass, &siteB);
+            bufferBytes += HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(64)];
+        }
+    }
+
+    std::vector<AllocationProfiler::SiteProfile> profile = profiler.getProfile();
+    assert(profile.size() == 2);
+    for (const auto& site : profile) {
+        if (site.allocation == "new Point") {
+            assert(site.function == "makePoints");
+            assert(site.samples > pointBytes / MEAN / 2);
+            assert(near(site.bytes, pointBytes, 0.15));
+        } else {
+            assert(site.allocation == "new Buffer" && site.function == "makeBuffers");
+            assert(near(site.bytes, bufferBytes, 0.15));
+        }
+    }
+
+    // Unregistered sites are named after what they allocate
+    for (int i = 0; i < 20000; i++) {
+        heap.allocateInTLAB(HeapSpace::SCOPE, 32, &loopScope, nullptr);
+    }
+    bool foundScope = false;
+    for (const auto& site : profiler.getProfile()) {
+        if (site.function == "(runtime)") {
+            assert(site.allocation == "(scope anonymous)");
+            foundScope = true;
+        }
+    }
+    assert(foundScope);
+
+    // Folded stacks: one "function;allocation bytes" line per site
+    std::ostringstream folded;
+    profiler.writeFolded(folded);
+    std::string text = folded.str();
+    assert(text.find("makePoints;new Point ") != std::string::npos);
+    assert(text.find("makeBuffers;new Buffer ") != std::string::npos);
+    assert(text.find("(runtime);(scope anonymous) ") != std::string::npos);
+
+    // Stopping restores full-length TLABs at the next slow path, unsampled
+    profiler.stop();
+    profiler.reset();
+    for (int i = 0; i < 50000; i++) {
+        allocateInline(heap, 32, &pointClass, &siteA);
+    }
+    assert(profiler.getProfile().empty());
+    assert(threadTLAB(HeapSpace::OBJECT, pointClassIndex).limit == threadTLAB(HeapSpace::OBJECT, pointClassIndex).end);
+
+    std::cout << "allocation_profiler test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,70 @@
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include "data_structures/frame_stack.h"
+
+int main() {
+    // LIFO push/pop within one block: frames are aligned, zeroed and reused
+    {
+        FrameStack stack(1024);
+        assert(stack.empty());
+
+        uint8_t* a = static_cast<uint8_t*>(stack.push(24));
+        uint8_t* b = static_cast<uint8_t*>(stack.push(40));
+        assert(reinterpret_cast<uintptr_t>(a) % FrameStack::ALIGNMENT == 0);
+        assert(b == a + 32);
+        assert(stack.bytesInUse() == 32 + 48);
+        assert(stack.contains(a) && stack.contains(b));
+
+        for (int i = 0; i < 40; i++) {
+            b[i] = 0xAB;
+        }
+        stack.pop(b);
+        uint8_t* c = static_cast<uint8_t*>(stack.push(40));
+        assert(c == b);
+        for (int i = 0; i < 40; i++) {
+            assert(c[i] == 0);
+        }
+
+        stack.pop(c);
+        stack.pop(a);
+        assert(stack.empty());
+        assert(stack.bytesInUse() == 0);
+    }
+
+    // Deep recursion spills into more blocks and unwinds back through them
+    {
+        FrameStack stack(256);
+        std::vector<void*> frames;
+        for (int i = 0; i < 1000; i++) {
+            frames.push_back(stack.push(48));
+        }
+        assert(stack.bytesInUse() >= 1000 * 48);
+        for (int i = 999; i >= 0; i--) {
+            stack.pop(frames[i]);
+        }
+        assert(stack.empty());
+
+        // The blocks are kept: the same depth again reuses the same memory
+        void* first = stack.push(48);
+        assert(first == frames[0]);
+        stack.pop(first);
+    }
+
+    // Frames larger than a block get a block of their own
+    {
+        FrameStack stack(256);
+        void* small = stack.push(64);
+        uint8_t* big = static_cast<uint8_t*>(stack.push(4096));
+        big[4095] = 1;
+        void* after = stack.push(64);
+        stack.pop(after);
+        stack.pop(big);
+        stack.pop(small);
+        assert(stack.empty());
+    }
+
+    std::cout << "frame_stack test passed\n";
+    return 0;
+}
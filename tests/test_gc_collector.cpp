@@ -0,0 +1,174 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "gc.h"
+#include "gc_heap.h"
+
+// Cells: [flags][metadata][one reference at 16]
+static VarMetadata nodeFields[1] = { VarMetadata(16, DataType::OBJECT, nullptr, "next") };
+static ClassMetadata nodeClass("Node", 1, nodeFields, 8);
+static ClassMetadata youngClass("Young", 1, nodeFields, 8);
+static VarMetadata scopeVars[1] = { VarMetadata(0, DataType::OBJECT, nullptr, "cell") };
+static ScopeMetadata scopeMetadata(1, scopeVars, 24);
+
+static void*& reference(void* cell) {
+    return *reinterpret_cast<void**>(static_cast<uint8_t*>(cell) + 16);
+}
+
+static void allocateGarbage(int count) {
+    for (int i = 0; i < count; i++) {
+        gc_allocate_object(24, &nodeClass);
+    }
+}
+
+// One trace line: a flat object of numbers, booleans and plain strings
+static std::map<std::string, std::string> parseTraceLine(const std::string& line) {
+    std::map<std::string, std::string> fields;
+    assert(line.size() > 2 && line.front() == '{' && line.back() == '}');
+    size_t pos = 1;
+    while (pos < line.size() - 1) {
+        assert(line[pos] == '"');
+        size_t keyEnd = line.find('"', pos + 1);
+        assert(keyEnd != std::string::npos && line[keyEnd + 1] == ':');
+        std::string key = line.substr(pos + 1, keyEnd - pos - 1);
+        size_t valueEnd = line.find_first_of(",}", keyEnd + 2);
+        std::string value = line.substr(keyEnd + 2, valueEnd - keyEnd - 2);
+        if (value.front() == '"') {
+            assert(value.size() >= 2 && value.back() == '"');
+            value = value.substr(1, value.size() - 2);
+        }
+        assert(!fields.count(key));
+        fields[key] = value;
+        pos = valueEnd + 1;
+    }
+    return fields;
+}
+
+static void pollSafepoint() {
+    if (GarbageCollector::getInstance().safepointPollWord()->load()) {
+        gc_safepoint_poll(nullptr, nullptr);
+    }
+}
+
+int main() {
+    GarbageCollector& gc = GarbageCollector::getInstance();
+    GCHeap& heap = GCHeap::getInstance();
+
+    std::string tracePath = "/tmp/test_gc_collector_trace_" + std::to_string(getpid()) + ".jsonl";
+    std::remove(tracePath.c_str());
+    gc.setTraceFile(tracePath);
+    assert(gc.getStats().cycles == 0);
+
+    // Blocking runtime code steps out of managed code, and back in however
+    // it returns
+    GoroutineGCState* state = gc.currentGCState();
+    state->enterManagedCode();
+    try {
+        ScopedOutsideManagedCode outside;
+        assert(!state->inManagedCode.load());
+        throw std::runtime_error("unwinding");
+    } catch (const std::runtime_error&) {
+    }
+    assert(state->inManagedCode.load());
+    state->leaveManagedCode();
+    {
+        ScopedOutsideManagedCode outside;
+    }
+    assert(!state->inManagedCode.load());
+
+    void* scope = gc_allocate_scope(24, &scopeMetadata);
+    gc_push_scope(scope);
+    allocateGarbage(1000);
+
+    // A cell bump-allocated and remembered while a cycle runs, after the
+    // cycle flushed the TLABs: no start bit yet when the cycle cleans up,
+    // which must not cost it its place in the remembered set. Allocation
+    // wakes the GC thread; we stay in managed code so its handshakes wait
+    // for our polls
+    void* cell = nullptr;
+    gc.start();
+    gc.currentGCState()->enterManagedCode();
+    while (gc.getCompletedCycles() < 1) {
+        if (!cell && gc.safepointPollWord()->load()) {
+            cell = gc_allocate_object(24, &nodeClass);
+            reference(scope) = cell;
+            gc_remember(scope);
+            gc_remember(cell);
+        }
+        pollSafepoint();
+        // Not another cell after it: a TLAB refill would publish it
+        if (!cell) {
+            allocateGarbage(100);
+        }
+    }
+    gc.currentGCState()->leaveManagedCode();
+    assert(cell);
+
+    // The next cycle sees it and makes it old
+    gc_collect();
+    assert(heap.isOld(cell) && reference(scope) == cell);
+
+    // A young cell only the old one refers to, recorded by the barrier
+    void* young = gc_allocate_object(24, &youngClass);
+    reference(cell) = young;
+    gc_remember(cell);
+
+    // A minor cycle (the pacer's) must keep it
+    uint64_t minorCycles = gc.getStats().minorCycles;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+    while (gc.getStats().minorCycles == minorCycles && std::chrono::steady_clock::now() < deadline) {
+        allocateGarbage(10000);
+    }
+    gc.stop();
+    GCStats stats = gc.getStats();
+    std::cout << "gc collector: " << stats.cycles << " cycles (" << stats.minorCycles << " minor), "
+              << stats.objectsFreed << " objects freed" << std::endl;
+    assert(stats.minorCycles > minorCycles);
+    assert(reference(cell) == young && heap.isAllocated(young));
+    assert(static_cast<ObjectHeader*>(young)->classMetadata == &youngClass);
+
+    // The counters moved, and the trace has one line per cycle agreeing with them
+    assert(stats.cycles >= 3 && stats.cycles == stats.lastCycle.cycle);
+    assert(stats.objectsFreed > 0 && stats.bytesReclaimed >= stats.objectsFreed * 24);
+    assert(stats.objectsScanned > 0 && stats.maxCycleMs > 0 && stats.totalMs >= stats.maxCycleMs);
+    assert(stats.outOfMemoryErrors == 0);
+    gc.setTraceFile("");
+
+    std::ifstream trace(tracePath);
+    std::vector<std::map<std::string, std::string>> lines;
+    for (std::string line; std::getline(trace, line);) {
+        lines.push_back(parseTraceLine(line));
+    }
+    std::remove(tracePath.c_str());
+    assert(lines.size() == stats.cycles);
+
+    uint64_t minorLines = 0;
+    uint64_t requestedLines = 0;
+    uint64_t objectsFreed = 0;
+    for (size_t i = 0; i < lines.size(); i++) {
+        auto& fields = lines[i];
+        assert(std::stoull(fields.at("cycle")) == i + 1);
+        assert(fields.at("type") == "minor" || fields.at("type") == "full");
+        assert(fields.at("requested") == "true" || fields.at("requested") == "false");
+        assert(std::stod(fields.at("total_ms")) >= std::stod(fields.at("phase1_ms")));
+        minorLines += fields.at("type") == "minor";
+        requestedLines += fields.at("requested") == "true";
+        objectsFreed += std::stoull(fields.at("objects_freed"));
+    }
+    assert(minorLines == stats.minorCycles);
+    assert(requestedLines == 1); // The gc_collect above
+    assert(objectsFreed == stats.objectsFreed);
+    assert(std::stoull(lines.back().at("heap_bytes")) == stats.lastCycle.heapBytesAfter);
+
+    std::cout << "gc_collector test passed" << std::endl;
+    return 0;
+}
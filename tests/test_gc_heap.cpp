@@ -0,0 +1,390 @@
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include <thread>
+#include <sys/mman.h>
+#include "gc_heap.h"
+
+// Test metadata: only its address is stored in cell headers
+struct TestMetadata {
+    size_t size;
+};
+
+// Read a word of the calling thread's TLS block the way generated code does
+static uint8_t* readThreadWord(intptr_t offset) {
+    uint8_t* value;
+    asm volatile("movq %%fs:(%1), %0" : "=r"(value) : "r"(offset));
+    return value;
+}
+
+static int triggerCalls = 0;
+static void countTrigger() { triggerCalls++; }
+
+int main() {
+    GCHeap& heap = GCHeap::getInstance();
+
+    // Size classes: granule steps up to 128 bytes, then 25% steps
+    assert(HeapLayout::sizeClassFor(1) == 0);
+    assert(HeapLayout::sizeClassFor(16) == 0);
+    assert(HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(24)] == 32);
+    assert(HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(129)] == 160);
+    assert(HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(HeapLayout::MAX_SMALL_CELL)] == HeapLayout::MAX_SMALL_CELL);
+    assert(HeapLayout::sizeClassFor(HeapLayout::MAX_SMALL_CELL + 1) == HeapLayout::NO_SIZE_CLASS);
+    for (size_t i = 1; i < HeapLayout::NUM_SIZE_CLASSES; i++) {
+        assert(HeapLayout::SIZE_CLASSES[i] % HeapLayout::GRANULE_SIZE == 0);
+        assert(HeapLayout::SIZE_CLASSES[i] > HeapLayout::SIZE_CLASSES[i - 1]);
+        assert(HeapLayout::SIZE_CLASSES[i] * 4 <= HeapLayout::SIZE_CLASSES[i - 1] * 5 + 64);
+    }
+
+    // Allocate a few objects and a scope
+    void* a = heap.allocate(HeapSpace::OBJECT, 24);
+    void* b = heap.allocate(HeapSpace::OBJECT, 40);
+    void* c = heap.allocate(HeapSpace::OBJECT, 8);
+    void* s = heap.allocate(HeapSpace::SCOPE, 32);
+
+    assert(heap.contains(a) && heap.contains(s));
+    assert(reinterpret_cast<uintptr_t>(a) % HeapLayout::GRANULE_SIZE == 0);
+    assert(HeapChunk::fromAddress(a)->space == HeapSpace::OBJECT);
+    assert(HeapChunk::fromAddress(s)->space == HeapSpace::SCOPE);
+
+    // Mixed-chunk cells are sized by the next start bit (or the bump pointer)
+    assert(heap.cellSize(a) == 32 && heap.cellSize(b) == 48 && heap.cellSize(c) == 16);
+
+    // Cells come back zeroed
+    for (int i = 0; i < 40; i++) {
+        assert(static_cast<uint8_t*>(b)[i] == 0);
+    }
+
+    // Marking is test-and-set
+    heap.beginMarking();
+    assert(heap.tryMark(a));
+    assert(!heap.tryMark(a));
+    assert(heap.isMarked(a));
+    assert(!heap.isMarked(b));
+
+    // Cells allocated while marking are born marked
+    void* d = heap.allocate(HeapSpace::OBJECT, 16);
+    assert(heap.isMarked(d));
+
+    // Bitmap scan finds exactly the unmarked cells of each space
+    std::vector<void*> unmarked;
+    heap.collectUnmarked(HeapSpace::OBJECT, unmarked);
+    heap.finishMarking();
+    assert(unmarked.size() == 2);
+    assert(std::find(unmarked.begin(), unmarked.end(), b) != unmarked.end());
+    assert(std::find(unmarked.begin(), unmarked.end(), c) != unmarked.end());
+
+    std::vector<void*> unmarkedScopes;
+    heap.collectUnmarked(HeapSpace::SCOPE, unmarkedScopes);
+    assert(unmarkedScopes.size() == 1 && unmarkedScopes[0] == s);
+
+    // Freed cells disappear from later scans
+    assert(heap.isAllocated(b) && heap.isAllocated(c));
+    heap.freeCell(b);
+    heap.freeCell(c);
+    assert(!heap.isAllocated(b) && !heap.isAllocated(c) && heap.isAllocated(a));
+    heap.clearMarkBits();
+    unmarked.clear();
+    heap.collectUnmarked(HeapSpace::OBJECT, unmarked);
+    assert(unmarked.size() == 2);
+
+    // Large cells get their own page-aligned mapping and are unmapped once
+    // dead; the address range is reused by the next large cell
+    size_t chunksBefore = heap.chunkCount();
+    void* big = heap.allocate(HeapSpace::OBJECT, HeapLayout::CHUNK_SIZE * 2);
+    assert(heap.chunkCount() == chunksBefore + 1);
+    assert(reinterpret_cast<uintptr_t>(big) % HeapLayout::PAGE_SIZE == 0);
+    assert(HeapChunk::fromAddress(big)->largeObject && heap.isAllocated(big));
+    assert(heap.cellSize(big) == HeapLayout::CHUNK_SIZE * 2);
+    assert(heap.largeObjectSpaceBytes() == HeapLayout::roundToPage(GCHeap::largeCellOffset() + HeapLayout::CHUNK_SIZE * 2));
+    static_cast<uint8_t*>(big)[HeapLayout::CHUNK_SIZE * 2 - 1] = 1;
+    heap.freeCell(big);
+    heap.sweep();
+    assert(heap.chunkCount() == chunksBefore);
+    assert(heap.largeObjectSpaceBytes() == 0);
+    void* bigAgain = heap.allocate(HeapSpace::OBJECT, HeapLayout::LARGE_OBJECT_THRESHOLD + 1);
+    assert(bigAgain == big && static_cast<uint8_t*>(bigAgain)[HeapLayout::LARGE_OBJECT_THRESHOLD] == 0);
+    heap.freeCell(bigAgain);
+    heap.sweep();
+
+    // Medium cells stay in shared chunks
+    void* medium1 = heap.allocate(HeapSpace::OBJECT, HeapLayout::LARGE_OBJECT_THRESHOLD);
+    assert(!HeapChunk::fromAddress(medium1)->largeObject);
+    heap.freeCell(medium1);
+
+    // Large RawMemory blocks: separate mappings outside the heap range
+    uint8_t* raw = static_cast<uint8_t*>(heap.allocateRaw(HeapLayout::LARGE_OBJECT_THRESHOLD * 3 + 5));
+    assert(!heap.contains(raw) && reinterpret_cast<uintptr_t>(raw) % HeapLayout::PAGE_SIZE == 0);
+    assert(raw[HeapLayout::LARGE_OBJECT_THRESHOLD * 3 + 4] == 0);
+    assert(heap.rawMemoryBytes() == HeapLayout::roundToPage(HeapLayout::LARGE_OBJECT_THRESHOLD * 3 + 5));
+    heap.setHugePageAdvice(true);
+    uint8_t* hugeRaw = static_cast<uint8_t*>(heap.allocateRaw(HeapLayout::HUGE_PAGE_SIZE * 2));
+    assert(reinterpret_cast<uintptr_t>(hugeRaw) % HeapLayout::HUGE_PAGE_SIZE == 0);
+    hugeRaw[HeapLayout::HUGE_PAGE_SIZE * 2 - 1] = 1;
+    heap.setHugePageAdvice(false);
+    assert(heap.releaseRaw(raw) && heap.releaseRaw(hugeRaw));
+    assert(!heap.releaseRaw(raw));
+    assert(heap.rawMemoryBytes() == 0);
+
+    // TLAB allocation: sizes of one class share a TLAB and get contiguous
+    // cells of the class size, header stored, no start bits until flushed
+    static TestMetadata small{24};
+    static TestMetadata medium{32};
+    constexpr uint32_t smallClass = HeapLayout::sizeClassFor(24);
+    constexpr size_t smallCell = HeapLayout::SIZE_CLASSES[smallClass];
+    static_assert(HeapLayout::sizeClassFor(32) == smallClass, "24 and 32 bytes share a class");
+
+    uint8_t* t1 = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, small.size, &small));
+    uint8_t* t2 = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, medium.size, &medium));
+    assert(t2 == t1 + smallCell);
+    assert(HeapChunk::fromAddress(t1)->sizeClass == smallClass);
+    assert(*reinterpret_cast<void**>(t1) == &small);
+    assert(*reinterpret_cast<void**>(t2) == &medium);
+    for (size_t i = 8; i < medium.size; i++) {
+        assert(t2[i] == 0);
+    }
+    assert(!HeapChunk::fromAddress(t1)->isAllocated(t1));
+
+    // Scope cells keep their metadata pointer at offset 8
+    uint8_t* ts = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::SCOPE, small.size, &small));
+    assert(*reinterpret_cast<void**>(ts + HeapLayout::metadataOffset(HeapSpace::SCOPE)) == &small);
+
+    // Generated code finds the TLAB at a fixed offset from the fs base
+    intptr_t topOffset = GCHeap::tlabThreadOffset(HeapSpace::OBJECT, smallClass) + TLABLayout::TOP_OFFSET;
+    intptr_t limitOffset = GCHeap::tlabThreadOffset(HeapSpace::OBJECT, smallClass) + TLABLayout::LIMIT_OFFSET;
+    uint8_t* top = readThreadWord(topOffset);
+    assert(top == t2 + smallCell);
+    assert(readThreadWord(limitOffset) > top);
+
+    // Emulate the inline fast path: header store, then bump top
+    *reinterpret_cast<void**>(top) = &small;
+    uint8_t* newTop = top + smallCell;
+    asm volatile("movq %0, %%fs:(%1)" : : "r"(newTop), "r"(topOffset) : "memory");
+    uint8_t* t3 = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, small.size, &small));
+    assert(t3 == newTop);
+
+    heap.flushTLABs();
+    assert(HeapChunk::fromAddress(t1)->isAllocated(t1));
+    assert(HeapChunk::fromAddress(t2)->isAllocated(t2));
+    assert(HeapChunk::fromAddress(top)->isAllocated(top));
+    assert(HeapChunk::fromAddress(t3)->isAllocated(t3));
+    assert(HeapChunk::fromAddress(ts)->isAllocated(ts));
+
+    // Cells allocated while marking and flushed later are born marked
+    heap.beginMarking();
+    uint8_t* t4 = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, small.size, &small));
+    heap.flushTLABs();
+    assert(heap.isMarked(t4) && !heap.isMarked(t1));
+    heap.finishMarking();
+
+    // Refill: exhausting a TLAB retires it (its cells get start bits) and
+    // carves a new one
+    std::vector<uint8_t*> cells;
+    for (size_t i = 0; i < 2 * HeapLayout::TLAB_SIZE / smallCell; i++) {
+        cells.push_back(static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, small.size, &small)));
+    }
+    assert(HeapChunk::fromAddress(cells[0])->isAllocated(cells[0]));
+
+    // A thread's TLABs are retired when it exits
+    uint8_t* threadCell = nullptr;
+    std::thread([&] {
+        threadCell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, small.size, &small));
+    }).join();
+    assert(HeapChunk::fromAddress(threadCell)->isAllocated(threadCell));
+
+    // Cells above MAX_SMALL_CELL go to the shared chunk and are allocated at once
+    static TestMetadata large{HeapLayout::MAX_SMALL_CELL * 2};
+    uint8_t* bigCell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, large.size, &large));
+    assert(HeapChunk::fromAddress(bigCell)->isAllocated(bigCell));
+    assert(HeapChunk::fromAddress(bigCell)->sizeClass == HeapLayout::NO_SIZE_CLASS);
+    assert(*reinterpret_cast<void**>(bigCell) == &large);
+
+    // Sweeping: another thread fills exactly one TLAB of a fresh size class
+    // and exits, some of its cells die, and the next TLAB reuses them zeroed
+    static TestMetadata swept{200};
+    constexpr uint32_t sweptClass = HeapLayout::sizeClassFor(200);
+    constexpr size_t sweptCell = HeapLayout::SIZE_CLASSES[sweptClass];
+    std::vector<uint8_t*> sweptCells;
+    std::thread([&] {
+        for (size_t i = 0; i < HeapLayout::TLAB_SIZE / sweptCell; i++) {
+            uint8_t* cell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, swept.size, &swept));
+            std::fill(cell + 8, cell + sweptCell, 0xAB);
+            sweptCells.push_back(cell);
+        }
+    }).join();
+    for (size_t i = 2; i < 6; i++) {
+        heap.freeCell(sweptCells[i]);
+    }
+    heap.sweep();
+    assert(heap.freeRunBytes() >= 4 * sweptCell);
+
+    for (size_t i = 2; i < 6; i++) {
+        uint8_t* cell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, swept.size, &swept));
+        assert(cell == sweptCells[i]);
+        for (size_t j = 8; j < sweptCell; j++) {
+            assert(cell[j] == 0);
+        }
+    }
+    heap.flushTLABs();
+    assert(HeapChunk::fromAddress(sweptCells[2])->isAllocated(sweptCells[2]));
+    assert(sweptCells[6][8] == 0xAB);
+
+    // Once the free run is used up the class falls back to fresh chunk space
+    uint8_t* fresh = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, swept.size, &swept));
+    assert(std::find(sweptCells.begin(), sweptCells.end(), fresh) == sweptCells.end());
+
+    // Generations: cells allocated before beginTenuring() become old when
+    // they survive the cycle, cells allocated during it stay young
+    void* survivor = heap.allocate(HeapSpace::OBJECT, 48);
+    void* casualty = heap.allocate(HeapSpace::OBJECT, 48);
+    heap.beginTenuring();
+    void* newborn = heap.allocate(HeapSpace::OBJECT, 48);
+    assert(!heap.isOld(survivor));
+    heap.freeCell(casualty);
+    heap.promoteSurvivors();
+    assert(heap.isOld(survivor) && !heap.isOld(newborn) && !heap.isOld(casualty));
+
+    // A young-only scan skips old cells
+    heap.clearMarkBits();
+    std::vector<void*> youngCells;
+    heap.collectUnmarked(HeapSpace::OBJECT, youngCells, true);
+    assert(std::find(youngCells.begin(), youngCells.end(), survivor) == youngCells.end());
+    assert(std::find(youngCells.begin(), youngCells.end(), newborn) != youngCells.end());
+
+    // Freed cells lose their age
+    size_t oldCells = heap.oldCellCount();
+    heap.freeCell(survivor);
+    assert(!heap.isOld(survivor));
+    assert(heap.oldCellCount() == oldCells - 1);
+
+    // Allocation pacing: shared cells count their size, TLABs count the
+    // whole buffer when refilled; the trigger fires once per crossing
+    heap.resetAllocationCounter();
+    heap.allocate(HeapSpace::OBJECT, 64);
+    assert(heap.bytesAllocatedSinceCycle() == 64);
+    heap.setAllocationTrigger(HeapLayout::TLAB_SIZE, &countTrigger);
+    TestMetadata paced{24};
+    for (size_t i = 0; i < 4 * HeapLayout::TLAB_SIZE / 32; i++) {
+        heap.allocateInTLAB(HeapSpace::OBJECT, paced.size, &paced);
+    }
+    assert(heap.bytesAllocatedSinceCycle() >= 3 * HeapLayout::TLAB_SIZE);
+    assert(triggerCalls == 1);
+    heap.resetAllocationCounter();
+    heap.setAllocationTrigger(SIZE_MAX, nullptr);
+    assert(heap.bytesAllocatedSinceCycle() == 0);
+    assert(heap.heapBytes() > 0 && heap.heapBytes() <= heap.chunkCount() * HeapLayout::CHUNK_SIZE);
+
+    // Lazy sweeping: beginSweep() only queues the chunks, a TLAB refill
+    // sweeps its own size class, sweepPending() releases the emptied chunks
+    static TestMetadata lazy{3000};
+    constexpr size_t lazyCell = HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(3000)];
+    std::vector<uint8_t*> lazyCells;
+    std::thread([&] {
+        for (size_t i = 0; i < 3 * HeapLayout::CHUNK_SIZE / lazyCell; i++) {
+            lazyCells.push_back(static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, lazy.size, &lazy)));
+        }
+    }).join();
+    HeapChunk* emptied = HeapChunk::fromAddress(lazyCells.front());
+    assert(HeapChunk::fromAddress(lazyCells.back()) != emptied);
+    for (uint8_t* cell : lazyCells) {
+        if (HeapChunk::fromAddress(cell) == emptied || cell == lazyCells.back()) {
+            heap.freeCell(cell);
+        }
+    }
+    heap.beginSweep();
+    assert(heap.hasPendingSweep());
+    size_t chunksBeforeSweep = heap.chunkCount();
+
+    uint8_t* lazyReused = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, lazy.size, &lazy));
+    assert(HeapChunk::fromAddress(lazyReused) == HeapChunk::fromAddress(lazyCells.back()));
+    assert(heap.hasPendingSweep() && heap.chunkCount() == chunksBeforeSweep);
+
+    assert(!heap.sweepPending(SIZE_MAX));
+    assert(!heap.hasPendingSweep());
+    assert(heap.chunkCount() < chunksBeforeSweep);
+
+    // heapBytes() counts what the queued chunks will give back up front
+    heap.beginSweep();
+    size_t queuedHeapBytes = heap.heapBytes();
+    heap.sweepPending(SIZE_MAX);
+    assert(heap.heapBytes() == queuedHeapBytes);
+    heap.sweep();
+    assert(heap.heapBytes() == queuedHeapBytes);
+
+    // Defragmentation: when most cells are dead, sparse chunks are drained -
+    // no new cells, free pages back to the OS at once - and released when
+    // their last cell dies
+    static TestMetadata sparse{1000};
+    constexpr size_t sparseCell = HeapLayout::SIZE_CLASSES[HeapLayout::sizeClassFor(1000)];
+    std::vector<uint8_t*> sparseCells;
+    std::thread([&] {
+        for (size_t i = 0; i < 4 * HeapLayout::CHUNK_SIZE / sparseCell; i++) {
+            uint8_t* cell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, sparse.size, &sparse));
+            std::fill(cell + 8, cell + sparseCell, 0xCD);
+            sparseCells.push_back(cell);
+        }
+    }).join();
+    std::vector<uint8_t*> sparseSurvivors;
+    uint8_t* deadPage = nullptr;
+    for (size_t i = 0; i < sparseCells.size(); i++) {
+        if (i % 16 == 0) {
+            sparseSurvivors.push_back(sparseCells[i]);
+        } else {
+            heap.freeCell(sparseCells[i]);
+            if (i % 16 == 8 && !deadPage) {
+                deadPage = reinterpret_cast<uint8_t*>(HeapLayout::roundToPage(reinterpret_cast<uintptr_t>(sparseCells[i])));
+            }
+        }
+    }
+    size_t chunksBeforeDrain = heap.chunkCount();
+    heap.setDefragmentation(30);
+    heap.sweep();
+    assert(heap.fragmentationPercent() >= 30);
+    size_t drainingCount = heap.drainingChunkCount();
+    assert(drainingCount >= 3);
+    assert(heap.purgedBytesTotal() > 0);
+    HeapChunk* drained = HeapChunk::fromAddress(deadPage);
+    assert(drained->draining);
+    unsigned char resident = 1;
+    assert(mincore(deadPage, HeapLayout::PAGE_SIZE, &resident) == 0 && !(resident & 1));
+
+    // Running into the heap limit stops draining, and the drained runs stop
+    // counting as free: nothing hands them out before the next sweep
+    size_t drainingHeapBytes = heap.heapBytes();
+    heap.setHeapLimit(heap.committedBytes());
+    bool limited = false;
+    try {
+        heap.allocateRaw(HeapLayout::LARGE_OBJECT_THRESHOLD);
+    } catch (const OutOfMemoryError&) {
+        limited = true;
+    }
+    assert(limited && heap.drainingChunkCount() == 0);
+    assert(heap.heapBytes() > drainingHeapBytes);
+    heap.setHeapLimit(SIZE_MAX);
+    heap.sweep();
+    assert(heap.heapBytes() == drainingHeapBytes);
+    drainingCount = heap.drainingChunkCount();
+    assert(drainingCount >= 3 && drained->draining);
+
+    for (int i = 0; i < 64; i++) {
+        uint8_t* cell = static_cast<uint8_t*>(heap.allocateInTLAB(HeapSpace::OBJECT, sparse.size, &sparse));
+        assert(!HeapChunk::fromAddress(cell)->draining);
+    }
+
+    for (uint8_t* cell : sparseSurvivors) {
+        if (HeapChunk::fromAddress(cell)->draining) {
+            heap.freeCell(cell);
+        }
+    }
+    heap.sweep();
+    // Every drained chunk is released (the 64 new cells may have taken one)
+    assert(heap.chunkCount() + drainingCount <= chunksBeforeDrain + 1);
+    heap.setDefragmentation(0);
+    heap.sweep();
+    assert(heap.drainingChunkCount() == 0);
+
+    std::cout << "gc_heap basic test passed\n";
+    return 0;
+}
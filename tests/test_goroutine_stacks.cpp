@@ -0,0 +1,291 @@
+#include <atomic>
+#include <cassert>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "gc.h"
+#include "goroutine.h"
+#include "goroutine_stack.h"
+
+extern thread_local std::shared_ptr<Goroutine> currentTask;
+
+// Stand-ins for generated functions, registered as generated code. The
+// first has the entry check codegen emits (emitStackCheck), the usual
+// prologue, and a 256-byte frame per level; it returns depth + (depth - 1)
+// + ... + 0 and calls testAtBottom at depth 0. The second passes the check
+// and then touches a 64 KB frame a page at a time, far more than the
+// reserve, so it runs into the guard.
+extern "C" {
+    intptr_t testStackLimitOffset;
+    uintptr_t testBottomLimit;
+    uint64_t testGeneratedRecurse(uint64_t depth);
+    void testGeneratedLargeFrame();
+    extern const char testGeneratedCodeEnd[];
+    void testAtBottom();
+}
+
+asm(R"(
+    .text
+    .globl testGeneratedRecurse
+    .type testGeneratedRecurse, @function
+testGeneratedRecurse:
+    movq testStackLimitOffset(%rip), %r11
+    cmpq %fs:(%r11), %rsp
+    jae 1f
+    call technoscript_morestack@PLT
+1:  pushq %rbp
+    movq %rsp, %rbp
+    pushq %r14
+    pushq %r15
+    subq $256, %rsp
+    movq %rdi, (%rsp)
+    testq %rdi, %rdi
+    jz 2f
+    decq %rdi
+    call testGeneratedRecurse
+    addq (%rsp), %rax
+    jmp 3f
+2:  call testAtBottom@PLT
+    xorl %eax, %eax
+3:  addq $256, %rsp
+    popq %r15
+    popq %r14
+    popq %rbp
+    ret
+    .size testGeneratedRecurse, .-testGeneratedRecurse
+
+    .globl testGeneratedLargeFrame
+    .type testGeneratedLargeFrame, @function
+testGeneratedLargeFrame:
+    movq testStackLimitOffset(%rip), %r11
+    cmpq %fs:(%r11), %rsp
+    jae 1f
+    call technoscript_morestack@PLT
+1:  pushq %rbp
+    movq %rsp, %rbp
+    movl $16, %ecx
+2:  subq $4096, %rsp
+    movq $0, (%rsp)
+    decl %ecx
+    jnz 2b
+    movq %rbp, %rsp
+    popq %rbp
+    ret
+    .size testGeneratedLargeFrame, .-testGeneratedLargeFrame
+
+    .globl testGeneratedCodeEnd
+testGeneratedCodeEnd:
+)");
+
+// Read through fs every time: the goroutine may be on another thread after
+// an await, and the compiler would happily reuse a thread pointer
+static uintptr_t stackLimit() {
+    uintptr_t limit;
+    asm volatile("movq %%fs:(%1), %0" : "=r"(limit) : "r"(testStackLimitOffset));
+    return limit;
+}
+
+void testAtBottom() {
+    testBottomLimit = stackLimit();
+}
+
+// Never tail-called away: uses its frame after the recursive call returns
+static volatile int recursionLimit = 1 << 30;
+
+static int recurse(int depth) {
+    volatile char frame[256];
+    frame[0] = static_cast<char>(depth);
+    if (depth >= recursionLimit) {
+        return frame[0];
+    }
+    return recurse(depth + 1) + frame[0];
+}
+
+// Whether a page is mapped and resident
+static bool resident(const void* address) {
+    unsigned char state = 0;
+    uintptr_t page = reinterpret_cast<uintptr_t>(address) & ~(uintptr_t(sysconf(_SC_PAGESIZE)) - 1);
+    return mincore(reinterpret_cast<void*>(page), 1, &state) == 0 && (state & 1);
+}
+
+static long residentKilobytes() {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.rfind("VmRSS:", 0) == 0) {
+            return std::stol(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+int main() {
+    using namespace StackPoolLayout;
+    constexpr int PARKED = 20000;
+    constexpr uint64_t DEEP = 3000;             // About 850 KB of frames
+    constexpr size_t MAX_STACK = 4 * 1024 * 1024;
+
+    setenv("TECHNOSCRIPT_WORKERS", "4", 1);
+    setenv("TECHNOSCRIPT_STACK_POOL", "256", 1);
+    setenv("TECHNOSCRIPT_STACK_SIZE", std::to_string(MAX_STACK).c_str(), 1);
+    testStackLimitOffset = Goroutine::stackLimitThreadOffset();
+    const char* generatedCode = reinterpret_cast<const char*>(&testGeneratedRecurse);
+    Goroutine::registerGeneratedCode(generatedCode, testGeneratedCodeEnd - generatedCode);
+    assert(Goroutine::isGeneratedCode(reinterpret_cast<const void*>(&testGeneratedLargeFrame)));
+    assert(!Goroutine::isGeneratedCode(reinterpret_cast<const void*>(&testAtBottom)));
+
+    // C++ code that runs into a guard may hold locks, so it takes the whole
+    // process down rather than just its goroutine (a child's, here)
+    pid_t child = fork();
+    if (child == 0) {
+        rlimit noCore = {0, 0};
+        setrlimit(RLIMIT_CORE, &noCore);
+        std::cout.rdbuf(nullptr);
+        EventLoop::getInstance().spawnGoroutine([] { recurse(0); });
+        EventLoop::getInstance().run();
+        _exit(0);
+    }
+    int status = 0;
+    assert(waitpid(child, &status, 0) == child);
+    assert(WIFSIGNALED(status) && WTERMSIG(status) == SIGSEGV);
+    GoroutineStackPool& pool = GoroutineStackPool::getInstance();
+    assert(pool.getMaxStackSize() == MAX_STACK);
+
+    // Recycling: a released segment is the next one handed out, with only
+    // its top page still committed
+    GoroutineStack first = pool.acquire(0);
+    size_t arena = pool.getMappedStacks();
+    assert(first.size == INITIAL_SEGMENT_SIZE && arena > 1 && pool.getPooledStacks() == arena - 1);
+    std::memset(first.base(), 0xab, first.size);
+    assert(resident(first.base()));
+    pool.release(first);
+    assert(pool.getPooledStacks() == arena);
+    assert(!resident(first.base()) && resident(first.top() - 1));
+    GoroutineStack again = pool.acquire(0);
+    assert(again.mapping == first.mapping);
+    assert(again.inGuard(again.mapping) && again.inGuard(again.base() - 1) && !again.inGuard(again.base()));
+    pool.release(again);
+
+    // Sizes round up to a power of two; more than a segment's worth is refused
+    GoroutineStack larger = pool.acquire(INITIAL_SEGMENT_SIZE * 2 + 1);
+    assert(larger.size == INITIAL_SEGMENT_SIZE * 4);
+    pool.release(larger);
+    bool refused = false;
+    try {
+        pool.acquire(MAX_SEGMENT_SIZE + 1);
+    } catch (const std::bad_alloc&) {
+        refused = true;
+    }
+    assert(refused);
+
+    EventLoop& loop = EventLoop::getInstance();
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+
+    // Growth: the recursion spills onto more segments and comes back, the
+    // limit following it; parking gives the spares back
+    std::atomic<bool> grew{false};
+    loop.spawnGoroutine([&] {
+        GoroutineContext* context = currentTask->context.get();
+        uintptr_t initialLimit = stackLimit();
+        assert(initialLimit == context->stackLimit());
+        uint64_t sum = testGeneratedRecurse(DEEP);
+        assert(sum == DEEP * (DEEP + 1) / 2);
+        assert(stackLimit() == initialLimit && testBottomLimit != initialLimit);
+        assert(context->segments.size() > 4 && context->segment == 0);
+
+        // Again: the spares are reused, not allocated
+        size_t mapped = GoroutineStackPool::getInstance().getMappedStacks();
+        assert(testGeneratedRecurse(DEEP) == sum);
+        assert(GoroutineStackPool::getInstance().getMappedStacks() == mapped);
+
+        runtime_await_promise(runtime_sleep(5));
+        assert(context->segments.size() == 1 && stackLimit() == context->stackLimit());
+        grew = true;
+    });
+
+    // Runtime work that needs more than the reserve (a collection) runs on
+    // the worker's stack: off every segment, with room for more than one,
+    // and what it throws comes back to the goroutine
+    std::atomic<bool> ranOnWorkerStack{false};
+    loop.spawnGoroutine([&] {
+        GoroutineContext* context = currentTask->context.get();
+        uintptr_t limit = stackLimit();
+        bool thrown = false;
+        try {
+            Goroutine::runOnWorkerStack([&] {
+                volatile char frame[INITIAL_SEGMENT_SIZE * 2];
+                frame[0] = 1;
+                frame[sizeof(frame) - 1] = 1;
+                uintptr_t address = reinterpret_cast<uintptr_t>(frame);
+                for (const GoroutineStack& segment : context->segments) {
+                    assert(address < reinterpret_cast<uintptr_t>(segment.mapping) ||
+                           address >= reinterpret_cast<uintptr_t>(segment.top()));
+                }
+                assert(stackLimit() == 0);
+                Goroutine::runOnWorkerStack([&] { assert(stackLimit() == 0); });
+                throw std::runtime_error("from the worker's stack");
+            });
+        } catch (const std::runtime_error&) {
+            thrown = true;
+        }
+        assert(thrown && stackLimit() == limit);
+        ranOnWorkerStack = true;
+    });
+
+    // Past the maximum stack size the goroutine is ended, like one whose
+    // generated code overflows a guard page; the second guard overflow comes
+    // after the handler already ran on that thread
+    std::atomic<int> overflowReturned{0};
+    loop.spawnGoroutine([&] {
+        testGeneratedRecurse(MAX_STACK / 256);
+        overflowReturned.fetch_add(1);
+    });
+    for (int i = 0; i < 2; i++) {
+        loop.spawnGoroutine([&] {
+            testGeneratedLargeFrame();
+            overflowReturned.fetch_add(1);
+        });
+    }
+
+    // Memory per parked goroutine: stack segment, shadow stack, GC state
+    std::atomic<int> parked{0};
+    std::atomic<int> finished{0};
+    std::atomic<long> parkedKilobytes{0};
+    long before = residentKilobytes();
+    for (int i = 0; i < PARKED; i++) {
+        loop.spawnGoroutine([&] {
+            uint64_t promise = runtime_sleep(1000);
+            if (parked.fetch_add(1) + 1 == PARKED) {
+                parkedKilobytes = residentKilobytes();
+            }
+            runtime_await_promise(promise);
+            finished.fetch_add(1);
+        });
+    }
+    loop.run();
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    double perGoroutine = (parkedKilobytes.load() - before) * 1024.0 / PARKED;
+    std::cout << "goroutine stacks: " << finished.load() << " parked at once, "
+              << static_cast<long>(perGoroutine) << " bytes resident each, "
+              << pool.getMappedStacks() << " segments mapped" << std::endl;
+    assert(grew && ranOnWorkerStack && finished.load() == PARKED && overflowReturned.load() == 0);
+    assert(loop.getAllGoroutines().empty());
+    assert(perGoroutine < 8 * 1024);
+
+    // Every segment is back in the pool
+    assert(pool.getPooledStacks() == pool.getMappedStacks());
+
+    std::cout << "goroutine_stacks test passed" << std::endl;
+    return 0;
+}
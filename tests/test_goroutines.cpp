@@ -0,0 +1,140 @@
+#include <atomic>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "gc.h"
+#include "goroutine.h"
+
+// Thread we run on. Not std::this_thread::get_id(): pthread_self() is a
+// const function, so the compiler may reuse a value read before an await.
+static long currentThread() {
+    return syscall(SYS_gettid);
+}
+
+// Stack usage C++ code on a goroutine must get away with: most of the
+// first 16 KB segment (only generated code moves on to further segments)
+static int deepFrames(int depth) {
+    volatile char frame[512];
+    std::memset(const_cast<char*>(frame), depth, sizeof(frame));
+    return depth == 0 ? frame[0] : deepFrames(depth - 1) + frame[1];
+}
+
+int main() {
+    constexpr int GOROUTINES = 1000;
+    constexpr int CHILDREN = 20000;
+    
+    // Several workers even on a single CPU, so goroutines can move between them
+    setenv("TECHNOSCRIPT_WORKERS", "4", 1);
+    EventLoop& loop = EventLoop::getInstance();
+    
+    // The runtime logs every spawn, timer and await
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+    
+    std::atomic<int> finished{0};
+    std::atomic<int> awaiting{0};
+    std::atomic<int> peakAwaiting{0};
+    std::atomic<int> migrated{0};
+    std::atomic<int64_t> sleptTotal{0};
+    std::mutex threadsMutex;
+    std::set<long> threads;
+    
+    // Every goroutine awaits at once: far more parked awaits than workers
+    for (int i = 0; i < GOROUTINES; i++) {
+        loop.spawnGoroutine([&, i] {
+            uint64_t promise = runtime_sleep(20 + i % 5);
+            long before = currentThread();
+            int now = awaiting.fetch_add(1) + 1;
+            int peak = peakAwaiting.load();
+            while (now > peak && !peakAwaiting.compare_exchange_weak(peak, now)) {
+            }
+            int64_t slept = runtime_await_promise(promise);
+            awaiting.fetch_sub(1);
+            
+            long after = currentThread();
+            if (after != before) {
+                migrated.fetch_add(1);
+            }
+            {
+                std::lock_guard<std::mutex> lock(threadsMutex);
+                threads.insert(after);
+            }
+            sleptTotal.fetch_add(slept);
+            assert(deepFrames(20) > 0);
+            finished.fetch_add(1);
+        });
+    }
+    
+    // A promise resolved before the await returns at once, without parking
+    std::atomic<bool> immediate{false};
+    loop.spawnGoroutine([&] {
+        uint64_t promise = loop.createPromise();
+        loop.resolvePromise(promise, 42);
+        assert(runtime_await_promise(promise) == 42);
+        immediate = true;
+    });
+    
+    // Goroutines spawned on a worker go on its own run queue; idle workers
+    // steal them from there, so they still spread over the workers
+    std::atomic<int> children{0};
+    std::set<long> childThreads;
+    loop.spawnGoroutine([&] {
+        for (int i = 0; i < CHILDREN; i++) {
+            loop.spawnGoroutine([&] {
+                children.fetch_add(1);
+                std::lock_guard<std::mutex> lock(threadsMutex);
+                childThreads.insert(currentThread());
+            });
+        }
+    });
+    
+    // A crashing goroutine takes only itself down
+    loop.spawnGoroutine([] {
+        throw std::runtime_error("expected crash");
+    });
+    
+    // So does one nesting scopes past the shadow stack's capacity: it is
+    // ended where it stands, not unwound (generated code can't be)
+    static ScopeMetadata emptyScope(0, nullptr, 16);
+    std::atomic<size_t> pushedScopes{0};
+    std::atomic<bool> pastCapacity{false};
+    loop.spawnGoroutine([&] {
+        void* scope = gc_allocate_scope(16, &emptyScope);
+        for (size_t i = 0; i <= ShadowStackLayout::CAPACITY; i++) {
+            gc_push_scope(scope);
+            pushedScopes.fetch_add(1);
+        }
+        pastCapacity = true;
+    });
+    
+    loop.run();
+    std::cout.rdbuf(output);
+    std::cout.clear();
+    
+    int64_t expectedSlept = 0;
+    for (int i = 0; i < GOROUTINES; i++) {
+        expectedSlept += 20 + i % 5;
+    }
+    std::cout << "goroutines: " << finished.load() << " finished, peak " << peakAwaiting.load()
+              << " awaiting on " << threads.size() << " worker threads, " << migrated.load()
+              << " resumed on another worker" << std::endl;
+    std::cout << "run queues: " << children.load() << " spawned on a worker ran on " << childThreads.size()
+              << " workers, " << loop.getStolenGoroutines() << " stolen" << std::endl;
+    assert(finished.load() == GOROUTINES);
+    assert(sleptTotal.load() == expectedSlept);
+    assert(immediate.load());
+    assert(peakAwaiting.load() > static_cast<int>(threads.size()));
+    assert(children.load() == CHILDREN);
+    assert(childThreads.size() > 1 && loop.getStolenGoroutines() > 0);
+    assert(pushedScopes.load() == ShadowStackLayout::CAPACITY && !pastCapacity.load());
+    assert(loop.getAllGoroutines().empty());
+    
+    std::cout << "goroutines test passed" << std::endl;
+    return 0;
+}
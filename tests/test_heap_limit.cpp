@@ -0,0 +1,185 @@
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <vector>
+#include <iostream>
+#include "gc.h"
+#include "gc_heap.h"
+#include "goroutine.h"
+
+static std::vector<void*> allocated;
+static unsigned handlerCalls = 0;
+static unsigned lastAttempt = 0;
+
+// Stands in for the GC's emergency collection: everything allocated so far is garbage
+static bool collectEverything(size_t, unsigned attempt) {
+    GCHeap& heap = GCHeap::getInstance();
+    handlerCalls++;
+    lastAttempt = attempt;
+    heap.flushTLABs();
+    for (void* cell : allocated) {
+        heap.freeCell(cell);
+    }
+    allocated.clear();
+    heap.sweep();
+    return true;
+}
+
+// Counts the frames an exception unwinds through: the goroutines below must
+// be ended where they stand, as generated code would be
+static std::atomic<int> unwoundFrames{0};
+struct UnwindWitness {
+    ~UnwindWitness() { unwoundFrames.fetch_add(1); }
+};
+
+// Recurses until the frame is less than `margin` bytes above the goroutine
+// stack's limit, then runs work there: a runtime call made by a JIT frame
+// at the bottom of a segment, with only the reserve below it
+__attribute__((noinline)) static void nearStackLimit(uintptr_t margin, const std::function<void()>& work) {
+    volatile char frame[256];
+    frame[0] = 0;
+    uintptr_t limit;
+    asm volatile("movq %%fs:(%1), %0" : "=r"(limit) : "r"(Goroutine::stackLimitThreadOffset()));
+    assert(limit != 0);
+    if (reinterpret_cast<uintptr_t>(__builtin_frame_address(0)) > limit + margin) {
+        nearStackLimit(margin, work);
+    } else {
+        work();
+    }
+    frame[1] = frame[0];  // Not a tail call
+}
+
+// Makes no room, gives up on the third call
+static bool neverEnough(size_t, unsigned attempt) {
+    handlerCalls++;
+    lastAttempt = attempt;
+    return attempt < 2;
+}
+
+int main() {
+    GCHeap& heap = GCHeap::getInstance();
+    constexpr size_t LIMIT = 1024 * 1024;
+    assert(heap.getHeapLimit() == SIZE_MAX);
+    assert(heap.committedBytes() == 0);
+    heap.setHeapLimit(LIMIT);
+
+    // Without a handler, the allocation that needs a chunk past the limit throws
+    bool thrown = false;
+    try {
+        for (;;) {
+            allocated.push_back(heap.allocateInTLAB(HeapSpace::OBJECT, 64, nullptr));
+        }
+    } catch (const OutOfMemoryError& e) {
+        thrown = true;
+        assert(e.requestedBytes() == HeapLayout::CHUNK_SIZE);
+        assert(e.limitBytes() == LIMIT);
+    }
+    assert(thrown);
+    assert(heap.committedBytes() <= LIMIT);
+    assert(heap.committedBytes() + HeapLayout::CHUNK_SIZE > LIMIT);
+    size_t cellsAtLimit = allocated.size();
+    assert(cellsAtLimit > 10000);
+
+    // A handler that frees memory is called once per allocation at the
+    // limit, which then succeeds
+    heap.setHeapLimitHandler(&collectEverything);
+    for (size_t i = 0; i < cellsAtLimit + 100; i++) {
+        allocated.push_back(heap.allocateInTLAB(HeapSpace::OBJECT, 64, nullptr));
+    }
+    assert(handlerCalls >= 1 && lastAttempt == 0);
+    assert(heap.committedBytes() <= LIMIT);
+
+    // Large cells and raw blocks count against the limit too
+    void* big = heap.allocate(HeapSpace::OBJECT, HeapLayout::LARGE_OBJECT_THRESHOLD * 2);
+    size_t withBig = heap.committedBytes();
+    assert(withBig >= HeapLayout::LARGE_OBJECT_THRESHOLD * 2);
+    heap.freeCell(big);
+    heap.sweep();
+    assert(heap.committedBytes() < withBig);
+
+    // A handler that can't help: OutOfMemoryError after its last attempt,
+    // and a std::bad_alloc to code that doesn't know the subclass
+    heap.setHeapLimitHandler(&neverEnough);
+    handlerCalls = 0;
+    size_t before = heap.committedBytes();
+    thrown = false;
+    try {
+        heap.allocateRaw(LIMIT);
+    } catch (const std::bad_alloc& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(handlerCalls == 3 && lastAttempt == 2);
+    assert(heap.committedBytes() == before);
+
+    void* raw = heap.allocateRaw(HeapLayout::LARGE_OBJECT_THRESHOLD);
+    assert(heap.committedBytes() == before + HeapLayout::LARGE_OBJECT_THRESHOLD);
+    assert(heap.releaseRaw(raw));
+    assert(heap.committedBytes() == before);
+
+    // Lifting the limit lets the heap grow again
+    heap.setHeapLimit(SIZE_MAX);
+    heap.allocateRaw(LIMIT);
+    assert(heap.committedBytes() == before + LIMIT);
+
+    // Generated code can't be unwound, so the entry points it calls end the
+    // goroutine instead of throwing. With the GC's own handler: an emergency
+    // collection and back-pressure for the raw blocks (which no collection
+    // frees), at once for requests larger than the whole limit.
+    EventLoop& loop = EventLoop::getInstance();
+    GarbageCollector& gc = GarbageCollector::getInstance();
+    heap.setHeapLimit(heap.committedBytes() + LIMIT);
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+    std::atomic<size_t> rawBlocks{0};
+    std::atomic<int> returned{0};
+    std::atomic<bool> unaffected{false};
+    loop.spawnGoroutine([&] {
+        UnwindWitness witness;
+        for (;;) {
+            gc_allocate_raw(HeapLayout::LARGE_OBJECT_THRESHOLD);
+            rawBlocks.fetch_add(1);
+        }
+    });
+    loop.spawnGoroutine([&] {
+        UnwindWitness witness;
+        gc_allocate_object(heap.getHeapLimit() + 1, nullptr);
+        returned.fetch_add(1);
+    });
+    loop.spawnGoroutine([&] {
+        UnwindWitness witness;
+        gc_allocate_scope(heap.getHeapLimit() + 1, nullptr);
+        returned.fetch_add(1);
+    });
+    // The same from a goroutine nested down to its segment's reserve: the
+    // collections run on the worker's stack (there's no GC thread here),
+    // not in the reserve
+    std::atomic<size_t> nestedRawBlocks{0};
+    loop.spawnGoroutine([&] {
+        UnwindWitness witness;
+        nearStackLimit(512, [&] {
+            for (;;) {
+                gc_allocate_raw(HeapLayout::LARGE_OBJECT_THRESHOLD);
+                nestedRawBlocks.fetch_add(1);
+            }
+        });
+        returned.fetch_add(1);
+    });
+    loop.spawnGoroutine([&] {
+        runtime_await_promise(runtime_sleep(10));
+        unaffected = true;
+    });
+    loop.run();
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    assert(returned.load() == 0 && unwoundFrames.load() == 0 && unaffected.load());
+    assert((rawBlocks.load() + nestedRawBlocks.load()) * HeapLayout::LARGE_OBJECT_THRESHOLD <= LIMIT);
+    GCStats stats = gc.getStats();
+    assert(stats.outOfMemoryErrors == 4 && stats.emergencyCollections >= 2);
+    assert(loop.getAllGoroutines().empty());
+
+    std::cout << "heap_limit test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include <cassert>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "gc.h"
+#include "gc_heap.h"
+#include "gc_snapshot.h"
+
+// Object layout used below: [metadata*][flags][left][right] (no methods)
+static VarMetadata nodeFields[] = {
+    VarMetadata(16, DataType::OBJECT, nullptr, "left"),
+    VarMetadata(24, DataType::OBJECT, nullptr, "right"),
+};
+static ClassMetadata nodeClass("Node", 2, nodeFields, 16);
+static ClassMetadata leafClass("Leaf", 0, nullptr, 16);
+
+// Scope layout: [flags][metadata*][a][b]
+static VarMetadata mainVars[] = {
+    VarMetadata(0, DataType::OBJECT, nullptr, "a"),
+    VarMetadata(8, DataType::OBJECT, nullptr, "b"),
+};
+static ScopeMetadata mainScopeMetadata(2, mainVars);
+
+static void** fieldsOf(void* obj) {
+    return reinterpret_cast<void**>(static_cast<uint8_t*>(obj) + 16);
+}
+
+static void* newObject(GCHeap& heap, ClassMetadata* metadata) {
+    void* obj = heap.allocate(HeapSpace::OBJECT, 32);
+    static_cast<ObjectHeader*>(obj)->classMetadata = metadata;
+    return obj;
+}
+
+int main() {
+    GCHeap& heap = GCHeap::getInstance();
+    mainScopeMetadata.name = "main";
+
+    //   scope --a--> A --right--> D1 -> D2 -> D3 (-> D1)
+    //         --b--> B
+    //   A --left--> C <--left-- B      (C is shared: only the scope dominates it)
+    void* scope = heap.allocate(HeapSpace::SCOPE, 32);
+    static_cast<ScopeHeader*>(scope)->scopeMetadata = &mainScopeMetadata;
+    void* a = newObject(heap, &nodeClass);
+    void* b = newObject(heap, &nodeClass);
+    void* c = newObject(heap, &leafClass);
+    void* d1 = newObject(heap, &nodeClass);
+    void* d2 = newObject(heap, &nodeClass);
+    void* d3 = newObject(heap, &nodeClass);
+    void* unreachable = newObject(heap, &nodeClass);
+    fieldsOf(unreachable)[0] = a;
+
+    void** vars = reinterpret_cast<void**>(static_cast<ScopeHeader*>(scope)->getDataStart());
+    vars[0] = a;
+    vars[1] = b;
+    fieldsOf(a)[0] = c;
+    fieldsOf(a)[1] = d1;
+    fieldsOf(b)[0] = c;
+    fieldsOf(d1)[0] = d2;
+    fieldsOf(d2)[0] = d3;
+    fieldsOf(d3)[0] = d1;
+
+    uint64_t cell = heap.cellSize(a);
+    uint64_t scopeSize = heap.cellSize(scope);
+
+    // Null and non-heap roots are ignored
+    int notInHeap = 0;
+    HeapSnapshot snapshot = HeapSnapshot::capture({scope, nullptr, &notInHeap});
+
+    assert(snapshot.cellCount() == 7);
+    assert(snapshot.totalBytes() == scopeSize + 6 * cell);
+
+    // Dominators and retained sizes
+    assert(snapshot.dominatorOf(scope) == nullptr);
+    assert(snapshot.dominatorOf(a) == scope);
+    assert(snapshot.dominatorOf(c) == scope);
+    assert(snapshot.dominatorOf(d1) == a);
+    assert(snapshot.dominatorOf(d3) == d2);
+    assert(snapshot.retainedSize(d1) == 3 * cell);
+    assert(snapshot.retainedSize(a) == 4 * cell);
+    assert(snapshot.retainedSize(b) == cell);
+    assert(snapshot.retainedSize(c) == cell);
+    assert(snapshot.retainedSize(scope) == scopeSize + 6 * cell);
+    assert(snapshot.retainedSize(unreachable) == 0);
+
+    // Per type: nested Node instances (D1-D3 under A) are not counted twice
+    std::vector<HeapSnapshot::TypeSummary> summary = snapshot.summary();
+    assert(summary.size() == 3);
+    assert(summary[0].scope && summary[0].name == "main");
+    assert(summary[0].count == 1);
+    assert(summary[0].retainedBytes == scopeSize + 6 * cell);
+    assert(!summary[1].scope && summary[1].name == "Node");
+    assert(summary[1].count == 5);
+    assert(summary[1].shallowBytes == 5 * cell);
+    assert(summary[1].retainedBytes == 5 * cell);
+    assert(summary[2].name == "Leaf");
+    assert(summary[2].count == 1 && summary[2].retainedBytes == cell);
+
+    // Output formats
+    std::ostringstream devtools;
+    snapshot.writeHeapSnapshot(devtools);
+    std::string json = devtools.str();
+    assert(json.find("\"node_count\":8") != std::string::npos);
+    assert(json.find("\"edge_count\":9") != std::string::npos);
+    assert(json.find("\"(scope main)\"") != std::string::npos);
+    assert(json.find("\"right\"") != std::string::npos);
+
+    std::ostringstream lines;
+    snapshot.writeSummary(lines);
+    assert(lines.str().find("{\"kind\":\"class\",\"name\":\"Node\",\"count\":5") != std::string::npos);
+
+    // An empty root set gives an empty snapshot
+    HeapSnapshot empty = HeapSnapshot::capture({});
+    assert(empty.cellCount() == 0);
+    assert(empty.summary().empty());
+
+    std::cout << "heap_snapshot test passed" << std::endl;
+    return 0;
+}
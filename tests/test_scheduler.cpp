@@ -0,0 +1,67 @@
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <sched.h>
+#include "gc.h"
+#include "goroutine.h"
+
+// Timers and promise wakeups on two workers. How fast they are is for
+// benchmarks/bench_scheduler.cpp; this checks that every one arrives.
+int main() {
+    constexpr int TIMER_ROUNDS = 200;
+    constexpr int PROMISE_ROUNDS = 200;
+
+    setenv("TECHNOSCRIPT_WORKERS", "2", 1);
+    EventLoop& loop = EventLoop::getInstance();
+    std::streambuf* output = std::cout.rdbuf(nullptr);
+
+    std::atomic<int> timersFired{0};
+    std::atomic<int> promisesResolved{0};
+    std::atomic<uint64_t> pending{0};
+    std::atomic<bool> resolverFinished{false};
+
+    loop.spawnGoroutine([&] {
+        for (int i = 0; i < TIMER_ROUNDS; i++) {
+            runtime_await_promise(runtime_sleep(1));
+            timersFired.fetch_add(1);
+        }
+
+        // A goroutine on the other worker resolves what we are parked on,
+        // so a sleeping worker has to be woken to run us
+        loop.spawnGoroutine([&] {
+            for (int i = 0; i < PROMISE_ROUNDS; i++) {
+                uint64_t promise;
+                while ((promise = pending.exchange(0)) == 0) {
+                    sched_yield();
+                }
+                // Give the awaiting side the time to park (it is fine if it
+                // hasn't: then it doesn't park at all)
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+                while (loop.getSleepingWorkers() == 0 && std::chrono::steady_clock::now() < deadline) {
+                    sched_yield();
+                }
+                loop.resolvePromise(promise, i);
+            }
+            resolverFinished = true;
+        });
+        for (int i = 0; i < PROMISE_ROUNDS; i++) {
+            uint64_t promise = loop.createPromise();
+            pending = promise;
+            assert(runtime_await_promise(promise) == i);
+            promisesResolved.fetch_add(1);
+        }
+    });
+
+    loop.run();
+    std::cout.rdbuf(output);
+    std::cout.clear();
+
+    assert(timersFired.load() == TIMER_ROUNDS);
+    assert(promisesResolved.load() == PROMISE_ROUNDS && resolverFinished.load());
+    assert(loop.getAllGoroutines().empty());
+
+    std::cout << "scheduler test passed" << std::endl;
+    return 0;
+}
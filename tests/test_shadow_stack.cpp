@@ -0,0 +1,124 @@
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include "data_structures/shadow_stack.h"
+
+static void* entry(uintptr_t value) {
+    return reinterpret_cast<void*>(value);
+}
+
+int main() {
+    // LIFO push/pop, and the entry array is where ShadowStackLayout says
+    {
+        ShadowStack stack;
+        assert(stack.size() == 0);
+        stack.pop();  // Popping an empty stack is a no-op
+        assert(stack.size() == 0);
+
+        for (uintptr_t i = 1; i <= 5; i++) {
+            assert(stack.push(entry(i)));
+        }
+        assert(stack.size() == 5);
+        assert(stack.at(4) == entry(5));
+
+        uint8_t* base = reinterpret_cast<uint8_t*>(&stack);
+        assert(*reinterpret_cast<size_t*>(base + ShadowStackLayout::TOP_OFFSET) == 5);
+        assert(*reinterpret_cast<uint64_t*>(base + ShadowStackLayout::SEQUENCE_OFFSET) == 10);
+        void** entries = *reinterpret_cast<void***>(base + ShadowStackLayout::ENTRIES_OFFSET);
+        assert(entries[2] == entry(3));
+
+        stack.pop();
+        stack.pop();
+        std::vector<void*> copy;
+        stack.snapshot(copy, false);
+        assert(copy.size() == 3);
+        assert(copy[0] == entry(1) && copy[2] == entry(3));
+    }
+
+    // Low-water mark: pops lower it, pushes don't raise it, and removeAt
+    // below it shifts it down with the entries
+    {
+        ShadowStack stack;
+        for (uintptr_t i = 1; i <= 6; i++) {
+            stack.push(entry(i));
+        }
+
+        std::vector<void*> copy;
+        stack.snapshot(copy, true);
+        assert(copy.empty());  // Not tracking: mark is 0
+
+        stack.startLowWater();
+        stack.pop();
+        stack.pop();
+        stack.push(entry(100));
+        stack.push(entry(101));
+        stack.snapshot(copy, true);
+        assert(copy.size() == 4);
+        assert(copy[3] == entry(4));
+
+        stack.removeAt(1);
+        copy.clear();
+        stack.snapshot(copy, true);
+        assert(copy.size() == 3);
+        assert(copy[1] == entry(3));
+        assert(stack.size() == 5);
+        assert(stack.at(3) == entry(100));
+
+        stack.resetLowWater();
+        stack.pop();
+        copy.clear();
+        stack.snapshot(copy, true);
+        assert(copy.empty());
+    }
+
+    // Overflow: push fails at capacity and leaves the stack intact
+    {
+        ShadowStack stack;
+        for (size_t i = 0; i < ShadowStackLayout::CAPACITY; i++) {
+            assert(stack.push(entry(i + 1)));
+        }
+        assert(!stack.push(entry(0)));
+        assert(stack.size() == ShadowStackLayout::CAPACITY);
+        assert(stack.at(ShadowStackLayout::CAPACITY - 1) == entry(ShadowStackLayout::CAPACITY));
+    }
+
+    // Concurrent reader: entry i always holds i + 1, so any torn copy shows up
+    {
+        ShadowStack stack;
+        std::atomic<bool> done{false};
+        std::thread writer([&] {
+            uint64_t rng = 0x9E3779B97F4A7C15ull;
+            for (int round = 0; round < 200000; round++) {
+                rng ^= rng << 13;
+                rng ^= rng >> 7;
+                rng ^= rng << 17;
+                if ((rng & 3) != 0 && stack.size() < 512) {
+                    stack.push(entry(stack.size() + 1));
+                } else {
+                    stack.pop();
+                }
+            }
+            done.store(true);
+        });
+
+        size_t snapshots = 0;
+        std::vector<void*> copy;
+        while (!done.load()) {
+            copy.clear();
+            stack.snapshot(copy, false);
+            for (size_t i = 0; i < copy.size(); i++) {
+                assert(copy[i] == entry(i + 1));
+            }
+            snapshots++;
+        }
+        writer.join();
+        assert(snapshots > 0);
+    }
+
+    std::cout << "shadow_stack test passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include "gc_stackmap.h"
+
+// Stand-ins for return addresses in generated code, and in the runtime
+// function that entered it
+static char pollInF, callInG, otherCall, runtimeCall, lessStack;
+
+// Stand-ins for cells
+static uint64_t scopeG[4], scopeF[4], cellA[4], cellB[4], cellC[4], cellD[4];
+
+static uint64_t address(const void* pointer) {
+    return reinterpret_cast<uint64_t>(pointer);
+}
+
+static bool throws(std::vector<StackMap> maps) {
+    try {
+        StackMapTable::getInstance().registerMaps(std::move(maps));
+    } catch (const std::runtime_error&) {
+        return true;
+    }
+    return false;
+}
+
+int main() {
+    using namespace StackMapLayout;
+    StackMapTable& table = StackMapTable::getInstance();
+
+    // F was called from G, which was entered from the runtime; F is at a
+    // safepoint poll. Each frame: [rbp] caller's rbp, [rbp+8] return address,
+    // [rbp-8] caller's r14, [rbp-16] caller's r15, then locals.
+    uint64_t stack[64] = {};
+    uint64_t* frameG = &stack[48];
+    uint64_t* frameF = &stack[24];
+
+    frameG[0] = 0x1234;                     // Runtime's rbp (not followed)
+    frameG[1] = address(&runtimeCall);
+    frameG[-1] = 0xdead;                    // Runtime's r14/r15: not references
+    frameG[-2] = 0xbeef;
+    frameG[-3] = address(cellA);            // G's local at rbp-24
+
+    frameF[0] = address(frameG);
+    frameF[1] = address(&callInG);
+    frameF[-1] = address(scopeG);           // G's r14 and r15 at the call
+    frameF[-2] = address(scopeF);
+    frameF[-3] = address(cellD);            // F's locals at rbp-24 and rbp-32
+    frameF[-4] = 0;
+
+    uint64_t registers[NUM_REGISTERS] = {};
+    registers[0] = address(cellB);          // rax: live reference
+    registers[3] = address(cellC);          // rbx: not in the map
+    registers[R14] = address(scopeG);
+    registers[R15] = address(scopeF);
+
+    StackMap poll;
+    poll.returnAddress = &pollInF;
+    poll.kind = StackMap::Kind::SAFEPOINT;
+    poll.registers = (1u << 0) | (1u << R14) | (1u << R15);
+    poll.slots = {-24, -32};
+
+    StackMap call;
+    call.returnAddress = &callInG;
+    call.kind = StackMap::Kind::CALL;
+    call.registers = CALLEE_SAVED;
+    call.slots = {-24};
+
+    table.registerMaps({poll, call});
+    assert(table.size() == 2);
+    assert(table.contains(&pollInF) && table.contains(&callInG) && !table.contains(&runtimeCall));
+
+    // The walk reports the poll's registers and slots, then G's (r14/r15
+    // read back from F's prologue), and stops at the runtime's return address
+    std::vector<void*> found;
+    size_t frames = table.scanFrames(&pollInF, frameF, registers, [&](void* reference) {
+        found.push_back(reference);
+    });
+    assert(frames == 2);
+    std::vector<void*> expected = {cellB, scopeG, scopeF, cellD, scopeG, scopeF, cellA};
+    assert(found == expected);
+    assert(std::find(found.begin(), found.end(), static_cast<void*>(cellC)) == found.end());
+
+    // F on a new stack segment: its return address is the segment stub, and
+    // the real one is found through the caller's rsp kept at the segment's
+    // top, just above F's frame
+    uint64_t segment[32] = {};
+    uint64_t* segmentF = &segment[24];
+    uint64_t callerStack[1] = {address(&callInG)};
+    segmentF[0] = address(frameG);
+    segmentF[1] = address(&lessStack);
+    segmentF[2] = address(callerStack);
+    segmentF[-1] = address(scopeG);
+    segmentF[-2] = address(scopeF);
+    segmentF[-3] = address(cellD);
+    segmentF[-4] = 0;
+    table.setSegmentReturnAddress(&lessStack);
+    found.clear();
+    frames = table.scanFrames(&pollInF, segmentF, registers, [&](void* reference) {
+        found.push_back(reference);
+    });
+    assert(frames == 2 && found == expected);
+
+    // An unmapped pc (not stopped in generated code) walks nothing
+    found.clear();
+    assert(table.scanFrames(&runtimeCall, frameF, registers, [&](void* reference) {
+        found.push_back(reference);
+    }) == 0);
+    assert(found.empty());
+
+    // Invalid maps are rejected and leave the table unchanged
+    StackMap clobbered = call;
+    clobbered.returnAddress = &otherCall;
+    clobbered.registers |= 1u << 0;         // rax doesn't survive a call
+    assert(throws({clobbered}));
+
+    StackMap stackPointer = poll;
+    stackPointer.returnAddress = &otherCall;
+    stackPointer.registers = 1u << RSP;
+    assert(throws({stackPointer}));
+
+    StackMap fresh = call;
+    fresh.returnAddress = &otherCall;
+    assert(throws({fresh, poll}));          // pollInF already has a map
+    assert(table.size() == 2 && !table.contains(&otherCall));
+
+    table.registerMaps({fresh});
+    assert(table.size() == 3 && table.contains(&otherCall));
+
+    table.clear();
+    assert(table.size() == 0);
+
+    std::cout << "stack_maps test passed" << std::endl;
+    return 0;
+}
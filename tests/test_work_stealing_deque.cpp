@@ -0,0 +1,92 @@
+#include <cassert>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include "data_structures/work_stealing_deque.h"
+
+int main() {
+    // Owner-only: LIFO pop, growth past the initial capacity
+    {
+        WorkStealingDeque<uintptr_t> deque(4);
+        for (uintptr_t i = 1; i <= 100; i++) {
+            deque.push(i);
+        }
+        assert(deque.size() == 100);
+
+        uintptr_t item = 0;
+        for (uintptr_t i = 100; i >= 1; i--) {
+            assert(deque.pop(item));
+            assert(item == i);
+        }
+        assert(!deque.pop(item));
+        assert(deque.empty());
+    }
+
+    // Steal takes from the opposite end
+    {
+        WorkStealingDeque<uintptr_t> deque;
+        deque.push(1);
+        deque.push(2);
+        deque.push(3);
+
+        uintptr_t item = 0;
+        assert(deque.steal(item) && item == 1);
+        assert(deque.pop(item) && item == 3);
+        assert(deque.steal(item) && item == 2);
+        assert(!deque.steal(item));
+        assert(!deque.pop(item));
+    }
+
+    // Owner pushes/pops while thieves steal: every item is taken exactly once
+    {
+        constexpr uintptr_t NUM_ITEMS = 200000;
+        constexpr int NUM_THIEVES = 3;
+
+        WorkStealingDeque<uintptr_t> deque(16);
+        std::vector<std::atomic<int>> taken(NUM_ITEMS + 1);
+        for (auto& t : taken) t.store(0);
+        std::atomic<bool> ownerDone{false};
+        std::atomic<uintptr_t> totalTaken{0};
+
+        std::vector<std::thread> thieves;
+        for (int t = 0; t < NUM_THIEVES; t++) {
+            thieves.emplace_back([&] {
+                uintptr_t item = 0;
+                while (!ownerDone.load() || !deque.empty()) {
+                    if (deque.steal(item)) {
+                        taken[item].fetch_add(1);
+                        totalTaken.fetch_add(1);
+                    }
+                }
+            });
+        }
+
+        uintptr_t item = 0;
+        for (uintptr_t i = 1; i <= NUM_ITEMS; i++) {
+            deque.push(i);
+            // Pop roughly every third push to race with the thieves
+            if (i % 3 == 0 && deque.pop(item)) {
+                taken[item].fetch_add(1);
+                totalTaken.fetch_add(1);
+            }
+        }
+        while (deque.pop(item)) {
+            taken[item].fetch_add(1);
+            totalTaken.fetch_add(1);
+        }
+        ownerDone.store(true);
+
+        for (auto& thief : thieves) {
+            thief.join();
+        }
+
+        assert(totalTaken.load() == NUM_ITEMS);
+        for (uintptr_t i = 1; i <= NUM_ITEMS; i++) {
+            assert(taken[i].load() == 1);
+        }
+    }
+
+    std::cout << "work_stealing_deque test passed\n";
+    return 0;
+}